@@ -5,15 +5,20 @@
 #include <plog/Log.h>
 #include <x86intrin.h>
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <fstream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <numeric>
+#include <ostream>
 #include <sstream>
+#include <string>
 #include <thread>
 
 #include "misc_lib.h"
@@ -22,7 +27,85 @@
 #include "xorwow.hpp"
 
 namespace kmercounter {
-using timer_type = std::uint32_t;
+
+/// Log-linear histogram of latencies in cycles, in the spirit of
+/// HdrHistogram: every power of two is cut into SUB_BUCKETS linear buckets,
+/// which bounds the relative error of a value by 1 / SUB_BUCKETS. Recording
+/// is a single increment, and the histograms of several threads are merged
+/// by adding up their buckets.
+class LatencyHistogram {
+ public:
+  static constexpr unsigned SUB_BUCKET_BITS = 5;
+  static constexpr std::uint64_t SUB_BUCKETS = 1ull << SUB_BUCKET_BITS;
+  static constexpr std::size_t NUM_BUCKETS =
+      (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  void record(std::uint64_t value) {
+    ++counts[index_of(value)];
+    ++total;
+    sum += value;
+    max_value = std::max(max_value, value);
+  }
+
+  void merge(const LatencyHistogram& other) {
+    for (auto i = 0u; i < NUM_BUCKETS; ++i) counts[i] += other.counts[i];
+    total += other.total;
+    sum += other.sum;
+    max_value = std::max(max_value, other.max_value);
+  }
+
+  std::uint64_t count() const { return total; }
+  std::uint64_t max() const { return max_value; }
+  double mean() const { return total ? static_cast<double>(sum) / total : 0; }
+
+  /// Smallest value that is not exceeded by `p` percent of the samples, up
+  /// to the width of its bucket.
+  std::uint64_t percentile(double p) const {
+    if (!total) return 0;
+    const auto rank = std::max<std::uint64_t>(
+        1, static_cast<std::uint64_t>(std::ceil(p / 100 * total)));
+    std::uint64_t seen{};
+    for (auto i = 0u; i < NUM_BUCKETS; ++i) {
+      seen += counts[i];
+      if (seen >= rank) return std::min(highest_of(i), max_value);
+    }
+    return max_value;
+  }
+
+  /// One "<lowest value of the bucket> <count>" line per non-empty bucket.
+  void dump(std::ostream& os) const {
+    for (auto i = 0u; i < NUM_BUCKETS; ++i)
+      if (counts[i]) os << lowest_of(i) << ' ' << counts[i] << '\n';
+  }
+
+  static std::size_t index_of(std::uint64_t value) {
+    if (value < SUB_BUCKETS) return value;
+    const unsigned shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + (value >> shift) - SUB_BUCKETS;
+  }
+
+  static std::uint64_t lowest_of(std::size_t i) {
+    if (i < SUB_BUCKETS) return i;
+    const unsigned shift = i / SUB_BUCKETS - 1;
+    return (i % SUB_BUCKETS + SUB_BUCKETS) << shift;
+  }
+
+  static std::uint64_t highest_of(std::size_t i) {
+    if (i < SUB_BUCKETS) return i;
+    const unsigned shift = i / SUB_BUCKETS - 1;
+    return lowest_of(i) + ((1ull << shift) - 1);
+  }
+
+ private:
+  std::array<std::uint64_t, NUM_BUCKETS> counts{};
+  std::uint64_t total{};
+  std::uint64_t sum{};
+  std::uint64_t max_value{};
+};
+
+/// Histograms of all threads merged by name, see LatencyCollector::dump.
+extern std::map<std::string, LatencyHistogram> latency_histograms;
+extern std::mutex collector_lock;
 
 template <std::size_t capacity>
 class alignas(64) LatencyCollector {
@@ -54,8 +137,7 @@ class alignas(64) LatencyCollector {
     stop_timed(stop);
     const auto time = stop - timers[id];
     free(id);
-    static constexpr auto max_time = std::numeric_limits<timer_type>::max();
-    push(time <= max_time ? static_cast<timer_type>(time) : max_time);
+    histogram.record(time);
   }
 
   std::uint64_t sync_start() {
@@ -75,26 +157,28 @@ class alignas(64) LatencyCollector {
 
     const auto stop = a;
     const auto time = stop - start;
-    static constexpr auto max_time = std::numeric_limits<timer_type>::max();
 
     // ++hacky_count;
     // if (hacky_count > 1'000'000 && hacky_count < 1'000'000 + 1'000)
     //   hack.push_back(time);
 
-    push(time <= max_time ? static_cast<timer_type>(time) : max_time);
+    histogram.record(time);
   }
 
+  const LatencyHistogram& get_histogram() const { return histogram; }
+
+  /// Write the histogram of this thread and merge it into the one of all
+  /// threads under the same name, which print_stats reports.
   void dump(const char* name, unsigned int id) {
-    if (next_log_entry) {
+    if (histogram.count()) {
       std::stringstream stream{};
       stream << "./latencies/" << name << '_' << id << ".dat";
       std::ofstream stats{stream.str().c_str()};
       stats.exceptions(stats.badbit | stats.failbit);
-      for (auto i = 0u; i <= next_log_entry && i < log.size(); ++i) {
-        const auto length = i < next_log_entry ? log.front().size() : next_slot;
-        for (auto j = 0u; j < length; ++j)
-          stats << static_cast<unsigned int>(log[i][j]) << "\n";
-      }
+      histogram.dump(stats);
+
+      const std::lock_guard guard{collector_lock};
+      latency_histograms[name].merge(histogram);
     }
   }
 
@@ -107,9 +191,7 @@ class alignas(64) LatencyCollector {
   std::array<std::uint64_t, capacity> timers{};
   std::array<std::uint64_t, capacity / 64> bitmap{};
 
-  std::array<std::array<timer_type, 64 / sizeof(timer_type)>, 4096> log{};
-  std::uint8_t next_slot{};
-  std::uint64_t next_log_entry{};
+  LatencyHistogram histogram{};
 
   std::shared_ptr<std::mutex> claim_lock{std::make_shared<std::mutex>()};
 
@@ -160,23 +242,13 @@ class alignas(64) LatencyCollector {
 
     return skipped * 64 + rightmost_zero;
   }
-
-  void push(timer_type time) {
-    if (next_slot == log.front().size()) {
-      if (next_log_entry == log.size() - 1) return;
-
-      next_slot = 0;
-      ++next_log_entry;
-    }
-
-    log[next_log_entry][next_slot++] = time;
-  }
 };
 
 constexpr auto pool_size = 2048;
 using collector_type = LatencyCollector<pool_size>;
 extern std::vector<collector_type> collectors;
-extern std::mutex collector_lock;
+// Stalls spent migrating buckets while a hashtable grows
+extern std::vector<collector_type> resize_collectors;
 
 }  // namespace kmercounter
 
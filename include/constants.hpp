@@ -8,8 +8,16 @@ constexpr int FLUSH_THRESHOLD = 32;
 constexpr int INS_FLUSH_THRESHOLD = 32;
 constexpr int KV_SIZE = 16;  // 8-byte key + 8-byte value
 
-constexpr uint32_t PREFETCH_QUEUE_SIZE = INS_FLUSH_THRESHOLD * 2;
-constexpr uint32_t PREFETCH_FIND_QUEUE_SIZE = FLUSH_THRESHOLD * 2;
+// Upper bound of --prefetch-depth, the queues are sized for it
+constexpr uint32_t MAX_PREFETCH_DEPTH = 64;
+
+constexpr uint32_t PREFETCH_QUEUE_SIZE = MAX_PREFETCH_DEPTH * 2;
+constexpr uint32_t PREFETCH_FIND_QUEUE_SIZE = MAX_PREFETCH_DEPTH * 2;
+
+// Upper bound of the slots of a table, --ht-size and its growth. The queues
+// keep the slot index of a request in 32 bits, and the CAS inserts keep one
+// past the index of a tombstone in as many.
+constexpr uint64_t MAX_HT_CAPACITY = 1ULL << 31;
 
 
 #if defined(DIRECT_INDEX)
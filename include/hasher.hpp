@@ -2,6 +2,9 @@
 #define _HASHER_HPP
 
 #include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
 #include <x86intrin.h>
 
 #include "fnv/fnv.h"
@@ -19,43 +22,213 @@ using key_type = std::uint32_t;
 using key_type = std::uint64_t;
 #endif
 
-class Hasher {
-public:
+/// Keys hashed at a time by the batch kernels (one AVX-512 vector of 64-bit
+/// lanes).
+constexpr int HASH_BATCH_SIZE = 8;
 
-  uint64_t operator()(const void* buff, uint64_t len) {
-    uint64_t hash_val;
+/// CRC32 of a buffer of any length, eight bytes at a time.
+inline uint64_t crc_hash(const void *buff, uint64_t len) {
+  auto p = static_cast<const char *>(buff);
+  uint64_t crc = 0xffffffff;
+  for (; len >= sizeof(std::uint64_t); len -= sizeof(std::uint64_t)) {
+    std::uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc = _mm_crc32_u64(crc, word);
+    p += sizeof(word);
+  }
+  for (; len > 0; len--) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return crc;
+}
+
+/// The hash functions the hashtables can be built with. Each one is a
+/// template argument of the hashtables, so a single binary carries all of
+/// them; `name` is what --hasher takes and what snapshots record.
+struct CityHasher {
+  static constexpr const char *name = "city";
+  uint64_t operator()(const void *buff, uint64_t len) {
+    return CityHash64((const char *)buff, len);
+  }
+};
+
+struct FnvHasher {
+  static constexpr const char *name = "fnv";
+  uint64_t operator()(const void *buff, uint64_t len) {
+    return fnv_64_buf(const_cast<void *>(buff), len, FNV1_64_INIT);
+  }
+};
+
+struct XxHasher {
+  static constexpr const char *name = "xxhash";
+  uint64_t operator()(const void *buff, uint64_t len) {
+    return XXH64(buff, len, 0);
+  }
+};
+
+struct Xx3Hasher {
+  static constexpr const char *name = "xxhash3";
+  uint64_t operator()(const void *buff, uint64_t len) {
+    return XXH3_64bits(buff, len);
+  }
+};
+
+struct CrcHasher {
+  static constexpr const char *name = "crc";
+  uint64_t operator()(const void *buff, uint64_t len) {
+    if (len == sizeof(std::uint32_t)) {
+      return _mm_crc32_u32(0xffffffff, *static_cast<const std::uint32_t *>(buff));
+    } else if (len == sizeof(std::uint64_t)) {
+      return _mm_crc32_u64(0xffffffff, *static_cast<const std::uint64_t *>(buff));
+    }
+    return crc_hash(buff, len);
+  }
+
+  // No batch kernel: there is no vector CRC32, and computing it with
+  // carry-less multiplies takes as many uops as the scalar crc32 does
+};
+
+struct CityCrcHasher {
+  static constexpr const char *name = "citycrc";
+  uint64_t operator()(const void *buff, uint64_t len) {
+    return Uint128Low64(CityHashCrc128((const char *)buff, len));
+  }
+};
+
+struct WyHasher {
+  static constexpr const char *name = "wyhash";
+  uint64_t operator()(const void *buff, uint64_t len) {
+    return wyhash((const char *)buff, len, 0, _wyp);
+  }
+};
+
+/// The murmur3 finalizer over each 8 bytes of the key. Only multiplies,
+/// shifts and xors, so a batch of keys hashes in SIMD lanes.
+struct MulXorHasher {
+  static constexpr const char *name = "mulxor";
+
+  static inline uint64_t mix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+  }
+
+  uint64_t operator()(const void *buff, uint64_t len) {
+    auto p = static_cast<const char *>(buff);
+    uint64_t hash = len;
+    for (; len >= sizeof(std::uint64_t); len -= sizeof(std::uint64_t)) {
+      std::uint64_t word;
+      memcpy(&word, p, sizeof(word));
+      hash = mix(hash ^ word);
+      p += sizeof(word);
+    }
+    if (len > 0) {
+      std::uint64_t word = 0;
+      memcpy(&word, p, len);
+      hash = mix(hash ^ word);
+    }
+    return hash;
+  }
+
+  static void hash8(const std::uint64_t *keys, uint64_t *hashes) {
+#ifdef AVX_SUPPORT
+    const __m512i m1 = _mm512_set1_epi64(0xff51afd7ed558ccdULL);
+    const __m512i m2 = _mm512_set1_epi64(0xc4ceb9fe1a85ec53ULL);
+    __m512i k = _mm512_xor_si512(_mm512_loadu_si512(keys),
+                                 _mm512_set1_epi64(sizeof(std::uint64_t)));
+    k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+    k = _mm512_mullo_epi64(k, m1);
+    k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+    k = _mm512_mullo_epi64(k, m2);
+    k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+    _mm512_storeu_si512(hashes, k);
+#else
+    for (int i = 0; i < HASH_BATCH_SIZE; i++) {
+      hashes[i] = mix(sizeof(std::uint64_t) ^ keys[i]);
+    }
+#endif
+  }
+};
+
+struct DirectHasher {
+  static constexpr const char *name = "direct_index";
+  uint64_t operator()(const void *buff, uint64_t len) {
+    return *((key_type*) buff);
+  }
+};
+
+/// The hasher used when none is picked at runtime, set by the HASHER build
+/// option.
 #if defined(CITY_HASH)
-    hash_val = CityHash64((const char *)buff, len);
+using Hasher = CityHasher;
 #elif defined(FNV_HASH)
-    hash_val = state_ = fnv_64_buf(buff, len, state_);
+using Hasher = FnvHasher;
 #elif defined(XX_HASH)
-    hash_val = XXH64(buff, len, 0);
+using Hasher = XxHasher;
 #elif defined(XX_HASH_3)
-    hash_val = XXH3_64bits(buff, len);
+using Hasher = Xx3Hasher;
 #elif defined(CRC_HASH)
-    assert(len == sizeof(std::uint64_t));
-    if (len == sizeof(std::uint32_t)) {
-      hash_val = _mm_crc32_u32(0xffffffff, *static_cast<const std::uint32_t *>(buff));
-    } else if (len == sizeof(std::uint64_t)) {
-      hash_val = _mm_crc32_u64(0xffffffff, *static_cast<const std::uint64_t *>(buff));
-    }
+using Hasher = CrcHasher;
 #elif defined(CITY_CRC_HASH)
-    hash_val = CityHashCrc128((const char *)buff, len);
+using Hasher = CityCrcHasher;
 #elif defined(WYHASH)
-    hash_val = wyhash((const char *)buff, len, 0, _wyp);
+using Hasher = WyHasher;
+#elif defined(MULXOR_HASH)
+using Hasher = MulXorHasher;
 #elif defined(DIRECT_INDEX)
-    hash_val = *((key_type*) buff);
+using Hasher = DirectHasher;
 #else
-    static_assert(false, "Hasher is not specified.");
+static_assert(false, "Hasher is not specified.");
 #endif
-    return hash_val;
+
+template <typename... Hs>
+struct HasherList {
+  /// Call `f(H{})` with the hasher called `name`. Returns false if there is
+  /// no such hasher.
+  template <typename F>
+  static bool dispatch(std::string_view name, F &&f) {
+    return ((name == Hs::name ? (f(Hs{}), true) : false) || ...);
   }
 
-private:
-#if defined(FNV_HASH)
-  uint64_t state_ = FNV1_64_INIT;
-#endif
+  static std::string names() {
+    std::string names;
+    ((names += names.empty() ? "" : ", ", names += Hs::name), ...);
+    return names;
+  }
 };
 
+using Hashers =
+    HasherList<CrcHasher, CityHasher, CityCrcHasher, XxHasher, Xx3Hasher,
+               WyHasher, FnvHasher, MulXorHasher, DirectHasher>;
+
+/// Hash the `n` keys of `len` bytes found every `stride` bytes from `keys`.
+/// Eight byte keys go through the batch kernel of the hasher, if it has one,
+/// HASH_BATCH_SIZE at a time.
+template <typename H>
+inline void hash_keys(H &hasher, const void *keys, size_t stride, size_t n,
+                      uint64_t len, uint64_t *hashes) {
+  auto p = static_cast<const char *>(keys);
+  size_t i = 0;
+  if constexpr (requires(const std::uint64_t *k, uint64_t *h) {
+                  H::hash8(k, h);
+                }) {
+    if (len == sizeof(std::uint64_t)) {
+      alignas(64) std::uint64_t lanes[HASH_BATCH_SIZE];
+      for (; i + HASH_BATCH_SIZE <= n; i += HASH_BATCH_SIZE) {
+        for (int j = 0; j < HASH_BATCH_SIZE; j++) {
+          memcpy(&lanes[j], p + (i + j) * stride, sizeof(lanes[j]));
+        }
+        H::hash8(lanes, &hashes[i]);
+      }
+    }
+  }
+  for (; i < n; i++) {
+    hashes[i] = hasher(p + i * stride, len);
+  }
+}
+
 } // namespace kmercounter
 #endif // _HASHER_HPP
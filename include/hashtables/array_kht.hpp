@@ -21,11 +21,12 @@
 #include "plog/Log.h"
 #include "helper.hpp"
 #include "ht_helper.hpp"
+#include "ht_scan.hpp"
 #include "sync.h"
 #include "hasher.hpp"
 
 namespace kmercounter {
-template <typename KV, typename KVQ>
+template <typename KV, typename KVQ, typename H = Hasher>
 class ArrayHashTable : public BaseHashTable {
  public:
   /// The global instance is shared by all threads.
@@ -103,6 +104,7 @@ class ArrayHashTable : public BaseHashTable {
 #ifdef LATENCY_COLLECTION
     collector->sync_end(timer_start);
 #endif
+    this->fold_stats();
   }
 
   bool insert(const void *data) {
@@ -125,6 +127,7 @@ class ArrayHashTable : public BaseHashTable {
       q.value = data.value;
       __insert_one(&q, collector);
     }
+    this->fold_stats();
   }
 
   // overridden function for insertion
@@ -144,6 +147,7 @@ class ArrayHashTable : public BaseHashTable {
       curr_queue_sz =
           (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
     }
+    this->fold_stats();
   }
 
   void flush_if_needed(ValuePairs &vp, collector_type* collector) {
@@ -187,12 +191,30 @@ class ArrayHashTable : public BaseHashTable {
       q.key_id = data.id;
       __find_one(&q, values, collector);
     }
+    this->fold_stats();
+  }
+
+  // erase a batch
+  void erase_batch(const InsertFindArguments &kp, collector_type* collector) override {
+
+    for (auto &data : kp) {
+      uint64_t idx = this->hash((const char *)&data.key);
+      this->prefetch(idx);
+    }
+
+    for (auto &data : kp) {
+      KVQ q;
+      q.idx = this->hash((const char *)&data.key);
+      q.key = data.key;
+      __erase_one(&q, collector);
+    }
+    this->fold_stats();
+  }
+
+  void flush_erase_queue(collector_type* collector) override {
   }
 
   void *find_noprefetch(const void *data, collector_type* collector) override {
-#ifdef CALC_STATS
-    uint64_t distance_from_bucket = 0;
-#endif
 #ifdef LATENCY_COLLECTION
     const auto timer_start = collector->sync_start();
 #endif
@@ -219,18 +241,10 @@ class ArrayHashTable : public BaseHashTable {
         PLOGV.printf("found %llu", curr->value);
         //break;
       }
-#ifdef CALC_STATS
       //distance_from_bucket++;
-#endif
       //idx++;
     //}
 
-#ifdef CALC_STATS
-    if (distance_from_bucket > this->max_distance_from_bucket) {
-      this->max_distance_from_bucket = distance_from_bucket;
-    }
-    this->sum_distance_from_bucket += distance_from_bucket;
-#endif
   exit:
 #ifdef LATENCY_COLLECTION
     collector->sync_end(timer_start);
@@ -243,37 +257,42 @@ class ArrayHashTable : public BaseHashTable {
       curr = nullptr;
     }
 
+    this->fold_stats();
     return curr;
   }
 
   void display() const override {
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (!this->hashtable[i].is_empty()) {
-        cout << this->hashtable[i] << endl;
-      }
-    }
+    scan_print(__scanner(), scan_threads(), std::cout);
   }
 
   size_t get_fill() const override {
-    size_t count = 0;
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (!this->hashtable[i].is_empty()) {
-        count++;
-      }
-    }
-    return count;
+    return scan_fill(__scanner(), scan_threads());
   }
 
   size_t get_capacity() const override { return this->capacity; }
 
+  bool is_shared() const override { return true; }
+
   size_t get_max_count() const override {
-    size_t count = 0;
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (this->hashtable[i].get_value() > count) {
-        count = this->hashtable[i].get_value();
-      }
-    }
-    return count;
+    return scan_max_count(__scanner(), scan_threads());
+  }
+
+  void scan(unsigned num_threads, const ScanCallback &cb) const override {
+    __scanner()(num_threads, [&cb](unsigned tid, KV &kv) {
+      cb(tid, KeyValuePair(kv.get_key(), kv.get_value()));
+    });
+  }
+
+  bool save_snapshot(const std::string &path) const override {
+    PLOG_FATAL << "Not implemented";
+    assert(false);
+    return false;
+  }
+
+  bool save_profile(const std::string &path) override {
+    PLOG_FATAL << "Not implemented";
+    assert(false);
+    return false;
   }
 
   void print_to_file(std::string &outfile) const override {
@@ -282,15 +301,16 @@ class ArrayHashTable : public BaseHashTable {
       PLOG_ERROR.printf("Could not open outfile %s", outfile.c_str());
       return;
     }
-
-    for (size_t i = 0; i < this->get_capacity(); i++) {
-      if (!this->hashtable[i].is_empty()) {
-        f << this->hashtable[i] << std::endl;
-      }
-    }
+    scan_print(__scanner(), max_scan_threads(), f);
   }
 
  private:
+  auto __scanner() const {
+    return [this](unsigned num_threads, auto &&f) {
+      scan_table(this->hashtable, this->capacity, num_threads, f);
+    };
+  }
+
   /// Assure thread-safety in constructor and destructor.
   static std::mutex ht_init_mutex;
   /// Reference counter of the global `hashtable`.
@@ -303,7 +323,7 @@ class ArrayHashTable : public BaseHashTable {
   uint32_t find_tail;
   uint32_t ins_head;
   uint32_t ins_tail;
-  Hasher hasher_;
+  H hasher_;
 
   uint64_t hash(const void *k) {
     return hasher_(k, this->key_length);
@@ -375,9 +395,7 @@ class ArrayHashTable : public BaseHashTable {
       //std::cout << "insert_cas k " << q->key << " : " << q->value << "\n";
       bool cas_res = curr->insert(q);
       if (cas_res) {
-#ifdef CALC_STATS
-        this->num_memcpys++;
-#endif
+        this->batch_stats.num_memcpys++;
 
 #ifdef COMPARE_HASH
         hashtable[pidx].key_hash = q->key_hash;
@@ -398,17 +416,13 @@ class ArrayHashTable : public BaseHashTable {
       // update the value instead of inserting new. Just fall-through to check!
     }
 
-#ifdef CALC_STATS
-    this->num_hashcmps++;
-#endif
+    this->batch_stats.num_hashcmps++;
 
 #ifdef COMPARE_HASH
     if (this->hashtable[pidx].key_hash == q->key_hash)
 #endif
     {
-#ifdef CALC_STATS
-      this->num_memcmps++;
-#endif
+      this->batch_stats.num_memcmps++;
       curr->update(q);
       // hashtable[pidx].kmer_count++;
       // hashtable_mutexes[pidx].unlock();
@@ -435,12 +449,24 @@ class ArrayHashTable : public BaseHashTable {
       empty_slot_ = q->value;
     } else if constexpr (std::is_same_v<KV, Aggr_KV>) {
       empty_slot_ += q->value;
+    } else if constexpr (Upserting<KV>) {
+      KV::insert_empty(empty_slot_, empty_slot_exists_, q->value);
     } else {
       assert(false && "Invalid template type");
     }
     empty_slot_exists_ = true;
   }
 
+  void __erase_one(KVQ *q, collector_type* collector) {
+    if (q->key == this->empty_item.get_key()) {
+      empty_slot_exists_ = false;
+      empty_slot_ = 0;
+    } else {
+      // direct indexed; there is no probe chain to preserve
+      this->hashtable[q->idx] = this->empty_item;
+    }
+  }
+
   uint64_t read_hashtable_element(const void *data) override {
     PLOG_FATAL << "1. Not implemented";
     assert(false);
@@ -518,19 +544,19 @@ class ArrayHashTable : public BaseHashTable {
 };
 
 /// Static variables
-template <class KV, class KVQ>
-KV *ArrayHashTable<KV, KVQ>::hashtable = nullptr;
+template <class KV, class KVQ, class H>
+KV *ArrayHashTable<KV, KVQ, H>::hashtable = nullptr;
 
-template <class KV, class KVQ>
-uint64_t ArrayHashTable<KV, KVQ>::empty_slot_ = 0;
+template <class KV, class KVQ, class H>
+uint64_t ArrayHashTable<KV, KVQ, H>::empty_slot_ = 0;
 
-template <class KV, class KVQ>
-bool ArrayHashTable<KV, KVQ>::empty_slot_exists_ = false;
+template <class KV, class KVQ, class H>
+bool ArrayHashTable<KV, KVQ, H>::empty_slot_exists_ = false;
 
-template <class KV, class KVQ>
-std::mutex ArrayHashTable<KV, KVQ>::ht_init_mutex;
+template <class KV, class KVQ, class H>
+std::mutex ArrayHashTable<KV, KVQ, H>::ht_init_mutex;
 
-template <class KV, class KVQ>
-uint32_t ArrayHashTable<KV, KVQ>::ref_cnt = 0;
+template <class KV, class KVQ, class H>
+uint32_t ArrayHashTable<KV, KVQ, H>::ref_cnt = 0;
 }  // namespace kmercounter
 #endif // HASHTABLES_CAS_ARRAY_KHT_HPP
@@ -3,13 +3,80 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <functional>
 #include <string>
 
 #include "Latency.hpp"
+#include "prefetch_depth.hpp"
 #include "types.hpp"
 
 using namespace std;
 namespace kmercounter {
+extern Configuration config;
+
+// Probe lengths are counted in power of two buckets: 0, 1, 2-3, 4-7, ...
+// with the last bucket open ended
+inline uint32_t probe_length_bucket(uint64_t len) {
+  const uint32_t b = len ? 64 - __builtin_clzll(len) : 0;
+  return std::min(b, PROBE_LENGTH_BUCKETS - 1);
+}
+
+// Slots a probe moved forward from `from` to `to` in a table of `capacity`
+// slots, wrapping around its end
+inline uint64_t probe_distance(uint64_t from, uint64_t to, uint64_t capacity) {
+  return to >= from ? to - from : to + capacity - from;
+}
+
+// Counters of the hashtable operations of one thread. They are always
+// compiled in: the tables count into the plain `batch_stats` of their own
+// (per-thread) object, and fold them into the exported `stats` once per
+// batch call when --ht-stats is set.
+struct alignas(CACHE_LINE_SIZE) HTStats {
+  uint64_t num_reprobes = 0;
+  uint64_t num_soft_reprobes = 0;
+  uint64_t num_memcmps = 0;
+  uint64_t num_memcpys = 0;
+  uint64_t num_hashcmps = 0;
+  uint64_t num_queue_flushes = 0;
+  uint64_t sum_distance_from_bucket = 0;
+  uint64_t max_distance_from_bucket = 0;
+  uint64_t num_swaps = 0;
+  uint64_t num_requeues_avoided = 0;
+  // Inserts the table had no room for. Their keys are lost, so the tables
+  // count them straight into `stats`, with or without --ht-stats.
+  uint64_t num_failed_inserts = 0;
+  uint64_t probe_lengths[PROBE_LENGTH_BUCKETS] = {};
+
+  void add_probe_length(uint64_t len) {
+    probe_lengths[probe_length_bucket(len)]++;
+    sum_distance_from_bucket += len;
+    max_distance_from_bucket = std::max(max_distance_from_bucket, len);
+  }
+
+  HTStats &operator+=(const HTStats &other) {
+    num_reprobes += other.num_reprobes;
+    num_soft_reprobes += other.num_soft_reprobes;
+    num_memcmps += other.num_memcmps;
+    num_memcpys += other.num_memcpys;
+    num_hashcmps += other.num_hashcmps;
+    num_queue_flushes += other.num_queue_flushes;
+    sum_distance_from_bucket += other.sum_distance_from_bucket;
+    max_distance_from_bucket =
+        std::max(max_distance_from_bucket, other.max_distance_from_bucket);
+    num_swaps += other.num_swaps;
+    num_requeues_avoided += other.num_requeues_avoided;
+    num_failed_inserts += other.num_failed_inserts;
+    for (auto i = 0u; i < PROBE_LENGTH_BUCKETS; i++) {
+      probe_lengths[i] += other.probe_lengths[i];
+    }
+    return *this;
+  }
+};
+
+// Called with the scan thread id and an entry of the table
+using ScanCallback = std::function<void(unsigned, const KeyValuePair &)>;
+
 class BaseHashTable {
  public:
   virtual bool insert(const void *data) = 0;
@@ -30,6 +97,11 @@ class BaseHashTable {
 
   virtual void flush_find_queue(ValuePairs &vp, collector_type* collector = nullptr) = 0;
 
+  // Erasing a key that is not in the table is a no-op
+  virtual void erase_batch(const InsertFindArguments &kp, collector_type* collector = nullptr) = 0;
+
+  virtual void flush_erase_queue(collector_type* collector = nullptr) = 0;
+
   virtual void display() const = 0;
 
   virtual size_t get_fill() const = 0;
@@ -38,23 +110,54 @@ class BaseHashTable {
 
   virtual size_t get_max_count() const = 0;
 
+  // True if all the instances operate on the same table, false if every
+  // instance has a table (partition) of its own
+  virtual bool is_shared() const = 0;
+
+  // Visit every entry from `num_threads` threads, each scanning disjoint
+  // cacheline-aligned chunks of the table (see hashtables/ht_scan.hpp).
+  // `cb` is called concurrently and the table must not change meanwhile.
+  virtual void scan(unsigned num_threads, const ScanCallback &cb) const = 0;
+
+  // Written by one shard only for shared tables, which scan with all of
+  // --scan-threads
   virtual void print_to_file(std::string &outfile) const = 0;
 
+  // Write the raw table to a binary snapshot, which the table can be mapped
+  // back from with --snapshot-in
+  virtual bool save_snapshot(const std::string &path) const = 0;
+
+  // Write the probe distance, run length and cacheline occupancy histograms
+  // of the table (see hashtables/ht_profile.hpp)
+  virtual bool save_profile(const std::string &path) = 0;
+
   virtual uint64_t read_hashtable_element(const void *data) = 0;
 
   virtual void prefetch_queue(QueueType qtype) = 0;
 
   virtual ~BaseHashTable() {}
 
-  uint64_t num_reprobes = 0;
-  uint64_t num_soft_reprobes = 0;
-  uint64_t num_memcmps = 0;
-  uint64_t num_memcpys = 0;
-  uint64_t num_hashcmps = 0;
-  uint64_t num_queue_flushes = 0;
-  uint64_t sum_distance_from_bucket = 0;
-  uint64_t max_distance_from_bucket = 0;
-  uint64_t num_swaps = 0;
+  // Counters of the batch calls that returned, read by get_ht_stats
+  HTStats stats;
+
+  // Prefetch distance of the insert, find and erase queues of the tables
+  // that have them
+  PrefetchDepth insert_depth{config.prefetch_depth, config.adaptive_prefetch};
+  PrefetchDepth find_depth{config.prefetch_depth, config.adaptive_prefetch};
+  PrefetchDepth erase_depth{config.prefetch_depth, config.adaptive_prefetch};
+
+ protected:
+  // Counters of the batch call in flight
+  HTStats batch_stats;
+
+  // Called by the tables at the end of every batch call; the flag is only
+  // looked at here, never per element
+  void fold_stats() {
+    if (config.ht_stats) [[unlikely]] {
+      this->stats += this->batch_stats;
+      this->batch_stats = {};
+    }
+  }
 };
 
 }  // namespace kmercounter
@@ -67,6 +67,9 @@ class HTBatchFinder {
  private:
   // Flush the insertion buffer without checking `buffer_size_`.
   void flush_buffer() {
+    // Point the results at this finder's buffer, which a copied or moved
+    // finder has not done yet
+    results_ = {0, result_buffer_};
     ht_->find_batch(InsertFindArguments(buffer_, buffer_size_), results_);
     num_flushed_ += buffer_size_;
     buffer_size_ = 0;
@@ -75,6 +78,7 @@ class HTBatchFinder {
 
   // Issue a flush to the hashtable.
   void flush_ht() {
+    results_ = {0, result_buffer_};
     ht_->flush_find_queue(results_);
     process_results();
   }
@@ -6,34 +6,51 @@
 /// instance.
 /// The original one is called the casht and the one we modified with
 /// batching + prefetching though is called casht++.
+/// With --ht-grow-threshold, the table grows online: once the fill crosses
+/// the threshold, a table twice the size takes over and the old one is
+/// migrated cacheline by cacheline by the threads that keep using it.
 // TODO bloom filters for high frequency kmers?
 
 #ifndef HASHTABLES_CAS_KHT_HPP
 #define HASHTABLES_CAS_KHT_HPP
 
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <mutex>
 #include <type_traits>
+#include <vector>
 
 #include "constants.hpp"
+#include "coro_lookup.hpp"
 #include "hasher.hpp"
 #include "helper.hpp"
 #include "ht_helper.hpp"
+#include "ht_profile.hpp"
+#include "ht_scan.hpp"
+#include "ht_snapshot.hpp"
 #include "plog/Log.h"
 #include "sync.h"
 
 namespace kmercounter {
-template <typename KV, typename KVQ>
+template <typename KV, typename KVQ, typename H = Hasher>
 class CASHashTable : public BaseHashTable {
  public:
-  /// The global instance is shared by all threads.
-  static KV *hashtable;
+  /// The table this instance operates on. All instances share the same
+  /// table; the pointer only changes when the table grows.
+  KV *hashtable;
   /// A dedicated slot for the empty value.
   static uint64_t empty_slot_;
   /// True if the empty value is inserted.
   static bool empty_slot_exists_;
+  /// A dedicated slot for the value of TOMBSTONE_KEY, which marks erased
+  /// slots.
+  static uint64_t tombstone_slot_;
+  /// True if the tombstone value is inserted.
+  static bool tombstone_slot_exists_;
   /// File descriptor backs the memory
   int fd;
   int id;
@@ -43,15 +60,40 @@ class CASHashTable : public BaseHashTable {
       (CACHELINE_SIZE / sizeof(KV)) - 1;
 
   CASHashTable(uint64_t c)
-      : fd(-1), id(1), find_head(0), find_tail(0), ins_head(0), ins_tail(0) {
+      : fd(-1),
+        id(1),
+        find_head(0),
+        find_tail(0),
+        ins_head(0),
+        ins_tail(0),
+        erase_head(0),
+        erase_tail(0) {
     this->capacity = kmercounter::utils::next_pow2(c);
     {
       const std::lock_guard<std::mutex> lock(ht_init_mutex);
-      if (!this->hashtable) {
+      if (!this->gen_.load()) {
         assert(this->ref_cnt == 0);
-        this->hashtable = calloc_ht<KV>(this->capacity, this->id, &this->fd);
-        PLOGI.printf("Hashtable base: %p Hashtable size: %lu",
-                     this->hashtable, this->capacity);
+        Generation *g = new Generation{};
+        if (!config.ht_snapshot_in.empty()) {
+          this->__map_snapshot(g);
+        } else {
+          g->capacity = this->capacity;
+          g->ht = calloc_ht<KV>(g->capacity, this->id, &g->fd);
+        }
+        assert(g->capacity <= MAX_HT_CAPACITY);
+        this->fd = g->fd;
+        this->grow_at_.store(__grow_at(g->capacity));
+        this->cur_epoch_.store(g->epoch);
+        this->gen_.store(g);
+        PLOGI.printf("Hashtable base: %p Hashtable size: %lu", g->ht,
+                     g->capacity);
+      }
+      Generation *g = this->gen_.load();
+      this->hashtable = g->ht;
+      this->capacity = g->capacity;
+      this->gen_view_ = g;
+      if (config.ht_grow_threshold > 0) {
+        this->__claim_epoch_slot();
       }
       this->ref_cnt++;
     }
@@ -64,20 +106,34 @@ class CASHashTable : public BaseHashTable {
         (KVQ *)(aligned_alloc(64, PREFETCH_QUEUE_SIZE * sizeof(KVQ)));
     this->find_queue =
         (KVQ *)(aligned_alloc(64, PREFETCH_FIND_QUEUE_SIZE * sizeof(KVQ)));
+    this->erase_queue =
+        (KVQ *)(aligned_alloc(64, PREFETCH_QUEUE_SIZE * sizeof(KVQ)));
 
     PLOGV.printf("%s, data_length %lu\n", __func__, this->data_length);
   }
 
   ~CASHashTable() {
+    free(erase_queue);
     free(find_queue);
     free(insert_queue);
     // Deallocate the global hashtable if ref_cnt goes down to zero.
     {
       const std::lock_guard<std::mutex> lock(ht_init_mutex);
+      if (this->epoch_slot_) {
+        this->epoch_slot_->epoch.store(IDLE_EPOCH);
+        this->epoch_slot_->used = false;
+      }
       this->ref_cnt--;
       if (this->ref_cnt == 0) {
-        free_mem<KV>(this->hashtable, this->capacity, this->id, this->fd);
-        this->hashtable = nullptr;
+        Generation *g = this->gen_.load();
+        free_mem<KV>(g->ht, g->capacity, this->id, g->fd);
+        this->retired_.push_back(g);
+        this->__free_retired();
+        this->gen_.store(nullptr);
+        this->fill_.store(0);
+        this->resize_due_.store(false);
+        empty_slot_exists_ = tombstone_slot_exists_ = false;
+        empty_slot_ = tombstone_slot_ = 0;
       }
     }
   }
@@ -85,38 +141,66 @@ class CASHashTable : public BaseHashTable {
   void prefetch_queue(QueueType qtype) override {}
 
   void insert_noprefetch(const void *data, collector_type *collector) override {
+    this->__enter();
 #ifdef LATENCY_COLLECTION
     const auto timer_start = collector->sync_start();
 #endif
 
     uint64_t hash = this->hash((const char *)data);
+    if (this->migrating_) [[unlikely]] {
+      this->__migrate_chain(hash);
+    }
     size_t idx = hash & (this->capacity - 1);  // modulo
     // size_t idx = fastrange32(hash, this->capacity);  // modulo
 
     KVQ *elem = const_cast<KVQ *>(reinterpret_cast<const KVQ *>(data));
+    if (__out_of_line(elem->key)) {
+      this->__insert_empty(elem);
+      goto exit;
+    }
 
-    for (auto i = 0u; i < this->capacity; i++) {
-      KV *curr = &this->hashtable[idx];
-    retry:
-      if (curr->is_empty()) {
-        bool cas_res = curr->insert_cas(elem);
-        if (cas_res) {
-          break;
-        } else {
+    {
+      // The first tombstone passed, taken at the end of the chain
+      KV *tombstone = nullptr;
+      for (auto i = 0u; i < this->capacity; i++) {
+        KV *curr = &this->hashtable[idx];
+      retry:
+        if (curr->is_empty() && tombstone) {
+          curr = std::exchange(tombstone, nullptr);
+          if (curr->reuse_cas(elem)) {
+            break;
+          }
+          idx = curr - this->hashtable;
+          goto retry;
+        } else if (curr->is_empty()) {
+          bool cas_res = curr->insert_cas(elem);
+          if (cas_res) {
+            this->pending_fill_++;
+            break;
+          } else {
+            goto retry;
+          }
+        } else if (curr->compare_key(data)) {
+          if (curr->update_cas(elem)) {
+            break;
+          }
+          // Erased or replaced meanwhile, look at the slot again
           goto retry;
+        } else {
+          if (!tombstone && curr->is_tombstone()) {
+            tombstone = curr;
+          }
+          idx++;
+          idx = idx & (this->capacity - 1);
         }
-      } else if (curr->compare_key(data)) {
-        curr->update_cas(elem);
-        break;
-      } else {
-        idx++;
-        idx = idx & (this->capacity - 1);
       }
     }
 
+  exit:
 #ifdef LATENCY_COLLECTION
     collector->sync_end(timer_start);
 #endif
+    this->__exit();
   }
 
   bool insert(const void *data) {
@@ -128,14 +212,21 @@ class CASHashTable : public BaseHashTable {
   // insert a batch
   void insert_batch(const InsertFindArguments &kp,
                     collector_type *collector) override {
+    this->__enter();
 
     this->flush_if_needed(collector);
 
-    for (auto &data : kp) {
-      add_to_insert_queue(&data, collector);
-    }
+    this->__for_each_located(
+        kp,
+        [this](auto &, uint64_t hash) { this->prefetch(this->__locate(hash)); },
+        [&](auto &data, uint64_t hash) {
+          add_to_insert_queue(&data, hash, collector);
+        });
 
     this->flush_if_needed(collector);
+    this->insert_depth.account(kp.size());
+
+    this->__exit();
   }
 
   // overridden function for insertion
@@ -143,7 +234,8 @@ class CASHashTable : public BaseHashTable {
     size_t curr_queue_sz =
         (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
 
-    while (curr_queue_sz >= INS_FLUSH_THRESHOLD) {
+    while (curr_queue_sz >= this->insert_depth.get()) {
+      this->__maybe_checkpoint();
       __insert_one(&this->insert_queue[this->ins_tail], collector);
       if (++this->ins_tail >= PREFETCH_QUEUE_SIZE) this->ins_tail = 0;
       curr_queue_sz =
@@ -153,39 +245,51 @@ class CASHashTable : public BaseHashTable {
   }
 
   void flush_insert_queue(collector_type *collector) override {
+    this->__enter();
+
     size_t curr_queue_sz =
         (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
 
     while (curr_queue_sz != 0) {
+      this->__maybe_checkpoint();
       __insert_one(&this->insert_queue[this->ins_tail], collector);
       if (++this->ins_tail >= PREFETCH_QUEUE_SIZE) this->ins_tail = 0;
       curr_queue_sz =
           (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
     }
+
+    this->__settle();
+    this->__exit();
   }
 
   void flush_find_queue(ValuePairs &vp, collector_type *collector) override {
+    this->__enter();
+
     size_t curr_queue_sz =
         (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
 
     while ((curr_queue_sz != 0) && (vp.first < config.batch_len)) {
+      this->__maybe_checkpoint();
       __find_one(&this->find_queue[this->find_tail], vp, collector);
       if (++this->find_tail >= PREFETCH_FIND_QUEUE_SIZE) this->find_tail = 0;
       curr_queue_sz =
           (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
     }
+
+    this->__exit();
   }
 
   void flush_if_needed(ValuePairs &vp, collector_type *collector) {
     size_t curr_queue_sz = (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
 
-    if((curr_queue_sz >= FLUSH_THRESHOLD) && (vp.first < config.batch_len))
+    if((curr_queue_sz >= this->find_depth.get()) && (vp.first < config.batch_len))
     {
       __builtin_prefetch(&curr_queue_sz, true, 3);
       __builtin_prefetch(&this->find_tail, true, 3);
     }
 
-    while ((curr_queue_sz > FLUSH_THRESHOLD) && (vp.first < config.batch_len)) {
+    while ((curr_queue_sz > this->find_depth.get()) && (vp.first < config.batch_len)) {
+      this->__maybe_checkpoint();
       __find_one(&this->find_queue[this->find_tail], vp, collector);
       if (++this->find_tail >= PREFETCH_FIND_QUEUE_SIZE) {
         this->find_tail = 0;
@@ -221,33 +325,107 @@ class CASHashTable : public BaseHashTable {
 
   void find_batch(const InsertFindArguments &kp, ValuePairs &values,
                   collector_type *collector) override {
-    this->flush_if_needed(values, collector);
+    this->__enter();
 
-    for (auto &data : kp) {
-      add_to_find_queue(&data, collector);
+    if (config.coro_lookups) {
+      this->__find_batch_coro(kp, values, collector);
+      this->__exit();
+      return;
     }
 
     this->flush_if_needed(values, collector);
+
+    this->__for_each_located(
+        kp,
+        [this](auto &, uint64_t hash) {
+          this->prefetch_read(this->__locate(hash));
+        },
+        [&](auto &data, uint64_t hash) {
+          add_to_find_queue(&data, hash, collector);
+        });
+
+    this->flush_if_needed(values, collector);
+    this->find_depth.account(kp.size());
+
+    this->__exit();
   }
 
   void simple_find_batch(const InsertFindArguments &kp, ValuePairs &values,
                          collector_type *collector) {
+    this->__enter();
     // this->simple_flush(values, collector);
     for (auto &data : kp) {
       simple_add_to_find_queue(&data, collector);
     }
     this->simple_flush(values, collector);
+    this->__exit();
+  }
+
+  /// Erased entries are replaced by a tombstone instead of being emptied, as
+  /// other threads may be walking the same probe chain concurrently. An
+  /// insert that reaches the end of its chain takes the first tombstone it
+  /// passed instead of the empty slot.
+  void erase_batch(const InsertFindArguments &kp,
+                   collector_type *collector) override {
+    this->__enter();
+
+    this->flush_erase_if_needed(collector);
+
+    // the slot gets written if the key is found
+    this->__for_each_located(
+        kp,
+        [this](auto &, uint64_t hash) { this->prefetch(this->__locate(hash)); },
+        [&](auto &data, uint64_t hash) {
+          add_to_erase_queue(&data, hash, collector);
+        });
+
+    this->flush_erase_if_needed(collector);
+    this->erase_depth.account(kp.size());
+
+    this->__exit();
+  }
+
+  void flush_erase_if_needed(collector_type *collector) {
+    size_t curr_queue_sz =
+        (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz >= this->erase_depth.get()) {
+      this->__maybe_checkpoint();
+      __erase_one(&this->erase_queue[this->erase_tail], collector);
+      if (++this->erase_tail >= PREFETCH_QUEUE_SIZE) this->erase_tail = 0;
+      curr_queue_sz =
+          (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+  }
+
+  void flush_erase_queue(collector_type *collector) override {
+    this->__enter();
+
+    size_t curr_queue_sz =
+        (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz != 0) {
+      this->__maybe_checkpoint();
+      __erase_one(&this->erase_queue[this->erase_tail], collector);
+      if (++this->erase_tail >= PREFETCH_QUEUE_SIZE) this->erase_tail = 0;
+      curr_queue_sz =
+          (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+
+    this->__exit();
   }
 
   void *find_noprefetch(const void *data, collector_type *collector) override {
-#ifdef CALC_STATS
     uint64_t distance_from_bucket = 0;
-#endif
+    this->__enter();
 #ifdef LATENCY_COLLECTION
     const auto timer_start = collector->sync_start();
 #endif
 
     uint64_t hash = this->hash((const char *)data);
+    if (this->migrating_) [[unlikely]] {
+      this->__migrate_chain(hash);
+    }
     size_t idx = hash;
     // size_t idx = fastrange32(hash, this->capacity);  // modulo
     InsertFindArgument *item = const_cast<InsertFindArgument *>(
@@ -255,6 +433,11 @@ class CASHashTable : public BaseHashTable {
     KV *curr;
     bool found = false;
 
+    // Out of line keys have no slot to point to
+    if (__out_of_line(item->key)) {
+      goto exit;
+    }
+
     // printf("Thread %" PRIu64 ": Trying memcmp at: %" PRIu64 "\n",
     // this->thread_id, idx);
     for (auto i = 0u; i < this->capacity; i++) {
@@ -268,19 +451,12 @@ class CASHashTable : public BaseHashTable {
         found = true;
         break;
       }
-#ifdef CALC_STATS
       distance_from_bucket++;
-#endif
       idx++;
     }
 
-#ifdef CALC_STATS
-    if (distance_from_bucket > this->max_distance_from_bucket) {
-      this->max_distance_from_bucket = distance_from_bucket;
-    }
-    this->sum_distance_from_bucket += distance_from_bucket;
-#endif
   exit:
+    this->batch_stats.add_probe_length(distance_from_bucket);
 #ifdef LATENCY_COLLECTION
     collector->sync_end(timer_start);
 #endif
@@ -293,37 +469,27 @@ class CASHashTable : public BaseHashTable {
       curr = nullptr;
     }
 
+    this->__exit();
     return curr;
   }
 
+  // The accessors below look at the current table, which may have grown
+  // since this instance last operated on it. They are not meant to race with
+  // a resize.
   void display() const override {
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (!this->hashtable[i].is_empty()) {
-        cout << this->hashtable[i] << endl;
-      }
-    }
+    scan_print(__scanner(), scan_threads(), std::cout);
   }
 
   size_t get_fill() const override {
-    size_t count = 0;
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (!this->hashtable[i].is_empty()) {
-        count++;
-      }
-    }
-    return count;
+    return scan_fill(__scanner(), scan_threads());
   }
 
-  size_t get_capacity() const override { return this->capacity; }
+  size_t get_capacity() const override { return gen_.load()->capacity; }
+
+  bool is_shared() const override { return true; }
 
   size_t get_max_count() const override {
-    size_t count = 0;
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (this->hashtable[i].get_value() > count) {
-        count = this->hashtable[i].get_value();
-      }
-    }
-    return count;
+    return scan_max_count(__scanner(), scan_threads());
   }
 
   void print_to_file(std::string &outfile) const override {
@@ -332,12 +498,49 @@ class CASHashTable : public BaseHashTable {
       PLOG_ERROR.printf("Could not open outfile %s", outfile.c_str());
       return;
     }
+    scan_print(__scanner(), max_scan_threads(), f);
+  }
 
-    for (size_t i = 0; i < this->get_capacity(); i++) {
-      if (!this->hashtable[i].is_empty()) {
-        f << this->hashtable[i] << std::endl;
+  void scan(unsigned num_threads, const ScanCallback &cb) const override {
+    __scan(num_threads, [&cb](unsigned tid, KV &kv) {
+      cb(tid, KeyValuePair(kv.get_key(), kv.get_value()));
+    });
+  }
+
+  bool save_snapshot(const std::string &path) const override {
+    const Generation *g = gen_.load();
+    if (g->epoch & 1) {
+      PLOG_ERROR.printf("Cannot snapshot the hashtable while it is resizing");
+      return false;
+    }
+
+    auto hdr = make_snapshot_header<KV, H>(CASHTPP, g->capacity);
+    // Tombstones are kept, they occupy their slot just the same
+    for (size_t i = 0; i < g->capacity; i++) {
+      if (!g->ht[i].is_empty()) {
+        hdr.fill++;
       }
     }
+    hdr.empty_slot = empty_slot_;
+    hdr.empty_slot_exists = empty_slot_exists_;
+    hdr.tombstone_slot = tombstone_slot_;
+    hdr.tombstone_slot_exists = tombstone_slot_exists_;
+    return write_snapshot(path, hdr, g->ht);
+  }
+
+  bool save_profile(const std::string &path) override {
+    const Generation *g = gen_.load();
+    if (g->epoch & 1) {
+      PLOG_ERROR.printf("Cannot profile the hashtable while it is resizing");
+      return false;
+    }
+
+    const uint64_t mask = g->capacity - 1;
+    const auto prof = profile_table(g->ht, g->capacity, [&](KV &kv) {
+      const uint64_t key = kv.get_key();
+      return this->hash(&key) & mask;
+    });
+    return write_profile(path, prof);
   }
 
  private:
@@ -349,13 +552,590 @@ class CASHashTable : public BaseHashTable {
   KV empty_item;
   KVQ *find_queue;
   KVQ *insert_queue;
+  KVQ *erase_queue;
   uint32_t find_head;
   uint32_t find_tail;
   uint32_t ins_head;
   uint32_t ins_tail;
-  Hasher hasher_;
+  uint32_t erase_head;
+  uint32_t erase_tail;
+  H hasher_;
+
+  static constexpr uint64_t KEYS_IN_CACHELINE = KEYS_IN_CACHELINE_MASK + 1;
+  /// Epoch published by instances that are not operating on the table.
+  static constexpr uint64_t IDLE_EPOCH = std::numeric_limits<uint64_t>::max();
+  /// Cachelines of the old table an instance migrates on every operation.
+  static constexpr uint64_t RESIZE_CHUNKS_PER_BATCH = 8;
+  /// Inserts an instance collects before publishing them to the fill count.
+  static constexpr uint64_t RESIZE_FILL_BATCH = 1024;
+  static constexpr size_t MAX_EPOCH_SLOTS = 128;
+
+  enum ChunkState : uint8_t { CHUNK_PENDING, CHUNK_MOVING, CHUNK_MOVED };
+
+  /// A version of the table. An even epoch has a single table; an odd epoch
+  /// is a migration from `old_ht` into `ht`, where every cacheline (chunk)
+  /// of `old_ht` is moved exactly once.
+  struct Generation {
+    uint64_t epoch;
+    KV *ht;
+    uint64_t capacity;
+    int fd;
+    KV *old_ht;
+    uint64_t old_capacity;
+    int old_fd;
+    uint64_t num_chunks;
+    std::atomic<uint8_t> *chunk_state;
+    /// Next chunk handed out to instances that help with the migration.
+    std::atomic<uint64_t> next_chunk;
+    std::atomic<uint64_t> chunks_done;
+  };
+
+  /// The epoch an instance is operating in, or IDLE_EPOCH. A table can only
+  /// be written by instances that are inside one of its epochs.
+  struct alignas(CACHELINE_SIZE) EpochSlot {
+    std::atomic<uint64_t> epoch{IDLE_EPOCH};
+    bool used{false};
+  };
+
+  /// Current version of the table. It changes when a resize starts and when
+  /// it finishes.
+  static std::atomic<Generation *> gen_;
+  /// Epoch of `gen_`, published after it.
+  static std::atomic<uint64_t> cur_epoch_;
+  /// Generations replaced by a newer one. They are freed by the next resize,
+  /// once no instance can be using them.
+  static std::vector<Generation *> retired_;
+  /// Approximate number of occupied slots in the current table.
+  static std::atomic<uint64_t> fill_;
+  /// Fill at which the current table grows.
+  static std::atomic<uint64_t> grow_at_;
+  /// Set once the fill crossed `grow_at_`, until the resize starts.
+  static std::atomic<bool> resize_due_;
+  /// Serializes starting and finishing a resize.
+  static std::mutex resize_mutex_;
+  static std::array<EpochSlot, MAX_EPOCH_SLOTS> epoch_slots_;
+
+  /// Null unless the table is allowed to grow.
+  EpochSlot *epoch_slot_ = nullptr;
+  uint32_t slot_idx_ = 0;
+  uint32_t section_depth_ = 0;
+  /// Generation this instance operates on while inside a section.
+  Generation *gen_view_ = nullptr;
+  uint64_t seen_epoch_ = IDLE_EPOCH;
+  uint64_t quiesced_epoch_ = IDLE_EPOCH;
+  bool migrating_ = false;
+  /// Inserts into the current table not yet added to `fill_`.
+  uint64_t pending_fill_ = 0;
+  /// Lookups of the batch in flight with --coro-lookups, with their hashes
+  std::vector<std::pair<const InsertFindArgument *, uint64_t>> coro_batch_;
+
+  uint64_t hash(const void *k) {
+    if constexpr (KeyByReference<KV>) {
+      return KV::hash_key(hasher_, *static_cast<const key_type *>(k));
+    } else {
+      return hasher_(k, this->key_length);
+    }
+  }
+
+  /// Visit the arguments of a batch along with the hashes of their keys,
+  /// which are computed HASH_BATCH_SIZE at a time. `locate(arg, hash)` is
+  /// called on the whole group before the first visit, so that the
+  /// prefetches of a group go out back to back.
+  template <typename L, typename F>
+  void __for_each_located(const InsertFindArguments &kp, L &&locate, F &&f) {
+    uint64_t hashes[HASH_BATCH_SIZE];
+    for (size_t i = 0; i < kp.size(); i += HASH_BATCH_SIZE) {
+      const size_t n = std::min<size_t>(HASH_BATCH_SIZE, kp.size() - i);
+      if constexpr (KeyByReference<KV>) {
+        for (size_t j = 0; j < n; j++) hashes[j] = this->hash(&kp[i + j].key);
+      } else {
+        hash_keys(hasher_, &kp[i].key, sizeof(InsertFindArgument), n,
+                  this->key_length, hashes);
+      }
+      for (size_t j = 0; j < n; j++) locate(kp[i + j], hashes[j]);
+      for (size_t j = 0; j < n; j++) f(kp[i + j], hashes[j]);
+    }
+  }
+
+  template <typename F>
+  void __for_each_hashed(const InsertFindArguments &kp, F &&f) {
+    this->__for_each_located(kp, [](auto &, uint64_t) {}, f);
+  }
+
+  /// The slot a key with `hash` starts probing at, after moving its chain
+  /// over if the table is growing.
+  size_t __locate(uint64_t hash) {
+    if (this->migrating_) [[unlikely]] {
+      this->__migrate_chain(hash);
+    }
+    // Since we use fastrange for partitioned HT, use it
+    // for this HT too for a fair comparison
+    // size_t idx = fastrange32(hash, this->capacity);  // modulo
+    return hash & (this->capacity - 1);
+  }
+
+  /// Look up a batch on config.coro_lookups interleaved coroutines (see
+  /// hashtables/coro_lookup.hpp) instead of the find queue.
+  void __find_batch_coro(const InsertFindArguments &kp, ValuePairs &vp,
+                         collector_type *collector) {
+    this->coro_batch_.clear();
+    this->__for_each_hashed(kp, [&](auto &data, uint64_t hash) {
+      this->coro_batch_.emplace_back(&data, hash);
+    });
+
+    size_t next = 0;
+    run_interleaved(config.coro_lookups, [&] {
+      return this->__find_worker(next, vp, collector);
+    });
+  }
+
+  /// Takes the lookups of `coro_batch_` from `next` on until there are none
+  /// left, suspending whenever it has to wait for a cacheline.
+  CoroTask __find_worker(size_t &next, ValuePairs &vp,
+                         collector_type *collector) {
+    while (next < this->coro_batch_.size()) {
+      const auto [arg, hash] = this->coro_batch_[next++];
+
+      KVQ q{};
+      q.key = arg->key;
+      q.key_id = arg->id;
+#ifdef LATENCY_COLLECTION
+      q.timer_id = collector->start();
+#endif
+      if (__out_of_line(q.key)) {
+        this->__find_empty(&q, vp);
+        continue;
+      }
+
+      if (this->migrating_) [[unlikely]] {
+        this->__migrate_chain(hash);
+      }
+      size_t idx = hash & (this->capacity - 1);
+      const size_t home = idx;
+      this->prefetch_read(idx);
+      co_await PrefetchSuspend{};
+
+      for (;;) {
+        KV *curr = &this->hashtable[idx];
+        q.idx = idx;
+        uint64_t retry;
+#ifdef AVX_SUPPORT
+        if constexpr (LineProbe<KV>) {
+          const size_t offset = idx & KEYS_IN_CACHELINE_MASK;
+          (curr - offset)->find_simd(&q, &retry, vp, offset);
+          idx |= KEYS_IN_CACHELINE_MASK;
+        } else
+#endif
+        {
+          curr->find(&q, &retry, vp);
+        }
+        if (!retry) break;
+
+        idx = (idx + 1) & (this->capacity - 1);
+        if ((idx & KEYS_IN_CACHELINE_MASK) == 0) {
+          this->prefetch_read(idx);
+          co_await PrefetchSuspend{};
+        }
+      }
+      this->batch_stats.add_probe_length(
+          probe_distance(home, q.idx, this->capacity));
+
+#ifdef LATENCY_COLLECTION
+      collector->end(q.timer_id);
+#endif
+    }
+  }
+
+  /// Map the shared table from its snapshot. The snapshot sets the capacity.
+  void __map_snapshot(Generation *g) {
+    const auto path = snapshot_path(config.ht_snapshot_in, 0);
+    SnapshotHeader hdr;
+    g->ht = map_snapshot<KV, H>(path, CASHTPP, &hdr);
+    if (!g->ht) {
+      PLOG_FATAL.printf("Couldn't load the hashtable from %s", path.c_str());
+      exit(-1);
+    }
+
+    g->capacity = hdr.capacity;
+    g->fd = SNAPSHOT_FD;
+    this->fill_.store(hdr.fill);
+    empty_slot_ = hdr.empty_slot;
+    empty_slot_exists_ = hdr.empty_slot_exists;
+    tombstone_slot_ = hdr.tombstone_slot;
+    tombstone_slot_exists_ = hdr.tombstone_slot_exists;
+  }
+
+  /// Visit every live entry of the current table, including the ones a
+  /// migration has not moved yet.
+  template <typename F>
+  static void __scan(unsigned num_threads, F &&f) {
+    const Generation *g = gen_.load();
+    auto live = [&f](unsigned tid, KV &kv) {
+      if (!kv.is_tombstone()) {
+        f(tid, kv);
+      }
+    };
+
+    scan_table(g->ht, g->capacity, num_threads, live);
+    if (g->epoch & 1) {
+      scan_table(g->old_ht, g->old_capacity, num_threads,
+                 [g, &live](unsigned tid, KV &kv) {
+                   const uint64_t c = (&kv - g->old_ht) / KEYS_IN_CACHELINE;
+                   if (g->chunk_state[c].load() != CHUNK_MOVED) {
+                     live(tid, kv);
+                   }
+                 });
+    }
+  }
+
+  static auto __scanner() {
+    return [](unsigned num_threads, auto &&f) { __scan(num_threads, f); };
+  }
+
+  void __claim_epoch_slot() {
+    for (auto i = 0u; i < epoch_slots_.size(); i++) {
+      if (!epoch_slots_[i].used) {
+        epoch_slots_[i].used = true;
+        this->epoch_slot_ = &epoch_slots_[i];
+        this->slot_idx_ = i;
+        return;
+      }
+    }
+    PLOG_FATAL << "Out of epoch slots for a growing hashtable";
+    std::terminate();
+  }
+
+  /// Publish the epoch this instance is about to operate in and catch up
+  /// with the current generation.
+  void __enter() {
+    if (!this->epoch_slot_ || this->section_depth_++ > 0) return;
+
+    Generation *g;
+    for (;;) {
+      const uint64_t epoch = cur_epoch_.load();
+      this->epoch_slot_->epoch.store(epoch);
+      // `gen_` is published before `cur_epoch_`, so `g` is at least as new as
+      // `epoch` and cannot be freed while the slot holds `epoch`
+      g = gen_.load();
+      if (g->epoch == epoch) break;
+    }
+
+    if (g->epoch != this->seen_epoch_) {
+      this->__rebase(g);
+    }
+
+    if (this->migrating_) [[unlikely]] {
+      this->__timed_stall(
+          [this] { this->__help_migrate(RESIZE_CHUNKS_PER_BATCH); });
+    }
+  }
 
-  uint64_t hash(const void *k) { return hasher_(k, this->key_length); }
+  void __exit() {
+    this->fold_stats();
+    if (!this->epoch_slot_ || --this->section_depth_ > 0) return;
+
+    this->epoch_slot_->epoch.store(IDLE_EPOCH, std::memory_order_release);
+
+    if (this->pending_fill_ >= this->__fill_batch() ||
+        resize_due_.load(std::memory_order_relaxed)) [[unlikely]] {
+      this->__account_fill();
+    }
+  }
+
+  /// Keep the unpublished inserts of all instances a small fraction of the
+  /// table.
+  uint64_t __fill_batch() const {
+    return std::min(RESIZE_FILL_BATCH, this->capacity >> 6);
+  }
+
+  /// Leave and re-enter the section between two queue entries when the table
+  /// has moved on or the fill is due, so that a long flush (e.g., one probing
+  /// a table that filled up) does not hold up a resize.
+  void __maybe_checkpoint() {
+    if (!this->epoch_slot_ || this->section_depth_ != 1) return;
+    if (cur_epoch_.load(std::memory_order_relaxed) == this->seen_epoch_ &&
+        this->pending_fill_ < this->__fill_batch() &&
+        !resize_due_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    this->__exit();
+    this->__enter();
+  }
+
+  void __rebase(Generation *g) {
+    const bool grown = g->capacity != this->capacity;
+
+    this->gen_view_ = g;
+    this->seen_epoch_ = g->epoch;
+    this->migrating_ = g->epoch & 1;
+    this->hashtable = g->ht;
+    this->capacity = g->capacity;
+
+    if (!grown) return;
+
+    // These inserts landed in the old table and are recounted by migration
+    this->pending_fill_ = 0;
+
+    // Queued keys still carry their probe position in the old table
+    this->__requeue(this->insert_queue, this->ins_tail, this->ins_head,
+                    PREFETCH_QUEUE_SIZE);
+    this->__requeue(this->find_queue, this->find_tail, this->find_head,
+                    PREFETCH_FIND_QUEUE_SIZE);
+    this->__requeue(this->erase_queue, this->erase_tail, this->erase_head,
+                    PREFETCH_QUEUE_SIZE);
+  }
+
+  void __requeue(KVQ *queue, uint32_t tail, uint32_t head, uint32_t size) {
+    for (auto i = tail; i != head; i = (i + 1) & (size - 1)) {
+      const uint64_t hash = this->hash(&queue[i].key);
+      if (this->migrating_) {
+        this->__migrate_chain(hash);
+      }
+      queue[i].idx = hash & (this->capacity - 1);
+      queue[i].part_id = 0;
+      queue[i].probe_len = 0;
+      this->prefetch(queue[i].idx);
+    }
+  }
+
+  template <typename F>
+  void __timed_stall(F &&f) {
+#ifdef LATENCY_COLLECTION
+    if (this->slot_idx_ < resize_collectors.size()) {
+      auto &resize_collector = resize_collectors[this->slot_idx_];
+      const auto timer_start = resize_collector.sync_start();
+      f();
+      resize_collector.sync_end(timer_start);
+      return;
+    }
+#endif
+    f();
+  }
+
+  /// Spin until no instance operates in an epoch older than `epoch`.
+  static void __wait_for_older(uint64_t epoch) {
+    for (auto &slot : epoch_slots_) {
+      while (slot.epoch.load() < epoch) {
+        _mm_pause();
+      }
+    }
+  }
+
+  /// The old table may only be read for migration once nobody can write to
+  /// it anymore.
+  void __wait_quiescent(Generation *g) {
+    if (this->quiesced_epoch_ == g->epoch) return;
+    __wait_for_older(g->epoch);
+    this->quiesced_epoch_ = g->epoch;
+  }
+
+  /// Make sure every key on the old probe chain of `hash` is in the new
+  /// table before the key is looked up, inserted or erased there.
+  void __migrate_chain(uint64_t hash) {
+    Generation *g = this->gen_view_;
+    if (g->chunks_done.load(std::memory_order_acquire) == g->num_chunks) {
+      return;
+    }
+
+    this->__timed_stall([this, g, hash] {
+      this->__wait_quiescent(g);
+
+      uint64_t idx = hash & (g->old_capacity - 1);
+      for (auto i = 0u; i < g->num_chunks; i++) {
+        const uint64_t chunk = idx / KEYS_IN_CACHELINE;
+        this->__move_chunk(g, chunk, true);
+
+        // The chain ends at the first empty slot of the old table
+        const uint64_t end =
+            std::min((chunk + 1) * KEYS_IN_CACHELINE, g->old_capacity);
+        for (; idx < end; idx++) {
+          if (g->old_ht[idx].is_empty()) return;
+        }
+        idx &= (g->old_capacity - 1);
+      }
+    });
+  }
+
+  void __help_migrate(uint64_t num_chunks) {
+    Generation *g = this->gen_view_;
+    if (g->next_chunk.load(std::memory_order_relaxed) >= g->num_chunks) {
+      return;
+    }
+
+    this->__wait_quiescent(g);
+
+    for (auto i = 0u; i < num_chunks; i++) {
+      const uint64_t chunk = g->next_chunk.fetch_add(1);
+      if (chunk >= g->num_chunks) break;
+      this->__move_chunk(g, chunk, false);
+    }
+  }
+
+  /// Publish the fill of this instance and complete any migration, including
+  /// one it triggers, so that the table is whole at the end of a phase.
+  void __settle() {
+    if (!this->epoch_slot_ || this->section_depth_ != 1) return;
+
+    do {
+      this->section_depth_ = 0;
+      this->epoch_slot_->epoch.store(IDLE_EPOCH, std::memory_order_release);
+      this->__account_fill();
+      this->__enter();
+      this->__complete_migration();
+    } while (resize_due_.load());
+  }
+
+  /// Help with and wait for the rest of the migration.
+  void __complete_migration() {
+    if (!this->migrating_) return;
+
+    Generation *g = this->gen_view_;
+    this->__timed_stall([this, g] {
+      this->__help_migrate(g->num_chunks);
+      while (g->chunks_done.load(std::memory_order_acquire) != g->num_chunks) {
+        _mm_pause();
+      }
+    });
+  }
+
+  void __move_chunk(Generation *g, uint64_t chunk, bool wait) {
+    std::atomic<uint8_t> &state = g->chunk_state[chunk];
+    uint8_t expected = CHUNK_PENDING;
+
+    if (!state.compare_exchange_strong(expected, CHUNK_MOVING)) {
+      // Someone else owns the chunk; its keys are usable once it has moved
+      while (wait && state.load(std::memory_order_acquire) != CHUNK_MOVED) {
+        _mm_pause();
+      }
+      return;
+    }
+
+    const uint64_t begin = chunk * KEYS_IN_CACHELINE;
+    const uint64_t end = std::min(begin + KEYS_IN_CACHELINE, g->old_capacity);
+    uint64_t moved = 0;
+
+    // Tombstones are dropped on the way
+    for (auto i = begin; i < end; i++) {
+      KV *from = &g->old_ht[i];
+      if (from->is_empty() || from->is_tombstone()) continue;
+      this->__move_one(g, from);
+      moved++;
+    }
+
+    fill_.fetch_add(moved);
+    state.store(CHUNK_MOVED, std::memory_order_release);
+
+    if (g->chunks_done.fetch_add(1) + 1 == g->num_chunks) {
+      this->__finish_resize(g);
+    }
+  }
+
+  void __move_one(Generation *g, KV *from) {
+    KVQ q{};
+    q.key = from->get_key();
+    q.value = from->get_value();
+
+    size_t idx = this->hash(&q.key) & (g->capacity - 1);
+    for (;;) {
+      KV *curr = &g->ht[idx];
+      // Nobody operates on this key before its chunk has moved, so a plain
+      // copy of the value is fine once the key is in place
+      if (curr->is_empty() && curr->insert_cas(&q)) {
+        *curr = *from;
+        return;
+      }
+      idx = (idx + 1) & (g->capacity - 1);
+    }
+  }
+
+  void __account_fill() {
+    const uint64_t fill =
+        fill_.fetch_add(this->pending_fill_) + this->pending_fill_;
+    this->pending_fill_ = 0;
+
+    if (fill >= grow_at_.load(std::memory_order_relaxed)) {
+      resize_due_.store(true, std::memory_order_relaxed);
+      this->__start_resize();
+    }
+  }
+
+  /// A table of MAX_HT_CAPACITY slots does not grow any further.
+  static uint64_t __grow_at(uint64_t capacity) {
+    return config.ht_grow_threshold > 0 && capacity < MAX_HT_CAPACITY
+               ? static_cast<uint64_t>(config.ht_grow_threshold * capacity)
+               : IDLE_EPOCH;
+  }
+
+  /// Allocate a table twice the size and publish the migration into it.
+  /// Called outside of a section.
+  void __start_resize() {
+    const std::lock_guard<std::mutex> lock(resize_mutex_);
+
+    Generation *g = gen_.load();
+    if ((g->epoch & 1) || fill_.load() < grow_at_.load()) return;
+
+    // Whatever the last resize replaced is unreachable once nobody operates
+    // in an epoch before the current one
+    __wait_for_older(g->epoch);
+    this->__free_retired();
+
+    Generation *next = new Generation{};
+    next->epoch = g->epoch + 1;
+    next->capacity = g->capacity << 1;
+    next->ht = calloc_ht<KV>(next->capacity, this->id, &next->fd);
+    next->old_ht = g->ht;
+    next->old_capacity = g->capacity;
+    next->old_fd = g->fd;
+    next->num_chunks =
+        (g->capacity + KEYS_IN_CACHELINE - 1) / KEYS_IN_CACHELINE;
+    next->chunk_state = new std::atomic<uint8_t>[next->num_chunks]();
+
+    PLOGI.printf("Growing hashtable %lu -> %lu (fill %lu)", g->capacity,
+                 next->capacity, fill_.load());
+
+    // Migration recounts the old entries
+    grow_at_.store(IDLE_EPOCH);
+    resize_due_.store(false);
+    fill_.store(0);
+    retired_.push_back(g);
+    gen_.store(next);
+    cur_epoch_.store(next->epoch);
+  }
+
+  /// Called by whoever moved the last chunk.
+  void __finish_resize(Generation *g) {
+    const std::lock_guard<std::mutex> lock(resize_mutex_);
+
+    Generation *next = new Generation{};
+    next->epoch = g->epoch + 1;
+    next->ht = g->ht;
+    next->capacity = g->capacity;
+    next->fd = g->fd;
+
+    PLOGV.printf("Hashtable migration into %lu slots done", next->capacity);
+
+    // Inserts during the migration may already have crossed the threshold
+    grow_at_.store(__grow_at(next->capacity));
+    if (fill_.load() >= grow_at_.load()) {
+      resize_due_.store(true);
+    }
+    retired_.push_back(g);
+    gen_.store(next);
+    cur_epoch_.store(next->epoch);
+  }
+
+  /// Tables owned by retired generations: an odd generation owns the table it
+  /// migrated from, the table it migrated into belongs to its successor.
+  void __free_retired() {
+    for (Generation *g : retired_) {
+      if (g->epoch & 1) {
+        free_mem<KV>(g->old_ht, g->old_capacity, this->id, g->old_fd);
+        delete[] g->chunk_state;
+      }
+      delete g;
+    }
+    retired_.clear();
+  }
 
   void prefetch(uint64_t i) {
 #if defined(PREFETCH_WITH_PREFETCH_INSTR)
@@ -376,28 +1156,70 @@ class CASHashTable : public BaseHashTable {
         sizeof(this->hashtable[i & (this->capacity - 1)]));
   }
 
+  /// A lookup in the find queue keeps in its part_id how many cachelines it
+  /// has crossed and how many of the lines after `idx` it has prefetched
+  /// already (see --reprobe-lines).
+  static uint32_t reprobe_state(uint32_t crossed, uint32_t ahead) {
+    return std::min(crossed, 0xffffu) << 16 | ahead;
+  }
+  static uint32_t reprobe_crossed(uint32_t state) { return state >> 16; }
+  static uint32_t reprobe_ahead(uint32_t state) { return state & 0xffff; }
+
+  /// The lookup ran off the end of its line into the one at `idx`. True if
+  /// that line was prefetched along with the one just probed, which has
+  /// arrived, so the lookup goes on right away. Otherwise it is queued behind
+  /// a prefetch of the line and, the longer the chain, of more lines after
+  /// it.
+  bool __reprobe_or_requeue(KVQ *q, size_t idx) {
+    const uint32_t crossed = reprobe_crossed(q->part_id) + 1;
+    const uint32_t ahead = reprobe_ahead(q->part_id);
+    if (ahead) {
+      q->part_id = reprobe_state(crossed, ahead - 1);
+      this->batch_stats.num_requeues_avoided++;
+      return true;
+    }
+
+    const uint32_t lines = std::min(1u << std::min(crossed - 1, 15u),
+                                    std::max(config.reprobe_lines, 1u));
+    for (auto i = 0u; i < lines; i++) {
+      this->prefetch_read(idx + i * (KEYS_IN_CACHELINE_MASK + 1));
+    }
+
+    this->find_queue[this->find_head].key = q->key;
+    this->find_queue[this->find_head].key_id = q->key_id;
+    this->find_queue[this->find_head].idx = idx;
+    this->find_queue[this->find_head].part_id =
+        reprobe_state(crossed, lines - 1);
+    this->find_queue[this->find_head].probe_len =
+        q->probe_len + probe_distance(q->idx, idx, this->capacity);
+#ifdef LATENCY_COLLECTION
+    this->find_queue[this->find_head].timer_id = q->timer_id;
+#endif
+
+    this->find_head += 1;
+    this->find_head &= (PREFETCH_FIND_QUEUE_SIZE - 1);
+    return false;
+  }
+
 #ifdef AVX_SUPPORT
   uint64_t __find_simd(KVQ *q, ValuePairs &vp) {
     uint64_t retry;
     size_t idx = q->idx;
-    idx = idx - (size_t)(idx & KEYS_IN_CACHELINE_MASK);
-    size_t offset = q->idx - idx;
+    uint64_t found;
 
-    KV *curr_cacheline = &this->hashtable[idx];
-    uint64_t found = curr_cacheline->find_simd(q, &retry, vp, offset);
+  try_find_simd:
+    const size_t offset = idx & KEYS_IN_CACHELINE_MASK;
+    KV *curr_cacheline = &this->hashtable[idx - offset];
+    found = curr_cacheline->find_simd(q, &retry, vp, offset);
 
     if (retry) {
-      idx += CACHELINE_SIZE / sizeof(KV);
-      idx = idx & (this->capacity - 1);
-      this->prefetch_read(idx);
-      this->find_queue[this->find_head].key = q->key;
-      this->find_queue[this->find_head].key_id = q->key_id;
-      this->find_queue[this->find_head].idx = idx;
-#ifdef LATENCY_COLLECTION
-      this->find_queue[this->find_head].timer_id = q->timer_id;
-#endif
-      this->find_head += 1;
-      this->find_head &= (PREFETCH_FIND_QUEUE_SIZE - 1);
+      idx = (idx - offset + KEYS_IN_CACHELINE) & (this->capacity - 1);
+      if (this->__reprobe_or_requeue(q, idx)) {
+        goto try_find_simd;
+      }
+    } else {
+      this->batch_stats.add_probe_length(
+          q->probe_len + probe_distance(q->idx, idx, this->capacity));
     }
     return found;
   }
@@ -407,9 +1229,12 @@ class CASHashTable : public BaseHashTable {
   uint64_t __find_branchless_cmov(KVQ *q, ValuePairs &vp) {
     // hashtable idx where the data should be found
     size_t idx = q->idx;
+    // slot probed last, for the probe length
+    size_t probed;
     uint64_t found = 0;
 
   try_find_brless:
+    probed = idx;
     KV *curr = &this->hashtable[idx];
     uint64_t retry;
     found = curr->find_brless(q, &retry, vp);  // find, not find (curr )
@@ -420,30 +1245,15 @@ class CASHashTable : public BaseHashTable {
       idx++;
       idx = idx & (this->capacity - 1);  // make sure idx is in the range
 
-      // If idx still on a cacheline, keep looking until idx spill over
-      if ((idx & KEYS_IN_CACHELINE_MASK) != 0) {
+      // If idx still on a cacheline, keep looking until idx spill over, or
+      // into the next line if it is prefetched already
+      if ((idx & KEYS_IN_CACHELINE_MASK) != 0 ||
+          this->__reprobe_or_requeue(q, idx)) {
         goto try_find_brless;
       }
-
-      // key is at a different cacheline, prefetch and delay the find
-      this->prefetch_read(idx);
-
-      this->find_queue[this->find_head].key = q->key;
-      this->find_queue[this->find_head].key_id = q->key_id;
-      this->find_queue[this->find_head].idx = idx;
-#ifdef LATENCY_COLLECTION
-      this->find_queue[this->find_head].timer_id = q->timer_id;
-#endif
-
-      this->find_head += 1;
-      this->find_head &= (PREFETCH_FIND_QUEUE_SIZE - 1);
-#ifdef CALC_STATS
-      this->sum_distance_from_bucket++;
-#endif
     } else {
-#ifdef LATENCY_COLLECTION__find_branched
-      collector->end(q->timer_id);
-#endif
+      this->batch_stats.add_probe_length(
+          q->probe_len + probe_distance(q->idx, probed, this->capacity));
     }
 
     return found;
@@ -452,12 +1262,26 @@ class CASHashTable : public BaseHashTable {
   uint64_t __find_branched(KVQ *q, ValuePairs &vp, collector_type *collector) {
     // hashtable idx where the data should be found
     size_t idx = q->idx;
+    // slot probed last, for the probe length
+    size_t probed;
     uint64_t found = 0;
 
   try_find:
+    probed = idx;
     KV *curr = &this->hashtable[idx];
     uint64_t retry;
-    found = curr->find(q, &retry, vp);
+#ifdef AVX_SUPPORT
+    if constexpr (LineProbe<KV>) {
+      // All the keys of the cacheline are compared at once, so a miss moves
+      // on to the next line
+      const size_t offset = idx & KEYS_IN_CACHELINE_MASK;
+      found = (curr - offset)->find_simd(q, &retry, vp, offset);
+      idx |= KEYS_IN_CACHELINE_MASK;
+    } else
+#endif
+    {
+      found = curr->find(q, &retry, vp);
+    }
 
     if (retry) {
       // insert back into queue, and prefetch next bucket.
@@ -465,27 +1289,15 @@ class CASHashTable : public BaseHashTable {
       idx++;
       idx = idx & (this->capacity - 1);  // modulo
 
-      // If idx still on a cacheline, keep looking until idx spill over
-      if ((idx & KEYS_IN_CACHELINE_MASK) != 0) {
+      // If idx still on a cacheline, keep looking until idx spill over, or
+      // into the next line if it is prefetched already
+      if ((idx & KEYS_IN_CACHELINE_MASK) != 0 ||
+          this->__reprobe_or_requeue(q, idx)) {
         goto try_find;
       }
-
-      // key is at a different cacheline, prefetch and delay the find
-      this->prefetch_read(idx);
-
-      this->find_queue[this->find_head].key = q->key;
-      this->find_queue[this->find_head].key_id = q->key_id;
-      this->find_queue[this->find_head].idx = idx;
-#ifdef LATENCY_COLLECTION
-      this->find_queue[this->find_head].timer_id = q->timer_id;
-#endif
-
-      this->find_head += 1;
-      this->find_head &= (PREFETCH_FIND_QUEUE_SIZE - 1);
-#ifdef CALC_STATS
-      this->sum_distance_from_bucket++;
-#endif
     } else {
+      this->batch_stats.add_probe_length(
+          q->probe_len + probe_distance(q->idx, probed, this->capacity));
 #ifdef LATENCY_COLLECTION
       collector->end(q->timer_id);
 #endif
@@ -495,7 +1307,7 @@ class CASHashTable : public BaseHashTable {
   }
 
   auto __find_one(KVQ *q, ValuePairs &vp, collector_type *collector) {
-    if (q->key == this->empty_item.get_key()) {
+    if (__out_of_line(q->key)) {
       return __find_empty(q, vp);
     }
 
@@ -512,16 +1324,33 @@ class CASHashTable : public BaseHashTable {
     }
   }
 
-  /// Update or increment the empty key.
+  /// The empty key and TOMBSTONE_KEY mark slots, so their values are kept
+  /// out of the table.
+  bool __out_of_line(key_type key) const {
+    return key == this->empty_item.get_key() || key == TOMBSTONE_KEY;
+  }
+
+  static uint64_t &__slot_of(key_type key) {
+    return key == TOMBSTONE_KEY ? tombstone_slot_ : empty_slot_;
+  }
+
+  static bool &__slot_exists(key_type key) {
+    return key == TOMBSTONE_KEY ? tombstone_slot_exists_ : empty_slot_exists_;
+  }
+
+  /// Look up an out of line key.
   uint64_t __find_empty(KVQ *q, ValuePairs &vp) {
-    if (empty_slot_exists_) {
+    if (__slot_exists(q->key)) {
       vp.second[vp.first].id = q->key_id;
-      vp.second[vp.first].value = empty_slot_;
+      vp.second[vp.first].value = __slot_of(q->key);
       vp.first++;
     }
-    return empty_slot_;
+    return __slot_of(q->key);
   }
 
+  /// An insert keeps in its part_id the first tombstone it has passed, plus
+  /// one (0: none). The key may still be further down the chain, so the
+  /// tombstone is only taken once the insert reaches the end of the chain.
   void __insert_branched(KVQ *q, collector_type *collector) {
     // hashtable idx at which data is to be inserted
 
@@ -529,6 +1358,19 @@ class CASHashTable : public BaseHashTable {
   try_insert:
     KV *curr = &this->hashtable[idx];
 
+    if (q->part_id && curr->is_empty()) {
+      idx = q->part_id - 1;
+      q->part_id = 0;
+      if (this->hashtable[idx].reuse_cas(q)) {
+#ifdef LATENCY_COLLECTION
+        collector->end(q->timer_id);
+#endif
+        return;
+      }
+      // Taken by another insert, maybe of the same key: probe on from there
+      goto try_insert;
+    }
+
     // hashtable_mutexes[pidx].lock();
     // printf("Thread %" PRIu64 ", grabbing lock: %" PRIu64 "\n",
     // this->thread_id, pidx); Compare with empty element
@@ -536,9 +1378,8 @@ class CASHashTable : public BaseHashTable {
       // std::cout << "insert_cas k " << q->key << " : " << q->value << "\n";
       bool cas_res = curr->insert_cas(q);
       if (cas_res) {
-#ifdef CALC_STATS
-        this->num_memcpys++;
-#endif
+        this->pending_fill_++;
+        this->batch_stats.num_memcpys++;
 
 #ifdef COMPARE_HASH
         hashtable[pidx].key_hash = q->key_hash;
@@ -559,19 +1400,19 @@ class CASHashTable : public BaseHashTable {
       // inserting new. Just fall-through to check!
     }
 
-#ifdef CALC_STATS
-    this->num_hashcmps++;
-#endif
+    this->batch_stats.num_hashcmps++;
 
 #ifdef COMPARE_HASH
     if (this->hashtable[pidx].key_hash == q->key_hash)
 #endif
     {
-#ifdef CALC_STATS
-      this->num_memcmps++;
-#endif
+      this->batch_stats.num_memcmps++;
       if (curr->compare_key(q)) {
-        curr->update_cas(q);
+        if (!curr->update_cas(q)) {
+          // The slot was erased or taken by another key since, look at it
+          // again: a tombstone is remembered, another key probed past
+          goto try_insert;
+        }
         // hashtable[pidx].kmer_count++;
         // hashtable_mutexes[pidx].unlock();
 
@@ -582,6 +1423,10 @@ class CASHashTable : public BaseHashTable {
       }
     }
 
+    if (!q->part_id && curr->is_tombstone()) {
+      q->part_id = idx + 1;
+    }
+
     // hashtable_mutexes[pidx].unlock();
 
     /* insert back into queue, and prefetch next bucket.
@@ -593,9 +1438,7 @@ class CASHashTable : public BaseHashTable {
     // |  CACHELINE_SIZE   |
     // | 0 | 1 | . | . | n | n+1 ....
     if ((idx & KEYS_IN_CACHELINE_MASK) != 0) {
-#ifdef CALC_STATS
-      ++this->num_soft_reprobes;
-#endif
+      ++this->batch_stats.num_soft_reprobes;
       goto try_insert;  // FIXME: @David get rid of the goto for crying out loud
     }
 
@@ -605,6 +1448,7 @@ class CASHashTable : public BaseHashTable {
     this->insert_queue[this->ins_head].key_id = q->key_id;
     this->insert_queue[this->ins_head].value = q->value;
     this->insert_queue[this->ins_head].idx = idx;
+    this->insert_queue[this->ins_head].part_id = q->part_id;
 
 #ifdef LATENCY_COLLECTION
     this->insert_queue[this->ins_head].timer_id = q->timer_id;
@@ -613,30 +1457,93 @@ class CASHashTable : public BaseHashTable {
     ++this->ins_head;
     this->ins_head &= (PREFETCH_QUEUE_SIZE - 1);
 
-#ifdef CALC_STATS
-    this->num_reprobes++;
-#endif
+    this->batch_stats.num_reprobes++;
     return;
   }
 
   void __insert_one(KVQ *q, collector_type *collector) {    
-    if (q->key == this->empty_item.get_key()) {
+    if (__out_of_line(q->key)) {
       __insert_empty(q);
     } else {
       __insert_branched(q, collector);
     }
   }
 
-  /// Update or increment the empty key.
+  /// Update or increment an out of line key.
   void __insert_empty(KVQ *q) {
+    uint64_t &slot = __slot_of(q->key);
+    bool &exists = __slot_exists(q->key);
     if constexpr (std::is_same_v<KV, Item>) {
-      empty_slot_ = q->value;
+      slot = q->value;
     } else if constexpr (std::is_same_v<KV, Aggr_KV>) {
-      empty_slot_ += q->value;
+      slot += q->value;
+    } else if constexpr (Upserting<KV>) {
+      KV::insert_empty(slot, exists, q->value);
     } else {
       assert(false && "Invalid template type");
     }
-    empty_slot_exists_ = true;
+    exists = true;
+  }
+
+  void __erase_branched(KVQ *q, collector_type *collector) {
+    // hashtable idx at which the key is expected
+    size_t idx = q->idx;
+  try_erase:
+    KV *curr = &this->hashtable[idx];
+
+    // end of the probe chain; the key is not in the table
+    if (curr->is_empty()) {
+#ifdef LATENCY_COLLECTION
+      collector->end(q->timer_id);
+#endif
+      return;
+    }
+
+    this->batch_stats.num_memcmps++;
+    if (curr->compare_key(q)) {
+      // If the CAS fails, another thread has erased the key under us
+      curr->erase_cas(q);
+#ifdef LATENCY_COLLECTION
+      collector->end(q->timer_id);
+#endif
+      return;
+    }
+
+    idx++;
+    idx = idx & (this->capacity - 1);  // modulo
+
+    if ((idx & KEYS_IN_CACHELINE_MASK) != 0) {
+      ++this->batch_stats.num_soft_reprobes;
+      goto try_erase;
+    }
+
+    prefetch(idx);
+
+    this->erase_queue[this->erase_head].key = q->key;
+    this->erase_queue[this->erase_head].key_id = q->key_id;
+    this->erase_queue[this->erase_head].idx = idx;
+#ifdef LATENCY_COLLECTION
+    this->erase_queue[this->erase_head].timer_id = q->timer_id;
+#endif
+
+    ++this->erase_head;
+    this->erase_head &= (PREFETCH_QUEUE_SIZE - 1);
+
+    this->batch_stats.num_reprobes++;
+  }
+
+  void __erase_one(KVQ *q, collector_type *collector) {
+    if (__out_of_line(q->key)) {
+      __erase_empty(q);
+    } else {
+      __erase_branched(q, collector);
+    }
+  }
+
+  /// Drop an out of line key.
+  void __erase_empty(KVQ *q) {
+    __slot_exists(q->key) = false;
+    __slot_of(q->key) = 0;
   }
 
   uint64_t read_hashtable_element(const void *data) override {
@@ -645,27 +1552,25 @@ class CASHashTable : public BaseHashTable {
     return -1;
   }
 
-  void add_to_insert_queue(void *data, collector_type *collector) {
+  void add_to_insert_queue(void *data, uint64_t hash,
+                           collector_type *collector) {
     InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
 
 #ifdef LATENCY_COLLECTION
     const auto timer = collector->start();
 #endif
 
-    uint64_t hash = this->hash((const char *)&key_data->key);
-    // Since we use fastrange for partitioned HT, use it
-    // for this HT too for a fair comparison
-    // size_t idx = fastrange32(hash, this->capacity);  // modulo
+    // located and prefetched by __for_each_located
     size_t idx = hash & (this->capacity - 1);
 
     // std::cout << " -- Adding " << key_data->key  << " : " << key_data->value
     // << endl;
-    this->prefetch(idx);
 
     this->insert_queue[this->ins_head].idx = idx;
     this->insert_queue[this->ins_head].key = key_data->key;
     this->insert_queue[this->ins_head].value = key_data->value;
     this->insert_queue[this->ins_head].key_id = key_data->id;
+    this->insert_queue[this->ins_head].part_id = 0;
 
 #ifdef LATENCY_COLLECTION
     this->insert_queue[this->ins_head].timer_id = timer;
@@ -679,10 +1584,36 @@ class CASHashTable : public BaseHashTable {
     if (this->ins_head >= PREFETCH_QUEUE_SIZE) this->ins_head = 0;
   }
 
+  void add_to_erase_queue(void *data, uint64_t hash,
+                          collector_type *collector) {
+    InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
+
+#ifdef LATENCY_COLLECTION
+    const auto timer = collector->start();
+#endif
+
+    // located and prefetched by __for_each_located
+    size_t idx = hash & (this->capacity - 1);
+
+    this->erase_queue[this->erase_head].idx = idx;
+    this->erase_queue[this->erase_head].key = key_data->key;
+    this->erase_queue[this->erase_head].key_id = key_data->id;
+
+#ifdef LATENCY_COLLECTION
+    this->erase_queue[this->erase_head].timer_id = timer;
+#endif
+
+    this->erase_head++;
+    if (this->erase_head >= PREFETCH_QUEUE_SIZE) this->erase_head = 0;
+  }
+
   void simple_add_to_find_queue(void *data, collector_type *collector) {
     InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
 
     uint64_t hash = this->hash((const char *)&key_data->key);
+    if (this->migrating_) [[unlikely]] {
+      this->__migrate_chain(hash);
+    }
 
     size_t idx = hash & (this->capacity - 1);  // modulo
 
@@ -694,33 +1625,33 @@ class CASHashTable : public BaseHashTable {
     this->find_queue[this->find_head].idx = idx;
     this->find_queue[this->find_head].key = key_data->key;
     this->find_queue[this->find_head].key_id = key_data->id;
+    this->find_queue[this->find_head].part_id = 0;
+    this->find_queue[this->find_head].probe_len = 0;
 
     // this->find_head++;
 
     if (++this->find_head >= config.batch_len) this->find_head = 0;
   }
 
-  void add_to_find_queue(void *data, collector_type *collector) {
+  void add_to_find_queue(void *data, uint64_t hash,
+                         collector_type *collector) {
     InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
 
 #ifdef LATENCY_COLLECTION
     const auto timer = collector->start();
 #endif
 
-    uint64_t hash = this->hash((const char *)&key_data->key);
-    // Since we use fastrange for partitioned HT, use it
-    // for this HT too for a fair comparison
-    // size_t idx = fastrange32(hash, this->capacity);  // modulo
+    // located and prefetched by __for_each_located
     size_t idx = hash & (this->capacity - 1);
 
-    prefetch_read(idx);
-
     // cout << " -- Adding " << key_data->key  << " at " << this->find_head <<
     // endl;
 
     this->find_queue[this->find_head].idx = idx;
     this->find_queue[this->find_head].key = key_data->key;
     this->find_queue[this->find_head].key_id = key_data->id;
+    this->find_queue[this->find_head].part_id = 0;
+    this->find_queue[this->find_head].probe_len = 0;
 
 #ifdef LATENCY_COLLECTION
     this->find_queue[this->find_head].timer_id = timer;
@@ -736,19 +1667,50 @@ class CASHashTable : public BaseHashTable {
 };
 
 /// Static variables
-template <class KV, class KVQ>
-KV *CASHashTable<KV, KVQ>::hashtable = nullptr;
+template <class KV, class KVQ, class H>
+std::atomic<typename CASHashTable<KV, KVQ, H>::Generation *>
+    CASHashTable<KV, KVQ, H>::gen_{nullptr};
+
+template <class KV, class KVQ, class H>
+std::atomic<uint64_t> CASHashTable<KV, KVQ, H>::cur_epoch_{0};
+
+template <class KV, class KVQ, class H>
+std::vector<typename CASHashTable<KV, KVQ, H>::Generation *>
+    CASHashTable<KV, KVQ, H>::retired_;
+
+template <class KV, class KVQ, class H>
+std::atomic<uint64_t> CASHashTable<KV, KVQ, H>::fill_{0};
+
+template <class KV, class KVQ, class H>
+std::atomic<uint64_t> CASHashTable<KV, KVQ, H>::grow_at_{0};
+
+template <class KV, class KVQ, class H>
+std::atomic<bool> CASHashTable<KV, KVQ, H>::resize_due_{false};
+
+template <class KV, class KVQ, class H>
+std::mutex CASHashTable<KV, KVQ, H>::resize_mutex_;
+
+template <class KV, class KVQ, class H>
+std::array<typename CASHashTable<KV, KVQ, H>::EpochSlot,
+           CASHashTable<KV, KVQ, H>::MAX_EPOCH_SLOTS>
+    CASHashTable<KV, KVQ, H>::epoch_slots_;
+
+template <class KV, class KVQ, class H>
+uint64_t CASHashTable<KV, KVQ, H>::empty_slot_ = 0;
+
+template <class KV, class KVQ, class H>
+bool CASHashTable<KV, KVQ, H>::empty_slot_exists_ = false;
 
-template <class KV, class KVQ>
-uint64_t CASHashTable<KV, KVQ>::empty_slot_ = 0;
+template <class KV, class KVQ, class H>
+uint64_t CASHashTable<KV, KVQ, H>::tombstone_slot_ = 0;
 
-template <class KV, class KVQ>
-bool CASHashTable<KV, KVQ>::empty_slot_exists_ = false;
+template <class KV, class KVQ, class H>
+bool CASHashTable<KV, KVQ, H>::tombstone_slot_exists_ = false;
 
-template <class KV, class KVQ>
-std::mutex CASHashTable<KV, KVQ>::ht_init_mutex;
+template <class KV, class KVQ, class H>
+std::mutex CASHashTable<KV, KVQ, H>::ht_init_mutex;
 
-template <class KV, class KVQ>
-uint32_t CASHashTable<KV, KVQ>::ref_cnt = 0;
+template <class KV, class KVQ, class H>
+uint32_t CASHashTable<KV, KVQ, H>::ref_cnt = 0;
 }  // namespace kmercounter
 #endif  // HASHTABLES_CAS_KHT_HPP
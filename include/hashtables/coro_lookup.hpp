@@ -0,0 +1,135 @@
+/// Interleaved lookups on C++20 coroutines, an alternative to the find
+/// queues (--coro-lookups N).
+/// Instead of parking the state of a lookup in a KVQ entry and re-entering
+/// __find_one when its cacheline has arrived, every lookup is the body of a
+/// coroutine that prefetches the line it needs next and suspends, in the
+/// manner of group prefetching/AMAC. N worker coroutines per thread take the
+/// lookups of a batch in turn and are resumed round-robin, so up to N misses
+/// are in flight, and a lookup that runs over several cachelines simply
+/// suspends once per line. All the lookups of a batch complete before the
+/// batch call returns.
+
+#ifndef HASHTABLES_CORO_LOOKUP_HPP
+#define HASHTABLES_CORO_LOOKUP_HPP
+
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <utility>
+#include <vector>
+
+namespace kmercounter {
+
+constexpr uint32_t MAX_CORO_LOOKUPS = 64;
+
+/// Coroutine frames are recycled through per-thread free lists, by size in
+/// cachelines, so a batch does not go through malloc.
+class CoroFrameCache {
+ public:
+  static void *alloc(size_t size) {
+    const size_t lines = (size + 63) / 64;
+    if (lines < SIZE_CLASSES) {
+      auto &list = free_lists()[lines];
+      if (!list.empty()) {
+        void *frame = list.back();
+        list.pop_back();
+        return frame;
+      }
+    }
+    return std::aligned_alloc(64, lines * 64);
+  }
+
+  static void free(void *frame, size_t size) {
+    const size_t lines = (size + 63) / 64;
+    if (lines < SIZE_CLASSES) {
+      free_lists()[lines].push_back(frame);
+    } else {
+      std::free(frame);
+    }
+  }
+
+ private:
+  static constexpr size_t SIZE_CLASSES = 64;
+
+  struct FreeLists {
+    std::vector<void *> lists[SIZE_CLASSES];
+    ~FreeLists() {
+      for (auto &list : lists) {
+        for (void *frame : list) std::free(frame);
+      }
+    }
+  };
+
+  static std::vector<void *> *free_lists() {
+    thread_local FreeLists cache;
+    return cache.lists;
+  }
+};
+
+/// A coroutine that starts suspended and is driven by run_interleaved()
+class CoroTask {
+ public:
+  struct promise_type {
+    CoroTask get_return_object() {
+      return CoroTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+
+    static void *operator new(size_t size) {
+      return CoroFrameCache::alloc(size);
+    }
+    static void operator delete(void *frame, size_t size) {
+      CoroFrameCache::free(frame, size);
+    }
+  };
+
+  CoroTask() = default;
+  explicit CoroTask(std::coroutine_handle<promise_type> h) : handle_(h) {}
+  CoroTask(CoroTask &&other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)) {}
+  CoroTask &operator=(CoroTask &&other) noexcept {
+    std::swap(this->handle_, other.handle_);
+    return *this;
+  }
+  CoroTask(const CoroTask &) = delete;
+  CoroTask &operator=(const CoroTask &) = delete;
+  ~CoroTask() {
+    if (this->handle_) this->handle_.destroy();
+  }
+
+  bool done() const { return this->handle_.done(); }
+  void resume() { this->handle_.resume(); }
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+/// Suspend after prefetching the line the lookup touches next
+using PrefetchSuspend = std::suspend_always;
+
+/// Run `n` workers made by `make_worker()` round-robin until all returned.
+template <typename F>
+void run_interleaved(uint32_t n, F &&make_worker) {
+  CoroTask workers[MAX_CORO_LOOKUPS];
+  n = std::clamp(n, 1u, MAX_CORO_LOOKUPS);
+  for (auto i = 0u; i < n; i++) {
+    workers[i] = make_worker();
+  }
+
+  for (uint32_t live = n; live;) {
+    for (auto i = 0u; i < n; i++) {
+      if (workers[i].done()) continue;
+      workers[i].resume();
+      live -= workers[i].done();
+    }
+  }
+}
+
+}  // namespace kmercounter
+
+#endif  // HASHTABLES_CORO_LOOKUP_HPP
@@ -0,0 +1,774 @@
+/// Bucketized cuckoo hashtable.
+/// Every key has two candidate buckets of one cacheline each, so that a
+/// lookup touches at most two cachelines whatever the load, and the table
+/// can be filled to 90-95% of its slots. Both buckets of a key are
+/// prefetched when it is queued.
+/// Like the CAS hashtable, there is at max one instance of the table and all
+/// threads share it. Writers lock the buckets they modify (the locks are
+/// striped), readers are optimistic and retry when one of their buckets
+/// changed under them. An insert into two full buckets searches for a short
+/// path of displacements (a cuckoo path) breadth-first and moves the keys
+/// along it, starting from its free end.
+
+#ifndef HASHTABLES_CUCKOO_KHT_HPP
+#define HASHTABLES_CUCKOO_KHT_HPP
+
+#include <immintrin.h>
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+#include "constants.hpp"
+#include "hasher.hpp"
+#include "helper.hpp"
+#include "ht_helper.hpp"
+#include "ht_scan.hpp"
+#include "ht_snapshot.hpp"
+#include "plog/Log.h"
+#include "sync.h"
+
+namespace kmercounter {
+template <typename KV, typename KVQ, typename H = Hasher>
+class CuckooHashTable : public BaseHashTable {
+  static_assert(!KeyByReference<KV>, "Keys are compared by value");
+  static_assert(CACHE_LINE_SIZE % sizeof(KV) == 0,
+                "A bucket is a cacheline of slots");
+
+ public:
+  static constexpr uint32_t SLOTS_PER_BUCKET = CACHE_LINE_SIZE / sizeof(KV);
+  /// Buckets share their lock with the ones NUM_LOCKS apart.
+  static constexpr uint32_t NUM_LOCKS = 1 << 16;
+  /// Buckets visited when looking for a cuckoo path, which bounds its
+  /// length to about log(MAX_BFS_NODES) / log(SLOTS_PER_BUCKET).
+  static constexpr uint32_t MAX_BFS_NODES = 512;
+  /// Cuckoo paths can be broken by other threads before they are used up.
+  static constexpr uint32_t MAX_INSERT_ATTEMPTS = 64;
+
+  /// The global instance is shared by all threads.
+  static KV *hashtable;
+  /// A dedicated slot for the empty value.
+  static uint64_t empty_slot_;
+  /// True if the empty value is inserted.
+  static bool empty_slot_exists_;
+  /// File descriptor backs the memory
+  static int fd;
+  int id;
+  size_t data_length, key_length;
+
+  CuckooHashTable(uint64_t c)
+      : id(1),
+        find_head(0),
+        find_tail(0),
+        ins_head(0),
+        ins_tail(0),
+        erase_head(0),
+        erase_tail(0) {
+    {
+      const std::lock_guard<std::mutex> lock(ht_init_mutex);
+      if (!this->hashtable) {
+        assert(this->ref_cnt == 0);
+        if (!config.ht_snapshot_in.empty()) {
+          this->__map_snapshot();
+        } else {
+          capacity = std::max<uint64_t>(kmercounter::utils::next_pow2(c),
+                                        2 * SLOTS_PER_BUCKET);
+          this->hashtable = calloc_ht<KV>(capacity, this->id, &this->fd);
+        }
+        num_buckets = capacity / SLOTS_PER_BUCKET;
+        bucket_bits = __builtin_ctzll(num_buckets);
+        locks = new std::atomic<uint32_t>[NUM_LOCKS]();
+      }
+      this->ref_cnt++;
+    }
+    this->empty_item = this->empty_item.get_empty_key();
+    this->key_length = empty_item.key_length();
+    this->data_length = empty_item.data_length();
+
+    this->insert_queue =
+        (KVQ *)(aligned_alloc(64, PREFETCH_QUEUE_SIZE * sizeof(KVQ)));
+    this->find_queue =
+        (KVQ *)(aligned_alloc(64, PREFETCH_FIND_QUEUE_SIZE * sizeof(KVQ)));
+    this->erase_queue =
+        (KVQ *)(aligned_alloc(64, PREFETCH_QUEUE_SIZE * sizeof(KVQ)));
+
+    PLOGV.printf("[INFO] Hashtable size: %lu, %lu buckets of %u", capacity,
+                 num_buckets, SLOTS_PER_BUCKET);
+    PLOGV.printf("%s, data_length %lu\n", __func__, this->data_length);
+  }
+
+  ~CuckooHashTable() {
+    free(find_queue);
+    free(insert_queue);
+    free(erase_queue);
+    if (this->stats.num_failed_inserts) {
+      PLOG_ERROR.printf("Dropped %lu inserts, the cuckoo hashtable is full",
+                        this->stats.num_failed_inserts);
+    }
+    // Deallocate the global hashtable if ref_cnt goes down to zero.
+    {
+      const std::lock_guard<std::mutex> lock(ht_init_mutex);
+      this->ref_cnt--;
+      if (this->ref_cnt == 0) {
+        free_mem<KV>(this->hashtable, capacity, this->id, this->fd);
+        this->hashtable = nullptr;
+        delete[] locks;
+        locks = nullptr;
+        empty_slot_ = 0;
+        empty_slot_exists_ = false;
+      }
+    }
+  }
+
+  void prefetch_queue(QueueType qtype) override {}
+
+  void insert_noprefetch(const void *data, collector_type *collector) override {
+#ifdef LATENCY_COLLECTION
+    const auto timer_start = collector->sync_start();
+#endif
+    const KVQ *elem = reinterpret_cast<const KVQ *>(data);
+
+    KVQ q{};
+    q.key = elem->key;
+    q.value = elem->value;
+    const auto [b1, b2] = this->__buckets(this->hash(&q.key));
+    q.idx = b1;
+    q.part_id = b2;
+    this->__insert_one(&q);
+
+#ifdef LATENCY_COLLECTION
+    collector->sync_end(timer_start);
+#endif
+    this->fold_stats();
+  }
+
+  /// Insert an InsertFindArgument right away, false if the table is full.
+  bool insert(const void *data) override {
+    const InsertFindArgument *item =
+        reinterpret_cast<const InsertFindArgument *>(data);
+
+    KVQ q{};
+    q.key = item->key;
+    q.value = item->value;
+    const auto [b1, b2] = this->__buckets(this->hash(&q.key));
+    q.idx = b1;
+    q.part_id = b2;
+    const bool inserted = this->__insert_one(&q);
+
+    this->fold_stats();
+    return inserted;
+  }
+
+  // insert a batch
+  void insert_batch(const InsertFindArguments &kp,
+                    collector_type *collector) override {
+    this->flush_if_needed(collector);
+
+    this->__for_each_hashed(kp, [&](auto &data, uint64_t hash) {
+      add_to_insert_queue(&data, hash, collector);
+    });
+
+    this->flush_if_needed(collector);
+    this->insert_depth.account(kp.size());
+    this->fold_stats();
+  }
+
+  void flush_if_needed(collector_type *collector) {
+    size_t curr_queue_sz =
+        (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz >= this->insert_depth.get()) {
+      __insert_one(&this->insert_queue[this->ins_tail], collector);
+      if (++this->ins_tail >= PREFETCH_QUEUE_SIZE) this->ins_tail = 0;
+      curr_queue_sz =
+          (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+  }
+
+  void flush_insert_queue(collector_type *collector) override {
+    size_t curr_queue_sz =
+        (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz != 0) {
+      __insert_one(&this->insert_queue[this->ins_tail], collector);
+      if (++this->ins_tail >= PREFETCH_QUEUE_SIZE) this->ins_tail = 0;
+      curr_queue_sz =
+          (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+    this->fold_stats();
+  }
+
+  void flush_find_queue(ValuePairs &vp, collector_type *collector) override {
+    size_t curr_queue_sz =
+        (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
+
+    while ((curr_queue_sz != 0) && (vp.first < config.batch_len)) {
+      __find_one(&this->find_queue[this->find_tail], vp, collector);
+      if (++this->find_tail >= PREFETCH_FIND_QUEUE_SIZE) this->find_tail = 0;
+      curr_queue_sz =
+          (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
+    }
+    this->fold_stats();
+  }
+
+  void flush_if_needed(ValuePairs &vp, collector_type *collector) {
+    size_t curr_queue_sz =
+        (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
+
+    while ((curr_queue_sz > this->find_depth.get()) && (vp.first < config.batch_len)) {
+      __find_one(&this->find_queue[this->find_tail], vp, collector);
+      if (++this->find_tail >= PREFETCH_FIND_QUEUE_SIZE) this->find_tail = 0;
+      curr_queue_sz =
+          (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
+    }
+  }
+
+  void find_batch(const InsertFindArguments &kp, ValuePairs &values,
+                  collector_type *collector) override {
+    this->flush_if_needed(values, collector);
+
+    this->__for_each_hashed(kp, [&](auto &data, uint64_t hash) {
+      add_to_find_queue(&data, hash, collector);
+    });
+
+    this->flush_if_needed(values, collector);
+    this->find_depth.account(kp.size());
+    this->fold_stats();
+  }
+
+  /// A key never leaves its two buckets, so erased slots are simply emptied.
+  void erase_batch(const InsertFindArguments &kp,
+                   collector_type *collector) override {
+    this->flush_erase_if_needed(collector);
+
+    this->__for_each_hashed(kp, [&](auto &data, uint64_t hash) {
+      add_to_erase_queue(&data, hash, collector);
+    });
+
+    this->flush_erase_if_needed(collector);
+    this->erase_depth.account(kp.size());
+    this->fold_stats();
+  }
+
+  void flush_erase_if_needed(collector_type *collector) {
+    size_t curr_queue_sz =
+        (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz >= this->erase_depth.get()) {
+      __erase_one(&this->erase_queue[this->erase_tail], collector);
+      if (++this->erase_tail >= PREFETCH_QUEUE_SIZE) this->erase_tail = 0;
+      curr_queue_sz =
+          (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+  }
+
+  void flush_erase_queue(collector_type *collector) override {
+    size_t curr_queue_sz =
+        (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz != 0) {
+      __erase_one(&this->erase_queue[this->erase_tail], collector);
+      if (++this->erase_tail >= PREFETCH_QUEUE_SIZE) this->erase_tail = 0;
+      curr_queue_sz =
+          (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+    this->fold_stats();
+  }
+
+  void *find_noprefetch(const void *data, collector_type *collector) override {
+#ifdef LATENCY_COLLECTION
+    const auto timer_start = collector->sync_start();
+#endif
+    const InsertFindArgument *item =
+        reinterpret_cast<const InsertFindArgument *>(data);
+
+    const auto [b1, b2] = this->__buckets(this->hash(&item->key));
+    KV *curr = this->__lookup(item->key, b1, b2);
+
+#ifdef LATENCY_COLLECTION
+    collector->sync_end(timer_start);
+#endif
+    this->fold_stats();
+    return curr;
+  }
+
+  void display() const override {
+    scan_print(__scanner(), scan_threads(), std::cout);
+  }
+
+  size_t get_fill() const override {
+    return scan_fill(__scanner(), scan_threads());
+  }
+
+  size_t get_capacity() const override { return capacity; }
+
+  bool is_shared() const override { return true; }
+
+  size_t get_max_count() const override {
+    return scan_max_count(__scanner(), scan_threads());
+  }
+
+  void scan(unsigned num_threads, const ScanCallback &cb) const override {
+    __scanner()(num_threads, [&cb](unsigned tid, KV &kv) {
+      cb(tid, KeyValuePair(kv.get_key(), kv.get_value()));
+    });
+  }
+
+  bool save_snapshot(const std::string &path) const override {
+    auto hdr = make_snapshot_header<KV, H>(CUCKOO_HT, capacity);
+    hdr.fill = this->get_fill();
+    hdr.empty_slot = empty_slot_;
+    hdr.empty_slot_exists = empty_slot_exists_;
+    return write_snapshot(path, hdr, this->hashtable);
+  }
+
+  bool save_profile(const std::string &path) override {
+    PLOG_FATAL << "Not implemented";
+    assert(false);
+    return false;
+  }
+
+  void print_to_file(std::string &outfile) const override {
+    std::ofstream f(outfile);
+    if (!f) {
+      PLOG_ERROR.printf("Could not open outfile %s", outfile.c_str());
+      return;
+    }
+    scan_print(__scanner(), max_scan_threads(), f);
+  }
+
+  uint64_t read_hashtable_element(const void *data) override {
+    PLOG_FATAL << "Not implemented";
+    assert(false);
+    return -1;
+  }
+
+ private:
+  /// A node of the search for a cuckoo path: `key` sits in slot `slot` of
+  /// the parent's bucket and can move to `bucket`.
+  struct BfsNode {
+    uint32_t bucket;
+    int32_t parent;
+    uint32_t slot;
+    key_type key;
+  };
+
+  /// Assure thread-safety in constructor and destructor.
+  static std::mutex ht_init_mutex;
+  /// Reference counter of the global `hashtable`.
+  static uint32_t ref_cnt;
+  static uint64_t capacity;
+  static uint64_t num_buckets;
+  static uint32_t bucket_bits;
+  /// Versioned bucket locks: odd while a writer holds the lock.
+  static std::atomic<uint32_t> *locks;
+
+  KV empty_item;
+  KVQ *find_queue;
+  KVQ *insert_queue;
+  KVQ *erase_queue;
+  uint32_t find_head;
+  uint32_t find_tail;
+  uint32_t ins_head;
+  uint32_t ins_tail;
+  uint32_t erase_head;
+  uint32_t erase_tail;
+  std::array<BfsNode, MAX_BFS_NODES> bfs_;
+  H hasher_;
+
+  uint64_t hash(const void *k) { return hasher_(k, this->key_length); }
+
+  /// The second bucket comes from a multiplicative remix of the hash, so
+  /// that it is spread over the table even by hashers that leave the upper
+  /// bits empty.
+  std::pair<uint32_t, uint32_t> __buckets(uint64_t hash) const {
+    const uint32_t b1 = hash & (num_buckets - 1);
+    const uint32_t b2 = (hash * 0x9E3779B97F4A7C15ULL) >> (64 - bucket_bits);
+    return {b1, b2 == b1 ? b1 ^ 1 : b2};
+  }
+
+  uint32_t __alt_bucket(key_type key, uint32_t b) {
+    const auto [b1, b2] = this->__buckets(this->hash(&key));
+    return b == b1 ? b2 : b1;
+  }
+
+  KV *__bucket(uint32_t b) const {
+    return &this->hashtable[(uint64_t)b * SLOTS_PER_BUCKET];
+  }
+
+  template <bool WRITE>
+  void __prefetch_buckets(uint32_t b1, uint32_t b2) {
+    prefetch_object<WRITE>(__bucket(b1), CACHE_LINE_SIZE);
+    prefetch_object<WRITE>(__bucket(b2), CACHE_LINE_SIZE);
+  }
+
+  std::atomic<uint32_t> &__lock_of(uint32_t b) const {
+    return locks[b & (NUM_LOCKS - 1)];
+  }
+
+  void __lock_one(uint32_t b) {
+    auto &l = __lock_of(b);
+    for (;;) {
+      uint32_t v = l.load(std::memory_order_relaxed);
+      if (!(v & 1) && l.compare_exchange_weak(v, v + 1,
+                                              std::memory_order_acquire)) {
+        return;
+      }
+      _mm_pause();
+    }
+  }
+
+  void __unlock_one(uint32_t b) {
+    __lock_of(b).fetch_add(1, std::memory_order_release);
+  }
+
+  /// Lock two buckets in the order of their locks, so that writers cannot
+  /// deadlock.
+  void __lock(uint32_t b1, uint32_t b2) {
+    uint32_t l1 = b1 & (NUM_LOCKS - 1), l2 = b2 & (NUM_LOCKS - 1);
+    if (l1 > l2) std::swap(l1, l2);
+    __lock_one(l1);
+    if (l2 != l1) __lock_one(l2);
+  }
+
+  void __unlock(uint32_t b1, uint32_t b2) {
+    const uint32_t l1 = b1 & (NUM_LOCKS - 1), l2 = b2 & (NUM_LOCKS - 1);
+    __unlock_one(l1);
+    if (l2 != l1) __unlock_one(l2);
+  }
+
+  uint32_t __read_begin(uint32_t b) const {
+    uint32_t v;
+    while ((v = __lock_of(b).load(std::memory_order_acquire)) & 1) {
+      _mm_pause();
+    }
+    return v;
+  }
+
+  bool __read_end(uint32_t b, uint32_t v) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return __lock_of(b).load(std::memory_order_relaxed) == v;
+  }
+
+  KV *__lookup(key_type key, uint32_t b1, uint32_t b2) const {
+    for (const auto b : {b1, b2}) {
+      KV *bucket = __bucket(b);
+      for (uint32_t s = 0; s < SLOTS_PER_BUCKET; s++) {
+        if (!bucket[s].is_empty() && bucket[s].get_key() == key) {
+          return &bucket[s];
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  KV *__free_slot(uint32_t b) const {
+    KV *bucket = __bucket(b);
+    for (uint32_t s = 0; s < SLOTS_PER_BUCKET; s++) {
+      if (bucket[s].is_empty()) {
+        return &bucket[s];
+      }
+    }
+    return nullptr;
+  }
+
+  /// Search for a bucket with a free slot that can be reached from b1 or b2
+  /// by moving keys to their other bucket, then move them so that b1 or b2
+  /// has a free slot. False if there is no short enough path or another
+  /// thread changed one of its buckets.
+  bool __make_room(uint32_t b1, uint32_t b2) {
+    uint32_t head = 0, tail = 0;
+    bfs_[tail++] = {b1, -1, 0, 0};
+    bfs_[tail++] = {b2, -1, 0, 0};
+
+    while (head < tail) {
+      const uint32_t n = head++;
+      const uint32_t b = bfs_[n].bucket;
+      if (this->__free_slot(b)) {
+        return this->__move_along(n);
+      }
+      KV *bucket = __bucket(b);
+      for (uint32_t s = 0; s < SLOTS_PER_BUCKET && tail < MAX_BFS_NODES; s++) {
+        const key_type key = bucket[s].get_key();
+        bfs_[tail++] = {this->__alt_bucket(key, b), (int32_t)n, s, key};
+      }
+    }
+    return false;
+  }
+
+  /// Move the keys of the path ending at node `n`, starting from its end,
+  /// where there is a free slot.
+  bool __move_along(uint32_t n) {
+    for (; bfs_[n].parent >= 0; n = bfs_[n].parent) {
+      const BfsNode &node = bfs_[n];
+      const uint32_t from = bfs_[node.parent].bucket;
+
+      this->__lock(from, node.bucket);
+      KV *src = &__bucket(from)[node.slot];
+      KV *dst = this->__free_slot(node.bucket);
+      const bool moved = dst && src->get_key() == node.key;
+      if (moved) {
+        *dst = *src;
+        *src = this->empty_item;
+        this->batch_stats.num_swaps++;
+      }
+      this->__unlock(from, node.bucket);
+
+      if (!moved) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  auto __scanner() const {
+    return [this](unsigned num_threads, auto &&f) {
+      scan_table(this->hashtable, capacity, num_threads, f);
+    };
+  }
+
+  /// Map the shared table from its snapshot. The snapshot sets the capacity.
+  void __map_snapshot() {
+    const auto path = snapshot_path(config.ht_snapshot_in, 0);
+    SnapshotHeader hdr;
+    this->hashtable = map_snapshot<KV, H>(path, CUCKOO_HT, &hdr);
+    if (!this->hashtable) {
+      PLOG_FATAL.printf("Couldn't load the hashtable from %s", path.c_str());
+      exit(-1);
+    }
+
+    capacity = hdr.capacity;
+    this->fd = SNAPSHOT_FD;
+    empty_slot_ = hdr.empty_slot;
+    empty_slot_exists_ = hdr.empty_slot_exists;
+  }
+
+  /// Visit the arguments of a batch along with the hashes of their keys,
+  /// which are computed HASH_BATCH_SIZE at a time.
+  template <typename F>
+  void __for_each_hashed(const InsertFindArguments &kp, F &&f) {
+    uint64_t hashes[HASH_BATCH_SIZE];
+    for (size_t i = 0; i < kp.size(); i += HASH_BATCH_SIZE) {
+      const size_t n = std::min<size_t>(HASH_BATCH_SIZE, kp.size() - i);
+      hash_keys(hasher_, &kp[i].key, sizeof(InsertFindArgument), n,
+                this->key_length, hashes);
+      for (size_t j = 0; j < n; j++) f(kp[i + j], hashes[j]);
+    }
+  }
+
+  uint64_t __find_branched(KVQ *q, ValuePairs &vp, collector_type *collector) {
+    const uint32_t b1 = q->idx, b2 = q->part_id;
+    uint32_t v1, v2;
+    uint64_t found, value;
+
+    // Retry if a writer changed either bucket during the lookup
+    do {
+      v1 = this->__read_begin(b1);
+      v2 = this->__read_begin(b2);
+      const KV *curr = this->__lookup(q->key, b1, b2);
+      found = curr != nullptr;
+      value = found ? curr->get_value() : 0;
+    } while (!this->__read_end(b1, v1) || !this->__read_end(b2, v2));
+
+    if (found) {
+      vp.second[vp.first].id = q->key_id;
+      vp.second[vp.first].value = value;
+      vp.first++;
+    }
+
+#ifdef LATENCY_COLLECTION
+    collector->end(q->timer_id);
+#endif
+    return found;
+  }
+
+  void __find_one(KVQ *q, ValuePairs &vp, collector_type *collector) {
+    if (q->key == this->empty_item.get_key()) {
+      __find_empty(q, vp);
+    } else {
+      __find_branched(q, vp, collector);
+    }
+  }
+
+  uint64_t __find_empty(KVQ *q, ValuePairs &vp) {
+    if (empty_slot_exists_) {
+      vp.second[vp.first].id = q->key_id;
+      vp.second[vp.first].value = empty_slot_;
+      vp.first++;
+    }
+    return empty_slot_;
+  }
+
+  /// False if no cuckoo path made room for the key, which is then dropped
+  /// and counted in the stats.
+  bool __insert_branched(KVQ *q) {
+    const uint32_t b1 = q->idx, b2 = q->part_id;
+
+    for (uint32_t i = 0; i < MAX_INSERT_ATTEMPTS; i++) {
+      this->__lock(b1, b2);
+      KV *curr = this->__lookup(q->key, b1, b2);
+      if (!curr && (curr = this->__free_slot(b1)) == nullptr) {
+        curr = this->__free_slot(b2);
+      }
+      if (curr) {
+        curr->insert(q);
+      }
+      this->__unlock(b1, b2);
+
+      if (curr) {
+        return true;
+      }
+
+      // Both buckets are full
+      this->batch_stats.num_reprobes++;
+      this->__make_room(b1, b2);
+    }
+    this->stats.num_failed_inserts++;
+    return false;
+  }
+
+  bool __insert_one(KVQ *q, collector_type *collector = nullptr) {
+    bool inserted = true;
+    if (q->key == this->empty_item.get_key()) {
+      __insert_empty(q);
+    } else {
+      inserted = __insert_branched(q);
+    }
+
+#ifdef LATENCY_COLLECTION
+    if (collector) collector->end(q->timer_id);
+#endif
+    return inserted;
+  }
+
+  /// Update or increment the empty key.
+  void __insert_empty(KVQ *q) {
+    if constexpr (std::is_same_v<KV, Item>) {
+      empty_slot_ = q->value;
+    } else if constexpr (std::is_same_v<KV, Aggr_KV>) {
+      empty_slot_ += q->value;
+    } else if constexpr (Upserting<KV>) {
+      KV::insert_empty(empty_slot_, empty_slot_exists_, q->value);
+    } else {
+      assert(false && "Invalid template type");
+    }
+    empty_slot_exists_ = true;
+  }
+
+  void __erase_one(KVQ *q, collector_type *collector) {
+    if (q->key == this->empty_item.get_key()) {
+      empty_slot_exists_ = false;
+      empty_slot_ = 0;
+    } else {
+      this->__lock(q->idx, q->part_id);
+      KV *curr = this->__lookup(q->key, q->idx, q->part_id);
+      if (curr) {
+        *curr = this->empty_item;
+      }
+      this->__unlock(q->idx, q->part_id);
+    }
+
+#ifdef LATENCY_COLLECTION
+    collector->end(q->timer_id);
+#endif
+  }
+
+  void __fill_queue_entry(KVQ &entry, const InsertFindArgument *key_data,
+                          uint64_t hash) {
+    const auto [b1, b2] = this->__buckets(hash);
+    entry.idx = b1;
+    entry.part_id = b2;
+    entry.key = key_data->key;
+    entry.value = key_data->value;
+    entry.key_id = key_data->id;
+  }
+
+  void add_to_insert_queue(void *data, uint64_t hash,
+                           collector_type *collector) {
+    InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
+    KVQ &entry = this->insert_queue[this->ins_head];
+
+#ifdef LATENCY_COLLECTION
+    entry.timer_id = collector->start();
+#endif
+
+    this->__fill_queue_entry(entry, key_data, hash);
+#if defined(PREFETCH_WITH_PREFETCH_INSTR)
+    this->__prefetch_buckets<true /* write */>(entry.idx, entry.part_id);
+#endif
+
+    this->ins_head++;
+    if (this->ins_head >= PREFETCH_QUEUE_SIZE) this->ins_head = 0;
+  }
+
+  void add_to_erase_queue(void *data, uint64_t hash,
+                          collector_type *collector) {
+    InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
+    KVQ &entry = this->erase_queue[this->erase_head];
+
+#ifdef LATENCY_COLLECTION
+    entry.timer_id = collector->start();
+#endif
+
+    this->__fill_queue_entry(entry, key_data, hash);
+    // the slot gets written if the key is found
+    this->__prefetch_buckets<true /* write */>(entry.idx, entry.part_id);
+
+    this->erase_head++;
+    if (this->erase_head >= PREFETCH_QUEUE_SIZE) this->erase_head = 0;
+  }
+
+  void add_to_find_queue(void *data, uint64_t hash,
+                         collector_type *collector) {
+    InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
+    KVQ &entry = this->find_queue[this->find_head];
+
+#ifdef LATENCY_COLLECTION
+    entry.timer_id = collector->start();
+#endif
+
+    this->__fill_queue_entry(entry, key_data, hash);
+    this->__prefetch_buckets<false /* write */>(entry.idx, entry.part_id);
+
+    this->find_head++;
+    if (this->find_head >= PREFETCH_FIND_QUEUE_SIZE) this->find_head = 0;
+  }
+};
+
+/// Static variables
+template <class KV, class KVQ, class H>
+KV *CuckooHashTable<KV, KVQ, H>::hashtable = nullptr;
+
+template <class KV, class KVQ, class H>
+uint64_t CuckooHashTable<KV, KVQ, H>::empty_slot_ = 0;
+
+template <class KV, class KVQ, class H>
+bool CuckooHashTable<KV, KVQ, H>::empty_slot_exists_ = false;
+
+template <class KV, class KVQ, class H>
+int CuckooHashTable<KV, KVQ, H>::fd = -1;
+
+template <class KV, class KVQ, class H>
+std::mutex CuckooHashTable<KV, KVQ, H>::ht_init_mutex;
+
+template <class KV, class KVQ, class H>
+uint32_t CuckooHashTable<KV, KVQ, H>::ref_cnt = 0;
+
+template <class KV, class KVQ, class H>
+uint64_t CuckooHashTable<KV, KVQ, H>::capacity = 0;
+
+template <class KV, class KVQ, class H>
+uint64_t CuckooHashTable<KV, KVQ, H>::num_buckets = 0;
+
+template <class KV, class KVQ, class H>
+uint32_t CuckooHashTable<KV, KVQ, H>::bucket_bits = 0;
+
+template <class KV, class KVQ, class H>
+std::atomic<uint32_t> *CuckooHashTable<KV, KVQ, H>::locks = nullptr;
+}  // namespace kmercounter
+#endif  // HASHTABLES_CUCKOO_KHT_HPP
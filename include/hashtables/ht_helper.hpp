@@ -29,6 +29,12 @@ constexpr auto MAP_FLAGS =
     MAP_HUGETLB | MAP_HUGE_1GB | MAP_PRIVATE | MAP_ANONYMOUS;
 constexpr auto ONEGB_PAGE_SZ = 1ULL * 1024 * 1024 * 1024;
 
+/// Tables mapped from a snapshot (see ht_snapshot.hpp) carry this fd, so that
+/// free_mem unmaps them instead of freeing them.
+constexpr int SNAPSHOT_FD = -2;
+/// The header of a snapshot takes up the first page of the file.
+constexpr uint64_t SNAPSHOT_DATA_OFFSET = PAGE_SIZE;
+
 constexpr uint64_t CACHE_BLOCK_BITS = 6;
 constexpr uint64_t CACHE_BLOCK_MASK = (1ULL << CACHE_BLOCK_BITS) - 1;
 
@@ -139,7 +145,9 @@ T *calloc_ht(uint64_t capacity, uint16_t id, int *out_fd) {
     }
     *out_fd = fd;
   }
-  if (config.ht_type == CASHTPP && (config.numa_split != 2)) {
+  if ((config.ht_type == CASHTPP || config.ht_type == CUCKOO_HT ||
+       config.ht_type == SWISS_HT) &&
+      (config.numa_split != 2)) {
     distribute_mem_to_nodes(addr, alloc_sz);
   }
 skip_mbind:
@@ -151,7 +159,10 @@ template <class T>
 void free_mem(T *addr, uint64_t capacity, int id, int fd) {
   auto alloc_sz = capacity * sizeof(T);
 
-  if (alloc_sz < ONEGB_PAGE_SZ) {
+  if (fd == SNAPSHOT_FD) {
+    munmap(reinterpret_cast<char *>(addr) - SNAPSHOT_DATA_OFFSET,
+           SNAPSHOT_DATA_OFFSET + alloc_sz);
+  } else if (alloc_sz < ONEGB_PAGE_SZ) {
     free(addr);
   } else {
     char mmap_path[256] = {0};
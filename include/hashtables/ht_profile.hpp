@@ -0,0 +1,178 @@
+/// Clustering profile of a linear probing hashtable.
+/// One walk over the slots collects how far every entry sits from its home
+/// slot, the lengths of the runs of occupied slots and how many slots of each
+/// cacheline are occupied, in total and per NUMA node backing the slots. It
+/// is meant to be run on a quiescent table, e.g. one mapped from a snapshot.
+
+#ifndef HASHTABLES_HT_PROFILE_HPP
+#define HASHTABLES_HT_PROFILE_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ht_scan.hpp"
+#include "plog/Log.h"
+#include "types.hpp"
+
+namespace kmercounter {
+
+/// Histograms indexed by the exact value: [d] is the number of entries d
+/// slots past their home slot, of runs of d occupied slots and of cachelines
+/// with d occupied slots.
+struct ClusterProfile {
+  uint64_t slots = 0;
+  uint64_t entries = 0;
+  std::vector<uint64_t> probe_distances;
+  std::vector<uint64_t> run_lengths;
+  std::vector<uint64_t> line_occupancy;
+
+  static void bump(std::vector<uint64_t> &hist, uint64_t value) {
+    if (value >= hist.size()) {
+      hist.resize(value + 1);
+    }
+    hist[value]++;
+  }
+
+  static double mean(const std::vector<uint64_t> &hist) {
+    uint64_t count = 0, sum = 0;
+    for (uint64_t v = 0; v < hist.size(); v++) {
+      count += hist[v];
+      sum += v * hist[v];
+    }
+    return count ? (double)sum / count : 0;
+  }
+
+  static uint64_t max(const std::vector<uint64_t> &hist) {
+    return hist.empty() ? 0 : hist.size() - 1;
+  }
+};
+
+struct TableProfile {
+  ClusterProfile total;
+  /// Keyed by node; -1 holds the slots whose pages are not faulted in.
+  std::map<int, ClusterProfile> nodes;
+
+  /// One "<histogram> <node> <value> <count>" line per non-empty bucket.
+  void dump(std::ostream &os) const {
+    os << "# histogram node value count\n";
+    auto dump_one = [&os](const std::string &node, const ClusterProfile &p) {
+      auto dump_hist = [&](const char *name, const std::vector<uint64_t> &h) {
+        for (uint64_t v = 0; v < h.size(); v++) {
+          if (h[v]) {
+            os << name << ' ' << node << ' ' << v << ' ' << h[v] << '\n';
+          }
+        }
+      };
+      dump_hist("probe_distance", p.probe_distances);
+      dump_hist("run_length", p.run_lengths);
+      dump_hist("line_occupancy", p.line_occupancy);
+    };
+    dump_one("all", this->total);
+    for (const auto &[node, p] : this->nodes) {
+      dump_one(node < 0 ? "none" : std::to_string(node), p);
+    }
+  }
+};
+
+/// Profile the `capacity` slots of `ht`; `home(kv)` gives the slot an entry
+/// hashes to. Tombstones take part in runs and cachelines, not in distances.
+template <typename KV, typename Home>
+TableProfile profile_table(KV *ht, uint64_t capacity, Home &&home) {
+  constexpr uint64_t line_slots = CACHE_LINE_SIZE % sizeof(KV) == 0
+                                      ? CACHE_LINE_SIZE / sizeof(KV)
+                                      : 1;
+  const uint64_t chunk_len = std::max(SCAN_CHUNK_BYTES / sizeof(KV), 1UL);
+  const auto nodes = chunk_nodes(ht, capacity, chunk_len);
+
+  TableProfile prof;
+  ClusterProfile *p = nullptr;
+  int node = -1, run_node = -1, head_node = -1;
+  // The run at the start of the table is only complete once the one at the
+  // end, which it continues, is known
+  uint64_t run = 0, head_run = 0, line_fill = 0;
+  bool in_head = true;
+
+  auto end_run = [&](uint64_t len, int n) {
+    ClusterProfile::bump(prof.total.run_lengths, len);
+    ClusterProfile::bump(prof.nodes[n].run_lengths, len);
+  };
+
+  for (uint64_t i = 0; i < capacity; i++) {
+    if (i % chunk_len == 0) {
+      node = nodes[i / chunk_len];
+      p = &prof.nodes[node];
+    }
+
+    KV &kv = ht[i];
+    if (!kv.is_empty()) {
+      if (run++ == 0) run_node = node;
+      line_fill++;
+      prof.total.entries++;
+      p->entries++;
+
+      bool tombstone = false;
+      if constexpr (requires { kv.is_tombstone(); }) {
+        tombstone = kv.is_tombstone();
+      }
+      if (!tombstone) {
+        const uint64_t distance = (i + capacity - home(kv)) % capacity;
+        ClusterProfile::bump(prof.total.probe_distances, distance);
+        ClusterProfile::bump(p->probe_distances, distance);
+      }
+    } else if (run) {
+      if (in_head) {
+        head_run = run;
+        head_node = run_node;
+      } else {
+        end_run(run, run_node);
+      }
+      run = 0;
+      in_head = false;
+    } else {
+      in_head = false;
+    }
+
+    prof.total.slots++;
+    p->slots++;
+    if ((i + 1) % line_slots == 0 || i + 1 == capacity) {
+      ClusterProfile::bump(prof.total.line_occupancy, line_fill);
+      ClusterProfile::bump(p->line_occupancy, line_fill);
+      line_fill = 0;
+    }
+  }
+
+  if (in_head) {
+    // No empty slot at all
+    if (run) end_run(run, run_node);
+  } else if (run + head_run) {
+    end_run(run + head_run, run ? run_node : head_node);
+  }
+  return prof;
+}
+
+inline bool write_profile(const std::string &path, const TableProfile &prof) {
+  std::ofstream f(path);
+  if (!f) {
+    PLOG_ERROR.printf("Could not open profile %s", path.c_str());
+    return false;
+  }
+  prof.dump(f);
+
+  const auto &t = prof.total;
+  PLOG_INFO.printf(
+      "Profile %s: %lu entries in %lu slots | probe distance mean %.2f max "
+      "%lu | run length mean %.2f max %lu | cacheline occupancy mean %.2f",
+      path.c_str(), t.entries, t.slots, ClusterProfile::mean(t.probe_distances),
+      ClusterProfile::max(t.probe_distances),
+      ClusterProfile::mean(t.run_lengths), ClusterProfile::max(t.run_lengths),
+      ClusterProfile::mean(t.line_occupancy));
+  return true;
+}
+
+}  // namespace kmercounter
+
+#endif  // HASHTABLES_HT_PROFILE_HPP
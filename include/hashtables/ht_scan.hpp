@@ -0,0 +1,245 @@
+/// Parallel scans over the slots of a hashtable.
+/// The table is cut into cacheline-aligned chunks that are handed out to the
+/// scan threads. Each thread runs on a NUMA node and takes the chunks backed
+/// by that node first, then helps with the rest.
+
+#ifndef HASHTABLES_HT_SCAN_HPP
+#define HASHTABLES_HT_SCAN_HPP
+
+#include <immintrin.h>
+#include <numa.h>
+#include <numaif.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "constants.hpp"
+#include "numa.hpp"
+#include "types.hpp"
+
+namespace kmercounter {
+
+extern Configuration config;
+
+/// Chunks are a multiple of the (small and huge) page size, so that each one
+/// is backed by a single node.
+constexpr uint64_t SCAN_CHUNK_BYTES = 2ULL << 20;
+
+/// scan_print appends the lines of a thread to the stream once they take up
+/// this many bytes.
+constexpr size_t SCAN_PRINT_FLUSH_BYTES = 1 << 20;
+
+/// Set on the shard threads. The shards may read a shared table while the
+/// others are still timed, so their scans stay on the calling thread unless
+/// they hold a SharedScan.
+inline thread_local bool on_shard_thread = false;
+
+/// Threads for a scan that runs once, from one thread (--scan-threads).
+inline unsigned max_scan_threads() {
+  return config.scan_threads ? config.scan_threads
+                             : std::thread::hardware_concurrency();
+}
+
+/// Threads used by the table accessors (get_fill and friends): one when
+/// called from a shard thread.
+inline unsigned scan_threads() {
+  return on_shard_thread ? 1 : max_scan_threads();
+}
+
+/// Lets the scans of a shard thread use max_scan_threads() while in scope,
+/// for the shard that scans a shared table once on behalf of all the others
+/// (see get_ht_stats).
+class SharedScan {
+ public:
+  SharedScan() : saved_(on_shard_thread) { on_shard_thread = false; }
+  ~SharedScan() { on_shard_thread = saved_; }
+  SharedScan(const SharedScan &) = delete;
+  SharedScan &operator=(const SharedScan &) = delete;
+
+ private:
+  const bool saved_;
+};
+
+/// Call `f(tid, kv)` for every non-empty slot in [begin, end) of `ht`.
+template <typename KV, typename F>
+void scan_range(KV *ht, uint64_t begin, uint64_t end, unsigned tid, F &f) {
+#ifdef AVX_SUPPORT
+  if constexpr (CACHE_LINE_SIZE % sizeof(KV) == 0) {
+    constexpr uint64_t KV_PER_LINE = CACHE_LINE_SIZE / sizeof(KV);
+    uint64_t i = begin;
+    for (; i + KV_PER_LINE <= end; i += KV_PER_LINE) {
+      // Empty slots are zeroed, skip cachelines without any entry
+      const __m512i line = _mm512_loadu_si512(&ht[i]);
+      if (!_mm512_test_epi64_mask(line, line)) {
+        continue;
+      }
+      for (auto j = i; j < i + KV_PER_LINE; j++) {
+        if (!ht[j].is_empty()) {
+          f(tid, ht[j]);
+        }
+      }
+    }
+    begin = i;
+  }
+#endif
+  for (auto i = begin; i < end; i++) {
+    if (!ht[i].is_empty()) {
+      f(tid, ht[i]);
+    }
+  }
+}
+
+/// The node backing each chunk of `chunk_len` slots of `ht`, or -1 where
+/// its page is not faulted in yet.
+template <typename KV>
+std::vector<int> chunk_nodes(KV *ht, uint64_t capacity, uint64_t chunk_len) {
+  const uint64_t num_chunks = (capacity + chunk_len - 1) / chunk_len;
+  std::vector<void *> pages(num_chunks);
+  std::vector<int> status(num_chunks, -1);
+  for (uint64_t c = 0; c < num_chunks; c++) {
+    pages[c] = &ht[c * chunk_len];
+  }
+  // Without target nodes, this only reports where the pages are
+  if (numa_move_pages(0, num_chunks, pages.data(), nullptr, status.data(),
+                      0) < 0) {
+    std::fill(status.begin(), status.end(), -1);
+  }
+  // Unmapped pages report a negative errno
+  for (auto &s : status) {
+    s = std::max(s, -1);
+  }
+  return status;
+}
+
+/// Call `f(tid, kv)` for every non-empty slot of `ht` from `num_threads`
+/// threads; `tid` is in [0, num_threads). The table must not be modified
+/// during the scan.
+template <typename KV, typename F>
+void scan_table(KV *ht, uint64_t capacity, unsigned num_threads, F &&f) {
+  const uint64_t chunk_len = std::max(SCAN_CHUNK_BYTES / sizeof(KV), 1UL);
+  const uint64_t num_chunks = (capacity + chunk_len - 1) / chunk_len;
+  num_threads = std::min<uint64_t>(std::max(num_threads, 1U), num_chunks);
+
+  if (num_threads <= 1) {
+    scan_range(ht, 0, capacity, 0, f);
+    return;
+  }
+
+  static const Numa numa;
+  const auto &nodes = numa.get_node_config();
+  const size_t num_nodes = std::max<size_t>(nodes.size(), 1);
+
+  // Chunks grouped by the node backing them
+  std::vector<std::vector<uint64_t>> node_chunks(num_nodes);
+  if (num_nodes > 1) {
+    const auto status = chunk_nodes(ht, capacity, chunk_len);
+    for (uint64_t c = 0; c < num_chunks; c++) {
+      // Pages that are not faulted in yet go round-robin
+      const size_t node = (status[c] >= 0 && (size_t)status[c] < num_nodes)
+                              ? status[c]
+                              : c % num_nodes;
+      node_chunks[node].push_back(c);
+    }
+  } else {
+    for (uint64_t c = 0; c < num_chunks; c++) {
+      node_chunks[0].push_back(c);
+    }
+  }
+
+  std::vector<std::atomic<uint64_t>> next(num_nodes);
+  std::vector<std::thread> threads;
+
+  for (unsigned t = 0; t < num_threads; t++) {
+    const size_t home = t % num_nodes;
+    threads.emplace_back([&, t, home] {
+      for (size_t k = 0; k < num_nodes; k++) {
+        const size_t node = (home + k) % num_nodes;
+        const auto &chunks = node_chunks[node];
+        for (uint64_t i; (i = next[node].fetch_add(1)) < chunks.size();) {
+          const uint64_t begin = chunks[i] * chunk_len;
+          scan_range(ht, begin, std::min(begin + chunk_len, capacity), t, f);
+        }
+      }
+    });
+
+    if (!nodes.empty() && !nodes[home].cpu_list.empty()) {
+      const auto &cpus = nodes[home].cpu_list;
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      CPU_SET(cpus[(t / num_nodes) % cpus.size()], &cpuset);
+      pthread_setaffinity_np(threads.back().native_handle(), sizeof(cpu_set_t),
+                             &cpuset);
+    }
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+/// The reductions below take a `scan(num_threads, f)` callable that visits
+/// the live entries of a table, e.g. one wrapping scan_table.
+struct alignas(CACHE_LINE_SIZE) ScanCounter {
+  uint64_t value = 0;
+};
+
+template <typename Scan>
+size_t scan_fill(Scan &&scan, unsigned num_threads) {
+  std::vector<ScanCounter> counts(std::max(num_threads, 1U));
+  scan(num_threads, [&counts](unsigned tid, auto &kv) { counts[tid].value++; });
+
+  size_t count = 0;
+  for (const auto &c : counts) count += c.value;
+  return count;
+}
+
+template <typename Scan>
+size_t scan_max_count(Scan &&scan, unsigned num_threads) {
+  std::vector<ScanCounter> counts(std::max(num_threads, 1U));
+  scan(num_threads, [&counts](unsigned tid, auto &kv) {
+    if (kv.get_value() > counts[tid].value) {
+      counts[tid].value = kv.get_value();
+    }
+  });
+
+  size_t count = 0;
+  for (const auto &c : counts) count = std::max(count, c.value);
+  return count;
+}
+
+/// Print one entry per line. Every thread buffers its lines and appends them
+/// to `os` a block at a time, so the order of the lines is not the order of
+/// the slots.
+template <typename Scan>
+void scan_print(Scan &&scan, unsigned num_threads, std::ostream &os) {
+  std::mutex os_mutex;
+  std::vector<std::ostringstream> bufs(std::max(num_threads, 1U));
+
+  auto flush = [&os, &os_mutex](std::ostringstream &buf) {
+    const std::lock_guard<std::mutex> lock(os_mutex);
+    os << buf.str();
+    buf.str("");
+  };
+
+  scan(num_threads, [&bufs, &flush](unsigned tid, auto &kv) {
+    auto &buf = bufs[tid];
+    buf << kv << '\n';
+    if (buf.tellp() >= (std::streampos)SCAN_PRINT_FLUSH_BYTES) {
+      flush(buf);
+    }
+  });
+
+  for (auto &buf : bufs) {
+    flush(buf);
+  }
+}
+
+}  // namespace kmercounter
+
+#endif  // HASHTABLES_HT_SCAN_HPP
@@ -0,0 +1,177 @@
+/// Binary snapshots of a hashtable.
+/// A snapshot is a one-page header followed by the raw KV array, so that a
+/// table can be mapped back from the file as is instead of being rebuilt.
+
+#ifndef HASHTABLES_HT_SNAPSHOT_HPP
+#define HASHTABLES_HT_SNAPSHOT_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include "hasher.hpp"
+#include "ht_helper.hpp"
+#include "kvtypes.hpp"
+#include "plog/Log.h"
+
+namespace kmercounter {
+
+constexpr uint64_t SNAPSHOT_MAGIC = 0x544948444d415244ULL;  // "DRAMHIT"
+/// Bumped whenever the header changes; other versions are not mapped.
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+
+struct SnapshotHeader {
+  uint64_t magic;
+  uint32_t version;
+  /// Tables lay out (and index) their slots differently.
+  uint32_t ht_type;
+  uint32_t kv_size;
+  uint32_t key_length;
+  char hasher[16];
+  uint64_t capacity;
+  /// Occupied slots.
+  uint64_t fill;
+  /// The value stored for the empty key, which has no slot in the table.
+  uint64_t empty_slot;
+  uint8_t empty_slot_exists;
+  /// Same for TOMBSTONE_KEY, in the tables that erase with tombstones.
+  uint64_t tombstone_slot;
+  uint8_t tombstone_slot_exists;
+};
+
+static_assert(sizeof(SnapshotHeader) <= SNAPSHOT_DATA_OFFSET);
+
+/// Snapshot files are named like the --out-file ones: one per partition, or
+/// a single one for the shared tables.
+inline std::string snapshot_path(const std::string &base, uint32_t id) {
+  return base + std::to_string(id);
+}
+
+template <typename KV, typename H>
+SnapshotHeader make_snapshot_header(uint32_t ht_type, uint64_t capacity) {
+  SnapshotHeader hdr{};
+  hdr.magic = SNAPSHOT_MAGIC;
+  hdr.version = SNAPSHOT_VERSION;
+  hdr.ht_type = ht_type;
+  hdr.kv_size = sizeof(KV);
+  hdr.key_length = KEY_LEN;
+  strncpy(hdr.hasher, H::name, sizeof(hdr.hasher) - 1);
+  hdr.capacity = capacity;
+  return hdr;
+}
+
+template <typename KV>
+bool write_snapshot(const std::string &path, const SnapshotHeader &hdr,
+                    const KV *table) {
+  if constexpr (KeyOutOfLine<KV>) {
+    PLOGE.printf("Couldn't write snapshot %s: keys are not in the table",
+                 path.c_str());
+    return false;
+  }
+
+  int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd < 0) {
+    PLOGE.printf("Couldn't open snapshot %s: %s", path.c_str(),
+                 strerror(errno));
+    return false;
+  }
+
+  char page[SNAPSHOT_DATA_OFFSET] = {0};
+  memcpy(page, &hdr, sizeof(hdr));
+
+  auto write_all = [fd](const char *buf, uint64_t len) {
+    while (len > 0) {
+      auto ret = write(fd, buf, len);
+      if (ret < 0) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      buf += ret;
+      len -= ret;
+    }
+    return true;
+  };
+
+  bool ok = write_all(page, sizeof(page)) &&
+            write_all(reinterpret_cast<const char *>(table),
+                      hdr.capacity * sizeof(KV));
+  if (!ok) {
+    PLOGE.printf("Couldn't write snapshot %s: %s", path.c_str(),
+                 strerror(errno));
+  }
+  close(fd);
+  return ok;
+}
+
+/// Map the table of a snapshot. The mapping is private, so the table can be
+/// updated without touching the file. Returns nullptr if the snapshot cannot
+/// be used by this build; the returned table is released by free_mem with
+/// SNAPSHOT_FD.
+template <typename KV, typename H>
+KV *map_snapshot(const std::string &path, uint32_t ht_type,
+                 SnapshotHeader *hdr) {
+  if constexpr (KeyOutOfLine<KV>) {
+    PLOGE.printf("Snapshot %s can't hold keys stored out of the table",
+                 path.c_str());
+    return nullptr;
+  }
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    PLOGE.printf("Couldn't open snapshot %s: %s", path.c_str(),
+                 strerror(errno));
+    return nullptr;
+  }
+
+  struct stat st;
+  KV *table = nullptr;
+  const char *reason = nullptr;
+
+  if (pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+      hdr->magic != SNAPSHOT_MAGIC) {
+    reason = "not a snapshot";
+  } else if (hdr->version != SNAPSHOT_VERSION) {
+    reason = "unsupported version";
+  } else if (hdr->ht_type != ht_type) {
+    reason = "built by a different hashtable";
+  } else if (hdr->kv_size != sizeof(KV) || hdr->key_length != KEY_LEN) {
+    reason = "built with a different KV layout";
+  } else if (strncmp(hdr->hasher, H::name, sizeof(hdr->hasher)) != 0) {
+    reason = "built with a different hash function";
+  } else if (fstat(fd, &st) < 0 ||
+             (uint64_t)st.st_size <
+                 SNAPSHOT_DATA_OFFSET + hdr->capacity * sizeof(KV)) {
+    reason = "truncated";
+  }
+
+  if (!reason) {
+    const uint64_t len = SNAPSHOT_DATA_OFFSET + hdr->capacity * sizeof(KV);
+    auto addr = static_cast<char *>(
+        mmap(ADDR, len, PROT_RW, MAP_PRIVATE | MAP_POPULATE, fd, 0));
+    if (addr == MAP_FAILED) {
+      PLOGE.printf("Couldn't map snapshot %s: %s", path.c_str(),
+                   strerror(errno));
+    } else {
+      table = reinterpret_cast<KV *>(addr + SNAPSHOT_DATA_OFFSET);
+      // Let the kernel back the table with transparent hugepages where it
+      // supports them for file mappings
+      madvise(table, len - SNAPSHOT_DATA_OFFSET, MADV_HUGEPAGE);
+      PLOGI.printf("Mapped snapshot %s: capacity %lu fill %lu", path.c_str(),
+                   hdr->capacity, hdr->fill);
+    }
+  } else {
+    PLOGE.printf("Snapshot %s is %s", path.c_str(), reason);
+  }
+
+  close(fd);
+  return table;
+}
+
+}  // namespace kmercounter
+
+#endif  // HASHTABLES_HT_SNAPSHOT_HPP
@@ -3,9 +3,17 @@
 
 #include <plog/Log.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
-
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "hasher.hpp"
 #include "types.hpp"
 #include <immintrin.h>
 
@@ -27,6 +35,11 @@ using key_type = std::uint64_t;
 
 using value_type = key_type;
 
+/// Key written over erased entries of the shared (CAS) hashtables. It is never
+/// empty and never matches a lookup, so probe chains stay intact.
+/// NEVER insert this key.
+constexpr key_type TOMBSTONE_KEY = ~static_cast<key_type>(0);
+
 struct Kmer_KV {
   Kmer_base kb;              // 20 + 2 bytes
   uint64_t kmer_hash;        // 8 bytes
@@ -95,20 +108,43 @@ struct Kmer_queue {
 
 struct ItemQueue {
   key_type key;
+  // in the find queue of the partitioned ht, the capacity idx is into
   value_type value;
-  //on multi-level ht this is used as ht-level
+  //on multi-level ht this is used as ht-level, on the cuckoo ht it holds
+  //the second bucket of the key, on the swiss ht its fingerprint and in the
+  //find queue of the CAS ht the reprobe state of the lookup
   uint32_t part_id;
   uint32_t key_id;
   uint32_t timer_id;
   uint32_t idx;
+  // slots a queued lookup has probed past its home bucket, for the
+  // probe-length histogram
+  uint32_t probe_len;
 #ifdef COMPARE_HASH
   uint64_t key_hash;  // 8 bytes
 #endif
 } PACKED;
 std::ostream& operator<<(std::ostream& os, const ItemQueue& q);
 
+/// Compare and swap a slot of a key and a value as one word (CMPXCHG16B with
+/// 8 byte keys), so that a write only lands while the slot still holds the
+/// key it was computed for. On failure `expected` is set to the contents seen.
+template <typename KV>
+inline bool cas_slot(KV *slot, KV &expected, const KV &desired) {
+  using word = std::conditional_t<sizeof(KV) == 16, unsigned __int128,
+                                  uint64_t>;
+  static_assert(sizeof(KV) == sizeof(word) && alignof(KV) == sizeof(word));
+  word old, want;
+  memcpy(&old, &expected, sizeof(word));
+  memcpy(&want, &desired, sizeof(word));
+  const word seen =
+      __sync_val_compare_and_swap(reinterpret_cast<word *>(slot), old, want);
+  memcpy(&expected, &seen, sizeof(word));
+  return seen == old;
+}
+
 // FIXME: @David paritioned gets the insert count wrong somehow
-struct Aggr_KV {
+struct alignas(2 * sizeof(key_type)) Aggr_KV {
   using queue = ItemQueue;
 
   key_type key;
@@ -142,15 +178,19 @@ struct Aggr_KV {
     return success;
   }
 
+  /// Fails if the slot no longer holds the key of `elem`, i.e. after a
+  /// concurrent erase
   inline bool update_cas(queue *elem) {
-    auto ret = false;
-    uint64_t old_val;
-
-    while (!ret) {
-      old_val = this->count;
-      ret = __sync_bool_compare_and_swap(&this->count, old_val, old_val + 1);
+    // A torn read only fails the CAS, which hands back the real contents
+    Aggr_KV old{this->key, this->count};
+    for (;;) {
+      if (old.key != elem->key) {
+        return false;
+      }
+      if (cas_slot(this, old, Aggr_KV{old.key, old.count + 1})) {
+        return true;
+      }
     }
-    return ret;
   }
 
   inline bool compare_key(const void *from) {
@@ -170,6 +210,26 @@ struct Aggr_KV {
         : "rbx");
   }
 
+  inline bool erase_cas(queue *elem) {
+    return __sync_bool_compare_and_swap(&this->key, elem->key, TOMBSTONE_KEY);
+  }
+
+  /// Claim a tombstone for the key of `elem`. The count of the erased key is
+  /// reset in the same CAS, before any other thread can see the new key.
+  inline bool reuse_cas(queue *elem) {
+    Aggr_KV old{this->key, this->count};
+    for (;;) {
+      if (old.key != TOMBSTONE_KEY) {
+        return false;
+      }
+      if (cas_slot(this, old, Aggr_KV{elem->key, 1})) {
+        return true;
+      }
+    }
+  }
+
+  inline bool is_tombstone() const { return this->key == TOMBSTONE_KEY; }
+
   inline uint64_t get_key() const { return this->key; }
   inline uint16_t get_value() const { return this->count; }
 
@@ -476,7 +536,7 @@ struct KVPair {
 
 std::ostream &operator<<(std::ostream &strm, const KVPair &item);
 
-struct Item {
+struct alignas(2 * sizeof(key_type)) Item {
   KVPair kvpair;
 
   using queue = ItemQueue;
@@ -509,21 +569,29 @@ struct Item {
     return success;
   }
 
+  /// Single writer insert without branches, for the cmov path of the
+  /// partitioned table: claims the slot if it is empty, overwrites the value
+  /// if it holds the key, and returns 0xFF in both cases (0: reprobe).
   inline uint16_t insert_or_update_v2(const void *data) {
-    PLOG_FATAL << "Not implemented";
-    assert(false);
-    return -1;
+    const queue *elem = reinterpret_cast<const queue *>(data);
+    const bool hit = this->is_empty() | (this->kvpair.key == elem->key);
+    this->kvpair.key = hit ? elem->key : this->kvpair.key;
+    this->kvpair.value = hit ? elem->value : this->kvpair.value;
+    return hit ? 0xFF : 0;
   }
 
+  /// Fails if the slot no longer holds the key of `elem`, i.e. after a
+  /// concurrent erase
   inline bool update_cas(queue *elem) {
-    auto ret = false;
-    uint64_t old_val;
-    while (!ret) {
-      old_val = this->kvpair.value;
-      ret = __sync_bool_compare_and_swap(&this->kvpair.value, old_val,
-                                         elem->value);
+    Item old{{this->kvpair.key, this->kvpair.value}};
+    for (;;) {
+      if (old.kvpair.key != elem->key) {
+        return false;
+      }
+      if (cas_slot(this, old, Item{{old.kvpair.key, elem->value}})) {
+        return true;
+      }
     }
-    return ret;
   }
 
   inline bool compare_key(const void *from) {
@@ -537,10 +605,14 @@ struct Item {
 
   inline constexpr size_t value_length() const { return sizeof(kvpair.value); }
 
+  /// Same as insert_or_update_v2, from an InsertFindArgument
   inline uint16_t insert_or_update(const void *data) {
-    std::cout << "Not implemented for Item!" << std::endl;
-    assert(false);
-    return -1;
+    const InsertFindArgument *arg =
+        reinterpret_cast<const InsertFindArgument *>(data);
+    queue elem{};
+    elem.key = arg->key;
+    elem.value = arg->value;
+    return this->insert_or_update_v2(&elem);
   }
 
   inline void update_value(const void *from) {
@@ -548,6 +620,28 @@ struct Item {
     this->kvpair.value = elem->value;
   }
 
+  inline bool erase_cas(queue *elem) {
+    return __sync_bool_compare_and_swap(&this->kvpair.key, elem->key,
+                                        TOMBSTONE_KEY);
+  }
+
+  /// Claim a tombstone for the key of `elem`, along with its value.
+  inline bool reuse_cas(queue *elem) {
+    Item old{{this->kvpair.key, this->kvpair.value}};
+    for (;;) {
+      if (old.kvpair.key != TOMBSTONE_KEY) {
+        return false;
+      }
+      if (cas_slot(this, old, Item{{elem->key, elem->value}})) {
+        return true;
+      }
+    }
+  }
+
+  inline bool is_tombstone() const {
+    return this->kvpair.key == TOMBSTONE_KEY;
+  }
+
   inline uint64_t get_key() const { return this->kvpair.key; }
   inline uint64_t get_value() const { return this->kvpair.value; }
 
@@ -672,9 +766,10 @@ struct Item {
     ItemQueue *elem =
         const_cast<ItemQueue *>(reinterpret_cast<const ItemQueue *>(data));
     uint64_t found = !this->is_empty() && (this->kvpair.key == elem->key);
-    *retry = !this->is_empty() && (this->kvpair.key != elem->key);    
-    vp.second[vp.first].id = found && elem->key_id;
-    vp.second[vp.first].value = found && this->kvpair.value;
+    *retry = !this->is_empty() && (this->kvpair.key != elem->key);
+    // The result is written either way and only kept if found
+    vp.second[vp.first].id = elem->key_id;
+    vp.second[vp.first].value = this->kvpair.value;
     vp.first = vp.first + found;
 
     return found;
@@ -792,6 +887,290 @@ struct Item {
   };
 } PACKED;
 
+/// Combiners for Upsert_KV: how the value of an insert merges into the value
+/// already stored for its key. `init` is the value a key is inserted with,
+/// `combine` folds one more insert into it and `merge` folds two partial
+/// aggregates together. All must be pure, as they are retried when another
+/// thread updated the slot in between.
+namespace combiner {
+
+/// Last insert wins (what Item does)
+struct overwrite {
+  static inline value_type init(value_type in) { return in; }
+  static inline value_type combine(value_type old, value_type in) { return in; }
+  static inline value_type merge(value_type old, value_type in) {
+    return combine(old, in);
+  }
+};
+
+/// Number of inserts, the values are ignored (what Aggr_KV does)
+struct count {
+  static inline value_type init(value_type in) { return 1; }
+  static inline value_type combine(value_type old, value_type in) {
+    return old + 1;
+  }
+  static inline value_type merge(value_type old, value_type in) {
+    return old + in;
+  }
+};
+
+struct sum {
+  static inline value_type init(value_type in) { return in; }
+  static inline value_type combine(value_type old, value_type in) {
+    return old + in;
+  }
+  static inline value_type merge(value_type old, value_type in) {
+    return combine(old, in);
+  }
+};
+
+struct max {
+  static inline value_type init(value_type in) { return in; }
+  static inline value_type combine(value_type old, value_type in) {
+    return std::max(old, in);
+  }
+  static inline value_type merge(value_type old, value_type in) {
+    return combine(old, in);
+  }
+};
+
+struct min {
+  static inline value_type init(value_type in) { return in; }
+  static inline value_type combine(value_type old, value_type in) {
+    return std::min(old, in);
+  }
+  static inline value_type merge(value_type old, value_type in) {
+    return combine(old, in);
+  }
+};
+
+/// Last writer wins by version: the upper half of the value is a version,
+/// the lower half the payload, and the insert with the highest version
+/// sticks whatever order the threads get to the slot in. On equal versions
+/// the later insert wins.
+struct latest {
+  static constexpr unsigned HALF = sizeof(value_type) * 4;
+
+  static inline value_type make(value_type version, value_type payload) {
+    return version << HALF | (payload & ((value_type(1) << HALF) - 1));
+  }
+  static inline value_type version(value_type v) { return v >> HALF; }
+  static inline value_type payload(value_type v) {
+    return v & ((value_type(1) << HALF) - 1);
+  }
+
+  static inline value_type init(value_type in) { return in; }
+  static inline value_type combine(value_type old, value_type in) {
+    return version(in) >= version(old) ? in : old;
+  }
+  static inline value_type merge(value_type old, value_type in) {
+    return combine(old, in);
+  }
+};
+
+/// Partial aggregates of `Combiner` folded together, e.g. per thread counts
+/// into totals
+template <typename Combiner>
+struct merged {
+  static inline value_type init(value_type in) { return in; }
+  static inline value_type combine(value_type old, value_type in) {
+    return Combiner::merge(old, in);
+  }
+  static inline value_type merge(value_type old, value_type in) {
+    return Combiner::merge(old, in);
+  }
+};
+
+}  // namespace combiner
+
+/// Key/value pair whose concurrent updates go through a Combiner, so the
+/// shared tables can aggregate (sum, max, ...) without locks.
+/// Key and value are compared and swapped together (CMPXCHG16B with 8 byte
+/// keys, CMPXCHG8B-sized with 4 byte ones): a key is published with its
+/// initial value in one step, so lookups never see a claimed slot without
+/// its value, and an update only lands while the slot still holds its key,
+/// i.e. not on top of a concurrent erase.
+template <typename Combiner>
+struct alignas(2 * sizeof(key_type)) Upsert_KV {
+  using queue = ItemQueue;
+  using word = std::conditional_t<sizeof(key_type) == 8, unsigned __int128,
+                                  uint64_t>;
+  static constexpr bool UPSERT = true;
+
+  key_type key;
+  value_type value;
+
+  friend std::ostream &operator<<(std::ostream &strm, const Upsert_KV &kv) {
+    return strm << "{" << kv.key << ": " << kv.value << "}";
+  }
+
+  static inline word pack(key_type key, value_type value) {
+    Upsert_KV kv{key, value};
+    word w;
+    memcpy(&w, &kv, sizeof(w));
+    return w;
+  }
+
+  static inline Upsert_KV unpack(word w) {
+    Upsert_KV kv;
+    memcpy(&kv, &w, sizeof(w));
+    return kv;
+  }
+
+  inline word *as_word() { return reinterpret_cast<word *>(this); }
+
+  /// The key and value read separately may be torn, in which case the CAS
+  /// they feed fails and hands back the real contents.
+  inline word snapshot() const { return pack(this->key, this->value); }
+
+  inline bool insert(queue *elem) {
+    if (this->is_empty()) {
+      this->key = elem->key;
+      this->value = Combiner::init(elem->value);
+      return false;
+    } else if (this->key == elem->key) {
+      this->value = Combiner::combine(this->value, elem->value);
+      return false;
+    }
+    return true;
+  }
+
+  inline bool insert_cas(queue *elem) {
+    word old = this->snapshot();
+    if (unpack(old).key != 0) {
+      return false;
+    }
+    return __sync_bool_compare_and_swap(
+        this->as_word(), old, pack(elem->key, Combiner::init(elem->value)));
+  }
+
+  /// Fails if the slot no longer holds the key of `elem`
+  inline bool update_cas(queue *elem) {
+    word old = this->snapshot();
+    for (;;) {
+      const Upsert_KV cur = unpack(old);
+      if (cur.key != elem->key) {
+        return false;
+      }
+      const word desired =
+          pack(cur.key, Combiner::combine(cur.value, elem->value));
+      const word seen =
+          __sync_val_compare_and_swap(this->as_word(), old, desired);
+      if (seen == old) {
+        return true;
+      }
+      old = seen;
+    }
+  }
+
+  /// Single writer insert without branches, for the cmov path of the
+  /// partitioned table: claims the slot if it is empty, folds the value in if
+  /// it holds the key, and returns 0xFF in both cases (0: reprobe).
+  inline uint16_t insert_or_update_v2(const void *data) {
+    const queue *elem = reinterpret_cast<const queue *>(data);
+    const bool empty = this->is_empty();
+    const bool hit = empty | (this->key == elem->key);
+    const value_type value = empty
+                                 ? Combiner::init(elem->value)
+                                 : Combiner::combine(this->value, elem->value);
+    this->key = hit ? elem->key : this->key;
+    this->value = hit ? value : this->value;
+    return hit ? 0xFF : 0;
+  }
+
+  /// Same as insert_or_update_v2, from an InsertFindArgument
+  inline uint16_t insert_or_update(const void *data) {
+    const InsertFindArgument *arg =
+        reinterpret_cast<const InsertFindArgument *>(data);
+    queue elem{};
+    elem.key = arg->key;
+    elem.value = arg->value;
+    return this->insert_or_update_v2(&elem);
+  }
+
+  /// Fold an insert of the empty key into `slot`, where the tables keep it
+  /// out of line. The slot is shared by all the threads of a shared table,
+  /// and the empty key is rare, so a lock will do.
+  static inline void insert_empty(uint64_t &slot, bool &exists,
+                                  value_type in) {
+    static std::mutex lock;
+    const std::lock_guard guard{lock};
+    slot = exists ? Combiner::combine(slot, in) : Combiner::init(in);
+    exists = true;
+  }
+
+  inline bool compare_key(const void *from) {
+    const queue *elem = reinterpret_cast<const queue *>(from);
+    return this->key == elem->key;
+  }
+
+  inline constexpr size_t data_length() const { return sizeof(Upsert_KV); }
+
+  inline constexpr size_t key_length() const { return sizeof(key_type); }
+
+  inline constexpr size_t value_length() const { return sizeof(value_type); }
+
+  inline bool erase_cas(queue *elem) {
+    return __sync_bool_compare_and_swap(&this->key, elem->key, TOMBSTONE_KEY);
+  }
+
+  /// Claim a tombstone for the key of `elem`, along with its value.
+  inline bool reuse_cas(queue *elem) {
+    word old = this->snapshot();
+    if (unpack(old).key != TOMBSTONE_KEY) {
+      return false;
+    }
+    return __sync_bool_compare_and_swap(
+        this->as_word(), old, pack(elem->key, Combiner::init(elem->value)));
+  }
+
+  inline bool is_tombstone() const { return this->key == TOMBSTONE_KEY; }
+
+  inline uint64_t get_key() const { return this->key; }
+  inline uint64_t get_value() const { return this->value; }
+
+  inline Upsert_KV get_empty_key() { return Upsert_KV{}; }
+
+  inline bool is_empty() { return this->key == 0; }
+
+  inline uint64_t find(const void *data, uint64_t *retry, ValuePairs &vp) {
+    const queue *elem = reinterpret_cast<const queue *>(data);
+
+    uint64_t found = !this->is_empty() && (this->key == elem->key);
+    *retry = !this->is_empty() && !found;
+
+    if (found) {
+      vp.second[vp.first].id = elem->key_id;
+      vp.second[vp.first].value = this->value;
+      vp.first++;
+    }
+
+    return found;
+  }
+
+  inline uint64_t find_brless(const void *data, uint64_t *retry,
+                              ValuePairs &vp) {
+    return this->find(data, retry, vp);
+  }
+
+#ifdef AVX_SUPPORT
+  // Same layout as Item, whose line compares work on key/value pairs
+  inline uint64_t find_simd(const void *data, uint64_t *retry, ValuePairs &vp,
+                            size_t offset) {
+    return reinterpret_cast<Item *>(this)->find_simd(data, retry, vp, offset);
+  }
+
+  inline uint64_t find_simd_brless(const void *data, uint64_t *retry,
+                                   ValuePairs &vp, size_t offset) {
+    return reinterpret_cast<Item *>(this)->find_simd_brless(data, retry, vp,
+                                                            offset);
+  }
+#endif
+};
+
+static_assert(sizeof(Upsert_KV<combiner::sum>) == sizeof(Item),
+              "Upsert_KV must keep the layout of Item");
+
 struct Value {
   value_type value;
 
@@ -853,7 +1232,485 @@ struct Value {
 } PACKED;
 
 
-#ifdef NOAGGR
+/// Keys that do not fit in key_type are passed by reference: the key field of
+/// the queue entries (and of InsertFindArgument) carries a pointer to the key,
+/// which must stay valid until the operation is flushed. The tables hash them
+/// through KV::hash_key.
+template <typename KV>
+concept KeyByReference = requires { requires KV::KEY_BY_REFERENCE; };
+
+/// KVs that only hold a pointer to their key; they cannot be snapshotted.
+template <typename KV>
+concept KeyOutOfLine = requires { requires KV::KEY_OUT_OF_LINE; };
+
+/// KVs that compare all the keys of a cacheline at once on lookups.
+template <typename KV>
+concept LineProbe = requires { requires KV::LINE_PROBE; };
+
+/// KVs whose inserts merge into the stored value through a combiner. Only
+/// the branched inserts go through the combiner.
+template <typename KV>
+concept Upserting = requires { requires KV::UPSERT; };
+
+#if (KEY_LEN == 8)
+
+struct Key16 {
+  uint64_t lo;
+  uint64_t hi;
+
+  bool operator==(const Key16 &) const = default;
+};
+
+/// 16-byte keys, two slots per cacheline. The all-zero key marks empty slots
+/// and the all-ones key tombstones: NEVER insert either.
+struct alignas(32) Item16 {
+  using queue = ItemQueue;
+
+  static constexpr bool KEY_BY_REFERENCE = true;
+  static constexpr bool LINE_PROBE = true;
+
+  Key16 key;
+  value_type value;
+
+  friend std::ostream &operator<<(std::ostream &strm, const Item16 &item) {
+    return strm << "{" << item.key.hi << ":" << item.key.lo << ": "
+                << item.value << "}";
+  }
+
+  static inline const Key16 &key_of(const void *data) {
+    return *reinterpret_cast<const Key16 *>(
+        reinterpret_cast<const queue *>(data)->key);
+  }
+
+  template <typename Hasher>
+  static inline uint64_t hash_key(Hasher &hasher, uint64_t key) {
+    return hasher(reinterpret_cast<const void *>(key), sizeof(Key16));
+  }
+
+  inline bool cas_key(const Key16 &expected, const Key16 &desired) {
+    unsigned __int128 e, d;
+    memcpy(&e, &expected, sizeof(e));
+    memcpy(&d, &desired, sizeof(d));
+    return __sync_bool_compare_and_swap(
+        reinterpret_cast<unsigned __int128 *>(&this->key), e, d);
+  }
+
+  inline bool insert(queue *elem) {
+    if (this->is_empty()) {
+      this->key = key_of(elem);
+      this->value = elem->value;
+      return false;
+    } else if (this->key == key_of(elem)) {
+      this->value = elem->value;
+      return false;
+    }
+    return true;
+  }
+
+  inline bool insert_cas(queue *elem) {
+    auto success = this->cas_key(Key16{}, key_of(elem));
+    if (success) {
+      this->update_value(elem);
+    }
+    return success;
+  }
+
+  /// Single writer insert without branches: claims the slot if it is empty,
+  /// overwrites the value if it holds the key, and returns 0xFF in both cases
+  /// (0: reprobe).
+  inline uint16_t insert_or_update_v2(const void *data) {
+    const queue *elem = reinterpret_cast<const queue *>(data);
+    const Key16 &k = key_of(elem);
+    const bool hit = this->is_empty() | (this->key == k);
+    this->key.lo = hit ? k.lo : this->key.lo;
+    this->key.hi = hit ? k.hi : this->key.hi;
+    this->value = hit ? elem->value : this->value;
+    return hit ? 0xFF : 0;
+  }
+
+  /// Same as insert_or_update_v2, from an InsertFindArgument
+  inline uint16_t insert_or_update(const void *data) {
+    const InsertFindArgument *arg =
+        reinterpret_cast<const InsertFindArgument *>(data);
+    queue elem{};
+    elem.key = arg->key;
+    elem.value = arg->value;
+    return this->insert_or_update_v2(&elem);
+  }
+
+  inline bool update_cas(queue *elem) {
+    this->update_value(elem);
+    return true;
+  }
+
+  inline bool compare_key(const void *from) {
+    return this->key == key_of(from);
+  }
+
+  inline constexpr size_t data_length() const { return sizeof(Item16); }
+
+  inline constexpr size_t key_length() const { return sizeof(Key16); }
+
+  inline constexpr size_t value_length() const { return sizeof(value_type); }
+
+  inline void update_value(const void *from) {
+    const queue *elem = reinterpret_cast<const queue *>(from);
+    this->value = elem->value;
+  }
+
+  inline bool erase_cas(queue *elem) {
+    return this->cas_key(key_of(elem), Key16{~0ULL, ~0ULL});
+  }
+
+  /// Claim a tombstone for the key of `elem`.
+  inline bool reuse_cas(queue *elem) {
+    auto success = this->cas_key(Key16{~0ULL, ~0ULL}, key_of(elem));
+    if (success) {
+      this->update_value(elem);
+    }
+    return success;
+  }
+
+  inline bool is_tombstone() const {
+    return this->key == Key16{~0ULL, ~0ULL};
+  }
+
+  /// The key is handed out by reference, like it is passed in.
+  inline uint64_t get_key() const {
+    return reinterpret_cast<uint64_t>(&this->key);
+  }
+  inline uint64_t get_value() const { return this->value; }
+
+  inline Item16 get_empty_key() { return Item16{}; }
+
+  inline bool is_empty() { return this->key == Key16{}; }
+
+  inline uint64_t find(const void *data, uint64_t *retry, ValuePairs &vp) {
+    const queue *elem = reinterpret_cast<const queue *>(data);
+
+    uint64_t found = !this->is_empty() && (this->key == key_of(elem));
+    *retry = !this->is_empty() && !found;
+
+    if (found) {
+      vp.second[vp.first].id = elem->key_id;
+      vp.second[vp.first].value = this->value;
+      vp.first++;
+    }
+
+    return found;
+  }
+
+  inline uint64_t find_brless(const void *data, uint64_t *retry,
+                              ValuePairs &vp) {
+    return this->find(data, retry, vp);
+  }
+
+#ifdef AVX_SUPPORT
+  /// Look the key up in the cacheline starting at this slot, from slot
+  /// `offset` on. Both keys of the line are compared at once: a slot matches
+  /// when both halves of its key do.
+  inline uint64_t find_simd(const void *data, uint64_t *retry, ValuePairs &vp,
+                            size_t offset) {
+    const queue *elem = reinterpret_cast<const queue *>(data);
+    const Key16 &k = key_of(elem);
+    // | lo | hi | value | pad | lo | hi | value | pad |
+    constexpr __mmask8 SLOTMSK = 0b00010001;
+
+    const __m512i key_vector =
+        _mm512_set_epi64(0, 0, k.hi, k.lo, 0, 0, k.hi, k.lo);
+    const __m512i cacheline = _mm512_load_si512(this);
+    const __mmask8 key_cmp = _mm512_cmpeq_epu64_mask(cacheline, key_vector);
+    const __mmask8 ept_cmp = _mm512_testn_epi64_mask(cacheline, cacheline);
+
+    // A slot bit is set when both halves of the key compare
+    const __mmask8 valid = SLOTMSK & (SLOTMSK << (4 * offset));
+    const __mmask8 match = valid & key_cmp & (key_cmp >> 1);
+    const __mmask8 empty = valid & ept_cmp & (ept_cmp >> 1);
+
+    *retry = 0;
+    if (match) {
+      vp.second[vp.first].id = elem->key_id;
+      vp.second[vp.first].value = this[_tzcnt_u32(match) >> 2].value;
+      vp.first++;
+      return 1;
+    }
+    *retry = !empty;
+    return 0;
+  }
+
+  inline uint64_t find_simd_brless(const void *data, uint64_t *retry,
+                                   ValuePairs &vp, size_t offset) {
+    return this->find_simd(data, retry, vp, offset);
+  }
+#endif
+};
+
+static_assert(sizeof(Item16) == 32, "Item16 must pack two per cacheline");
+
+/// A key of any length. The tables take keys of IndirectItem by reference to
+/// a VarKey.
+struct VarKey {
+  const char *data;
+  uint64_t len;
+
+  bool operator==(const VarKey &other) const {
+    return this->len == other.len && !memcmp(this->data, other.data, this->len);
+  }
+};
+
+/// Storage for the keys of IndirectItem, which must outlive the table. Keys
+/// are copied in blocks that are never moved nor freed before the arena is.
+/// One arena per inserting thread; an arena is not thread safe.
+class KeyArena {
+ public:
+  static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+  /// Copy `len` bytes of key into the arena.
+  const VarKey *intern(const void *data, uint64_t len) {
+    auto key = reinterpret_cast<VarKey *>(this->alloc(sizeof(VarKey) + len));
+    char *bytes = reinterpret_cast<char *>(key + 1);
+    memcpy(bytes, data, len);
+    key->data = bytes;
+    key->len = len;
+    return key;
+  }
+
+  /// Copy a fixed size key, e.g. a Key16, into the arena.
+  template <typename K>
+  const K *intern(const K &key) {
+    static_assert(alignof(K) <= alignof(VarKey));
+    return new (this->alloc(sizeof(K))) K(key);
+  }
+
+  /// Drop all the keys, for an arena whose keys are only needed until the
+  /// operations on them are flushed.
+  void clear() {
+    this->blocks_.clear();
+    this->next_ = nullptr;
+    this->left_ = 0;
+  }
+
+ private:
+  char *alloc(size_t need) {
+    if (need > this->left_) {
+      const size_t size = std::max(need, BLOCK_SIZE);
+      this->blocks_.emplace_back(new char[size]);
+      this->next_ = this->blocks_.back().get();
+      this->left_ = size;
+    }
+
+    char *p = this->next_;
+    // Keep the next key aligned
+    const size_t used = (need + alignof(VarKey) - 1) & ~(alignof(VarKey) - 1);
+    this->next_ += std::min(used, this->left_);
+    this->left_ -= std::min(used, this->left_);
+    return p;
+  }
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char *next_ = nullptr;
+  size_t left_ = 0;
+};
+
+/// Keys of any length, stored out of line: the slot keeps a fingerprint of
+/// the key and a pointer to it. The fingerprint answers most mismatches
+/// without touching the key. Inserted keys must be interned, e.g. in a
+/// KeyArena, and outlive the table; lookups and erases take any VarKey.
+struct alignas(32) IndirectItem {
+  using queue = ItemQueue;
+
+  static constexpr bool KEY_BY_REFERENCE = true;
+  static constexpr bool KEY_OUT_OF_LINE = true;
+
+  /// 0 for empty slots, TOMBSTONE_FP for erased ones.
+  uint64_t fingerprint;
+  const VarKey *key;
+  value_type value;
+
+  static constexpr uint64_t TOMBSTONE_FP = 1;
+
+  friend std::ostream &operator<<(std::ostream &strm,
+                                  const IndirectItem &item) {
+    strm << "{";
+    if (item.key) {
+      strm << std::string_view(item.key->data, item.key->len);
+    }
+    return strm << ": " << item.value << "}";
+  }
+
+  static inline const VarKey &key_of(const void *data) {
+    return *reinterpret_cast<const VarKey *>(
+        reinterpret_cast<const queue *>(data)->key);
+  }
+
+  template <typename Hasher>
+  static inline uint64_t hash_key(Hasher &hasher, uint64_t key) {
+    const VarKey *k = reinterpret_cast<const VarKey *>(key);
+    return hasher(k->data, k->len);
+  }
+
+  /// Never 0 nor TOMBSTONE_FP.
+  static inline uint64_t fingerprint_of(const VarKey &k) {
+    return (k.len << 32 | crc_hash(k.data, k.len)) | (1ULL << 63);
+  }
+
+  /// A slot is claimed by its fingerprint before the key pointer is
+  /// published, so wait for it.
+  inline const VarKey *load_key() const {
+    const VarKey *k;
+    while (!(k = __atomic_load_n(&this->key, __ATOMIC_ACQUIRE))) {
+      _mm_pause();
+    }
+    return k;
+  }
+
+  inline bool matches(const VarKey &k, uint64_t fp) const {
+    return this->fingerprint == fp && *this->load_key() == k;
+  }
+
+  inline bool insert(queue *elem) {
+    const VarKey &k = key_of(elem);
+    const uint64_t fp = fingerprint_of(k);
+    if (this->is_empty()) {
+      this->fingerprint = fp;
+      this->key = &k;
+      this->value = elem->value;
+      return false;
+    } else if (this->matches(k, fp)) {
+      this->value = elem->value;
+      return false;
+    }
+    return true;
+  }
+
+  inline bool insert_cas(queue *elem) {
+    const VarKey &k = key_of(elem);
+    auto success =
+        __sync_bool_compare_and_swap(&this->fingerprint, 0, fingerprint_of(k));
+    if (success) {
+      this->update_value(elem);
+      __atomic_store_n(&this->key, &k, __ATOMIC_RELEASE);
+    }
+    return success;
+  }
+
+  /// Single writer insert: claims the slot if it is empty, overwrites the
+  /// value if it holds the key, and returns 0xFF in both cases (0: reprobe).
+  /// Only the key comparison behind a fingerprint match branches.
+  inline uint16_t insert_or_update_v2(const void *data) {
+    const queue *elem = reinterpret_cast<const queue *>(data);
+    const VarKey &k = key_of(elem);
+    const uint64_t fp = fingerprint_of(k);
+    const bool empty = this->is_empty();
+    const bool hit = empty | this->matches(k, fp);
+    this->fingerprint = hit ? fp : this->fingerprint;
+    this->key = empty ? &k : this->key;
+    this->value = hit ? elem->value : this->value;
+    return hit ? 0xFF : 0;
+  }
+
+  /// Same as insert_or_update_v2, from an InsertFindArgument
+  inline uint16_t insert_or_update(const void *data) {
+    const InsertFindArgument *arg =
+        reinterpret_cast<const InsertFindArgument *>(data);
+    queue elem{};
+    elem.key = arg->key;
+    elem.value = arg->value;
+    return this->insert_or_update_v2(&elem);
+  }
+
+  inline bool update_cas(queue *elem) {
+    this->update_value(elem);
+    return true;
+  }
+
+  inline bool compare_key(const void *from) {
+    const VarKey &k = key_of(from);
+    return this->matches(k, fingerprint_of(k));
+  }
+
+  inline constexpr size_t data_length() const { return sizeof(IndirectItem); }
+
+  inline constexpr size_t key_length() const { return sizeof(VarKey); }
+
+  inline constexpr size_t value_length() const { return sizeof(value_type); }
+
+  inline void update_value(const void *from) {
+    const queue *elem = reinterpret_cast<const queue *>(from);
+    this->value = elem->value;
+  }
+
+  inline bool erase_cas(queue *elem) {
+    const VarKey &k = key_of(elem);
+    const uint64_t fp = fingerprint_of(k);
+    return this->matches(k, fp) &&
+           __sync_bool_compare_and_swap(&this->fingerprint, fp, TOMBSTONE_FP);
+  }
+
+  /// Tombstones keep the pointer to the erased key, which lookups that
+  /// matched its fingerprint may still be reading, so they are not reused.
+  inline bool reuse_cas(queue *elem) { return false; }
+
+  inline bool is_tombstone() const {
+    return this->fingerprint == TOMBSTONE_FP;
+  }
+
+  inline uint64_t get_key() const {
+    return this->fingerprint ? reinterpret_cast<uint64_t>(this->load_key())
+                             : 0;
+  }
+  inline uint64_t get_value() const { return this->value; }
+
+  inline IndirectItem get_empty_key() { return IndirectItem{}; }
+
+  inline bool is_empty() { return this->fingerprint == 0; }
+
+  inline uint64_t find(const void *data, uint64_t *retry, ValuePairs &vp) {
+    const queue *elem = reinterpret_cast<const queue *>(data);
+    const VarKey &k = key_of(elem);
+
+    uint64_t found = !this->is_empty() && this->matches(k, fingerprint_of(k));
+    *retry = !this->is_empty() && !found;
+
+    if (found) {
+      vp.second[vp.first].id = elem->key_id;
+      vp.second[vp.first].value = this->value;
+      vp.first++;
+    }
+
+    return found;
+  }
+
+  inline uint64_t find_brless(const void *data, uint64_t *retry,
+                              ValuePairs &vp) {
+    return this->find(data, retry, vp);
+  }
+
+#ifdef AVX_SUPPORT
+  inline uint64_t find_simd(const void *data, uint64_t *retry, ValuePairs &vp,
+                            size_t offset) {
+    PLOG_FATAL << "Not implemented";
+    assert(false);
+    return 0;
+  }
+
+  inline uint64_t find_simd_brless(const void *data, uint64_t *retry,
+                                   ValuePairs &vp, size_t offset) {
+    PLOG_FATAL << "Not implemented";
+    assert(false);
+    return 0;
+  }
+#endif
+};
+
+static_assert(sizeof(IndirectItem) == 32,
+              "IndirectItem must pack two per cacheline");
+
+#endif  // KEY_LEN == 8
+
+#if defined(UPSERT_COMBINER)
+using KVType = Upsert_KV<UPSERT_COMBINER>;
+#elif defined(NOAGGR)
 using KVType = Item;
 #else
 using KVType = Aggr_KV;
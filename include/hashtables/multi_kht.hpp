@@ -21,11 +21,12 @@
 #include "hasher.hpp"
 #include "helper.hpp"
 #include "ht_helper.hpp"
+#include "ht_scan.hpp"
 #include "plog/Log.h"
 #include "sync.h"
 
 namespace kmercounter {
-template <typename KV, typename KVQ>
+template <typename KV, typename KVQ, typename H = Hasher>
 class MultiHashTable : public BaseHashTable {
  public:
   /// The global instance is shared by all threads.
@@ -34,6 +35,11 @@ class MultiHashTable : public BaseHashTable {
   static uint64_t empty_slot_;
   /// True if the empty value is inserted.
   static bool empty_slot_exists_;
+  /// A dedicated slot for the value of TOMBSTONE_KEY, which marks erased
+  /// slots.
+  static uint64_t tombstone_slot_;
+  /// True if the tombstone value is inserted.
+  static bool tombstone_slot_exists_;
   /// File descriptor backs the memory
   static KV *backup_hashtable;
   int fd;
@@ -53,7 +59,9 @@ class MultiHashTable : public BaseHashTable {
         find_head(0),
         find_tail(0),
         ins_head(0),
-        ins_tail(0) {
+        ins_tail(0),
+        erase_head(0),
+        erase_tail(0) {
     this->capacity = kmercounter::utils::next_pow2(c);
 
     //capacity = capacity*2;
@@ -98,12 +106,16 @@ class MultiHashTable : public BaseHashTable {
       this->find_queue[i].part_id = 0;
     }
 
+    this->erase_queue =
+        (KVQ *)(aligned_alloc(64, PREFETCH_QUEUE_SIZE * sizeof(KVQ)));
+
     PLOGV.printf("%s, data_length %lu\n", __func__, this->data_length);
   }
 
   ~MultiHashTable() {
     free(find_queue);
     free(insert_queue);
+    free(erase_queue);
     // Deallocate the global hashtable if ref_cnt goes down to zero.
     {
       const std::lock_guard<std::mutex> lock(ht_init_mutex);
@@ -130,6 +142,10 @@ class MultiHashTable : public BaseHashTable {
     // size_t idx = fastrange32(hash, this->capacity);  // modulo
 
     KVQ *elem = const_cast<KVQ *>(reinterpret_cast<const KVQ *>(data));
+    if (__out_of_line(elem->key)) {
+      this->__insert_empty(elem);
+      goto exit;
+    }
 
     for (auto i = 0u; i < this->capacity; i++) {
       KV *curr = &this->hashtable[idx];
@@ -150,9 +166,11 @@ class MultiHashTable : public BaseHashTable {
       }
     }
 
+  exit:
 #ifdef LATENCY_COLLECTION
     collector->sync_end(timer_start);
 #endif
+    this->fold_stats();
   }
 
   bool insert(const void *data) {
@@ -171,6 +189,8 @@ class MultiHashTable : public BaseHashTable {
     }
 
     this->flush_if_needed(collector);
+    this->insert_depth.account(kp.size());
+    this->fold_stats();
   }
 
   // overridden function for insertion
@@ -178,7 +198,7 @@ class MultiHashTable : public BaseHashTable {
     size_t curr_queue_sz =
         (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
 
-    while (curr_queue_sz >= INS_FLUSH_THRESHOLD) {
+    while (curr_queue_sz >= this->insert_depth.get()) {
       __insert_one(&this->insert_queue[this->ins_tail], collector);
 
       if (++this->ins_tail >= PREFETCH_QUEUE_SIZE) this->ins_tail = 0;
@@ -198,6 +218,7 @@ class MultiHashTable : public BaseHashTable {
       curr_queue_sz =
           (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
     }
+    this->fold_stats();
   }
 
   void flush_find_queue(ValuePairs &vp, collector_type *collector) override {
@@ -210,6 +231,7 @@ class MultiHashTable : public BaseHashTable {
       curr_queue_sz =
           (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
     }
+    this->fold_stats();
   }
 
   void flush_if_needed(ValuePairs &vp, collector_type *collector) {
@@ -218,13 +240,13 @@ class MultiHashTable : public BaseHashTable {
     // make sure you return at most batch_sz (but can possibly return lesser
     // number of elements)
 
-    if((curr_queue_sz >= FLUSH_THRESHOLD) && (vp.first < config.batch_len))
+    if((curr_queue_sz >= this->find_depth.get()) && (vp.first < config.batch_len))
     {
       __builtin_prefetch(&curr_queue_sz, true, 3);
       __builtin_prefetch(&this->find_tail, true, 3);
     }
 
-    while ((curr_queue_sz >= FLUSH_THRESHOLD) && (vp.first < config.batch_len)) {
+    while ((curr_queue_sz >= this->find_depth.get()) && (vp.first < config.batch_len)) {
       __find_one(&this->find_queue[this->find_tail], vp, collector);
       if (++this->find_tail >= PREFETCH_FIND_QUEUE_SIZE) {
         this->find_tail = 0;
@@ -246,12 +268,53 @@ class MultiHashTable : public BaseHashTable {
     }
 
     this->flush_if_needed(values, collector);
+    this->find_depth.account(kp.size());
+    this->fold_stats();
+  }
+
+  /// Erased entries are replaced by a tombstone, like in the CAS table. An
+  /// erase takes the path of the inserts, through level 0 to level 1.
+  /// Tombstones are not reused.
+  void erase_batch(const InsertFindArguments &kp,
+                   collector_type *collector) override {
+    this->flush_erase_if_needed(collector);
+
+    for (auto &data : kp) {
+      add_to_erase_queue(&data, collector);
+    }
+
+    this->flush_erase_if_needed(collector);
+    this->erase_depth.account(kp.size());
+    this->fold_stats();
+  }
+
+  void flush_erase_if_needed(collector_type *collector) {
+    size_t curr_queue_sz =
+        (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz >= this->erase_depth.get()) {
+      __erase_one(&this->erase_queue[this->erase_tail], collector);
+      if (++this->erase_tail >= PREFETCH_QUEUE_SIZE) this->erase_tail = 0;
+      curr_queue_sz =
+          (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+  }
+
+  void flush_erase_queue(collector_type *collector) override {
+    size_t curr_queue_sz =
+        (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz != 0) {
+      __erase_one(&this->erase_queue[this->erase_tail], collector);
+      if (++this->erase_tail >= PREFETCH_QUEUE_SIZE) this->erase_tail = 0;
+      curr_queue_sz =
+          (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+    this->fold_stats();
   }
 
   void *find_noprefetch(const void *data, collector_type *collector) override {
-#ifdef CALC_STATS
     uint64_t distance_from_bucket = 0;
-#endif
 #ifdef LATENCY_COLLECTION
     const auto timer_start = collector->sync_start();
 #endif
@@ -277,19 +340,12 @@ class MultiHashTable : public BaseHashTable {
         found = true;
         break;
       }
-#ifdef CALC_STATS
       distance_from_bucket++;
-#endif
       idx++;
     }
 
-#ifdef CALC_STATS
-    if (distance_from_bucket > this->max_distance_from_bucket) {
-      this->max_distance_from_bucket = distance_from_bucket;
-    }
-    this->sum_distance_from_bucket += distance_from_bucket;
-#endif
   exit:
+    this->batch_stats.add_probe_length(distance_from_bucket);
 #ifdef LATENCY_COLLECTION
     collector->sync_end(timer_start);
 #endif
@@ -302,25 +358,16 @@ class MultiHashTable : public BaseHashTable {
       curr = nullptr;
     }
 
+    this->fold_stats();
     return curr;
   }
 
   void display() const override {
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (!this->hashtable[i].is_empty()) {
-        cout << this->hashtable[i] << endl;
-      }
-    }
+    scan_print(__scanner(), scan_threads(), std::cout);
   }
 
   size_t get_fill() const override {
-    size_t count = 0;
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (!this->hashtable[i].is_empty()) {
-        count++;
-      }
-    }
-    return count;
+    return scan_fill(__scanner(), scan_threads());
   }
 
   size_t get_lvl1_fill() {
@@ -335,14 +382,28 @@ class MultiHashTable : public BaseHashTable {
 
   size_t get_capacity() const override { return this->capacity; }
 
+  bool is_shared() const override { return true; }
+
   size_t get_max_count() const override {
-    size_t count = 0;
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (this->hashtable[i].get_value() > count) {
-        count = this->hashtable[i].get_value();
-      }
-    }
-    return count;
+    return scan_max_count(__scanner(), scan_threads());
+  }
+
+  void scan(unsigned num_threads, const ScanCallback &cb) const override {
+    __scanner()(num_threads, [&cb](unsigned tid, KV &kv) {
+      cb(tid, KeyValuePair(kv.get_key(), kv.get_value()));
+    });
+  }
+
+  bool save_snapshot(const std::string &path) const override {
+    PLOG_FATAL << "Not implemented";
+    assert(false);
+    return false;
+  }
+
+  bool save_profile(const std::string &path) override {
+    PLOG_FATAL << "Not implemented";
+    assert(false);
+    return false;
   }
 
   void print_to_file(std::string &outfile) const override {
@@ -351,15 +412,21 @@ class MultiHashTable : public BaseHashTable {
       PLOG_ERROR.printf("Could not open outfile %s", outfile.c_str());
       return;
     }
-
-    for (size_t i = 0; i < this->get_capacity(); i++) {
-      if (!this->hashtable[i].is_empty()) {
-        f << this->hashtable[i] << std::endl;
-      }
-    }
+    scan_print(__scanner(), max_scan_threads(), f);
   }
 
  private:
+  auto __scanner() const {
+    return [this](unsigned num_threads, auto &&f) {
+      scan_table(this->hashtable, this->capacity, num_threads,
+                 [&f](unsigned tid, KV &kv) {
+                   if (!kv.is_tombstone()) {
+                     f(tid, kv);
+                   }
+                 });
+    };
+  }
+
   /// Assure thread-safety in constructor and destructor.
   static std::mutex ht_init_mutex;
   /// Reference counter of the global `hashtable`.
@@ -370,11 +437,14 @@ class MultiHashTable : public BaseHashTable {
   KV empty_item;
   KVQ *find_queue;
   KVQ *insert_queue;
+  KVQ *erase_queue;
   uint32_t find_head;
   uint32_t find_tail;
   uint32_t ins_head;
   uint32_t ins_tail;
-  Hasher hasher_;
+  uint32_t erase_head;
+  uint32_t erase_tail;
+  H hasher_;
 
   uint64_t hash(const void *k) { return hasher_(k, this->key_length); }
 
@@ -445,6 +515,10 @@ class MultiHashTable : public BaseHashTable {
     this->find_queue[this->find_head].key = q->key;
     this->find_queue[this->find_head].key_id = q->key_id;
     this->find_queue[this->find_head].part_id = 1;
+    // the rest of the level 0 line has been probed
+    this->find_queue[this->find_head].probe_len =
+        q->probe_len + KEYS_IN_CACHELINE_MASK + 1 -
+        (q->idx & KEYS_IN_CACHELINE_MASK);
     this->find_head += 1;
     this->find_head &= (PREFETCH_FIND_QUEUE_SIZE - 1);
   }
@@ -468,12 +542,16 @@ class MultiHashTable : public BaseHashTable {
       this->find_queue[this->find_head].key_id = q->key_id;
       this->find_queue[this->find_head].idx = idx;
       this->find_queue[this->find_head].part_id = 1;
+      this->find_queue[this->find_head].probe_len =
+          q->probe_len + probe_distance(q->idx, idx, lvl1_capacity);
 
 #ifdef LATENCY_COLLECTION
       this->find_queue[this->find_head].timer_id = q->timer_id;
 #endif
       this->find_head += 1;
       this->find_head &= (PREFETCH_FIND_QUEUE_SIZE - 1);
+    } else {
+      this->batch_stats.add_probe_length(q->probe_len);
     }
     return found;
 
@@ -518,6 +596,8 @@ class MultiHashTable : public BaseHashTable {
     
     if(retry) {
       __add_to_findqueue(q, q->idx);
+    } else {
+      this->batch_stats.add_probe_length(q->probe_len);
     }
 
     return found; 
@@ -530,27 +610,31 @@ class MultiHashTable : public BaseHashTable {
   }
 #endif
 
-  // TODO.
+  /// A lookup takes the path of the inserts: the line of its key in level 0
+  /// and, if that is full, the probe chain in level 1 (part_id 1).
   uint64_t __find_branched(KVQ *q, ValuePairs &vp, collector_type *collector) {
+    const bool lvl1 = q->part_id;
+    KV *ht = lvl1 ? this->backup_hashtable : this->hashtable;
+    const uint64_t capacity = lvl1 ? lvl1_capacity : lvl0_capacity;
     // hashtable idx where the data should be found
-    size_t idx = q->idx;
+    const size_t start =
+        lvl1 ? q->idx : q->idx & ~(size_t)KEYS_IN_CACHELINE_MASK;
+    size_t idx = start;
+    // slot probed last, for the probe length
+    size_t probed;
     uint64_t found = 0;
 
   try_find:
-    KV *curr = &this->hashtable[idx];
+    probed = idx;
+    KV *curr = &ht[idx];
     uint64_t retry;
     found = curr->find(q, &retry, vp);
 
-    // printf("%s, key = %" PRIu64 " | num_values %u, value %" PRIu64 " (id = %"
-    // PRIu64 ") | found=%ld, retry %ld\n",
-    //          __func__, q->key, vp.first, vp.second[(vp.first - 1) %
-    //                  PREFETCH_FIND_QUEUE_SIZE].value, vp.second[(vp.first -
-    //                  1) % PREFETCH_FIND_QUEUE_SIZE].id, found, retry);
     if (retry) {
       // insert back into queue, and prefetch next bucket.
       // next bucket will be probed in the next run
       idx++;
-      idx = idx & (this->capacity - 1);  // modulo
+      idx = idx & (capacity - 1);  // modulo
 
       // If idx still on a cacheline, keep looking until idx spill over
       if ((idx & KEYS_IN_CACHELINE_MASK) != 0) {
@@ -558,21 +642,24 @@ class MultiHashTable : public BaseHashTable {
       }
 
       // key is at a different cacheline, prefetch and delay the find
-      this->prefetch_read(idx);
+      const size_t next = lvl1 ? idx : q->idx & (lvl1_capacity - 1);
+      this->prefetch_read_backup(next);
 
       this->find_queue[this->find_head].key = q->key;
       this->find_queue[this->find_head].key_id = q->key_id;
-      this->find_queue[this->find_head].idx = idx;
+      this->find_queue[this->find_head].idx = next;
+      this->find_queue[this->find_head].part_id = 1;
+      this->find_queue[this->find_head].probe_len =
+          q->probe_len + probe_distance(start, idx, capacity);
 #ifdef LATENCY_COLLECTION
       this->find_queue[this->find_head].timer_id = q->timer_id;
 #endif
 
       this->find_head += 1;
       this->find_head &= (PREFETCH_FIND_QUEUE_SIZE - 1);
-#ifdef CALC_STATS
-      this->sum_distance_from_bucket++;
-#endif
     } else {
+      this->batch_stats.add_probe_length(
+          q->probe_len + probe_distance(start, probed, capacity));
 #ifdef LATENCY_COLLECTION
       collector->end(q->timer_id);
 #endif
@@ -582,27 +669,41 @@ class MultiHashTable : public BaseHashTable {
   }
 
   auto __find_one(KVQ *q, ValuePairs &vp, collector_type *collector) {
-    if (q->key == this->empty_item.get_key()) {
+    if (__out_of_line(q->key)) {
       return __find_empty(q, vp);
     }
 
-    if constexpr (branching == BRANCHKIND::WithBranch) {
-      return __find_branched(q, vp, collector);
-    } else if constexpr (branching == BRANCHKIND::NoBranch_Simd) {
+    // There is no cmov lookup; it takes the branched one
 #ifdef AVX_SUPPORT
+    if constexpr (branching == BRANCHKIND::NoBranch_Simd) {
       return __find_simd(q, vp);
-#endif
     }
+#endif
+    return __find_branched(q, vp, collector);
+  }
+
+  /// The empty key and TOMBSTONE_KEY mark slots, so their values are kept
+  /// out of the table.
+  bool __out_of_line(key_type key) const {
+    return key == this->empty_item.get_key() || key == TOMBSTONE_KEY;
+  }
+
+  static uint64_t &__slot_of(key_type key) {
+    return key == TOMBSTONE_KEY ? tombstone_slot_ : empty_slot_;
+  }
+
+  static bool &__slot_exists(key_type key) {
+    return key == TOMBSTONE_KEY ? tombstone_slot_exists_ : empty_slot_exists_;
   }
 
-  /// Update or increment the empty key.
+  /// Look up an out of line key.
   uint64_t __find_empty(KVQ *q, ValuePairs &vp) {
-    if (empty_slot_exists_) {
+    if (__slot_exists(q->key)) {
       vp.second[vp.first].id = q->key_id;
-      vp.second[vp.first].value = empty_slot_;
+      vp.second[vp.first].value = __slot_of(q->key);
       vp.first++;
     }
-    return empty_slot_;
+    return __slot_of(q->key);
   }
 
 
@@ -834,23 +935,131 @@ class MultiHashTable : public BaseHashTable {
   }
 
   void __insert_one(KVQ *q, collector_type *collector) {
-    if (q->key == this->empty_item.get_key()) {
+    if (__out_of_line(q->key)) {
       __insert_empty(q);
     } else {
       __insert_branched(q, collector);
     }
   }
 
-  /// Update or increment the empty key.
+  /// Update or increment an out of line key.
   void __insert_empty(KVQ *q) {
+    uint64_t &slot = __slot_of(q->key);
+    bool &exists = __slot_exists(q->key);
     if constexpr (std::is_same_v<KV, Item>) {
-      empty_slot_ = q->value;
+      slot = q->value;
     } else if constexpr (std::is_same_v<KV, Aggr_KV>) {
-      empty_slot_ += q->value;
+      slot += q->value;
+    } else if constexpr (Upserting<KV>) {
+      KV::insert_empty(slot, exists, q->value);
     } else {
       assert(false && "Invalid template type");
     }
-    empty_slot_exists_ = true;
+    exists = true;
+  }
+
+  /// Level 0 lines fill up in order, so the key has spilled to level 1 only
+  /// if its line is full.
+  void __erase_l0(KVQ *q, collector_type *collector) {
+    const size_t line = q->idx & ~(size_t)KEYS_IN_CACHELINE_MASK;
+    for (size_t i = 0; i <= KEYS_IN_CACHELINE_MASK; i++) {
+      KV *curr = &this->hashtable[line + i];
+      if (curr->is_empty()) {
+        goto done;
+      }
+      this->batch_stats.num_memcmps++;
+      if (curr->compare_key(q)) {
+        // If the CAS fails, another thread has erased the key under us
+        curr->erase_cas(q);
+        goto done;
+      }
+    }
+
+    {
+      const size_t queue_idx = q->idx & (lvl1_capacity - 1);
+      this->prefetch_backup(queue_idx);
+      this->erase_queue[this->erase_head].key = q->key;
+      this->erase_queue[this->erase_head].key_id = q->key_id;
+      this->erase_queue[this->erase_head].idx = queue_idx;
+      this->erase_queue[this->erase_head].part_id = 1;
+#ifdef LATENCY_COLLECTION
+      this->erase_queue[this->erase_head].timer_id = q->timer_id;
+#endif
+      ++this->erase_head;
+      this->erase_head &= (PREFETCH_QUEUE_SIZE - 1);
+      this->batch_stats.num_reprobes++;
+      return;
+    }
+
+  done:
+#ifdef LATENCY_COLLECTION
+    collector->end(q->timer_id);
+#endif
+    return;
+  }
+
+  void __erase_l1(KVQ *q, collector_type *collector) {
+    // hashtable idx at which the key is expected
+    size_t idx = q->idx;
+  try_erase:
+    KV *curr = &this->backup_hashtable[idx];
+
+    // end of the probe chain; the key is not in the table
+    if (curr->is_empty()) {
+#ifdef LATENCY_COLLECTION
+      collector->end(q->timer_id);
+#endif
+      return;
+    }
+
+    this->batch_stats.num_memcmps++;
+    if (curr->compare_key(q)) {
+      // If the CAS fails, another thread has erased the key under us
+      curr->erase_cas(q);
+#ifdef LATENCY_COLLECTION
+      collector->end(q->timer_id);
+#endif
+      return;
+    }
+
+    idx++;
+    idx = idx & (lvl1_capacity - 1);  // modulo
+
+    if ((idx & KEYS_IN_CACHELINE_MASK) != 0) {
+      ++this->batch_stats.num_soft_reprobes;
+      goto try_erase;
+    }
+
+    this->prefetch_backup(idx);
+
+    this->erase_queue[this->erase_head].key = q->key;
+    this->erase_queue[this->erase_head].key_id = q->key_id;
+    this->erase_queue[this->erase_head].idx = idx;
+    this->erase_queue[this->erase_head].part_id = 1;
+#ifdef LATENCY_COLLECTION
+    this->erase_queue[this->erase_head].timer_id = q->timer_id;
+#endif
+
+    ++this->erase_head;
+    this->erase_head &= (PREFETCH_QUEUE_SIZE - 1);
+
+    this->batch_stats.num_reprobes++;
+  }
+
+  void __erase_one(KVQ *q, collector_type *collector) {
+    if (__out_of_line(q->key)) {
+      __erase_empty(q);
+    } else if (q->part_id == 0) {
+      __erase_l0(q, collector);
+    } else {
+      __erase_l1(q, collector);
+    }
+  }
+
+  /// Drop an out of line key.
+  void __erase_empty(KVQ *q) {
+    __slot_exists(q->key) = false;
+    __slot_of(q->key) = 0;
   }
 
   uint64_t read_hashtable_element(const void *data) override {
@@ -903,6 +1112,7 @@ class MultiHashTable : public BaseHashTable {
     this->find_queue[this->find_head].key = key_data->key;
     this->find_queue[this->find_head].key_id = key_data->id;
     this->find_queue[this->find_head].part_id = 0;
+    this->find_queue[this->find_head].probe_len = 0;
 
 #ifdef LATENCY_COLLECTION
     this->find_queue[this->find_head].timer_id = timer;
@@ -915,26 +1125,56 @@ class MultiHashTable : public BaseHashTable {
     this->find_head++;
     if (this->find_head >= PREFETCH_FIND_QUEUE_SIZE) this->find_head = 0;
   }
+
+  void add_to_erase_queue(void *data, collector_type *collector) {
+    InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
+
+#ifdef LATENCY_COLLECTION
+    const auto timer = collector->start();
+#endif
+
+    uint64_t hash = this->hash((const char *)&key_data->key);
+    size_t idx = hash & (lvl0_capacity - 1);
+    prefetch(idx);
+
+    this->erase_queue[this->erase_head].idx = idx;
+    this->erase_queue[this->erase_head].key = key_data->key;
+    this->erase_queue[this->erase_head].key_id = key_data->id;
+    this->erase_queue[this->erase_head].part_id = 0;
+
+#ifdef LATENCY_COLLECTION
+    this->erase_queue[this->erase_head].timer_id = timer;
+#endif
+
+    this->erase_head++;
+    if (this->erase_head >= PREFETCH_QUEUE_SIZE) this->erase_head = 0;
+  }
 };
 
 /// Static variables
-template <class KV, class KVQ>
-KV *MultiHashTable<KV, KVQ>::hashtable = nullptr;
+template <class KV, class KVQ, class H>
+KV *MultiHashTable<KV, KVQ, H>::hashtable = nullptr;
+
+template <class KV, class KVQ, class H>
+KV *MultiHashTable<KV, KVQ, H>::backup_hashtable = nullptr;
+
+template <class KV, class KVQ, class H>
+uint64_t MultiHashTable<KV, KVQ, H>::empty_slot_ = 0;
 
-template <class KV, class KVQ>
-KV *MultiHashTable<KV, KVQ>::backup_hashtable = nullptr;
+template <class KV, class KVQ, class H>
+bool MultiHashTable<KV, KVQ, H>::empty_slot_exists_ = false;
 
-template <class KV, class KVQ>
-uint64_t MultiHashTable<KV, KVQ>::empty_slot_ = 0;
+template <class KV, class KVQ, class H>
+uint64_t MultiHashTable<KV, KVQ, H>::tombstone_slot_ = 0;
 
-template <class KV, class KVQ>
-bool MultiHashTable<KV, KVQ>::empty_slot_exists_ = false;
+template <class KV, class KVQ, class H>
+bool MultiHashTable<KV, KVQ, H>::tombstone_slot_exists_ = false;
 
-template <class KV, class KVQ>
-std::mutex MultiHashTable<KV, KVQ>::ht_init_mutex;
+template <class KV, class KVQ, class H>
+std::mutex MultiHashTable<KV, KVQ, H>::ht_init_mutex;
 
-template <class KV, class KVQ>
-uint32_t MultiHashTable<KV, KVQ>::ref_cnt = 0;
+template <class KV, class KVQ, class H>
+uint32_t MultiHashTable<KV, KVQ, H>::ref_cnt = 0;
 }  // namespace kmercounter
 
 #endif
@@ -0,0 +1,96 @@
+/// Prefetch distance of the insert/find queues of a hashtable.
+/// The tables prefetch the slot of a request when it is queued and process
+/// it once `get()` requests are queued behind it, so the depth is how far
+/// ahead of the memory accesses the prefetches run. The right depth depends
+/// on the DRAM latency the thread sees (NUMA placement, hyperthreading), so
+/// with --adaptive-prefetch it is tuned per thread while the run goes: the
+/// cycles per request are measured over epochs of requests and the depth
+/// hill-climbs in steps of DEPTH_STEP between MIN and MAX_PREFETCH_DEPTH,
+/// turning around whenever an epoch got slower than the one before.
+
+#ifndef HASHTABLES_PREFETCH_DEPTH_HPP
+#define HASHTABLES_PREFETCH_DEPTH_HPP
+
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <cstdint>
+
+#include "constants.hpp"
+
+namespace kmercounter {
+
+class PrefetchDepth {
+ public:
+  static constexpr uint32_t MIN_PREFETCH_DEPTH = 4;
+  static constexpr uint32_t DEPTH_STEP = 4;
+  static constexpr uint64_t EPOCH_OPS = 1 << 14;
+
+  // The queues hold a batch on top of the depth
+  static_assert(MAX_PREFETCH_DEPTH * 2 <= PREFETCH_QUEUE_SIZE);
+  static_assert(MAX_PREFETCH_DEPTH * 2 <= PREFETCH_FIND_QUEUE_SIZE);
+
+  /// A `depth` of 0 picks the build's FLUSH_THRESHOLD
+  PrefetchDepth(uint32_t depth, bool adaptive)
+      : depth_(std::clamp(depth ? depth : (uint32_t)FLUSH_THRESHOLD,
+                          MIN_PREFETCH_DEPTH, MAX_PREFETCH_DEPTH)),
+        adaptive_(adaptive) {}
+
+  uint32_t get() const { return this->depth_; }
+
+  /// Called once per batch call with the number of requests it queued
+  void account(uint64_t ops) {
+    this->depth_ops_ += ops * this->depth_;
+    this->total_ops_ += ops;
+    if (!this->adaptive_) return;
+
+    // The first batch only starts the clock
+    if (!this->epoch_start_) [[unlikely]] {
+      this->epoch_start_ = __rdtsc();
+      return;
+    }
+    this->epoch_ops_ += ops;
+    if (this->epoch_ops_ >= EPOCH_OPS) [[unlikely]] {
+      this->adjust();
+    }
+  }
+
+  /// Depth averaged over the requests queued so far
+  double mean() const {
+    return this->total_ops_ ? (double)this->depth_ops_ / this->total_ops_
+                            : this->depth_;
+  }
+
+ private:
+  void adjust() {
+    const uint64_t now = __rdtsc();
+    const double cycles_per_op =
+        (double)(now - this->epoch_start_) / this->epoch_ops_;
+    if (this->last_cycles_per_op_ && cycles_per_op > this->last_cycles_per_op_) {
+      this->step_ = -this->step_;
+    }
+    this->last_cycles_per_op_ = cycles_per_op;
+
+    const int64_t next = (int64_t)this->depth_ + this->step_;
+    if (next < MIN_PREFETCH_DEPTH || next > MAX_PREFETCH_DEPTH) {
+      this->step_ = -this->step_;
+    }
+    this->depth_ += this->step_;
+
+    this->epoch_start_ = now;
+    this->epoch_ops_ = 0;
+  }
+
+  uint32_t depth_;
+  bool adaptive_;
+  int32_t step_ = DEPTH_STEP;
+  uint64_t epoch_start_ = 0;
+  uint64_t epoch_ops_ = 0;
+  double last_cycles_per_op_ = 0;
+  uint64_t depth_ops_ = 0;
+  uint64_t total_ops_ = 0;
+};
+
+}  // namespace kmercounter
+
+#endif  // HASHTABLES_PREFETCH_DEPTH_HPP
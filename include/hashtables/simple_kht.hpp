@@ -1,6 +1,8 @@
 /// Partitioned hashtable.
 /// Each partition is a linear probing with SIMD lookup.
 /// Key and values are stored directly in the table.
+/// With --ht-grow-threshold, a partition whose fill crosses the threshold
+/// doubles and rehashes itself; the other partitions keep their size.
 
 #ifndef _SKHT_H
 #define _SKHT_H
@@ -16,19 +18,25 @@
 
 //#include <linux/getcpu.h>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <mutex>
 #include <tuple>
 #include <type_traits>
 
 #include "constants.hpp"
+#include "coro_lookup.hpp"
 #include "experiments.hpp"
 #include "fastrange.h"
 #include "hasher.hpp"
 #include "helper.hpp"
 #include "ht_helper.hpp"
+#include "ht_profile.hpp"
+#include "ht_scan.hpp"
+#include "ht_snapshot.hpp"
 #include "misc_lib.h"
 #include "plog/Log.h"
 #include "sync.h"
@@ -106,17 +114,33 @@ constexpr std::uint32_t histogram_buckets{1 << histogram_bits};
 constexpr std::uint32_t histogram_mask{histogram_buckets - 1};
 extern thread_local std::vector<unsigned int> hash_histogram;
 
-template <typename KV, typename KVQ>
+template <typename KV, typename KVQ, typename H = Hasher>
 class alignas(64) PartitionedHashStore : public BaseHashTable {
  public:
   static KV **hashtable;
   static int *fds;
+  /// The table of a partition and its capacity, published together (see
+  /// partitions_). A grow publishes a new one instead of changing it.
+  struct Partition {
+    KV *ht;
+    uint64_t capacity;
+  };
   int id;
   size_t data_length, key_length;
+  static constexpr uint64_t KEYS_IN_CACHELINE_MASK =
+      std::max<size_t>(CACHE_LINE_SIZE / sizeof(KV), 1) - 1;
+  /// The branchless inserts only count (Aggr_KV) or overwrite (Item); the
+  /// other KV types, e.g. the combiners of Upsert_KV, insert branched. Keys
+  /// passed by reference overwrite with cmov, but have no SIMD insert.
+  static constexpr BRANCHKIND insert_branching =
+      (std::is_same_v<KV, Aggr_KV> || std::is_same_v<KV, Item>) ? branching
+      : (KeyByReference<KV> && branching == BRANCHKIND::NoBranch_Cmove)
+          ? branching
+          : BRANCHKIND::WithBranch;
   /// A dedicated slot for the empty value.
-  uint64_t empty_slot_;
+  uint64_t empty_slot_ = 0;
   /// True if the empty value is inserted.
-  bool empty_slot_exists_;
+  bool empty_slot_exists_ = false;
 
   // https://www.bfilipek.com/2019/08/newnew-align.html
   void *operator new(std::size_t size, std::align_val_t align) {
@@ -154,18 +178,15 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
 #endif
   };
 
-  void prefetch_partition(uint64_t idx, int _part_id, bool write) {
-    if (idx > this->capacity) [[unlikely]] {
+  void prefetch_partition(uint64_t idx, const Partition *part, bool write) {
+    if (idx > part->capacity) [[unlikely]] {
       std::terminate();
     }
 
-    auto p = _part_id;
     if (write) {
-      prefetch_object<true>((void *)&this->hashtable[p][idx],
-                            sizeof(this->hashtable[p][idx]));
+      prefetch_object<true>((void *)&part->ht[idx], sizeof(part->ht[idx]));
     } else {
-      prefetch_object<false>((void *)&this->hashtable[p][idx],
-                             sizeof(this->hashtable[p][idx]));
+      prefetch_object<false>((void *)&part->ht[idx], sizeof(part->ht[idx]));
     }
   };
 
@@ -194,7 +215,13 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
   };
 
   PartitionedHashStore(uint64_t c, uint8_t id)
-      : id(id), find_head(0), find_tail(0), ins_head(0), ins_tail(0) {
+      : id(id),
+        find_head(0),
+        find_tail(0),
+        ins_head(0),
+        ins_tail(0),
+        erase_head(0),
+        erase_tail(0) {
     this->capacity = c;
 
     {
@@ -219,11 +246,20 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     // paranoid check. id should be unique
     assert(this->hashtable[this->id] == nullptr);
 
+    if (!config.ht_snapshot_in.empty()) {
+      this->__map_snapshot();
+    } else {
+      // Allocate for this id
+      this->hashtable[this->id] =
+          (KV *)calloc_ht<KV>(this->capacity, this->id, &this->fds[this->id]);
+    }
     this->ht_sz = this->capacity * sizeof(KV);
-
-    // Allocate for this id
-    this->hashtable[this->id] =
-        (KV *)calloc_ht<KV>(this->capacity, this->id, &this->fds[this->id]);
+    this->part_ = new Partition{this->hashtable[this->id], this->capacity};
+    partitions_[this->id].store(this->part_, std::memory_order_release);
+    this->grow_at_ = this->__grow_at();
+    if (this->grow_at_ != std::numeric_limits<uint64_t>::max()) {
+      this->epoch_slot_ = &epoch_slots_[this->id];
+    }
     this->empty_item = this->empty_item.get_empty_key();
     this->key_length = empty_item.key_length();
     this->data_length = empty_item.data_length();
@@ -233,11 +269,15 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
         (KVQ *)(aligned_alloc(64, PREFETCH_QUEUE_SIZE * sizeof(KVQ)));
     this->find_queue =
         (KVQ *)(aligned_alloc(64, PREFETCH_FIND_QUEUE_SIZE * sizeof(KVQ)));
+    this->erase_queue =
+        (KVQ *)(aligned_alloc(64, PREFETCH_QUEUE_SIZE * sizeof(KVQ)));
 
     memset(this->insert_queue, 0x0, PREFETCH_QUEUE_SIZE * sizeof(KVQ));
 
     memset(this->find_queue, 0x0, PREFETCH_FIND_QUEUE_SIZE * sizeof(KVQ));
 
+    memset(this->erase_queue, 0x0, PREFETCH_QUEUE_SIZE * sizeof(KVQ));
+
     PLOG_DEBUG.printf("id: %d insert_queue %p | find_queue %p", id,
                       this->insert_queue, this->find_queue);
     PLOGV.printf("Hashtable base %p | Hashtable size: %lu | data_length %lu",
@@ -246,11 +286,19 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
   }
 
   ~PartitionedHashStore() {
+    free(erase_queue);
     free(find_queue);
     free(insert_queue);
+    if (this->epoch_slot_) {
+      this->epoch_slot_->epoch.store(IDLE_EPOCH);
+    }
+    this->__free_retired(true);
+    partitions_[this->id].store(nullptr);
+    delete this->part_;
     free_mem<KV>(this->hashtable[this->id], this->capacity, this->id,
                  this->fds[this->id]);
     this->hashtable[this->id] = nullptr;
+    this->fds[this->id] = 0;
   }
 
 #ifdef AVX_SUPPORT
@@ -434,10 +482,9 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
             nidx >= this->capacity ? (nidx - this->capacity) : nidx;  // modulo
         idx = nidx;
         i += inc_idx;
-#ifdef CALC_STATS
-        this->num_reprobes++;
-#endif
+        this->batch_stats.num_reprobes++;
       } else {
+        this->fill_ += (copy_mask != 0);
         if constexpr (std::is_same_v<KV, Aggr_KV>) {
           blend(cacheline, kv_vector, copy_mask);
           increment_count(cacheline, val_mask);
@@ -476,16 +523,16 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     for (auto i = 0u; i < this->capacity; i++) {
       KV *curr = &cur_ht[idx];
       auto retry = false;
+      const bool was_empty = curr->is_empty();
 
       retry = curr->insert(key_data);
 
       if (retry) {
         idx++;
         idx = idx == this->capacity ? 0 : idx;  // modulo
-#ifdef CALC_STATS
-        this->num_reprobes++;
-#endif
+        this->batch_stats.num_reprobes++;
       } else {
+        this->fill_ += was_empty;
 #ifdef LATENCY_COLLECTION
         collector->sync_end(start_time);
 #endif
@@ -501,29 +548,42 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
 
   void insert_noprefetch(const void *data, collector_type* collector) override {
 #ifdef LATENCY_COLLECTION
-    static_assert(branching == BRANCHKIND::WithBranch, "Latency collection only supported with branched insertion");
+    static_assert(insert_branching == BRANCHKIND::WithBranch, "Latency collection only supported with branched insertion");
 #endif
 
-    if constexpr (branching == BRANCHKIND::WithBranch) {
+    if constexpr (insert_branching == BRANCHKIND::WithBranch) {
       __insert_noprefetch_branched(data, collector);
-    } else if constexpr (branching == BRANCHKIND::NoBranch_Simd) {
+    } else if constexpr (insert_branching == BRANCHKIND::NoBranch_Simd) {
       #ifdef AVX_SUPPORT
         __insert_noprefetch_simd(data);
       #else
         __insert_noprefetch_branched(data, collector);
       #endif 
     }
+
+    if (this->fill_ >= this->grow_at_) [[unlikely]] {
+      this->__grow();
+    }
+    this->fold_stats();
   }
 
   // insert a batch
   void insert_batch(const InsertFindArguments &kp, collector_type* collector) override {
     this->flush_if_needed(collector);
 
-    for (auto &data : kp) {
-      add_to_insert_queue(&data, collector);
-    }
+    this->__for_each_located(
+        kp,
+        [this](auto &data, uint64_t hash) {
+          this->prefetch(
+              fastrange32(this->__queued_hash(data, hash), this->capacity));
+        },
+        [&](auto &data, uint64_t hash) {
+          add_to_insert_queue(&data, hash, collector);
+        });
 
     this->flush_if_needed(collector);
+    this->insert_depth.account(kp.size());
+    this->fold_stats();
   }
 
   bool insert(const void *data) { return false; }
@@ -534,7 +594,7 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
   void flush_if_needed(collector_type* collector) {
     size_t curr_queue_sz =
         (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
-    while (curr_queue_sz >= INS_FLUSH_THRESHOLD) {
+    while (curr_queue_sz >= this->insert_depth.get()) {
       __insert_one(&this->insert_queue[this->ins_tail], collector);
       this->ins_tail = (this->ins_tail + 1) & (PREFETCH_QUEUE_SIZE - 1);
       curr_queue_sz =
@@ -553,18 +613,22 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
       curr_queue_sz =
           (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
     }
+    this->fold_stats();
   }
 
   void flush_find_queue(ValuePairs &vp, collector_type* collector) override {
     size_t curr_queue_sz =
         (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
 
+    this->__enter();
     while ((curr_queue_sz != 0) && (vp.first < config.batch_len)) {
       __find_one(&this->find_queue[this->find_tail], vp, collector);
       if (++this->find_tail >= PREFETCH_FIND_QUEUE_SIZE) this->find_tail = 0;
       curr_queue_sz =
           (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
     }
+    this->__exit();
+    this->fold_stats();
   }
 
   void flush_if_needed(ValuePairs &vp, collector_type* collector) {
@@ -572,7 +636,7 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
         (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
     // make sure you return at most batch_sz (but can possibly return lesser
     // number of elements)
-    while ((curr_queue_sz > FLUSH_THRESHOLD) &&
+    while ((curr_queue_sz > this->find_depth.get()) &&
            (vp.first < config.batch_len)) {
       // cout << "Finding value for key " <<
       // this->find_queue[this->find_tail].key << " at tail : " <<
@@ -596,27 +660,89 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     // of them can be reaped 3) The prefetch queue is half-full -> we can
     // enqueue half the batch, process the queue and enqueue the leftover items
 
+    this->__enter();
+    if (config.coro_lookups) {
+      this->__find_batch_coro(kp, values, collector);
+      this->__exit();
+      this->fold_stats();
+      return;
+    }
+
     // cout << "-> flush_before head: " << this->find_head << " tail: " <<
     // this->find_tail << endl;
     this->flush_if_needed(values, collector);
     // cout << "== > post flush_before head: " << this->find_head << " tail: "
     // << this->find_tail << endl;
 
-    for (auto &data : kp) {
-      add_to_find_queue(&data, collector);
-    }
+    this->__for_each_located(
+        kp,
+        [this](auto &data, uint64_t hash) {
+          const Partition *part = this->__view(data.part_id);
+          this->prefetch_partition(
+              fastrange32(this->__queued_hash(data, hash), part->capacity),
+              part, false);
+        },
+        [&](auto &data, uint64_t hash) {
+          add_to_find_queue(&data, hash, collector);
+        });
 
     // cout << "-> flush_after head: " << this->find_head << " tail: " <<
     // this->find_tail << endl;
     this->flush_if_needed(values, collector);
+    this->find_depth.account(kp.size());
     // cout << "== > post flush_after head: " << this->find_head << " tail: " <<
     // this->find_tail << endl;
+    this->__exit();
+    this->fold_stats();
+  }
+
+  /// Each partition has a single writer, so erased entries are removed with
+  /// backward-shift deletion and no tombstones are left behind. Like inserts,
+  /// erases only touch the partition owned by this instance.
+  void erase_batch(const InsertFindArguments &kp, collector_type* collector) override {
+    this->flush_erase_if_needed(collector);
+
+    // the slot gets written if the key is found
+    this->__for_each_located(
+        kp,
+        [this](auto &, uint64_t hash) {
+          this->prefetch(fastrange32(hash, this->capacity));
+        },
+        [&](auto &data, uint64_t hash) {
+          add_to_erase_queue(&data, hash, collector);
+        });
+
+    this->flush_erase_if_needed(collector);
+    this->erase_depth.account(kp.size());
+    this->fold_stats();
+  }
+
+  void flush_erase_if_needed(collector_type* collector) {
+    size_t curr_queue_sz =
+        (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    while (curr_queue_sz >= this->erase_depth.get()) {
+      __erase_one(&this->erase_queue[this->erase_tail], collector);
+      this->erase_tail = (this->erase_tail + 1) & (PREFETCH_QUEUE_SIZE - 1);
+      curr_queue_sz =
+          (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+  }
+
+  void flush_erase_queue(collector_type* collector) override {
+    size_t curr_queue_sz =
+        (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz != 0) {
+      __erase_one(&this->erase_queue[this->erase_tail], collector);
+      this->erase_tail = (this->erase_tail + 1) & (PREFETCH_QUEUE_SIZE - 1);
+      curr_queue_sz =
+          (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+    this->fold_stats();
   }
 
   void *find_noprefetch(const void *data, collector_type* collector) override {
-#ifdef CALC_STATS
     uint64_t distance_from_bucket = 0;
-#endif
     InsertFindArgument *item = const_cast<InsertFindArgument *>(reinterpret_cast<const InsertFindArgument *>(data));
 
 #ifdef LATENCY_COLLECTION
@@ -624,21 +750,24 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
 #endif
     uint64_t hash;//, key;
     size_t idx;
+    this->__enter();
+    const Partition *part = this->__view(item->part_id);
+    const uint64_t capacity = part->capacity;
 #if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
     hash = item->key >> 32;
     item->key &= 0xffffffff;
-    idx = fastrange32(_mm_crc32_u32(0xffffffff, hash), this->capacity);
+    idx = fastrange32(_mm_crc32_u32(0xffffffff, hash), capacity);
 #else
     hash = this->hash((const char *)&item->key);
-    idx = fastrange32(hash, this->capacity);
+    idx = fastrange32(hash, capacity);
 #endif
 
-    KV *cur_ht = this->hashtable[item->part_id];
+    KV *cur_ht = part->ht;
     KV *curr;
 
     bool found = false;
 
-    for (auto i = 0u; i < this->capacity; i++) {
+    for (auto i = 0u; i < capacity; i++) {
       curr = &cur_ht[idx];
 
       if (curr->compare_key(item)) {
@@ -648,18 +777,11 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
         goto exit;
       }
 
-#ifdef CALC_STATS
       distance_from_bucket++;
-#endif
       idx++;
-      idx = idx == this->capacity ? 0 : idx;
+      idx = idx == capacity ? 0 : idx;
     }
-#ifdef CALC_STATS
-    if (distance_from_bucket > this->max_distance_from_bucket) {
-      this->max_distance_from_bucket = distance_from_bucket;
-    }
-    this->sum_distance_from_bucket += distance_from_bucket;
-#endif
+    this->batch_stats.add_probe_length(distance_from_bucket);
 
 #ifdef LATENCY_COLLECTION
     collector->sync_end(start_time);
@@ -672,40 +794,25 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
              hash);
       curr = nullptr;
     }
+    this->__exit();
+    this->fold_stats();
     return curr;
   }
 
+  // A partition is scanned by the shard that owns it; the shards already
+  // scan their partitions in parallel.
   void display() const override {
-    KV *ht = this->hashtable[this->id];
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (!ht[i].is_empty()) {
-        cout << ht[i] << endl;
-      }
-    }
+    scan_print(__scanner(), 1, std::cout);
   }
 
-  size_t get_fill() const override {
-    size_t count = 0;
-    KV *ht = this->hashtable[this->id];
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (!ht[i].is_empty()) {
-        count++;
-      }
-    }
-    return count;
-  }
+  size_t get_fill() const override { return scan_fill(__scanner(), 1); }
 
   size_t get_capacity() const override { return this->capacity; }
 
+  bool is_shared() const override { return false; }
+
   size_t get_max_count() const override {
-    size_t count = 0;
-    KV *ht = this->hashtable[this->id];
-    for (size_t i = 0; i < this->capacity; i++) {
-      if (ht[i].get_value() > count) {
-        count = ht[i].get_value();
-      }
-    }
-    return count;
+    return scan_max_count(__scanner(), 1);
   }
 
   void print_to_file(std::string &outfile) const override {
@@ -714,12 +821,37 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
       PLOG_ERROR.printf("Could not open outfile %s", outfile.c_str());
       return;
     }
-    KV *ht = this->hashtable[this->id];
-    for (size_t i = 0; i < this->get_capacity(); i++) {
-      if (!ht[i].is_empty()) {
-        f << ht[i] << std::endl;
-      }
-    }
+    scan_print(__scanner(), 1, f);
+  }
+
+  void scan(unsigned num_threads, const ScanCallback &cb) const override {
+    __scanner()(num_threads, [&cb](unsigned tid, KV &kv) {
+      cb(tid, KeyValuePair(kv.get_key(), kv.get_value()));
+    });
+  }
+
+  bool save_snapshot(const std::string &path) const override {
+    auto hdr = make_snapshot_header<KV, H>(PARTITIONED_HT, this->capacity);
+    hdr.fill = this->fill_;
+    hdr.empty_slot = this->empty_slot_;
+    hdr.empty_slot_exists = this->empty_slot_exists_;
+    return write_snapshot(path, hdr, this->hashtable[this->id]);
+  }
+
+  bool save_profile(const std::string &path) override {
+#if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
+    // The stored keys no longer carry the hash they were placed with
+    PLOG_ERROR.printf("Cannot profile a partition without the key hashes");
+    return false;
+#else
+    const uint64_t capacity = this->capacity;
+    const auto prof =
+        profile_table(this->hashtable[this->id], capacity, [&](KV &kv) {
+          const uint64_t key = kv.get_key();
+          return fastrange32(this->hash(&key), capacity);
+        });
+    return write_profile(path, prof);
+#endif
   }
 
   size_t get_ht_size() const { return this->ht_sz; }
@@ -732,17 +864,362 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
   KVQ *queue;    // TODO prefetch this?
   KVQ *find_queue;
   KVQ *insert_queue;
+  KVQ *erase_queue;
   uint32_t find_head;
   uint32_t find_tail;
   uint32_t ins_head;
   uint32_t ins_tail;
-  Hasher hasher_;
+  uint32_t erase_head;
+  uint32_t erase_tail;
+  H hasher_;
+  /// Number of keys in this partition.
+  uint64_t fill_ = 0;
+  /// Fill at which this partition doubles.
+  uint64_t grow_at_;
+
+  /// Epoch published by instances that are not reading the partitions.
+  static constexpr uint64_t IDLE_EPOCH = std::numeric_limits<uint64_t>::max();
+
+  /// The epoch an instance reads the partitions in, or IDLE_EPOCH. Lookups
+  /// read the partitions of other instances, so a partition that grew keeps
+  /// its old table until every reader has moved past the epoch it was
+  /// replaced in.
+  struct alignas(CACHE_LINE_SIZE) EpochSlot {
+    std::atomic<uint64_t> epoch{IDLE_EPOCH};
+  };
 
-  uint64_t hash(const void *k) { return hasher_(k, this->key_length); }
+  /// A table replaced by a grow, freed once no lookup can be reading it.
+  struct Retired {
+    const Partition *part;
+    int fd;
+    /// First epoch in which the table is unreachable.
+    uint64_t epoch;
+  };
+
+  /// Bumped by every grow, after the new table is published.
+  static std::atomic<uint64_t> cur_epoch_;
+  /// Indexed by the partition id.
+  static std::array<EpochSlot, MAX_PARTITIONS> epoch_slots_;
+  /// The current table of every partition, indexed by its id. Lookups into
+  /// another partition read its table through this, never through
+  /// `hashtable` and `capacity` separately, which its owner changes apart.
+  static std::array<std::atomic<const Partition *>, MAX_PARTITIONS>
+      partitions_;
+
+  /// The table of this partition, owned by this instance.
+  Partition *part_ = nullptr;
+  /// The tables this instance reads the partitions through until
+  /// `__exit`, those of the bits of `viewed_` that are set.
+  std::array<const Partition *, MAX_PARTITIONS> views_;
+  uint64_t viewed_ = 0;
+
+  /// Null unless the partitions are allowed to grow.
+  EpochSlot *epoch_slot_ = nullptr;
+  uint32_t section_depth_ = 0;
+  /// Tables of this partition replaced by a grow and not freed yet.
+  std::vector<Retired> retired_;
+  /// Lookups of the batch in flight with --coro-lookups, with their hashes
+  std::vector<std::pair<const InsertFindArgument *, uint64_t>> coro_batch_;
+
+  uint64_t hash(const void *k) {
+    if constexpr (KeyByReference<KV>) {
+      return KV::hash_key(hasher_, *static_cast<const key_type *>(k));
+    } else {
+      return hasher_(k, this->key_length);
+    }
+  }
+
+  /// Look up a batch on config.coro_lookups interleaved coroutines (see
+  /// hashtables/coro_lookup.hpp) instead of the find queue.
+  void __find_batch_coro(const InsertFindArguments &kp, ValuePairs &vp,
+                         collector_type* collector) {
+    this->coro_batch_.clear();
+    this->__for_each_hashed(kp, [&](auto &data, uint64_t hash) {
+      this->coro_batch_.emplace_back(&data, hash);
+    });
+
+    size_t next = 0;
+    run_interleaved(config.coro_lookups, [&] {
+      return this->__find_worker(next, vp, collector);
+    });
+  }
+
+  /// Takes the lookups of `coro_batch_` from `next` on until there are none
+  /// left, suspending whenever it has to wait for a cacheline.
+  CoroTask __find_worker(size_t &next, ValuePairs &vp,
+                         collector_type* collector) {
+    while (next < this->coro_batch_.size()) {
+      auto [arg, hash] = this->coro_batch_[next++];
+
+      KVQ q{};
+      q.key = arg->key;
+      q.key_id = arg->id;
+      q.part_id = arg->part_id;
+#ifdef LATENCY_COLLECTION
+      q.timer_id = collector->start();
+#endif
+#if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
+      if (bq_load == BQUEUE_LOAD::HtInsert) {
+        hash = arg->key >> 32;
+        q.key = arg->key & 0xFFFFFFFF;
+      }
+#endif
+      if (q.key == this->empty_item.get_key()) {
+        this->__find_empty(&q, vp);
+        continue;
+      }
+
+      const Partition *part = this->__view(q.part_id);
+      const uint64_t capacity = part->capacity;
+      KV *ht = part->ht;
+      size_t idx = fastrange32(hash, capacity);
+      const size_t home = idx;
+      this->prefetch_partition(idx, part, false);
+      co_await PrefetchSuspend{};
+
+      for (;;) {
+        KV *curr = &ht[idx];
+        q.idx = idx;
+        uint64_t retry;
+#ifdef AVX_SUPPORT
+        if constexpr (LineProbe<KV>) {
+          const size_t offset = idx & KEYS_IN_CACHELINE_MASK;
+          if ((idx | KEYS_IN_CACHELINE_MASK) < capacity) {
+            (curr - offset)->find_simd(&q, &retry, vp, offset);
+            idx |= KEYS_IN_CACHELINE_MASK;
+          } else {
+            curr->find(&q, &retry, vp);
+          }
+        } else
+#endif
+        {
+          curr->find(&q, &retry, vp);
+        }
+        if (!retry) break;
+
+        idx = idx + 1 == capacity ? 0 : idx + 1;
+        if ((idx & KEYS_IN_CACHELINE_MASK) == 0) {
+          this->prefetch_partition(idx, part, false);
+          co_await PrefetchSuspend{};
+        }
+      }
+      this->batch_stats.add_probe_length(probe_distance(home, q.idx, capacity));
+
+#ifdef LATENCY_COLLECTION
+      collector->end(q.timer_id);
+#endif
+    }
+  }
+
+  /// Visit the arguments of a batch along with the hashes of their keys,
+  /// which are computed HASH_BATCH_SIZE at a time. `locate(arg, hash)` is
+  /// called on the whole group before the first visit, so that the
+  /// prefetches of a group go out back to back.
+  template <typename L, typename F>
+  void __for_each_located(const InsertFindArguments &kp, L &&locate, F &&f) {
+    uint64_t hashes[HASH_BATCH_SIZE];
+    for (size_t i = 0; i < kp.size(); i += HASH_BATCH_SIZE) {
+      const size_t n = std::min<size_t>(HASH_BATCH_SIZE, kp.size() - i);
+      if constexpr (KeyByReference<KV>) {
+        for (size_t j = 0; j < n; j++) hashes[j] = this->hash(&kp[i + j].key);
+      } else {
+        hash_keys(hasher_, &kp[i].key, sizeof(InsertFindArgument), n,
+                  this->key_length, hashes);
+      }
+      for (size_t j = 0; j < n; j++) locate(kp[i + j], hashes[j]);
+      for (size_t j = 0; j < n; j++) f(kp[i + j], hashes[j]);
+    }
+  }
+
+  template <typename F>
+  void __for_each_hashed(const InsertFindArguments &kp, F &&f) {
+    this->__for_each_located(kp, [](auto &, uint64_t) {}, f);
+  }
+
+  /// The hash an inserted or looked up key is placed by. The queue producers
+  /// may pass it in the upper bits of the key instead.
+  uint64_t __queued_hash(const InsertFindArgument &arg, uint64_t hash) const {
+#if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
+    if (bq_load == BQUEUE_LOAD::HtInsert) [[likely]] {
+      return arg.key >> 32;
+    }
+#endif
+    return hash;
+  }
+
+  auto __scanner() const {
+    return [this](unsigned num_threads, auto &&f) {
+      scan_table(this->hashtable[this->id], this->capacity, num_threads, f);
+    };
+  }
+
+  /// Take over this partition's table from its snapshot. The snapshot sets
+  /// the capacity.
+  void __map_snapshot() {
+    const auto path = snapshot_path(config.ht_snapshot_in, this->id);
+    SnapshotHeader hdr;
+    KV *ht = map_snapshot<KV, H>(path, PARTITIONED_HT, &hdr);
+    if (!ht) {
+      PLOG_FATAL.printf("Couldn't load partition %d from %s", this->id,
+                        path.c_str());
+      exit(-1);
+    }
+
+    this->hashtable[this->id] = ht;
+    this->fds[this->id] = SNAPSHOT_FD;
+    this->capacity = hdr.capacity;
+    this->fill_ = hdr.fill;
+    this->empty_slot_ = hdr.empty_slot;
+    this->empty_slot_exists_ = hdr.empty_slot_exists;
+  }
+
+  uint64_t __grow_at() const {
+#if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
+    // The stored keys no longer carry the hash they were placed with
+    return std::numeric_limits<uint64_t>::max();
+#else
+    if (config.ht_grow_threshold <= 0 ||
+        2 * this->capacity > MAX_HT_CAPACITY) {
+      return std::numeric_limits<uint64_t>::max();
+    }
+    return static_cast<uint64_t>(config.ht_grow_threshold * this->capacity);
+#endif
+  }
+
+  /// Publish the epoch this instance reads the partitions in. The epoch is
+  /// read again after it is published, so that a grow either waits for this
+  /// instance or has its new table visible to it.
+  void __enter() {
+    if (this->section_depth_++ > 0) return;
+    this->viewed_ = 0;
+    if (!this->epoch_slot_) return;
+
+    uint64_t epoch = cur_epoch_.load();
+    for (;;) {
+      this->epoch_slot_->epoch.store(epoch);
+      const uint64_t now = cur_epoch_.load();
+      if (now == epoch) break;
+      epoch = now;
+    }
+  }
+
+  void __exit() {
+    if (--this->section_depth_ > 0 || !this->epoch_slot_) return;
+    this->epoch_slot_->epoch.store(IDLE_EPOCH, std::memory_order_release);
+  }
+
+  /// The table partition `p` is read through in this section: the one it
+  /// had when the section first looked, so that a grow meanwhile does not
+  /// change the capacity under a probe.
+  const Partition *__view(uint32_t p) {
+    const uint64_t bit = 1ULL << p;
+    if (!(this->viewed_ & bit)) {
+      this->views_[p] = partitions_[p].load(std::memory_order_acquire);
+      this->viewed_ |= bit;
+    }
+    return this->views_[p];
+  }
+
+  /// The table a queued lookup goes on probing. The lookup keeps in its
+  /// value the capacity its idx is into; if the partition grew since, it
+  /// starts over from its home slot in the new table, which holds every key
+  /// of the old one.
+  const Partition *__view_queued(KVQ *q) {
+    const Partition *part = this->__view(q->part_id);
+    if (q->value != part->capacity) [[unlikely]] {
+      q->idx = fastrange32(this->hash(&q->key), part->capacity);
+      q->value = part->capacity;
+      q->probe_len = 0;
+    }
+    return part;
+  }
+
+  /// True if no instance reads the partitions in an epoch older than `epoch`.
+  static bool __none_older(uint64_t epoch) {
+    for (auto &slot : epoch_slots_) {
+      if (slot.epoch.load() < epoch) return false;
+    }
+    return true;
+  }
+
+  /// Free the retired tables nobody can be reading anymore, or, with `wait`,
+  /// wait for the readers and free them all.
+  void __free_retired(bool wait) {
+    auto it = this->retired_.begin();
+    for (; it != this->retired_.end(); it++) {
+      if (!wait && !__none_older(it->epoch)) break;
+      while (!__none_older(it->epoch)) {
+        _mm_pause();
+      }
+      free_mem<KV>(it->part->ht, it->part->capacity, this->id, it->fd);
+      delete it->part;
+    }
+    // Tables are retired in epoch order
+    this->retired_.erase(this->retired_.begin(), it);
+  }
+
+  size_t __home(key_type key) {
+    return fastrange32(this->hash(&key), this->capacity);
+  }
+
+  /// Double this partition. Only this instance writes to it, so the entries
+  /// are rehashed into the new table in one go before it is published.
+  /// Lookups from other instances may still be reading the old table, which
+  /// is retired until they have moved on; they can miss keys inserted while
+  /// the partition grows, but not the ones it held.
+  void __grow() {
+    KV *old_ht = this->part_->ht;
+    const uint64_t old_capacity = this->capacity;
+    const int old_fd = this->fds[this->id];
+
+    this->capacity = old_capacity << 1;
+    KV *cur_ht = calloc_ht<KV>(this->capacity, this->id, &this->fds[this->id]);
+
+    for (size_t i = 0; i < old_capacity; i++) {
+      if (old_ht[i].is_empty()) {
+        continue;
+      }
+
+      size_t idx = __home(old_ht[i].get_key());
+      while (!cur_ht[idx].is_empty()) {
+        idx++;
+        idx = idx == this->capacity ? 0 : idx;  // modulo
+      }
+      cur_ht[idx] = old_ht[i];
+    }
+
+    Partition *old_part = this->part_;
+    this->part_ = new Partition{cur_ht, this->capacity};
+    this->hashtable[this->id] = cur_ht;
+    partitions_[this->id].store(this->part_, std::memory_order_release);
+    this->viewed_ &= ~(1ULL << this->id);
+    const uint64_t epoch = cur_epoch_.fetch_add(1) + 1;
+    this->retired_.push_back({old_part, old_fd, epoch});
+    this->__free_retired(false);
+    this->ht_sz = this->capacity * sizeof(KV);
+    this->grow_at_ = this->__grow_at();
+
+    // Queued entries still carry their probe position in the old table.
+    // Lookups find out from the capacity they carry (__view_queued).
+    for (auto i = this->ins_tail; i != this->ins_head;
+         i = (i + 1) & (PREFETCH_QUEUE_SIZE - 1)) {
+      this->insert_queue[i].idx = __home(this->insert_queue[i].key);
+    }
+    for (auto i = this->erase_tail; i != this->erase_head;
+         i = (i + 1) & (PREFETCH_QUEUE_SIZE - 1)) {
+      this->erase_queue[i].idx = __home(this->erase_queue[i].key);
+    }
+
+    PLOGV.printf("Partition %d grew %lu -> %lu (fill %lu)", this->id,
+                 old_capacity, this->capacity, this->fill_);
+  }
 
   uint64_t __find_branched(KVQ *q, ValuePairs &vp, collector_type* collector) {
+    const Partition *part = this->__view_queued(q);
     // hashtable idx where the data should be found
     size_t idx = q->idx;
+    // slot probed last, for the probe length
+    size_t probed;
     uint64_t found = 0;
     // unsigned int cpu, node;
 
@@ -750,9 +1227,26 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
   try_find:
     // printf("%s, cpu: %d part_id %d idx %d\n", __func__, cpu, q->part_id,
     // idx);
-    KV *curr = &this->hashtable[q->part_id][idx];
+    probed = idx;
+    KV *curr = &part->ht[idx];
     uint64_t retry;
-    found = curr->find(q, &retry, vp);
+#ifdef AVX_SUPPORT
+    if constexpr (LineProbe<KV>) {
+      // All the keys of the cacheline are compared at once, so a miss moves
+      // on to the next line. A line cut short by the end of the partition is
+      // probed slot by slot.
+      const size_t offset = idx & KEYS_IN_CACHELINE_MASK;
+      if ((idx | KEYS_IN_CACHELINE_MASK) < part->capacity) {
+        found = (curr - offset)->find_simd(q, &retry, vp, offset);
+        idx |= KEYS_IN_CACHELINE_MASK;
+      } else {
+        found = curr->find(q, &retry, vp);
+      }
+    } else
+#endif
+    {
+      found = curr->find(q, &retry, vp);
+    }
 
     // printf("%s, key = %" PRIu64 " | found = %d\n", __func__, q->key, found);
     //  printf("%s, key = %" PRIu64 " | num_values %u, value %" PRIu64 " (id = %" PRIu64 ") | found
@@ -764,30 +1258,30 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
       // insert back into queue, and prefetch next bucket.
       // next bucket will be probed in the next run
       idx++;
-      idx = idx == this->capacity ? 0 : idx;  // modulo
-      // |    4 elements |
-      // | 0 | 1 | 2 | 3 | 4 | 5 ....
-      if ((idx & 0x3) != 0) {
+      idx = idx == part->capacity ? 0 : idx;  // modulo
+      // If idx still on a cacheline, keep looking until idx spill over
+      if ((idx & KEYS_IN_CACHELINE_MASK) != 0) {
         goto try_find;
       }
 
-      this->prefetch_partition(idx, q->part_id, false);
+      this->prefetch_partition(idx, part, false);
 
       this->find_queue[this->find_head].key = q->key;
       this->find_queue[this->find_head].key_id = q->key_id;
       this->find_queue[this->find_head].idx = idx;
+      this->find_queue[this->find_head].value = part->capacity;
       this->find_queue[this->find_head].part_id = q->part_id;
+      this->find_queue[this->find_head].probe_len =
+          q->probe_len + probe_distance(q->idx, idx, part->capacity);
 #ifdef LATENCY_COLLECTION
       this->find_queue[this->find_head].timer_id = q->timer_id;
 #endif
 
       this->find_head += 1;
       this->find_head &= (PREFETCH_FIND_QUEUE_SIZE - 1);
-
-#ifdef CALC_STATS
-      this->sum_distance_from_bucket++;
-#endif
     } else {
+      this->batch_stats.add_probe_length(
+          q->probe_len + probe_distance(q->idx, probed, part->capacity));
 #ifdef LATENCY_COLLECTION
       collector->end(q->timer_id);
 #endif
@@ -797,11 +1291,12 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
   }
 
   uint64_t __find_branchless_cmov(KVQ *q, ValuePairs &vp) {
+    const Partition *part = this->__view_queued(q);
     // hashtable idx where the data should be found
     size_t idx = q->idx;
     uint64_t found = 0;
 
-    KV *curr = &this->hashtable[q->part_id][idx];
+    KV *curr = &part->ht[idx];
     uint64_t retry = 1;
 
     found = curr->find_brless(q, &retry, vp);
@@ -809,11 +1304,17 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     // insert back into queue, and prefetch next bucket.
     // next bucket will be probed in the next run
     idx++;
-    idx = idx == this->capacity ? 0 : idx;  // modulo
+    idx = idx == part->capacity ? 0 : idx;  // modulo
+    if (retry == 0) {
+      this->batch_stats.add_probe_length(q->probe_len);
+    }
     this->find_queue[this->find_head].key = q->key;
     this->find_queue[this->find_head].key_id = q->key_id;
     this->find_queue[this->find_head].idx = idx;
-    this->prefetch_read(idx);
+    this->find_queue[this->find_head].value = part->capacity;
+    this->find_queue[this->find_head].part_id = q->part_id;
+    this->find_queue[this->find_head].probe_len = q->probe_len + 1;
+    this->prefetch_partition(idx, part, false);
 
     // this->find_head should not be incremented if either
     // the desired key is empty or it is found.
@@ -829,6 +1330,7 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
   uint64_t __find_branchless_simd(KVQ *q, ValuePairs &vp) {
     static_assert(sizeof(KV) == KV_SIZE);
 
+    const Partition *part = this->__view_queued(q);
     // hashtable idx at which data is to be found
     size_t idx = q->idx;
     // index within the cacheline
@@ -836,7 +1338,7 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     // index at which current cacheline starts
     const size_t ccidx = idx - cidx;
     // pointer to current cacheline
-    KV *cptr = &this->hashtable[q->part_id][idx & ~(KV_PER_CACHE_LINE - 1)];
+    KV *cptr = &part->ht[idx & ~(KV_PER_CACHE_LINE - 1)];
 
     auto load_key_vector = [q]() {
       // we want to load only the keys into a ZMM register, as two 32-bit
@@ -859,7 +1361,7 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
 
     // compute index at which there is a key match
     //size_t midx = _bit_scan_forward(eq_cmp) >> 1;
-    const KV *match = &this->hashtable[q->part_id][idx];
+    const KV *match = &part->ht[idx];
 
     //PLOGV.printf("match found? key %lu | key_id %lu | value %lu", q->key, q->key_id, match->get_value());
 
@@ -890,22 +1392,25 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
         : [found] "r"(found), [empty_cmp] "r"(empty_cmp));
 
     if (reprobe) {
-#ifdef CALC_STATS
-      this->max_distance_from_bucket++;
-#endif
       // index at which reprobe must begin
+      const uint64_t capacity = part->capacity;
       size_t ridx = ccidx + reprobe * KV_PER_CACHE_LINE;
-      ridx = (ridx >= this->capacity) ? (ridx - this->capacity) : ridx;  // modulo
+      ridx = (ridx >= capacity) ? (ridx - capacity) : ridx;  // modulo
 
-      this->prefetch_partition(ridx, q->part_id, false);
+      this->prefetch_partition(ridx, part, false);
 
       this->find_queue[this->find_head].key = q->key;
       this->find_queue[this->find_head].key_id = q->key_id;
       this->find_queue[this->find_head].idx = ridx;
+      this->find_queue[this->find_head].value = capacity;
       this->find_queue[this->find_head].part_id = q->part_id;
+      this->find_queue[this->find_head].probe_len =
+          q->probe_len + probe_distance(idx, ridx, capacity);
 
       this->find_head += reprobe;
       this->find_head &= (PREFETCH_FIND_QUEUE_SIZE - 1);
+    } else {
+      this->batch_stats.add_probe_length(q->probe_len);
     }
     return found;
   }
@@ -949,10 +1454,12 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
   try_insert:
     KV *curr = &cur_ht[idx];
     auto retry = false;
+    const bool was_empty = curr->is_empty();
     // if constexpr (experiment_inactive(experiment_type::insert_dry_run,
     //                                   experiment_type::aggr_kv_write_key_only))
     //PLOGV.printf("Inserting key %lu", q->key);
     retry = curr->insert(q);
+    this->fill_ += was_empty;
 
     // if constexpr (experiment_active(experiment_type::aggr_kv_write_key_only))
     // {
@@ -966,12 +1473,9 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
       idx++;
       idx = idx == this->capacity ? 0 : idx;  // modulo
 
-      // |    4 elements |
-      // | 0 | 1 | 2 | 3 | 4 | 5 ....
-      if ((idx & 0x3) != 0) {
-#ifdef CALC_STATS
-        ++this->num_soft_reprobes;
-#endif
+      // If idx still on a cacheline, keep looking until idx spill over
+      if ((idx & KEYS_IN_CACHELINE_MASK) != 0) {
+        ++this->batch_stats.num_soft_reprobes;
 
         goto try_insert;
       }
@@ -990,9 +1494,7 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
       ++this->ins_head;
       this->ins_head &= (PREFETCH_QUEUE_SIZE - 1);
 
-#ifdef CALC_STATS
-      this->num_reprobes++;
-#endif
+      this->batch_stats.num_reprobes++;
     }
   }
 
@@ -1000,6 +1502,7 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     // hashtable idx at which data is to be inserted
     size_t idx = q->idx;
     KV *curr = &this->hashtable[this->id][idx];
+    this->fill_ += curr->is_empty();
     // returns 1 succeeded
     uint8_t cmp = curr->insert_or_update_v2(q);
 
@@ -1010,6 +1513,7 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     prefetch(idx);
     this->insert_queue[this->ins_head].key = q->key;
     this->insert_queue[this->ins_head].key_id = q->key_id;
+    this->insert_queue[this->ins_head].value = q->value;
     this->insert_queue[this->ins_head].idx = idx;
 
     // this->queue_idx should not be incremented if either
@@ -1018,6 +1522,7 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     inc = (cmp == 0xff) ? 0 : inc;
     this->ins_head += inc;
     this->ins_head &= (PREFETCH_QUEUE_SIZE - 1);
+    this->batch_stats.num_reprobes += inc;
   }
 
 #ifdef AVX_SUPPORT
@@ -1182,6 +1687,8 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     __mmask8 val_mask = key_mask << 1;
     __mmask8 kv_mask = key_mask | val_mask;
 
+    this->fill_ += (copy_mask != 0);
+
 #ifdef PURE_BRANCHLESS
     if constexpr (std::is_same_v<KV, Aggr_KV>) {
       blend(cacheline, kv_vector, copy_mask);
@@ -1248,15 +1755,15 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     }
 
 #ifdef LATENCY_COLLECTION
-    static_assert(branching == BRANCHKIND::WithBranch, "Latency collection only supported with branched insertion");
+    static_assert(insert_branching == BRANCHKIND::WithBranch, "Latency collection only supported with branched insertion");
 #endif
 
     if constexpr (experiment_inactive(experiment_type::nop_insert)) {
-      if constexpr (branching == BRANCHKIND::WithBranch) {
+      if constexpr (insert_branching == BRANCHKIND::WithBranch) {
         __insert_branched(q, collector);
-      } else if constexpr (branching == BRANCHKIND::NoBranch_Cmove) {
+      } else if constexpr (insert_branching == BRANCHKIND::NoBranch_Cmove) {
         __insert_branchless_cmov(q);
-      } else if constexpr (branching == BRANCHKIND::NoBranch_Simd) {
+      } else if constexpr (insert_branching == BRANCHKIND::NoBranch_Simd) {
         #ifdef AVX_SUPPORT
           __insert_branchless_simd(q); 
         #else 
@@ -1264,6 +1771,10 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
         #endif
       }
     }
+
+    if (this->fill_ >= this->grow_at_) [[unlikely]] {
+      this->__grow();
+    }
   }
 
   /// Update or increment the empty key.
@@ -1272,12 +1783,107 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
       empty_slot_ = q->value;
     } else if constexpr (std::is_same_v<KV, Aggr_KV>) {
       empty_slot_ += q->value;
+    } else if constexpr (Upserting<KV>) {
+      KV::insert_empty(empty_slot_, empty_slot_exists_, q->value);
     } else {
       assert(false && "Invalid template type");
     }
     empty_slot_exists_ = true;
   }
 
+  void __erase_branched(KVQ *q, collector_type* collector) {
+    // hashtable idx at which the key is expected
+    size_t idx = q->idx;
+    KV *cur_ht = this->hashtable[this->id];
+  try_erase:
+    KV *curr = &cur_ht[idx];
+
+    // end of the probe chain; the key is not in the table
+    if (curr->is_empty()) {
+#ifdef LATENCY_COLLECTION
+      collector->end(q->timer_id);
+#endif
+      return;
+    }
+
+    if (curr->compare_key(q)) {
+      __backward_shift(cur_ht, idx);
+      this->fill_--;
+#ifdef LATENCY_COLLECTION
+      collector->end(q->timer_id);
+#endif
+      return;
+    }
+
+    idx++;
+    idx = idx == this->capacity ? 0 : idx;  // modulo
+
+    // If idx still on a cacheline, keep looking until idx spill over
+    if ((idx & KEYS_IN_CACHELINE_MASK) != 0) {
+      ++this->batch_stats.num_soft_reprobes;
+      goto try_erase;
+    }
+
+    prefetch(idx);
+
+    this->erase_queue[this->erase_head].key = q->key;
+    this->erase_queue[this->erase_head].key_id = q->key_id;
+    this->erase_queue[this->erase_head].idx = idx;
+#ifdef LATENCY_COLLECTION
+    this->erase_queue[this->erase_head].timer_id = q->timer_id;
+#endif
+
+    ++this->erase_head;
+    this->erase_head &= (PREFETCH_QUEUE_SIZE - 1);
+
+    this->batch_stats.num_reprobes++;
+  }
+
+  /// Fill the hole at `hole` by moving back every entry of the following run
+  /// whose home slot does not lie (cyclically) in (hole, idx]. The last hole
+  /// is then emptied.
+  /// NOTE: with BQ_KEY_UPPER_BITS_HAS_HASH the home slot is recomputed from
+  /// the stored key, which only matches if producers hashed the same bits.
+  void __backward_shift(KV *cur_ht, size_t hole) {
+    size_t idx = hole;
+
+    for (auto i = 1u; i < this->capacity; i++) {
+      idx++;
+      idx = idx == this->capacity ? 0 : idx;  // modulo
+      KV *curr = &cur_ht[idx];
+
+      if (curr->is_empty()) {
+        break;
+      }
+
+      key_type key = curr->get_key();
+      size_t home = fastrange32(this->hash(&key), this->capacity);
+
+      bool in_place = (hole < idx) ? (hole < home && home <= idx)
+                                   : (hole < home || home <= idx);
+      if (!in_place) {
+        cur_ht[hole] = *curr;
+        hole = idx;
+        this->batch_stats.num_swaps++;
+      }
+    }
+
+    cur_ht[hole] = this->empty_item;
+  }
+
+  void __erase_one(KVQ *q, collector_type* collector) {
+    if (q->key == this->empty_item.get_key()) {
+      return __erase_empty(q);
+    }
+    __erase_branched(q, collector);
+  }
+
+  /// Drop the empty key.
+  void __erase_empty(KVQ *q) {
+    empty_slot_exists_ = false;
+    empty_slot_ = 0;
+  }
+
   uint64_t read_hashtable_element(const void *data) {
     std::terminate();  // TODO: if you want to use this, we don't use pow2
                        // capacities anymore
@@ -1301,39 +1907,27 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     }
   }
 
-  void add_to_insert_queue(void *data, collector_type* collector) {
+  void add_to_insert_queue(void *data, uint64_t hash,
+                           collector_type* collector) {
     InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
-    uint64_t hash = 0;
-    uint64_t key = 0;
+    uint64_t key = key_data->key;
 
-    if (bq_load == BQUEUE_LOAD::HtInsert) [[likely]] {
 #if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
-      hash = key_data->key >> 32;
+    if (bq_load == BQUEUE_LOAD::HtInsert) [[likely]] {
       key = key_data->key & 0xFFFFFFFF;
-#else
-      hash = this->hash((const char *)&key_data->key);
-      key = key_data->key;
-#endif
-    } else {
-      hash = this->hash((const char *)&key_data->key);
-      key = key_data->key;
     }
+#endif
+    hash = this->__queued_hash(*key_data, hash);
 
     // The hashes have little to no upper-bit entropy _because of how they are
     // assigned to the queues_
     size_t idx;
     idx = fastrange32(hash, this->capacity);  // modulo
 
-    //PLOGD.printf("Getting idx %zu", idx);
-    if (idx > this->capacity) [[unlikely]] {
-      PLOG_ERROR.printf("%u > %" PRIu64 "\n", idx, this->capacity);
-      std::terminate();
-    }
-
 #if defined(HASH_HISTOGRAM)
     ++hash_histogram.at(idx & histogram_mask);
 #endif
-    this->prefetch(idx);
+    // prefetched by __for_each_located
 
     // if constexpr (experiment_inactive(experiment_type::prefetch_only)) {
     this->insert_queue[this->ins_head].idx = idx;
@@ -1349,37 +1943,54 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
     //}
   }
 
-  void add_to_find_queue(void *data, collector_type* collector) {
+  void add_to_erase_queue(void *data, uint64_t hash,
+                          collector_type* collector) {
     InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
-    uint64_t hash = 0;
-    uint64_t key = 0;
 
 #ifdef LATENCY_COLLECTION
     const auto time = collector->start();
 #endif
 
-    if (bq_load == BQUEUE_LOAD::HtInsert) {
+    size_t idx = fastrange32(hash, this->capacity);  // modulo
+    // prefetched by __for_each_located
+
+    this->erase_queue[this->erase_head].idx = idx;
+    this->erase_queue[this->erase_head].key = key_data->key;
+    this->erase_queue[this->erase_head].key_id = key_data->id;
+#ifdef LATENCY_COLLECTION
+    this->erase_queue[this->erase_head].timer_id = time;
+#endif
+
+    this->erase_head = (this->erase_head + 1) & (PREFETCH_QUEUE_SIZE - 1);
+  }
+
+  void add_to_find_queue(void *data, uint64_t hash,
+                         collector_type* collector) {
+    InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
+    uint64_t key = key_data->key;
+
+#ifdef LATENCY_COLLECTION
+    const auto time = collector->start();
+#endif
+
 #if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
-      hash = key_data->key >> 32;
+    if (bq_load == BQUEUE_LOAD::HtInsert) {
       key = key_data->key & 0xFFFFFFFF;
-#else
-      hash = this->hash((const char *)&key_data->key);
-      key = key_data->key;
-#endif
-    } else {
-      hash = this->hash((const char *)&key_data->key);
-      key = key_data->key;
     }
+#endif
+    hash = this->__queued_hash(*key_data, hash);
 
+    const uint64_t capacity = this->__view(key_data->part_id)->capacity;
     size_t idx;
-    idx = fastrange32(hash, this->capacity);  // modulo
-
-    this->prefetch_partition(idx, key_data->part_id, false);
+    idx = fastrange32(hash, capacity);  // modulo
+    // prefetched by __for_each_located
 
     this->find_queue[this->find_head].idx = idx;
+    this->find_queue[this->find_head].value = capacity;
     this->find_queue[this->find_head].key = key;
     this->find_queue[this->find_head].key_id = key_data->id;
     this->find_queue[this->find_head].part_id = key_data->part_id;
+    this->find_queue[this->find_head].probe_len = 0;
 #ifdef LATENCY_COLLECTION
     this->find_queue[this->find_head].timer_id = time;
 #endif
@@ -1393,14 +2004,27 @@ class alignas(64) PartitionedHashStore : public BaseHashTable {
   }
 };
 
-template <class KV, class KVQ>
-KV **PartitionedHashStore<KV, KVQ>::hashtable;
+template <class KV, class KVQ, class H>
+KV **PartitionedHashStore<KV, KVQ, H>::hashtable;
+
+template <class KV, class KVQ, class H>
+std::mutex PartitionedHashStore<KV, KVQ, H>::ht_init_mutex;
+
+template <class KV, class KVQ, class H>
+int *PartitionedHashStore<KV, KVQ, H>::fds;
+
+template <class KV, class KVQ, class H>
+std::array<std::atomic<const typename PartitionedHashStore<KV, KVQ, H>::Partition *>,
+           MAX_PARTITIONS>
+    PartitionedHashStore<KV, KVQ, H>::partitions_;
 
-template <class KV, class KVQ>
-std::mutex PartitionedHashStore<KV, KVQ>::ht_init_mutex;
+template <class KV, class KVQ, class H>
+std::atomic<uint64_t> PartitionedHashStore<KV, KVQ, H>::cur_epoch_{0};
 
-template <class KV, class KVQ>
-int *PartitionedHashStore<KV, KVQ>::fds;
+template <class KV, class KVQ, class H>
+std::array<typename PartitionedHashStore<KV, KVQ, H>::EpochSlot,
+           MAX_PARTITIONS>
+    PartitionedHashStore<KV, KVQ, H>::epoch_slots_;
 
 // std::vector<std::mutex> PartitionedArrayHashTable:: hashtable_mutexes;
 
@@ -0,0 +1,675 @@
+/// Swiss table style hashtable with a separate array of control bytes.
+/// Every slot has a control byte holding a 7-bit fingerprint of its key's
+/// hash. The control bytes of a group of slots are matched against the
+/// fingerprint at once with SIMD (64 per cacheline with AVX-512, 16 with
+/// SSE), so that most lookups of absent keys, as in the probe phase of a
+/// join with a low match rate, only touch the control bytes. Groups are
+/// probed linearly, and finds and inserts prefetch the control bytes of the
+/// first group.
+/// Like the CAS hashtable, there is at max one instance of the table and all
+/// threads share it. Slots are claimed by a CAS on their control byte and
+/// published once their key is written; erased slots are marked deleted
+/// and are never reused.
+
+#ifndef HASHTABLES_SWISS_KHT_HPP
+#define HASHTABLES_SWISS_KHT_HPP
+
+#include <immintrin.h>
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <type_traits>
+
+#include "constants.hpp"
+#include "hasher.hpp"
+#include "helper.hpp"
+#include "ht_helper.hpp"
+#include "ht_scan.hpp"
+#include "plog/Log.h"
+#include "sync.h"
+
+namespace kmercounter {
+template <typename KV, typename KVQ, typename H = Hasher>
+class SwissHashTable : public BaseHashTable {
+  static_assert(!KeyByReference<KV>, "Keys are compared by value");
+
+ public:
+#ifdef AVX_SUPPORT
+  static constexpr uint32_t GROUP_SIZE = 64;
+  using group_mask = uint64_t;
+  using group_ctrl = __m512i;
+#else
+  static constexpr uint32_t GROUP_SIZE = 16;
+  using group_mask = uint32_t;
+  using group_ctrl = __m128i;
+#endif
+  /// Control bytes. Full slots have the top bit set and the fingerprint in
+  /// the low 7 bits.
+  static constexpr uint8_t CTRL_EMPTY = 0x00;
+  static constexpr uint8_t CTRL_BUSY = 0x01;
+  static constexpr uint8_t CTRL_DELETED = 0x02;
+  static constexpr uint8_t CTRL_FULL = 0x80;
+
+  /// The global instance is shared by all threads.
+  static KV *hashtable;
+  static uint8_t *ctrl;
+  /// A dedicated slot for the empty value.
+  static uint64_t empty_slot_;
+  /// True if the empty value is inserted.
+  static bool empty_slot_exists_;
+  /// File descriptor backs the memory
+  static int fd;
+  int id;
+  size_t data_length, key_length;
+
+  SwissHashTable(uint64_t c)
+      : id(1),
+        find_head(0),
+        find_tail(0),
+        ins_head(0),
+        ins_tail(0),
+        erase_head(0),
+        erase_tail(0) {
+    {
+      const std::lock_guard<std::mutex> lock(ht_init_mutex);
+      if (!this->hashtable) {
+        assert(this->ref_cnt == 0);
+        capacity = std::max<uint64_t>(kmercounter::utils::next_pow2(c),
+                                      GROUP_SIZE);
+        num_groups = capacity / GROUP_SIZE;
+        this->hashtable = calloc_ht<KV>(capacity, this->id, &this->fd);
+        ctrl = (uint8_t *)(aligned_alloc(CACHE_LINE_SIZE, capacity));
+        memset(ctrl, CTRL_EMPTY, capacity);
+      }
+      this->ref_cnt++;
+    }
+    this->empty_item = this->empty_item.get_empty_key();
+    this->key_length = empty_item.key_length();
+    this->data_length = empty_item.data_length();
+
+    this->insert_queue =
+        (KVQ *)(aligned_alloc(64, PREFETCH_QUEUE_SIZE * sizeof(KVQ)));
+    this->find_queue =
+        (KVQ *)(aligned_alloc(64, PREFETCH_FIND_QUEUE_SIZE * sizeof(KVQ)));
+    this->erase_queue =
+        (KVQ *)(aligned_alloc(64, PREFETCH_QUEUE_SIZE * sizeof(KVQ)));
+
+    PLOGV.printf("[INFO] Hashtable size: %lu, %lu groups of %u", capacity,
+                 num_groups, GROUP_SIZE);
+    PLOGV.printf("%s, data_length %lu\n", __func__, this->data_length);
+  }
+
+  ~SwissHashTable() {
+    free(find_queue);
+    free(insert_queue);
+    free(erase_queue);
+    if (this->stats.num_failed_inserts) {
+      PLOG_ERROR.printf("Dropped %lu inserts, the swiss hashtable is full",
+                        this->stats.num_failed_inserts);
+    }
+    // Deallocate the global hashtable if ref_cnt goes down to zero.
+    {
+      const std::lock_guard<std::mutex> lock(ht_init_mutex);
+      this->ref_cnt--;
+      if (this->ref_cnt == 0) {
+        free_mem<KV>(this->hashtable, capacity, this->id, this->fd);
+        this->hashtable = nullptr;
+        free(ctrl);
+        ctrl = nullptr;
+        empty_slot_ = 0;
+        empty_slot_exists_ = false;
+      }
+    }
+  }
+
+  void prefetch_queue(QueueType qtype) override {}
+
+  void insert_noprefetch(const void *data, collector_type *collector) override {
+#ifdef LATENCY_COLLECTION
+    const auto timer_start = collector->sync_start();
+#endif
+    const KVQ *elem = reinterpret_cast<const KVQ *>(data);
+
+    KVQ q{};
+    q.key = elem->key;
+    q.value = elem->value;
+    const uint64_t hash = this->hash(&q.key);
+    q.idx = this->__group_of(hash);
+    q.part_id = this->__tag_of(hash);
+    this->__insert_one(&q);
+
+#ifdef LATENCY_COLLECTION
+    collector->sync_end(timer_start);
+#endif
+    this->fold_stats();
+  }
+
+  /// Insert an InsertFindArgument right away, false if the table is full.
+  bool insert(const void *data) override {
+    const InsertFindArgument *item =
+        reinterpret_cast<const InsertFindArgument *>(data);
+
+    KVQ q{};
+    q.key = item->key;
+    q.value = item->value;
+    const uint64_t hash = this->hash(&q.key);
+    q.idx = this->__group_of(hash);
+    q.part_id = this->__tag_of(hash);
+    const uint64_t failed = this->stats.num_failed_inserts;
+    this->__insert_one(&q);
+
+    this->fold_stats();
+    return this->stats.num_failed_inserts == failed;
+  }
+
+  // insert a batch
+  void insert_batch(const InsertFindArguments &kp,
+                    collector_type *collector) override {
+    this->flush_if_needed(collector);
+
+    this->__for_each_hashed(kp, [&](auto &data, uint64_t hash) {
+      add_to_insert_queue(&data, hash, collector);
+    });
+
+    this->flush_if_needed(collector);
+    this->insert_depth.account(kp.size());
+    this->fold_stats();
+  }
+
+  void flush_if_needed(collector_type *collector) {
+    size_t curr_queue_sz =
+        (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz >= this->insert_depth.get()) {
+      __insert_one(&this->insert_queue[this->ins_tail], collector);
+      if (++this->ins_tail >= PREFETCH_QUEUE_SIZE) this->ins_tail = 0;
+      curr_queue_sz =
+          (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+  }
+
+  void flush_insert_queue(collector_type *collector) override {
+    size_t curr_queue_sz =
+        (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz != 0) {
+      __insert_one(&this->insert_queue[this->ins_tail], collector);
+      if (++this->ins_tail >= PREFETCH_QUEUE_SIZE) this->ins_tail = 0;
+      curr_queue_sz =
+          (this->ins_head - this->ins_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+    this->fold_stats();
+  }
+
+  void flush_find_queue(ValuePairs &vp, collector_type *collector) override {
+    size_t curr_queue_sz =
+        (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
+
+    while ((curr_queue_sz != 0) && (vp.first < config.batch_len)) {
+      __find_one(&this->find_queue[this->find_tail], vp, collector);
+      if (++this->find_tail >= PREFETCH_FIND_QUEUE_SIZE) this->find_tail = 0;
+      curr_queue_sz =
+          (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
+    }
+    this->fold_stats();
+  }
+
+  void flush_if_needed(ValuePairs &vp, collector_type *collector) {
+    size_t curr_queue_sz =
+        (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
+
+    while ((curr_queue_sz > this->find_depth.get()) && (vp.first < config.batch_len)) {
+      __find_one(&this->find_queue[this->find_tail], vp, collector);
+      if (++this->find_tail >= PREFETCH_FIND_QUEUE_SIZE) this->find_tail = 0;
+      curr_queue_sz =
+          (this->find_head - this->find_tail) & (PREFETCH_FIND_QUEUE_SIZE - 1);
+    }
+  }
+
+  void find_batch(const InsertFindArguments &kp, ValuePairs &values,
+                  collector_type *collector) override {
+    this->flush_if_needed(values, collector);
+
+    this->__for_each_hashed(kp, [&](auto &data, uint64_t hash) {
+      add_to_find_queue(&data, hash, collector);
+    });
+
+    this->flush_if_needed(values, collector);
+    this->find_depth.account(kp.size());
+    this->fold_stats();
+  }
+
+  void erase_batch(const InsertFindArguments &kp,
+                   collector_type *collector) override {
+    this->flush_erase_if_needed(collector);
+
+    this->__for_each_hashed(kp, [&](auto &data, uint64_t hash) {
+      add_to_erase_queue(&data, hash, collector);
+    });
+
+    this->flush_erase_if_needed(collector);
+    this->erase_depth.account(kp.size());
+    this->fold_stats();
+  }
+
+  void flush_erase_if_needed(collector_type *collector) {
+    size_t curr_queue_sz =
+        (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz >= this->erase_depth.get()) {
+      __erase_one(&this->erase_queue[this->erase_tail], collector);
+      if (++this->erase_tail >= PREFETCH_QUEUE_SIZE) this->erase_tail = 0;
+      curr_queue_sz =
+          (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+  }
+
+  void flush_erase_queue(collector_type *collector) override {
+    size_t curr_queue_sz =
+        (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+
+    while (curr_queue_sz != 0) {
+      __erase_one(&this->erase_queue[this->erase_tail], collector);
+      if (++this->erase_tail >= PREFETCH_QUEUE_SIZE) this->erase_tail = 0;
+      curr_queue_sz =
+          (this->erase_head - this->erase_tail) & (PREFETCH_QUEUE_SIZE - 1);
+    }
+    this->fold_stats();
+  }
+
+  void *find_noprefetch(const void *data, collector_type *collector) override {
+#ifdef LATENCY_COLLECTION
+    const auto timer_start = collector->sync_start();
+#endif
+    const InsertFindArgument *item =
+        reinterpret_cast<const InsertFindArgument *>(data);
+
+    const uint64_t hash = this->hash(&item->key);
+    KV *curr = this->__lookup(item->key, this->__group_of(hash),
+                              this->__tag_of(hash));
+
+#ifdef LATENCY_COLLECTION
+    collector->sync_end(timer_start);
+#endif
+    this->fold_stats();
+    return curr;
+  }
+
+  void display() const override {
+    scan_print(__scanner(), scan_threads(), std::cout);
+  }
+
+  size_t get_fill() const override {
+    return scan_fill(__scanner(), scan_threads());
+  }
+
+  size_t get_capacity() const override { return capacity; }
+
+  bool is_shared() const override { return true; }
+
+  size_t get_max_count() const override {
+    return scan_max_count(__scanner(), scan_threads());
+  }
+
+  void scan(unsigned num_threads, const ScanCallback &cb) const override {
+    __scanner()(num_threads, [&cb](unsigned tid, KV &kv) {
+      cb(tid, KeyValuePair(kv.get_key(), kv.get_value()));
+    });
+  }
+
+  /// Snapshots hold the slots only, not the control bytes, and profiles are
+  /// of linear probing; both options are rejected for this table.
+  bool save_snapshot(const std::string &path) const override {
+    PLOGE.printf("Couldn't write snapshot %s: unsupported for the swiss "
+                 "hashtable",
+                 path.c_str());
+    return false;
+  }
+
+  bool save_profile(const std::string &path) override {
+    PLOGE.printf("Couldn't write profile %s: unsupported for the swiss "
+                 "hashtable",
+                 path.c_str());
+    return false;
+  }
+
+  void print_to_file(std::string &outfile) const override {
+    std::ofstream f(outfile);
+    if (!f) {
+      PLOG_ERROR.printf("Could not open outfile %s", outfile.c_str());
+      return;
+    }
+    scan_print(__scanner(), max_scan_threads(), f);
+  }
+
+  uint64_t read_hashtable_element(const void *data) override {
+    const key_type key = *reinterpret_cast<const key_type *>(data);
+    const uint64_t hash = this->hash(&key);
+    const KV *curr =
+        this->__lookup(key, this->__group_of(hash), this->__tag_of(hash));
+    return curr ? curr->get_value() : 0;
+  }
+
+ private:
+  /// Assure thread-safety in constructor and destructor.
+  static std::mutex ht_init_mutex;
+  /// Reference counter of the global `hashtable`.
+  static uint32_t ref_cnt;
+  static uint64_t capacity;
+  static uint64_t num_groups;
+
+  KV empty_item;
+  KVQ *find_queue;
+  KVQ *insert_queue;
+  KVQ *erase_queue;
+  uint32_t find_head;
+  uint32_t find_tail;
+  uint32_t ins_head;
+  uint32_t ins_tail;
+  uint32_t erase_head;
+  uint32_t erase_tail;
+  H hasher_;
+
+  uint64_t hash(const void *k) { return hasher_(k, this->key_length); }
+
+  /// The group comes from the low bits of the hash and the fingerprint from
+  /// the top ones.
+  uint32_t __group_of(uint64_t hash) const { return hash & (num_groups - 1); }
+
+  uint8_t __tag_of(uint64_t hash) const { return CTRL_FULL | (hash >> 57); }
+
+  /// The control bytes of a group, read with a single aligned load. The
+  /// matches of a probe step all come from one such snapshot, so that they
+  /// agree with each other.
+  static group_ctrl __load(const uint8_t *group) {
+#ifdef AVX_SUPPORT
+    const group_ctrl g = _mm512_load_si512(group);
+#else
+    const group_ctrl g = _mm_load_si128((const __m128i *)group);
+#endif
+    // The keys of the full slots are read after their control bytes
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return g;
+  }
+
+  /// Bit i is set if control byte i of the group is `c`.
+  static group_mask __match(group_ctrl g, uint8_t c) {
+#ifdef AVX_SUPPORT
+    return _mm512_cmpeq_epi8_mask(g, _mm512_set1_epi8(c));
+#else
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c)));
+#endif
+  }
+
+  /// Call `f(slot)` for the slots of the group whose control byte matches,
+  /// until it returns true.
+  template <typename F>
+  static bool __for_each_match(uint32_t g, group_mask m, F &&f) {
+    for (; m; m &= m - 1) {
+      if (f(&hashtable[(uint64_t)g * GROUP_SIZE + __builtin_ctzll(m)])) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  KV *__lookup(key_type key, uint32_t g, uint8_t tag) const {
+    for (uint64_t i = 0; i < num_groups; i++, g = (g + 1) & (num_groups - 1)) {
+      const group_ctrl group = __load(&ctrl[(uint64_t)g * GROUP_SIZE]);
+      KV *found = nullptr;
+      if (__for_each_match(g, __match(group, tag), [&](KV *slot) {
+            found = slot;
+            return slot->get_key() == key;
+          })) {
+        return found;
+      }
+      // The key would have been put in the first group with an empty slot
+      if (__match(group, CTRL_EMPTY)) {
+        break;
+      }
+    }
+    return nullptr;
+  }
+
+  auto __scanner() const {
+    return [this](unsigned num_threads, auto &&f) {
+      // Erased slots keep their key, only the control byte tells them apart
+      scan_table(this->hashtable, capacity, num_threads,
+                 [this, &f](unsigned tid, KV &kv) {
+                   if (ctrl[&kv - this->hashtable] & CTRL_FULL) {
+                     f(tid, kv);
+                   }
+                 });
+    };
+  }
+
+  /// Visit the arguments of a batch along with the hashes of their keys,
+  /// which are computed HASH_BATCH_SIZE at a time.
+  template <typename F>
+  void __for_each_hashed(const InsertFindArguments &kp, F &&f) {
+    uint64_t hashes[HASH_BATCH_SIZE];
+    for (size_t i = 0; i < kp.size(); i += HASH_BATCH_SIZE) {
+      const size_t n = std::min<size_t>(HASH_BATCH_SIZE, kp.size() - i);
+      hash_keys(hasher_, &kp[i].key, sizeof(InsertFindArgument), n,
+                this->key_length, hashes);
+      for (size_t j = 0; j < n; j++) f(kp[i + j], hashes[j]);
+    }
+  }
+
+  uint64_t __find_branched(KVQ *q, ValuePairs &vp, collector_type *collector) {
+    const KV *curr = this->__lookup(q->key, q->idx, q->part_id);
+    if (curr) {
+      vp.second[vp.first].id = q->key_id;
+      vp.second[vp.first].value = curr->get_value();
+      vp.first++;
+    }
+
+#ifdef LATENCY_COLLECTION
+    collector->end(q->timer_id);
+#endif
+    return curr != nullptr;
+  }
+
+  void __find_one(KVQ *q, ValuePairs &vp, collector_type *collector) {
+    if (q->key == this->empty_item.get_key()) {
+      __find_empty(q, vp);
+    } else {
+      __find_branched(q, vp, collector);
+    }
+  }
+
+  uint64_t __find_empty(KVQ *q, ValuePairs &vp) {
+    if (empty_slot_exists_) {
+      vp.second[vp.first].id = q->key_id;
+      vp.second[vp.first].value = empty_slot_;
+      vp.first++;
+    }
+    return empty_slot_;
+  }
+
+  /// Control bytes only go from empty to busy to full to deleted, and every
+  /// insert claims the first empty slot of a snapshot of the group without
+  /// the key or a busy slot in it. Inserts of the same key thus race for the
+  /// same empty slot: had the other one claimed an earlier slot, the snapshot
+  /// would show it busy or full. The loser retries and finds the key of the
+  /// winner once it is published.
+  void __insert_branched(KVQ *q) {
+    const uint8_t tag = q->part_id;
+    uint32_t g = q->idx;
+
+    for (uint64_t i = 0; i < num_groups; i++, g = (g + 1) & (num_groups - 1)) {
+      uint8_t *ctrl_group = &ctrl[(uint64_t)g * GROUP_SIZE];
+    retry:
+      const group_ctrl group = __load(ctrl_group);
+      if (__for_each_match(g, __match(group, tag), [q](KV *slot) {
+            if (slot->get_key() != q->key) return false;
+            slot->update_cas(q);
+            return true;
+          })) {
+        return;
+      }
+
+      // A slot that is being written may hold the same key
+      if (group_mask busy = __match(group, CTRL_BUSY)) {
+        for (; busy; busy &= busy - 1) {
+          while (__atomic_load_n(&ctrl_group[__builtin_ctzll(busy)],
+                                 __ATOMIC_ACQUIRE) == CTRL_BUSY) {
+            _mm_pause();
+          }
+        }
+        goto retry;
+      }
+
+      if (group_mask empty = __match(group, CTRL_EMPTY)) {
+        const uint32_t s = __builtin_ctzll(empty);
+        if (!__sync_bool_compare_and_swap(&ctrl_group[s], CTRL_EMPTY,
+                                          CTRL_BUSY)) {
+          goto retry;
+        }
+        this->hashtable[(uint64_t)g * GROUP_SIZE + s].insert(q);
+        __atomic_store_n(&ctrl_group[s], tag, __ATOMIC_RELEASE);
+        this->batch_stats.num_memcpys++;
+        return;
+      }
+
+      this->batch_stats.num_reprobes++;
+    }
+    this->stats.num_failed_inserts++;
+  }
+
+  void __insert_one(KVQ *q, collector_type *collector = nullptr) {
+    if (q->key == this->empty_item.get_key()) {
+      __insert_empty(q);
+    } else {
+      __insert_branched(q);
+    }
+
+#ifdef LATENCY_COLLECTION
+    if (collector) collector->end(q->timer_id);
+#endif
+  }
+
+  /// Update or increment the empty key.
+  void __insert_empty(KVQ *q) {
+    if constexpr (std::is_same_v<KV, Item>) {
+      empty_slot_ = q->value;
+    } else if constexpr (std::is_same_v<KV, Aggr_KV>) {
+      empty_slot_ += q->value;
+    } else if constexpr (Upserting<KV>) {
+      KV::insert_empty(empty_slot_, empty_slot_exists_, q->value);
+    } else {
+      assert(false && "Invalid template type");
+    }
+    empty_slot_exists_ = true;
+  }
+
+  void __erase_one(KVQ *q, collector_type *collector) {
+    if (q->key == this->empty_item.get_key()) {
+      empty_slot_exists_ = false;
+      empty_slot_ = 0;
+    } else if (KV *curr = this->__lookup(q->key, q->idx, q->part_id)) {
+      uint8_t *c = &ctrl[curr - this->hashtable];
+      __sync_bool_compare_and_swap(c, (uint8_t)q->part_id, CTRL_DELETED);
+    }
+
+#ifdef LATENCY_COLLECTION
+    collector->end(q->timer_id);
+#endif
+  }
+
+  void __fill_queue_entry(KVQ &entry, const InsertFindArgument *key_data,
+                          uint64_t hash) {
+    entry.idx = this->__group_of(hash);
+    entry.part_id = this->__tag_of(hash);
+    entry.key = key_data->key;
+    entry.value = key_data->value;
+    entry.key_id = key_data->id;
+  }
+
+  void add_to_insert_queue(void *data, uint64_t hash,
+                           collector_type *collector) {
+    InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
+    KVQ &entry = this->insert_queue[this->ins_head];
+
+#ifdef LATENCY_COLLECTION
+    entry.timer_id = collector->start();
+#endif
+
+    this->__fill_queue_entry(entry, key_data, hash);
+#if defined(PREFETCH_WITH_PREFETCH_INSTR)
+    prefetch_object<true /* write */>(
+        &ctrl[(uint64_t)entry.idx * GROUP_SIZE], GROUP_SIZE);
+#endif
+
+    this->ins_head++;
+    if (this->ins_head >= PREFETCH_QUEUE_SIZE) this->ins_head = 0;
+  }
+
+  void add_to_erase_queue(void *data, uint64_t hash,
+                          collector_type *collector) {
+    InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
+    KVQ &entry = this->erase_queue[this->erase_head];
+
+#ifdef LATENCY_COLLECTION
+    entry.timer_id = collector->start();
+#endif
+
+    this->__fill_queue_entry(entry, key_data, hash);
+    // the control byte gets written if the key is found
+    prefetch_object<true /* write */>(
+        &ctrl[(uint64_t)entry.idx * GROUP_SIZE], GROUP_SIZE);
+
+    this->erase_head++;
+    if (this->erase_head >= PREFETCH_QUEUE_SIZE) this->erase_head = 0;
+  }
+
+  void add_to_find_queue(void *data, uint64_t hash,
+                         collector_type *collector) {
+    InsertFindArgument *key_data = reinterpret_cast<InsertFindArgument *>(data);
+    KVQ &entry = this->find_queue[this->find_head];
+
+#ifdef LATENCY_COLLECTION
+    entry.timer_id = collector->start();
+#endif
+
+    this->__fill_queue_entry(entry, key_data, hash);
+    prefetch_object<false /* write */>(
+        &ctrl[(uint64_t)entry.idx * GROUP_SIZE], GROUP_SIZE);
+
+    this->find_head++;
+    if (this->find_head >= PREFETCH_FIND_QUEUE_SIZE) this->find_head = 0;
+  }
+};
+
+/// Static variables
+template <class KV, class KVQ, class H>
+KV *SwissHashTable<KV, KVQ, H>::hashtable = nullptr;
+
+template <class KV, class KVQ, class H>
+uint8_t *SwissHashTable<KV, KVQ, H>::ctrl = nullptr;
+
+template <class KV, class KVQ, class H>
+uint64_t SwissHashTable<KV, KVQ, H>::empty_slot_ = 0;
+
+template <class KV, class KVQ, class H>
+bool SwissHashTable<KV, KVQ, H>::empty_slot_exists_ = false;
+
+template <class KV, class KVQ, class H>
+int SwissHashTable<KV, KVQ, H>::fd = -1;
+
+template <class KV, class KVQ, class H>
+std::mutex SwissHashTable<KV, KVQ, H>::ht_init_mutex;
+
+template <class KV, class KVQ, class H>
+uint32_t SwissHashTable<KV, KVQ, H>::ref_cnt = 0;
+
+template <class KV, class KVQ, class H>
+uint64_t SwissHashTable<KV, KVQ, H>::capacity = 0;
+
+template <class KV, class KVQ, class H>
+uint64_t SwissHashTable<KV, KVQ, H>::num_groups = 0;
+}  // namespace kmercounter
+#endif  // HASHTABLES_SWISS_KHT_HPP
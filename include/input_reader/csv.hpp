@@ -37,7 +37,9 @@ class KeyValueCsvReader : public InputReader<KeyValuePair> {
     data->key = key;
 
     // Parse value
-    const std::string_view value_str = line.substr(mid, line.size());
+    const std::string_view value_str =
+        mid == std::string_view::npos ? ""
+                                      : line.substr(mid + delimiter_.size());
     uint64_t value{};
     std::from_chars(value_str.begin(), value_str.end(), value);
     data->value = value;
@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "PapiEvent.hpp"
+#include "utils/tsc.hpp"
 
 namespace kmercounter {
 
@@ -15,7 +16,6 @@ class MemoryBwCounters {
   // XXX: I don't know how to get this from an API
   const std::uint64_t NUM_MEMORY_CHANNELS = 6;
 
-  static constexpr double CYCLES_PER_SEC = (2.6 * 1000 * 1000 * 1000);
   static constexpr double MB_IN_BYTES = (1 << 20);
 
   // TODO: get this from NUMA API
@@ -27,6 +27,11 @@ class MemoryBwCounters {
   std::uint64_t read_bw;
   std::uint64_t write_bw;
 
+  // MiB/s of the last start/stop interval, and its length
+  double read_mibs;
+  double write_mibs;
+  double seconds;
+
   std::uint64_t start_ts;
   std::uint64_t stop_ts;
 
@@ -47,6 +52,8 @@ class MemoryBwCounters {
   }
 
   void start() {
+    read_bw = 0;
+    write_bw = 0;
     for (auto &event : imc_read) {
       event->start();
     }
@@ -71,13 +78,14 @@ class MemoryBwCounters {
 
   void compute_mem_bw() {
     double bw_duration = stop_ts - start_ts;
-    double bw_duration_secs = bw_duration / CYCLES_PER_SEC;
+    double bw_duration_secs = bw_duration / tsc_hz();
+    seconds = bw_duration_secs;
 
     PLOGI.printf("BW duration %f (secs %f)", bw_duration, bw_duration_secs);
-    PLOGI.printf("Total read BW %f MiB/s",
-                 (read_bw * 64 / MB_IN_BYTES) / bw_duration_secs);
-    PLOGI.printf("Total write BW %f MiB/s",
-                 (write_bw * 64 / MB_IN_BYTES) / bw_duration_secs);
+    read_mibs = (read_bw * 64 / MB_IN_BYTES) / bw_duration_secs;
+    write_mibs = (write_bw * 64 / MB_IN_BYTES) / bw_duration_secs;
+    PLOGI.printf("Total read BW %f MiB/s", read_mibs);
+    PLOGI.printf("Total write BW %f MiB/s", write_mibs);
   }
 };
 
@@ -1,31 +1,303 @@
 #ifndef _PRINT_STATS_H
 #define _PRINT_STATS_H
 
+#include <immintrin.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <ctime>
+
 #include "hashtables/base_kht.hpp"
+#include "hashtables/ht_scan.hpp"
+#include "stats_record.hpp"
+#include "utils/tsc.hpp"
 
 namespace kmercounter {
 
-//CHANGE ME DEPENDING ON MACHINE
-/*From /proc/cpuinfo*/
-#define CPUFREQ_MHZ (2100.0)
-static const float one_cycle_ns = ((float)1000 / CPUFREQ_MHZ);
+/// Fill and max count of a shared table, scanned by shard 0 and read by the
+/// other shards.
+struct SharedTableStats {
+  std::atomic<uint32_t> arrived{0};
+  std::atomic<uint64_t> generation{0};
+  size_t fill = 0;
+  size_t max_count = 0;
+};
+
+inline SharedTableStats shared_table_stats;
+
+/// Every shard calls this when it is done. A partitioned table is scanned by
+/// its shard. A shared table is scanned once, by shard 0 with all of
+/// --scan-threads after the other shards arrived (they no longer touch the
+/// table), and the result is published to them.
+inline void get_ht_scan_stats(Shard *sh, BaseHashTable *kmer_ht) {
+  if (!kmer_ht->is_shared()) {
+    sh->stats->ht_fill = kmer_ht->get_fill();
+    sh->stats->max_count = kmer_ht->get_max_count();
+    return;
+  }
+
+  auto &shared = shared_table_stats;
+  const uint64_t gen = shared.generation.load(std::memory_order_acquire);
+  shared.arrived.fetch_add(1);
+  if (sh->shard_idx == 0) {
+    while (shared.arrived.load() < config.num_threads) {
+      _mm_pause();
+    }
+    shared.arrived.store(0);
+    {
+      const SharedScan scan;
+      shared.fill = kmer_ht->get_fill();
+      shared.max_count = kmer_ht->get_max_count();
+    }
+    shared.generation.store(gen + 1, std::memory_order_release);
+  } else {
+    while (shared.generation.load(std::memory_order_acquire) == gen) {
+      _mm_pause();
+    }
+  }
+  sh->stats->ht_fill = shared.fill;
+  sh->stats->max_count = shared.max_count;
+}
 
 inline void get_ht_stats(Shard *sh, BaseHashTable *kmer_ht) {
-  sh->stats->ht_fill = kmer_ht->get_fill();
+  get_ht_scan_stats(sh, kmer_ht);
   sh->stats->ht_capacity = kmer_ht->get_capacity();
-  sh->stats->max_count = kmer_ht->get_max_count();
+  sh->stats->insert_prefetch_depth = kmer_ht->insert_depth.mean();
+  sh->stats->find_prefetch_depth = kmer_ht->find_depth.mean();
 
-#ifdef CALC_STATS
-  sh->stats->num_reprobes = kmer_ht->num_reprobes;
-  sh->stats->num_memcmps = kmer_ht->num_memcmps;
-  sh->stats->num_memcpys = kmer_ht->num_memcpys;
-  sh->stats->num_queue_flushes = kmer_ht->num_queue_flushes;
-  sh->stats->num_hashcmps = kmer_ht->num_hashcmps;
-  if (sh->stats->ht_fill)
-    sh->stats->avg_distance_from_bucket =
-      (double)(kmer_ht->sum_distance_from_bucket / sh->stats->ht_fill);
-  sh->stats->max_distance_from_bucket = kmer_ht->max_distance_from_bucket;
-#endif
+  const HTStats &ht_stats = kmer_ht->stats;
+  sh->stats->num_reprobes = ht_stats.num_reprobes;
+  sh->stats->num_soft_reprobes = ht_stats.num_soft_reprobes;
+  sh->stats->num_memcmps = ht_stats.num_memcmps;
+  sh->stats->num_memcpys = ht_stats.num_memcpys;
+  sh->stats->num_queue_flushes = ht_stats.num_queue_flushes;
+  sh->stats->num_requeues_avoided = ht_stats.num_requeues_avoided;
+  sh->stats->num_failed_inserts = ht_stats.num_failed_inserts;
+  sh->stats->num_hashcmps = ht_stats.num_hashcmps;
+  sh->stats->avg_distance_from_bucket =
+      sh->stats->ht_fill
+          ? (double)ht_stats.sum_distance_from_bucket / sh->stats->ht_fill
+          : 0;
+  sh->stats->max_distance_from_bucket = ht_stats.max_distance_from_bucket;
+  std::copy(std::begin(ht_stats.probe_lengths),
+            std::end(ht_stats.probe_lengths), sh->stats->probe_lengths);
+}
+
+/// Hashtable counters of all the threads, collected with --ht-stats.
+inline void print_ht_stats(Shard *all_sh, Configuration &config) {
+  uint64_t reprobes = 0, soft_reprobes = 0, memcmps = 0, memcpys = 0,
+           hashcmps = 0, requeues_avoided = 0, max_distance = 0;
+  uint64_t probe_lengths[PROBE_LENGTH_BUCKETS] = {};
+
+  for (auto k = 0u; k < config.num_threads; k++) {
+    const thread_stats *st = all_sh[k].stats;
+    reprobes += st->num_reprobes;
+    soft_reprobes += st->num_soft_reprobes;
+    memcmps += st->num_memcmps;
+    memcpys += st->num_memcpys;
+    hashcmps += st->num_hashcmps;
+    requeues_avoided += st->num_requeues_avoided;
+    max_distance = std::max(max_distance, st->max_distance_from_bucket);
+    for (auto i = 0u; i < PROBE_LENGTH_BUCKETS; i++) {
+      probe_lengths[i] += st->probe_lengths[i];
+    }
+  }
+
+  printf("Hashtable: reprobes %" PRIu64 ", soft reprobes %" PRIu64
+         ", memcmps %" PRIu64 ", memcpys %" PRIu64 ", hashcmps %" PRIu64
+         ", requeues avoided %" PRIu64 ", max distance from bucket %" PRIu64
+         "\n",
+         reprobes, soft_reprobes, memcmps, memcpys, hashcmps, requeues_avoided,
+         max_distance);
+
+  printf("Probe lengths:");
+  for (auto i = 0u; i < PROBE_LENGTH_BUCKETS; i++) {
+    if (!probe_lengths[i]) continue;
+    const uint64_t lo = i ? 1ULL << (i - 1) : 0;
+    if (i == PROBE_LENGTH_BUCKETS - 1) {
+      printf(" [%" PRIu64 "+]: %" PRIu64, lo, probe_lengths[i]);
+    } else {
+      printf(" [%" PRIu64 "-%" PRIu64 "]: %" PRIu64, lo, i > 1 ? 2 * lo - 1 : lo,
+             probe_lengths[i]);
+    }
+  }
+  printf("\n");
+}
+
+/// Prefetch depths the threads settled on with --adaptive-prefetch, each
+/// averaged over the requests of the thread.
+inline void print_prefetch_depths(Shard *all_sh, Configuration &config) {
+  printf("Prefetch depth (insert/find):");
+  for (auto k = 0u; k < config.num_threads; k++) {
+    const thread_stats *st = all_sh[k].stats;
+    printf(" [%u] %.1f/%.1f", k, st->insert_prefetch_depth,
+           st->find_prefetch_depth);
+  }
+  printf("\n");
+}
+
+/// Percentiles of the latencies the collectors dumped during the run, with
+/// the threads merged.
+inline void print_latencies() {
+  const std::lock_guard guard{collector_lock};
+  for (const auto &[name, hist] : latency_histograms) {
+    printf("Latency %s (cycles): count %" PRIu64 ", mean %.1f, p50 %" PRIu64
+           ", p99 %" PRIu64 ", p99.9 %" PRIu64 ", p99.99 %" PRIu64
+           ", max %" PRIu64 "\n",
+           name.c_str(), hist.count(), hist.mean(), hist.percentile(50),
+           hist.percentile(99), hist.percentile(99.9), hist.percentile(99.99),
+           hist.max());
+    printf("Latency %s (ns): mean %.1f, p50 %.1f, p99 %.1f, p99.9 %.1f, "
+           "p99.99 %.1f, max %.1f\n",
+           name.c_str(), cycles_to_ns(hist.mean()),
+           cycles_to_ns(hist.percentile(50)), cycles_to_ns(hist.percentile(99)),
+           cycles_to_ns(hist.percentile(99.9)),
+           cycles_to_ns(hist.percentile(99.99)), cycles_to_ns(hist.max()));
+  }
+}
+
+inline void add_config(StatsRecord &rec, const Configuration &c) {
+  rec.add("config.mode", run_mode_strings[c.mode]);
+  rec.add("config.ht_type", ht_type_strings[c.ht_type]);
+  rec.add("config.num_threads", c.num_threads);
+  rec.add("config.numa_split", c.numa_split);
+  rec.add("config.ht_fill", c.ht_fill);
+  rec.add("config.ht_size", c.ht_size);
+  rec.add("config.insert_factor", c.insert_factor);
+  rec.add("config.ht_grow_threshold", c.ht_grow_threshold);
+  rec.add("config.hasher", c.hasher);
+  rec.add("config.key_type", c.key_type);
+  rec.add("config.ht_stats", c.ht_stats);
+  rec.add("config.n_prod", c.n_prod);
+  rec.add("config.n_cons", c.n_cons);
+  rec.add("config.skew", c.skew);
+  rec.add("config.seed", c.seed);
+  rec.add("config.pread", c.pread);
+  rec.add("config.hwprefetchers", c.hwprefetchers);
+  rec.add("config.no_prefetch", c.no_prefetch);
+  rec.add("config.prefetch_depth", c.prefetch_depth);
+  rec.add("config.adaptive_prefetch", c.adaptive_prefetch);
+  rec.add("config.reprobe_lines", c.reprobe_lines);
+  rec.add("config.coro_lookups", c.coro_lookups);
+  rec.add("config.run_both", c.run_both);
+  rec.add("config.batch_len", c.batch_len);
+  rec.add("config.rw_queues", c.rw_queues);
+  rec.add("config.pollute_ratio", c.pollute_ratio);
+  rec.add("config.delegate_finds", c.delegate_finds);
+  rec.add("config.rebalance_parts", c.rebalance_parts);
+  rec.add("config.combine_slots", c.combine_slots);
+  rec.add("config.steal_chunk", c.steal_chunk);
+  rec.add("config.num_nops", c.num_nops);
+  rec.add("config.scan_threads", c.scan_threads);
+  rec.add("config.K", c.K);
+  rec.add("config.kmer_create_data_base", c.kmer_create_data_base);
+  rec.add("config.kmer_create_data_mult", c.kmer_create_data_mult);
+  rec.add("config.kmer_create_data_uniq", c.kmer_create_data_uniq);
+  rec.add("config.kmer_files_dir", c.kmer_files_dir);
+  rec.add("config.alphanum_kmers", c.alphanum_kmers);
+  rec.add("config.drop_caches", c.drop_caches);
+  rec.add("config.in_file", c.in_file);
+  rec.add("config.in_file_sz", c.in_file_sz);
+  rec.add("config.stats_file", c.stats_file);
+  rec.add("config.ht_file", c.ht_file);
+  rec.add("config.ht_snapshot_in", c.ht_snapshot_in);
+  rec.add("config.ht_snapshot_out", c.ht_snapshot_out);
+  rec.add("config.ht_profile", c.ht_profile);
+  rec.add("config.materialize", c.materialize);
+  rec.add("config.relation_r", c.relation_r);
+  rec.add("config.relation_s", c.relation_s);
+  rec.add("config.relation_r_size", c.relation_r_size);
+  rec.add("config.relation_s_size", c.relation_s_size);
+  rec.add("config.delimitor", c.delimitor);
+  rec.add("config.groupby_strategy", c.groupby_strategy);
+  rec.add("config.groupby_aggrs", c.groupby_aggrs);
+  rec.add("config.groupby_relation", c.groupby_relation);
+  rec.add("config.groupby_rows", c.groupby_rows);
+  rec.add("config.groupby_groups", c.groupby_groups);
+}
+
+inline void add_ops(StatsRecord &rec, const std::string &key,
+                    const OpTimings &ops) {
+  rec.add(key + ".cycles", ops.duration);
+  rec.add(key + ".ops", ops.op_count);
+}
+
+/// Append the run to --stats-file: the build, the configuration, the stats
+/// of every thread, the `totals` print_stats computed, the latency
+/// percentiles and the side counters.
+inline void write_stats_record(Shard *all_sh, Configuration &config,
+                               const StatsRecord &totals) {
+  StatsRecord rec;
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  rec.add("run.timestamp", (int64_t)time(nullptr));
+  rec.add("run.host", host);
+  rec.add("run.tsc_hz", tsc_hz());
+  rec.add("build.compiler", __VERSION__);
+  rec.add("build.key_len", KEY_LEN);
+  add_config(rec, config);
+
+  for (auto k = 0u; k < config.num_threads; k++) {
+    const thread_stats *st = all_sh[k].stats;
+    const std::string t = "threads." + std::to_string(k);
+    add_ops(rec, t + ".insertions", st->insertions);
+    add_ops(rec, t + ".finds", st->finds);
+    add_ops(rec, t + ".enqueues", st->enqueues);
+    add_ops(rec, t + ".any", st->any);
+    rec.add(t + ".ht_fill", st->ht_fill);
+    rec.add(t + ".ht_capacity", st->ht_capacity);
+    rec.add(t + ".max_count", st->max_count);
+    rec.add(t + ".num_failed_inserts", st->num_failed_inserts);
+    rec.add(t + ".insert_prefetch_depth", st->insert_prefetch_depth);
+    rec.add(t + ".find_prefetch_depth", st->find_prefetch_depth);
+    // Zero without --ht-stats, but always there so the columns line up
+    rec.add(t + ".num_reprobes", st->num_reprobes);
+    rec.add(t + ".num_soft_reprobes", st->num_soft_reprobes);
+    rec.add(t + ".num_memcmps", st->num_memcmps);
+    rec.add(t + ".num_memcpys", st->num_memcpys);
+    rec.add(t + ".num_hashcmps", st->num_hashcmps);
+    rec.add(t + ".num_requeues_avoided", st->num_requeues_avoided);
+    rec.add(t + ".avg_distance_from_bucket", st->avg_distance_from_bucket);
+    rec.add(t + ".max_distance_from_bucket", st->max_distance_from_bucket);
+    for (auto i = 0u; i < PROBE_LENGTH_BUCKETS; i++) {
+      rec.add(t + ".probe_lengths." + std::to_string(i), st->probe_lengths[i]);
+    }
+  }
+
+  rec.append(totals);
+
+  {
+    const std::lock_guard guard{collector_lock};
+    for (const auto &[name, hist] : latency_histograms) {
+      const std::string l = "latency." + name;
+      rec.add(l + ".count", hist.count());
+      rec.add(l + ".mean", hist.mean());
+      rec.add(l + ".p50", hist.percentile(50));
+      rec.add(l + ".p99", hist.percentile(99));
+      rec.add(l + ".p999", hist.percentile(99.9));
+      rec.add(l + ".p9999", hist.percentile(99.99));
+      rec.add(l + ".max", hist.max());
+      rec.add(l + ".mean_ns", cycles_to_ns(hist.mean()));
+      rec.add(l + ".p50_ns", cycles_to_ns(hist.percentile(50)));
+      rec.add(l + ".p99_ns", cycles_to_ns(hist.percentile(99)));
+      rec.add(l + ".p999_ns", cycles_to_ns(hist.percentile(99.9)));
+      rec.add(l + ".max_ns", cycles_to_ns(hist.max()));
+    }
+  }
+
+  for (const auto &[name, value] : run_counters) {
+    rec.add("counters." + name, value);
+  }
+
+  const std::string written = rec.append_to(config.stats_file);
+  if (written.empty()) {
+    PLOG_ERROR.printf("Could not write the stats to %s",
+                      config.stats_file.c_str());
+  } else if (written != config.stats_file) {
+    PLOG_WARNING.printf(
+        "The columns of %s are not the ones of this run, wrote to %s",
+        config.stats_file.c_str(), written.c_str());
+  }
 }
 
 inline void print_stats(Shard *all_sh, Configuration &config) {
@@ -97,7 +369,7 @@ inline void print_stats(Shard *all_sh, Configuration &config) {
 //     );
     all_total_cycles += all_sh[k].stats->insertions.duration;
     all_total_time_ns +=
-        (double)all_sh[k].stats->insertions.duration * one_cycle_ns;
+        cycles_to_ns(all_sh[k].stats->insertions.duration);
     all_total_num_inserts += all_sh[k].stats->insertions.op_count;
     total_finds += all_sh[k].stats->finds.op_count;
     total_find_cycles += all_sh[k].stats->finds.duration;
@@ -134,6 +406,7 @@ inline void print_stats(Shard *all_sh, Configuration &config) {
   printf("===============================================================\n");
   printf("Total  : %" PRIu64 " cycles for %" PRIu64 " insertions\n", all_total_cycles, all_total_num_inserts);
   double find_mops = 0.0, insert_mops = 0.0;
+  StatsRecord totals;
   {
     uint64_t cycles_per_insert = all_total_cycles / all_total_num_inserts;
 
@@ -174,7 +447,7 @@ inline void print_stats(Shard *all_sh, Configuration &config) {
     if (config.mode == BQ_TESTS_YES_BQ) {
       num_threads = config.n_cons;
     }
-    insert_mops = ((double)CPUFREQ_MHZ / cycles_per_insert) * num_threads;// old one
+    insert_mops = cycles_to_mops(cycles_per_insert) * num_threads;
     printf("Number of insertions per sec (Mops/s): %.3f\n", insert_mops);
 
     // for find, we use all threads
@@ -182,12 +455,26 @@ inline void print_stats(Shard *all_sh, Configuration &config) {
     if (config.mode == BQ_TESTS_YES_BQ) {
       num_threads = config.n_cons + config.n_prod;
     }
-    find_mops = ((double)CPUFREQ_MHZ / cycles_per_find) * (config.rw_queues ? config.n_prod : num_threads);
+    find_mops = cycles_to_mops(cycles_per_find) * (config.rw_queues ? config.n_prod : num_threads);
 
     printf("%s, num_threads %" PRIu64 "\n", __func__, num_threads);
     printf("Number of finds per sec (Mops/s): %.3f\n", find_mops);
     printf("{ set_cycles : %" PRIu64 ", get_cycles : %" PRIu64 ",", cycles_per_insert, cycles_per_find);
     printf(" set_mops : %.3f, get_mops : %.3f }\n", insert_mops, find_mops);
+    printf("Per op (TSC %.3f MHz): %.1f ns/insert, %.1f ns/find\n",
+           tsc_hz() / 1e6, cycles_to_ns(cycles_per_insert),
+           cycles_to_ns(cycles_per_find));
+
+    totals.add("totals.insert_cycles", all_total_cycles);
+    totals.add("totals.inserts", all_total_num_inserts);
+    totals.add("totals.find_cycles", total_find_cycles);
+    totals.add("totals.finds", total_finds);
+    totals.add("totals.set_cycles", cycles_per_insert);
+    totals.add("totals.get_cycles", cycles_per_find);
+    totals.add("totals.set_mops", insert_mops);
+    totals.add("totals.get_mops", find_mops);
+    totals.add("totals.set_ns", cycles_to_ns(cycles_per_insert));
+    totals.add("totals.get_ns", cycles_to_ns(cycles_per_find));
     //printf("{ new_set_mops : %.3f, new_get_mops : %.3f }\n", new_insert_mops, new_find_mops);
   }
 
@@ -199,6 +486,27 @@ inline void print_stats(Shard *all_sh, Configuration &config) {
   //     kmer_big_pool_size_per_shard,
   //     all_total_find_cycles / config.num_threads /
   //         kmer_big_pool_size_per_shard);
+  uint64_t failed_inserts = 0;
+  for (auto k = 0u; k < config.num_threads; k++) {
+    failed_inserts += all_sh[k].stats->num_failed_inserts;
+  }
+  if (failed_inserts) {
+    printf("Failed inserts: %" PRIu64 ", the hashtable is full\n",
+           failed_inserts);
+  }
+  totals.add("totals.failed_inserts", failed_inserts);
+  if (config.ht_stats) {
+    print_ht_stats(all_sh, config);
+  }
+  if (config.adaptive_prefetch) {
+    print_prefetch_depths(all_sh, config);
+  }
+  if (!latency_histograms.empty()) {
+    print_latencies();
+  }
+  if (!config.stats_file.empty()) {
+    write_stats_record(all_sh, config, totals);
+  }
   printf("===============================================================\n");
 }
 
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace kmercounter {
+
+/// Per-producer buffer of the queue tests (--combine-slots) that merges the
+/// messages of a key before they are enqueued, so that a skewed stream of
+/// inserts sends a hot key once per flush instead of once per insert.
+///
+/// A slot holds a message and the number of times it was added. The slot of
+/// a key is picked by its hash: a different message evicts what the slot
+/// holds, the same message (key and value) bumps its weight. A slot is sent
+/// when it is evicted, when its weight reaches MAX_WEIGHT, or when the whole
+/// buffer is flushed, which the producer does every FLUSH_CYCLES and before
+/// it is done.
+///
+/// A message sent with a weight of n > 1 is preceded by a {WEIGHT_KEY, n}
+/// message on the same queue, and the consumer inserts it n times: the
+/// tables count every insert, whatever the value (Aggr_KV), so this is what
+/// keeps the counts exact. Only equal messages are merged, so the tables
+/// that keep the value end up with the same one too.
+template <typename Msg>
+class HotKeyCombiner {
+ public:
+  // Control message from the producers to the consumers
+  static constexpr uint64_t WEIGHT_KEY = 0xD221A6BE96E04676UL;
+
+  static constexpr uint32_t MAX_WEIGHT = 1 << 12;
+  static constexpr uint64_t FLUSH_CYCLES = 1 << 20;
+
+  struct Slot {
+    Msg msg;
+    uint32_t weight;
+    uint32_t part;
+  };
+
+  /// n_slots is rounded up to a power of two
+  explicit HotKeyCombiner(uint32_t n_slots) {
+    uint32_t size = 1;
+    while (size < n_slots) size <<= 1;
+    slots.assign(size, Slot{Msg{}, 0, 0});
+    mask = size - 1;
+  }
+
+  /// Merge the message of the given key hash and partition into its slot.
+  /// send(const Slot &) gets called for what has to go out.
+  template <typename Send>
+  void add(const Msg &msg, uint64_t hash, uint32_t part, Send &&send) {
+    keys++;
+    Slot &slot = slots[hash & mask];
+    if (slot.weight && slot.msg == msg) {
+      if (++slot.weight == MAX_WEIGHT) {
+        emit(slot, send);
+      }
+      return;
+    }
+    if (slot.weight) {
+      emit(slot, send);
+    }
+    slot = Slot{msg, 1, part};
+  }
+
+  /// Send all the slots, if FLUSH_CYCLES went by since the last flush
+  template <typename Send>
+  void tick(uint64_t now, Send &&send) {
+    if (!last_flush) {
+      last_flush = now;
+    } else if (now - last_flush >= FLUSH_CYCLES) {
+      flush(send);
+      last_flush = now;
+    }
+  }
+
+  template <typename Send>
+  void flush(Send &&send) {
+    for (auto &slot : slots) {
+      if (slot.weight) {
+        emit(slot, send);
+      }
+    }
+  }
+
+  /// Messages added, and messages sent for them, weights included
+  uint64_t num_keys() const { return keys; }
+  uint64_t num_messages() const { return messages; }
+
+ private:
+  template <typename Send>
+  void emit(Slot &slot, Send &send) {
+    messages += slot.weight > 1 ? 2 : 1;
+    send(slot);
+    slot.weight = 0;
+  }
+
+  std::vector<Slot> slots;
+  uint64_t mask;
+  uint64_t last_flush = 0;
+  uint64_t keys = 0;
+  uint64_t messages = 0;
+};
+
+}  // namespace kmercounter
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "queue.hpp"
+
+namespace kmercounter {
+
+/// Ownership of the key partitions of the queue tests (--rebalance-parts),
+/// moved from busy to idle consumers while they run.
+///
+/// The keys are split into more partitions than there are consumers, every
+/// partition with a table of its own. The controller (tick(), on a producer)
+/// watches the backlog of the consumers' queues and, when one consumer lags
+/// behind another, moves one of the partitions of the busy consumer to the
+/// idle one. A move only reroutes the messages: the table goes along, and
+/// one consumer at a time writes to it.
+///  1. The controller sets the new owner of the partition and bumps the
+///     epoch. From then on the producers send its messages to the new owner,
+///     which keeps them aside as it does not hold the table yet.
+///  2. A producer that sees the new epoch sends a MARK_KEY message to the old
+///     owner: anything it sent there for the partition comes before it.
+///  3. Once the old owner got the marks of all the producers (or they are
+///     done), it inserts what it has of the partition and hands the table
+///     over (release()).
+///  4. The new owner sees it holds the table and inserts what it kept aside.
+/// There is one move at a time: the next waits for the table to be released.
+/// Moves are never rewritten, so a thread can read the current one without
+/// racing the controller.
+class PartitionBalancer {
+ public:
+  // Control messages from the producers to the consumers
+  static constexpr uint64_t MARK_KEY = 0xD221A6BE96E04674UL;
+  static constexpr uint64_t FILL_KEY = 0xD221A6BE96E04675UL;
+
+  struct Move {
+    uint32_t part;
+    uint32_t from;
+    uint32_t to;
+    uint64_t epoch;
+  };
+
+  // Moves of a run, after which the ownership stays put
+  static constexpr uint64_t MAX_MOVES = 4096;
+
+  PartitionBalancer(uint32_t n_parts, uint32_t n_cons, uint64_t min_backlog)
+      : n_parts(n_parts),
+        n_cons(n_cons),
+        min_backlog(min_backlog),
+        parts(n_parts),
+        last_load(n_parts, 0) {
+    for (auto p = 0u; p < n_parts; p++) {
+      parts[p].owner = parts[p].holder = initial_owner(p);
+    }
+    // Epoch 0 is no move
+    moves.reserve(MAX_MOVES + 1);
+    moves.push_back(Move{n_parts, n_cons, n_cons, 0});
+  }
+
+  uint32_t initial_owner(uint32_t part) const { return part % n_cons; }
+
+  /// Consumer the messages of the partition go to
+  uint32_t owner(uint32_t part) const {
+    return parts[part].owner.load(std::memory_order_relaxed);
+  }
+
+  /// Whether the consumer may write to the table of the partition
+  bool holds(uint32_t part, uint32_t cons) const {
+    return parts[part].holder.load(std::memory_order_acquire) == cons;
+  }
+
+  uint64_t epoch() const { return cur_epoch.load(std::memory_order_acquire); }
+
+  /// The last move; it moves nothing while epoch() is 0
+  const Move &current() const { return moves[epoch()]; }
+
+  /// Called by the holder for every message it inserts into the partition
+  void count(uint32_t part, uint64_t n = 1) {
+    auto &load = parts[part].load;
+    load.store(load.load(std::memory_order_relaxed) + n,
+               std::memory_order_relaxed);
+  }
+
+  /// The old owner hands the table of the move over
+  void release(const Move &move) {
+    parts[move.part].holder.store(move.to, std::memory_order_release);
+  }
+
+  /// Look at the backlog of every consumer, and start a move from the
+  /// busiest to the idlest if it is worth it. Returns whether it did.
+  bool tick(const std::vector<uint64_t> &backlog) {
+    const Move &last = moves.back();
+    if (last.epoch && !holds(last.part, last.to)) {
+      return false;
+    }
+    if (last.epoch == MAX_MOVES) {
+      return false;
+    }
+
+    // Messages inserted per partition and per consumer since the last look
+    std::vector<uint64_t> delta(n_parts), cons_load(n_cons, 0);
+    std::vector<uint32_t> cons_parts(n_cons, 0);
+    for (auto p = 0u; p < n_parts; p++) {
+      const uint64_t load = parts[p].load.load(std::memory_order_relaxed);
+      delta[p] = load - last_load[p];
+      last_load[p] = load;
+      cons_load[owner(p)] += delta[p];
+      cons_parts[owner(p)]++;
+    }
+
+    uint32_t hot = 0, cold = 0;
+    for (auto c = 1u; c < n_cons; c++) {
+      if (backlog[c] > backlog[hot]) hot = c;
+      if (backlog[c] < backlog[cold]) cold = c;
+    }
+    if (backlog[hot] < min_backlog || backlog[hot] < 2 * backlog[cold] ||
+        cons_parts[hot] < 2 || cons_load[hot] <= cons_load[cold]) {
+      return false;
+    }
+
+    // The partition that evens the load of the two out the best
+    const uint64_t target = (cons_load[hot] - cons_load[cold]) / 2;
+    uint32_t best = n_parts;
+    uint64_t best_diff = UINT64_MAX;
+    for (auto p = 0u; p < n_parts; p++) {
+      if (owner(p) != hot || !delta[p]) continue;
+      const uint64_t diff = delta[p] > target ? delta[p] - target
+                                              : target - delta[p];
+      if (diff < best_diff) {
+        best = p;
+        best_diff = diff;
+      }
+    }
+    if (best == n_parts) {
+      return false;
+    }
+
+    moves.push_back(Move{best, hot, cold, last.epoch + 1});
+    parts[best].owner.store(cold, std::memory_order_relaxed);
+    cur_epoch.store(moves.back().epoch, std::memory_order_release);
+    return true;
+  }
+
+  uint64_t num_moves() const { return moves.size() - 1; }
+
+  const uint32_t n_parts;
+  const uint32_t n_cons;
+
+ private:
+  struct CACHE_ALIGNED Partition {
+    std::atomic<uint32_t> owner;
+    std::atomic<uint32_t> holder;
+    std::atomic<uint64_t> load{};
+  };
+
+  // Backlog, in messages, below which a consumer keeps up
+  const uint64_t min_backlog;
+  std::vector<Partition> parts;
+  // Owned by the controller
+  std::vector<uint64_t> last_load;
+  std::vector<Move> moves;
+  CACHE_ALIGNED std::atomic<uint64_t> cur_epoch{};
+};
+
+}  // namespace kmercounter
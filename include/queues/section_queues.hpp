@@ -3,9 +3,14 @@
 #include <assert.h>
 #include <numaif.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <map>
 #include <numa.hpp>
+#include <span>
 #include <tuple>
+#include <vector>
 
 #include "helper.hpp"
 #include "queue.hpp"
@@ -109,6 +114,8 @@ class SectionQueue {
   static const uint64_t BQ_MAGIC_64BIT = 0xD221A6BE96E04673UL;
   static const data_t BQ_MAGIC_KV;
   static const uint64_t SECTION_MASK = SECTION_SIZE - 1;
+  static const uint64_t KV_PER_LINE =
+      std::max<uint64_t>(64 / sizeof(data_t), 1);
 
   size_t queue_size;
 
@@ -164,13 +171,14 @@ class SectionQueue {
     }
   }
 
-  void init_data(NumaPolicyQueues *npq) {
+  // Queue data lives on the node of the producer, whose cpu is prod_cpus[p]
+  void init_data(const std::vector<uint32_t> &prod_cpus) {
     // auto qdata_sz = nprod * ncons * this->queue_size;
     std::map<uint32_t, std::vector<uint32_t>> node_map;
 
     auto get_current_node = [](uint32_t cpu) { return numa_node_of_cpu(cpu); };
 
-    for (auto cpu : npq->get_assigned_cpu_list_producers()) {
+    for (auto cpu : prod_cpus) {
       auto cpu_node = get_current_node(cpu);
       if (node_map.find(cpu_node) != node_map.end()) {
         node_map[cpu_node].push_back(cpu);
@@ -213,8 +221,7 @@ class SectionQueue {
     }
 
     for (auto p = 0u; p < nprod; p++) {
-      uint32_t node_for_prod =
-          get_current_node(npq->get_assigned_cpu_list_producers()[p]);
+      uint32_t node_for_prod = get_current_node(prod_cpus[p]);
       char *qdata = node_memmap[node_for_prod];
       node_memmap[node_for_prod] = qdata + ncons * this->queue_size;
 
@@ -248,6 +255,24 @@ class SectionQueue {
     }
   }
 
+  // The producer filled a section: move on to the next one once the consumer
+  // is out of it, and publish the filled one
+  inline void next_section(prod_queue_t *pq, uint32_t p, uint32_t c) {
+    if (pq->enqPtr == pq->queue_end) {
+      pq->enqPtr = pq->data;
+    }
+
+    pc_queue_t *pcq = &all_pc_queues[p][c];
+    while (pq->enqPtr == pq->deqLocalPtr) {
+      pq->deqLocalPtr = pcq->deqSharedPtr;
+#ifdef CALC_STATS
+      pcq->numEnqueueSpins++;
+#endif
+      asm volatile("pause");
+    }
+    pcq->enqSharedPtr = pq->enqPtr;
+  }
+
   void teardown_prod_queues() {
     for (auto p = 0u; p < nprod; p++) {
       free(this->all_pqueues[p]);
@@ -276,7 +301,13 @@ class SectionQueue {
   }
 
   explicit SectionQueue(uint32_t nprod, uint32_t ncons, size_t num_sections,
-                        NumaPolicyQueues *npq) {
+                        NumaPolicyQueues *npq)
+      : SectionQueue(nprod, ncons, num_sections,
+                     npq->get_assigned_cpu_list_producers()) {}
+
+  /// Queues from nprod producers, running on prod_cpus, to ncons consumers
+  explicit SectionQueue(uint32_t nprod, uint32_t ncons, size_t num_sections,
+                        const std::vector<uint32_t> &prod_cpus) {
     printf("%s, numsections %zu\n", __func__, num_sections);
     assert((num_sections & (num_sections - 1)) == 0);
     this->num_sections = num_sections;
@@ -298,7 +329,7 @@ class SectionQueue {
     this->init_prod_queues();
     this->init_cons_queues();
     this->init_pc_shared_queues();
-    this->init_data(npq);
+    this->init_data(prod_cpus);
 
     this->queues = (queue_t ***)calloc(1, nprod * sizeof(queue_t *));
     for (auto p = 0u; p < nprod; p++) {
@@ -331,20 +362,29 @@ class SectionQueue {
     pq->enqPtr += 1;
 
     if (((uint64_t)pq->enqPtr & SECTION_MASK) == 0) {
-      if (pq->enqPtr == pq->queue_end) {
-        pq->enqPtr = pq->data;
-      }
+      this->next_section(pq, p, c);
+    }
+    return SUCCESS;
+  }
 
-      {
-        pc_queue_t *pcq = &all_pc_queues[p][c];
-        while (pq->enqPtr == pq->deqLocalPtr) {
-          pq->deqLocalPtr = pcq->deqSharedPtr;
-#ifdef CALC_STATS
-          pcq->numEnqueueSpins++;
-#endif
-          asm volatile("pause");
-        }
-        pcq->enqSharedPtr = pq->enqPtr;
+  /// Enqueue n values at once. They are copied up to a section at a time and,
+  /// as with enqueue(), published once their section is full, so staging a
+  /// cacheline (KV_PER_LINE values) per consumer writes whole lines of the
+  /// queue instead of a value at a time.
+  inline int enqueue_bulk(prod_queue_t *pq, uint32_t p, uint32_t c,
+                          const data_t *values, size_t n) {
+    while (n) {
+      const size_t room =
+          (SECTION_SIZE - ((uint64_t)pq->enqPtr & SECTION_MASK)) /
+          sizeof(data_t);
+      const size_t len = std::min(n, room);
+      std::memcpy(pq->enqPtr, values, len * sizeof(data_t));
+      pq->enqPtr += len;
+      values += len;
+      n -= len;
+
+      if (((uint64_t)pq->enqPtr & SECTION_MASK) == 0) {
+        this->next_section(pq, p, c);
       }
     }
     return SUCCESS;
@@ -375,6 +415,101 @@ class SectionQueue {
     return SUCCESS;
   }
 
+  /// Pad the section being filled with `filler`, which publishes it now
+  inline void fill_section(prod_queue_t *pq, uint32_t p, uint32_t c,
+                           data_t filler) {
+    if (((uint64_t)pq->enqPtr & SECTION_MASK) == 0) {
+      return;
+    }
+    do {
+      *pq->enqPtr = filler;
+      pq->enqPtr += 1;
+    } while (((uint64_t)pq->enqPtr & SECTION_MASK) != 0);
+    this->next_section(pq, p, c);
+  }
+
+  /// Values published to consumer c and not yet released by it, at section
+  /// granularity. Read by anyone, so only a snapshot.
+  size_t backlog(uint32_t p, uint32_t c) const {
+    const data_t *data = all_pqueues[p][c].data;
+    const data_t *queue_end = all_pqueues[p][c].queue_end;
+    const data_t *enq = all_pc_queues[p][c].enqSharedPtr;
+    const data_t *deq = all_pc_queues[p][c].deqSharedPtr;
+    // A producer that is done leaves a bogus pointer behind
+    if (enq < data || enq >= queue_end) {
+      return 0;
+    }
+    const size_t entries = queue_end - data;
+    return ((enq - deq) + entries) % entries;
+  }
+
+  /// Dequeue up to max values at once without copying them out: the span
+  /// points into the queue and is valid until the next dequeue from it. It
+  /// ends at the end of the section, and is empty if there is nothing to
+  /// dequeue.
+  inline std::span<const data_t> dequeue_bulk(cons_queue_t *cq, uint32_t p,
+                                              uint32_t c, size_t max) {
+    if (((uint64_t)cq->deqPtr & SECTION_MASK) == 0) {
+      if (cq->deqPtr == cq->queue_end) {
+        cq->deqPtr = cq->data;
+      }
+
+      pc_queue_t *pcq = &all_pc_queues[p][c];
+      pcq->deqSharedPtr = cq->deqPtr;
+      if (cq->deqPtr == cq->enqLocalPtr) {
+        cq->enqLocalPtr = pcq->enqSharedPtr;
+        if (cq->deqPtr == cq->enqLocalPtr) {
+#ifdef CALC_STATS
+          pcq->numDequeueSpins++;
+#endif
+          return {};
+        }
+      }
+    }
+    const size_t left =
+        (SECTION_SIZE - ((uint64_t)cq->deqPtr & SECTION_MASK)) /
+        sizeof(data_t);
+    const std::span<const data_t> values(cq->deqPtr, std::min(max, left));
+    cq->deqPtr += values.size();
+
+    return values;
+  }
+
+  /// Make what was enqueued so far visible to the consumer without waiting
+  /// for the section to fill. The consumer then has to use try_dequeue(), as
+  /// dequeue() takes every published section to be full.
+  inline void publish(prod_queue_t *pq, uint32_t p, uint32_t c) {
+    std::atomic_signal_fence(std::memory_order_release);
+    all_pc_queues[p][c].enqSharedPtr = pq->enqPtr;
+  }
+
+  /// Like dequeue(), but also picks up sections published part way by
+  /// publish(), at the price of a compare per entry.
+  inline int try_dequeue(cons_queue_t *cq, uint32_t p, uint32_t c,
+                         data_t *value) {
+    if (((uint64_t)cq->deqPtr & SECTION_MASK) == 0) {
+      if (cq->deqPtr == cq->queue_end) {
+        cq->deqPtr = cq->data;
+      }
+      all_pc_queues[p][c].deqSharedPtr = cq->deqPtr;
+    }
+
+    if (cq->deqPtr == cq->enqLocalPtr) {
+      cq->enqLocalPtr = all_pc_queues[p][c].enqSharedPtr;
+      if (cq->deqPtr == cq->enqLocalPtr) {
+#ifdef CALC_STATS
+        all_pc_queues[p][c].numDequeueSpins++;
+#endif
+        return RETRY;
+      }
+      std::atomic_signal_fence(std::memory_order_acquire);
+    }
+    *value = *((data_t *)cq->deqPtr);
+    cq->deqPtr += 1;
+
+    return SUCCESS;
+  }
+
   void dump_stats(uint32_t p, uint32_t c) {
 #ifdef CALC_STATS
     auto cq = &all_cqueues[c][p];
@@ -0,0 +1,170 @@
+/// Machine readable result of a run.
+/// A record is a flat, ordered list of dotted keys ("config.ht_size",
+/// "threads.3.finds.cycles") that is written either as one JSON object per
+/// line, nested along the dots, or as one CSV row under a header of the keys.
+/// Both formats append, so the runs of a sweep end up in the same file. The
+/// columns of a CSV depend on the run (threads, latency timers, counters), so
+/// a record whose header differs from the file's goes to a file of its own.
+
+#ifndef STATS_RECORD_HPP
+#define STATS_RECORD_HPP
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace kmercounter {
+
+/// Named counters the run collects on the side (memory bandwidth, ...), which
+/// end up in the "counters" section of the record.
+extern std::map<std::string, double> run_counters;
+
+class StatsRecord {
+ public:
+  void add(const std::string &key, const std::string &value) {
+    std::string quoted = "\"";
+    for (const char c : value) {
+      if (c == '"' || c == '\\') {
+        quoted += '\\';
+        quoted += c;
+      } else if ((unsigned char)c < 0x20) {
+        char esc[8];
+        snprintf(esc, sizeof(esc), "\\u%04x", c);
+        quoted += esc;
+      } else {
+        quoted += c;
+      }
+    }
+    quoted += '"';
+    this->fields.emplace_back(key, quoted);
+  }
+
+  void add(const std::string &key, const char *value) {
+    this->add(key, std::string(value));
+  }
+
+  void add(const std::string &key, bool value) {
+    this->fields.emplace_back(key, value ? "true" : "false");
+  }
+
+  void add(const std::string &key, double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", value);
+    this->fields.emplace_back(key, buf);
+  }
+
+  template <typename T>
+    requires std::is_integral_v<T>
+  void add(const std::string &key, T value) {
+    this->fields.emplace_back(key, std::to_string(value));
+  }
+
+  void append(const StatsRecord &other) {
+    this->fields.insert(this->fields.end(), other.fields.begin(),
+                        other.fields.end());
+  }
+
+  /// Keys sharing a prefix must be added next to each other.
+  void write_json(std::ostream &os) const {
+    std::vector<std::string> path;
+    os << '{';
+    bool first = true;
+    for (const auto &[key, value] : this->fields) {
+      const auto parts = split(key);
+      // Close the objects the key is not in, open the ones it is
+      size_t common = 0;
+      while (common < path.size() && common + 1 < parts.size() &&
+             path[common] == parts[common]) {
+        common++;
+      }
+      for (auto i = path.size(); i > common; i--) {
+        os << '}';
+      }
+      path.resize(common);
+      if (!first) os << ',';
+      first = false;
+      for (auto i = common; i + 1 < parts.size(); i++) {
+        os << '"' << parts[i] << "\":{";
+        path.push_back(parts[i]);
+      }
+      os << '"' << parts.back() << "\":" << value;
+    }
+    for (auto i = path.size(); i > 0; i--) {
+      os << '}';
+    }
+    os << "}\n";
+  }
+
+  std::string csv_header() const {
+    std::string header;
+    for (size_t i = 0; i < this->fields.size(); i++) {
+      header += (i ? "," : "") + this->fields[i].first;
+    }
+    return header;
+  }
+
+  void write_csv_header(std::ostream &os) const { os << csv_header() << '\n'; }
+
+  /// Strings keep their JSON quoting, which CSV readers take as is unless
+  /// they hold quotes themselves.
+  void write_csv_row(std::ostream &os) const {
+    for (size_t i = 0; i < this->fields.size(); i++) {
+      os << (i ? "," : "") << this->fields[i].second;
+    }
+    os << '\n';
+  }
+
+  /// Append the record to `path`: CSV if it ends in ".csv", JSON lines
+  /// otherwise. A CSV whose header is not the record's is left alone and the
+  /// row goes to the first of "x.1.csv", "x.2.csv", ... that is new or has
+  /// the record's header. Returns the file written, empty on failure.
+  std::string append_to(const std::string &path) const {
+    const bool csv = path.size() >= 4 && path.substr(path.size() - 4) == ".csv";
+    if (!csv) {
+      std::ofstream f(path, std::ios::app);
+      this->write_json(f);
+      return f.good() ? path : "";
+    }
+
+    const std::string header = this->csv_header();
+    const std::string stem = path.substr(0, path.size() - 4);
+    for (unsigned n = 0;; n++) {
+      const std::string file =
+          n ? stem + "." + std::to_string(n) + ".csv" : path;
+      std::string line;
+      std::ifstream in(file);
+      const bool is_new = !in.good() || !std::getline(in, line);
+      if (!is_new && line != header) {
+        continue;
+      }
+      std::ofstream f(file, std::ios::app);
+      if (is_new) this->write_csv_header(f);
+      this->write_csv_row(f);
+      return f.good() ? file : "";
+    }
+  }
+
+ private:
+  static std::vector<std::string> split(const std::string &key) {
+    std::vector<std::string> parts;
+    size_t start = 0, dot;
+    while ((dot = key.find('.', start)) != std::string::npos) {
+      parts.push_back(key.substr(start, dot - start));
+      start = dot + 1;
+    }
+    parts.push_back(key.substr(start));
+    return parts;
+  }
+
+  std::vector<std::pair<std::string, std::string>> fields;
+};
+
+}  // namespace kmercounter
+
+#endif  // STATS_RECORD_HPP
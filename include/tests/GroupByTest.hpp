@@ -0,0 +1,50 @@
+#ifndef __GROUPBY_TEST_HPP__
+#define __GROUPBY_TEST_HPP__
+
+#include <atomic>
+#include <barrier>
+#include <functional>
+#include <iterator>
+#include <string_view>
+#include <vector>
+
+#include "types.hpp"
+
+namespace kmercounter {
+
+/// SELECT key, count(*), sum(value), min(value), max(value) GROUP BY key
+/// over a generated or CSV relation (mode 15), with one of three strategies:
+///  shared      - every thread upserts its rows into shared CAS tables
+///  partitioned - rows are hash partitioned between the threads, which then
+///                aggregate their partition into a private table
+///  local       - every thread aggregates its rows into a private table and
+///                the partial aggregates are merged into shared CAS tables
+class GroupByTest {
+ public:
+  static constexpr const char *AGGR_NAMES[] = {"count", "sum", "min", "max"};
+  static constexpr const char *STRATEGIES[] = {"shared", "partitioned",
+                                               "local"};
+
+  /// Indices into AGGR_NAMES of the comma separated `aggrs`; false if one of
+  /// them is unknown or there are none.
+  static bool parse_aggrs(std::string_view aggrs, std::vector<unsigned> *out);
+  static bool valid_strategy(std::string_view strategy);
+
+  void run(Shard *sh, const Configuration &config,
+           std::barrier<VoidFn> *barrier);
+
+ private:
+  // Rows routed from thread src to thread dst, at [src * num_threads + dst]
+  std::vector<std::vector<KeyValuePair>> partitions;
+
+  std::atomic<uint64_t> total_rows{};
+  std::atomic<uint64_t> total_sum{};
+  std::atomic<uint64_t> dropped_rows{};
+  // Totals over the groups of the result, one per aggregate
+  std::atomic<uint64_t> groups[std::size(AGGR_NAMES)]{};
+  std::atomic<uint64_t> checksums[std::size(AGGR_NAMES)]{};
+};
+
+}  // namespace kmercounter
+
+#endif  // __GROUPBY_TEST_HPP__
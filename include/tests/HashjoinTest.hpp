@@ -3,14 +3,27 @@
 
 #include <barrier>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "hashtables/base_kht.hpp"
 #include "types.hpp"
+#include "utils/work_pool.hpp"
 
 namespace kmercounter {
 
 class HashjoinTest {
  public:
+  /// A relation generated a part per thread, and the pool its rows are
+  /// joined from: every thread starts out with its own part, and steals rows
+  /// of the others once it is done (--steal-chunk).
+  struct Relation {
+    std::vector<KeyValuePair *> parts;
+    std::vector<uint64_t> sizes;
+    std::unique_ptr<WorkPool> pool;
+  };
+
   /// Generate and join two relations.
   void join_relations_generated(Shard *sh, const Configuration &config,
                                 BaseHashTable *ht,
@@ -20,8 +33,12 @@ class HashjoinTest {
   void join_relations_from_files(Shard *sh, const Configuration &config,
                                  BaseHashTable *ht,
                                  std::barrier<VoidFn> *barrier);
+
+ private:
+  std::once_flag init_once, pool_once;
+  Relation rel_r, rel_s;
 };
 
 }  // namespace kmercounter
 
-#endif  // __HASHJOIN_TEST_HPP__
\ No newline at end of file
+#endif  // __HASHJOIN_TEST_HPP__
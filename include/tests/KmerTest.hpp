@@ -3,18 +3,31 @@
 
 #include <barrier>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "hashtables/base_kht.hpp"
 #include "types.hpp"
 #include "input_reader/fastq.hpp"
+#include "utils/work_pool.hpp"
 
 namespace kmercounter {
 
 class KmerTest {
  public:
+  // Parts of the input file per thread, the chunks of work they steal
+  // (--steal-chunk)
+  static constexpr uint32_t PARTS_PER_THREAD = 8;
+
   void count_kmer(Shard *sh, const Configuration &config,
                   BaseHashTable *ht,
                   std::barrier<VoidFn> *barrier);
+
+ private:
+  // Readers of the parts, each preloaded by the thread it starts out with
+  std::once_flag init_once;
+  std::vector<std::unique_ptr<input_reader::InputReaderU64>> parts;
+  std::unique_ptr<WorkPool> pool;
 };
 
 }  // namespace kmercounter
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <atomic>
 #include <barrier>
 #include <thread>
 
 #include "hashtables/base_kht.hpp"
 #include "numa.hpp"
+#include "queues/partition_balancer.hpp"
 #include "types.hpp"
 
 namespace kmercounter {
@@ -21,6 +23,23 @@ class QueueTest {
 
   T *queues;
 
+  // Find requests from every thread to the consumer owning the key, and the
+  // results back, for the delegated finds (--delegate-finds)
+  T *find_requests{};
+  T *find_replies{};
+
+  // Key partitions, n_cons unless they are moved between the consumers
+  // (--rebalance-parts), in which case every one has a table of its own
+  uint32_t n_parts = 0;
+  PartitionBalancer *balancer{};
+  std::vector<BaseHashTable *> part_tables;
+
+  // Producers merge repeated messages before enqueuing them
+  // (--combine-slots); keys they were given and messages they sent for them
+  bool combining = false;
+  std::atomic<uint64_t> combined_keys{};
+  std::atomic<uint64_t> combined_messages{};
+
   std::vector<numa_node> nodes;
 
   uint64_t QUEUE_SIZE = 0;
@@ -50,8 +69,21 @@ class QueueTest {
   void find_thread(int tid, int n_prod, int n_cons,
                        bool is_join,
                        std::barrier<std::function<void()>>* barrier);
+  void delegated_find_thread(int tid, int n_prod, int n_cons,
+                             std::barrier<std::function<void()>>* barrier);
 
   void init_queues(uint32_t nprod, uint32_t ncons);
+
+ private:
+  // Consumer the messages of a key partition go to
+  uint32_t owner_of(uint32_t part) const {
+    return this->balancer ? this->balancer->owner(part) : part;
+  }
+  // Tables of the partitions the consumer holds, with their ids
+  std::vector<std::pair<uint32_t, BaseHashTable *>> held_tables(
+      uint32_t tid, uint32_t n_prod, BaseHashTable *ht) const;
+  void get_held_ht_stats(Shard *sh, uint32_t tid, uint32_t n_prod,
+                         BaseHashTable *ht) const;
 };
 
 }  // namespace kmercounter
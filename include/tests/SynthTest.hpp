@@ -1,8 +1,15 @@
 #ifndef __SYNTH_TEST_HPP__
 #define __SYNTH_TEST_HPP__
 
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "hashtables/base_kht.hpp"
+#include "hashtables/kvtypes.hpp"
 #include "types.hpp"
+#include "utils/work_pool.hpp"
+#include "xorwow.hpp"
 
 namespace kmercounter {
 
@@ -11,6 +18,23 @@ class SynthTest {
   void synth_run_exec(Shard *sh, BaseHashTable *kmer_ht);
   OpTimings synth_run(BaseHashTable *ktable, uint8_t start);
   OpTimings synth_run_get(BaseHashTable *ktable, uint8_t start);
+
+ private:
+  void init_xorwow();
+
+  // The keys of every thread, stolen by the others once they are done
+  // (--steal-chunk); made by the first thread to get to a phase
+  std::once_flag insert_once, find_once;
+  std::unique_ptr<WorkPool> insert_pool, find_pool;
+  // Seeds of the xorwow keys of every thread (XORWOW), so that a stolen key
+  // and the key found later come out the same whoever draws them
+  std::once_flag xorwow_once;
+  std::vector<xorwow_state> xw_seeds;
+#if (KEY_LEN == 8)
+  // Per thread copies of the keys passed by reference (--key-type). Inserted
+  // indirect keys stay for as long as the table.
+  std::vector<KeyArena> insert_keys, find_keys;
+#endif
 };
 
 }  // namespace kmercounter
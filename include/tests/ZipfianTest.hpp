@@ -2,14 +2,24 @@
 #define __ZIPFIAN_TEST_HPP__
 
 #include <barrier>
+#include <memory>
+#include <mutex>
+
 #include "hashtables/base_kht.hpp"
 #include "types.hpp"
+#include "utils/work_pool.hpp"
 
 namespace kmercounter {
 
 class ZipfianTest {
  public:
   void run(Shard *sh, BaseHashTable *kmer_ht, double skew, int64_t seed, unsigned int count, std::barrier<std::function<void ()>>*);
+
+ private:
+  // The keys of every thread, stolen by the others once they are done
+  // (--steal-chunk); made by the first thread to get to a phase
+  std::once_flag insert_once, find_once;
+  std::unique_ptr<WorkPool> insert_pool, find_pool;
 };
 
 }  // namespace kmercounter
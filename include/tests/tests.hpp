@@ -9,6 +9,7 @@
 #include "KmerTest.hpp"
 #include "HashjoinTest.hpp"
 #include "RWRatioTest.hpp"
+#include "GroupByTest.hpp"
 
 namespace kmercounter {
 
@@ -28,6 +29,7 @@ class Tests {
   KmerTest kmer;
   HashjoinTest hj;
   RWRatioTest rw;
+  GroupByTest gb;
 
   Tests() {
   }
@@ -70,6 +70,8 @@ typedef enum {
   ZIPFIAN = 11,
   RW_RATIO = 12,
   HASHJOIN = 13,
+  HT_PROFILE = 14,
+  GROUP_BY = 15,
 } run_mode_t;
 
 // XXX: If you add/modify a mode, update the `ht_type_strings` in
@@ -80,6 +82,8 @@ typedef enum {
   CASHTPP = 3,
   ARRAY_HT = 4,
   MULTI_HT = 5,
+  CUCKOO_HT = 6,
+  SWISS_HT = 7,
 } ht_type_t;
 
 extern const char* run_mode_strings[];
@@ -119,6 +123,24 @@ struct Configuration {
   uint64_t ht_size;
   // insert factor
   uint64_t insert_factor;
+  // grow the hashtable (or a partition) past this fill fraction (0: never)
+  double ht_grow_threshold;
+  // binary snapshot of the hashtable written at the end of the run
+  std::string ht_snapshot_out;
+  // snapshot the hashtable is mapped from instead of starting empty
+  std::string ht_snapshot_in;
+  // clustering profile of the hashtable written at the end of the run
+  std::string ht_profile;
+  // threads of the hashtable scans that run once, not from every shard
+  // (0: all cpus)
+  uint32_t scan_threads;
+  // hash function of the hashtables (empty: the one picked at build time)
+  std::string hasher;
+  // keys of the synthetic test: int (the build's KV type), key16 (Item16) or
+  // indirect (IndirectItem)
+  std::string key_type;
+  // report the hashtable operation counters (reprobes, probe lengths)
+  bool ht_stats;
 
   // bqueue configuration
   // prod/cons count
@@ -139,6 +161,15 @@ struct Configuration {
   bool hwprefetchers;
   // disable prefetching
   bool no_prefetch;
+  // requests queued ahead of the one processed (0: FLUSH_THRESHOLD)
+  uint32_t prefetch_depth;
+  // tune the prefetch depth of every thread while the run goes
+  bool adaptive_prefetch;
+  // cachelines prefetched at once for a lookup that keeps reprobing
+  uint32_t reprobe_lines;
+  // interleave the lookups of a batch on this many coroutines instead of
+  // the find queue (0: use the queue)
+  uint32_t coro_lookups;
 
   // Run both casht/cashtpp
   bool run_both;
@@ -162,8 +193,27 @@ struct Configuration {
   // CSV delimitor for relation files.
   std::string delimitor;
 
+  // Group-by specific configs.
+  // shared, partitioned or local (see tests/GroupByTest.hpp)
+  std::string groupby_strategy;
+  // comma separated aggregates of count, sum, min and max
+  std::string groupby_aggrs;
+  // CSV relation of key, value rows to group. Generated when empty.
+  std::string groupby_relation;
+  // Number of rows and of distinct keys in the generated relation.
+  uint64_t groupby_rows;
+  uint64_t groupby_groups;
+
   bool rw_queues;
   unsigned pollute_ratio;
+  // Send the finds of the queue tests to the consumer owning the partition
+  bool delegate_finds;
+  // Partitions per consumer the queue tests move between the consumers
+  uint32_t rebalance_parts;
+  // Slots of the per-producer buffer merging repeated messages (0: off)
+  uint32_t combine_slots;
+  // Items per chunk the drivers steal between the threads (0: static split)
+  uint64_t steal_chunk;
 
   void dump_configuration() {
     printf("Run configuration {\n");
@@ -177,10 +227,22 @@ struct Configuration {
     printf("  P(read) %f\n", pread);
     printf("  Pollution Ratio %u\n", pollute_ratio);
     printf("BQUEUES:\n  n_prod %u | n_cons %u\n", n_prod, n_cons);
+    printf("  delegated finds %s\n", delegate_finds ? "enabled" : "disabled");
+    printf("  rebalance_parts %u\n", rebalance_parts);
+    printf("  combine_slots %u\n", combine_slots);
+    printf("  steal_chunk %" PRIu64 "\n", steal_chunk);
     printf("  ht_fill %u\n", ht_fill);
+    printf("  ht_grow_threshold %f\n", ht_grow_threshold);
+    printf("  hasher %s\n", hasher.c_str());
+    printf("  key_type %s\n", key_type.c_str());
+    printf("  ht_stats %s\n", ht_stats ? "enabled" : "disabled");
     printf("ZIPFIAN:\n  skew: %f\n  seed: %ld\n", skew, seed);
     printf("  HW prefetchers %s\n", hwprefetchers ? "enabled" : "disabled");
     printf("  SW prefetch engine %s\n", no_prefetch ? "disabled" : "enabled");
+    printf("  prefetch depth %u%s\n", prefetch_depth,
+           adaptive_prefetch ? " (adaptive)" : "");
+    printf("  reprobe lines %u\n", reprobe_lines);
+    printf("  coroutine lookups %u\n", coro_lookups);
     printf("  Run both %s\n", run_both ? "enabled" : "disabled");
     printf("  batch length %u\n", batch_len);
     printf("  relation_r %s\n", relation_r.c_str());
@@ -188,6 +250,16 @@ struct Configuration {
     printf("  relation_r_size %" PRIu64 "\n", relation_r_size);
     printf("  relation_s_size %" PRIu64 "\n", relation_s_size);
     printf("  delimitor %s\n", delimitor.c_str());
+    if (mode == GROUP_BY) {
+      printf("GROUP BY:\n  strategy %s\n  aggregates %s\n",
+             groupby_strategy.c_str(), groupby_aggrs.c_str());
+      if (groupby_relation.empty()) {
+        printf("  generated %" PRIu64 " rows, %" PRIu64 " groups\n",
+               groupby_rows, groupby_groups);
+      } else {
+        printf("  relation %s\n", groupby_relation.c_str());
+      }
+    }
     printf("}\n");
   }
 };
@@ -207,6 +279,9 @@ inline auto cycles_per_op(const OpTimings& ops) {
   return ops.duration / ops.op_count;
 }
 
+// Buckets of the probe length distribution of the hashtable counters
+constexpr uint32_t PROBE_LENGTH_BUCKETS = 16;
+
 /* Thread stats */
 struct thread_stats {
   OpTimings insertions;
@@ -216,15 +291,24 @@ struct thread_stats {
   uint64_t ht_fill;
   uint64_t ht_capacity;
   uint32_t max_count;
+  // prefetch depths averaged over the requests (see --adaptive-prefetch)
+  double insert_prefetch_depth;
+  double find_prefetch_depth;
   // uint64_t total_threads; // TODO add this back
-#ifdef CALC_STATS
+  // inserts dropped by a full table, always counted
+  uint64_t num_failed_inserts;
+  // hashtable counters, filled in with --ht-stats
   uint64_t num_reprobes;
+  uint64_t num_soft_reprobes;
   uint64_t num_memcpys;
   uint64_t num_memcmps;
   uint64_t num_hashcmps;
   uint64_t num_queue_flushes;
+  uint64_t num_requeues_avoided;
   double avg_distance_from_bucket;
   uint64_t max_distance_from_bucket;
+  uint64_t probe_lengths[PROBE_LENGTH_BUCKETS];
+#ifdef CALC_STATS
   uint64_t avg_read_length;
   uint64_t num_sequences;
 #endif /*CALC_STATS*/
@@ -0,0 +1,67 @@
+#ifndef UTILS_TSC_HPP
+#define UTILS_TSC_HPP
+
+#include <cpuid.h>
+#include <x86intrin.h>
+
+#include <chrono>
+#include <cstdint>
+
+#include "plog/Log.h"
+
+namespace kmercounter {
+
+/// Frequency of the TSC, in Hz, which RDTSC_START/RDTSCP, the latency
+/// collectors and every cycle count we report tick at. Taken from CPUID leaf
+/// 0x15 (crystal clock * ratio) when the CPU enumerates it, else timed
+/// against steady_clock.
+inline double calibrate_tsc_hz() {
+  unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && !(edx & (1 << 8))) {
+    PLOG_WARNING << "TSC is not invariant, cycle counts will not convert to "
+                    "time reliably";
+  }
+
+  if (__get_cpuid_max(0, nullptr) >= 0x15) {
+    __cpuid_count(0x15, 0, eax, ebx, ecx, edx);
+    // eax/ebx is the TSC to crystal clock ratio, ecx the crystal clock in Hz;
+    // either may be left as 0 by the CPU
+    if (eax && ebx && ecx) {
+      const double hz = (double)ecx * ebx / eax;
+      PLOG_INFO.printf("TSC frequency %.3f MHz (CPUID)", hz / 1e6);
+      return hz;
+    }
+  }
+
+  using clock = std::chrono::steady_clock;
+  unsigned aux;
+  const auto t0 = clock::now();
+  const auto c0 = __rdtsc();
+  while (clock::now() - t0 < std::chrono::milliseconds(100)) {
+  }
+  const auto c1 = __rdtscp(&aux);
+  const auto t1 = clock::now();
+  const double hz =
+      (c1 - c0) / std::chrono::duration<double>(t1 - t0).count();
+  PLOG_INFO.printf("TSC frequency %.3f MHz (timed)", hz / 1e6);
+  return hz;
+}
+
+/// Calibrated on the first call; make it early so the calibration does not
+/// land inside a measurement.
+inline double tsc_hz() {
+  static const double hz = calibrate_tsc_hz();
+  return hz;
+}
+
+inline double cycles_to_ns(double cycles) { return cycles * 1e9 / tsc_hz(); }
+
+/// Millions of operations per second for one thread taking `cycles_per_op`.
+inline double cycles_to_mops(double cycles_per_op) {
+  return cycles_per_op ? tsc_hz() / 1e6 / cycles_per_op : 0;
+}
+
+}  // namespace kmercounter
+
+#endif  // UTILS_TSC_HPP
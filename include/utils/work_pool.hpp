@@ -0,0 +1,160 @@
+#ifndef UTILS_WORK_POOL_HPP
+#define UTILS_WORK_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "plog/Log.h"
+#include "stats_record.hpp"
+
+namespace kmercounter {
+
+/// Chunked work-stealing pool for the drivers that split their input between
+/// the threads (--steal-chunk).
+///
+/// The items of a phase (keys, rows, parts of a file) start out with the
+/// thread they used to be split to, cut into chunks. A thread takes its own
+/// chunks front to back, and once it runs out takes half of what is left to
+/// the thread with the most chunks, from the back. A slow core (busy SMT
+/// sibling, remote memory) thus no longer holds the phase up at the barrier.
+/// With a chunk size of 0, every thread has its items as one chunk and
+/// nothing gets stolen, which is the static split.
+///
+/// Chunks are thousands of items, so their deques are behind a lock.
+class WorkPool {
+ public:
+  struct Chunk {
+    // Thread the items were given to, and which of its items
+    uint32_t home;
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  /// Thread t starts out with items[t] items
+  WorkPool(const std::vector<uint64_t> &items, uint64_t chunk_size)
+      : steal(chunk_size), deques(items.size()) {
+    for (auto t = 0u; t < items.size(); t++) {
+      const uint64_t size = chunk_size ? chunk_size : items[t];
+      deques[t].head = chunks.size();
+      for (uint64_t i = 0; i < items[t]; i += size) {
+        chunks.push_back(Chunk{t, i, std::min(i + size, items[t])});
+      }
+      deques[t].tail = chunks.size();
+    }
+  }
+
+  WorkPool(uint32_t n_threads, uint64_t items_per_thread, uint64_t chunk_size)
+      : WorkPool(std::vector<uint64_t>(n_threads, items_per_thread),
+                 chunk_size) {}
+
+  /// The next chunk for the thread, false once there are none left
+  bool next(uint32_t tid, Chunk *chunk) {
+    Deque &own = deques[tid];
+    {
+      std::lock_guard lock{own.lock};
+      if (own.head < own.tail) {
+        take(own, own.head++, chunk);
+        return true;
+      }
+    }
+
+    while (steal) {
+      // The thread with the most left
+      uint32_t victim = tid;
+      uint32_t most = 0;
+      for (auto i = 1u; i < deques.size(); i++) {
+        const uint32_t t = (tid + i) % deques.size();
+        const uint32_t left = deques[t].left();
+        if (left > most) {
+          victim = t;
+          most = left;
+        }
+      }
+      if (!most) {
+        return false;
+      }
+
+      uint32_t first, last;
+      {
+        Deque &from = deques[victim];
+        std::lock_guard lock{from.lock};
+        const uint32_t left = from.tail - from.head;
+        if (!left) continue;
+        last = from.tail;
+        first = last - (left + 1) / 2;
+        from.tail = first;
+      }
+
+      std::lock_guard lock{own.lock};
+      own.stolen += last - first;
+      own.head = first + 1;
+      own.tail = last;
+      take(own, first, chunk);
+      return true;
+    }
+    return false;
+  }
+
+  /// The thread ran out of chunks, `cycles` after it started on the phase
+  void done(uint32_t tid, uint64_t cycles) { deques[tid].cycles = cycles; }
+
+  /// Log how evenly the threads were busy and add it to the run counters,
+  /// once they are all done
+  void report(const std::string &phase) const {
+    uint64_t max_cycles = 0, sum_cycles = 0, stolen = 0;
+    for (auto t = 0u; t < deques.size(); t++) {
+      const Deque &d = deques[t];
+      PLOGV.printf("%s: thread %u did %" PRIu64 " items in %" PRIu64
+                   " chunks (%" PRIu64 " stolen), %" PRIu64 " cycles",
+                   phase.c_str(), t, d.items, d.chunks, d.stolen, d.cycles);
+      max_cycles = std::max(max_cycles, d.cycles);
+      sum_cycles += d.cycles;
+      stolen += d.stolen;
+    }
+    const double mean = (double)sum_cycles / deques.size();
+    const double imbalance = mean ? max_cycles / mean : 1.0;
+    PLOG_INFO.printf("%s: %zu chunks, %" PRIu64
+                     " stolen, slowest thread %.2fx the mean",
+                     phase.c_str(), chunks.size(), stolen, imbalance);
+    run_counters[phase + ".chunks_stolen"] = stolen;
+    run_counters[phase + ".imbalance"] = imbalance;
+  }
+
+ private:
+  struct alignas(64) Deque {
+    std::mutex lock;
+    // Chunks [head, tail) are left, read outside the lock to pick a victim
+    std::atomic<uint32_t> head{};
+    std::atomic<uint32_t> tail{};
+    uint64_t items = 0;
+    uint64_t chunks = 0;
+    uint64_t stolen = 0;
+    uint64_t cycles = 0;
+
+    uint32_t left() const {
+      const uint32_t h = head.load(std::memory_order_relaxed);
+      const uint32_t t = tail.load(std::memory_order_relaxed);
+      return t > h ? t - h : 0;
+    }
+  };
+
+  void take(Deque &own, uint32_t idx, Chunk *chunk) {
+    *chunk = chunks[idx];
+    own.items += chunk->end - chunk->begin;
+    own.chunks++;
+  }
+
+  const bool steal;
+  std::vector<Chunk> chunks;
+  std::vector<Deque> deques;
+};
+
+}  // namespace kmercounter
+
+#endif  // UTILS_WORK_POOL_HPP
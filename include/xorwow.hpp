@@ -36,4 +36,19 @@ class xorwow_urbg {
   }()};
 };
 
+/// Random access into a xorwow stream: draw n comes from a generator seeded
+/// with (seed, n / BLOCK), so the draw does not depend on who made the ones
+/// before it. Going to any n costs at most BLOCK draws, the next n costs one.
+class xorwow_seek {
+ public:
+  static constexpr uint64_t BLOCK = 1024;
+
+  uint32_t at(const xorwow_state &seed, uint64_t n);
+
+ private:
+  const xorwow_state *seed{};
+  uint64_t next{};
+  xorwow_state state{};
+};
+
 #endif /* XORWOW_HPP */
@@ -13,7 +13,9 @@
 #include <functional>
 
 #include "./hashtables/cas_kht.hpp"
+#include "./hashtables/cuckoo_kht.hpp"
 #include "./hashtables/simple_kht.hpp"
+#include "./hashtables/swiss_kht.hpp"
 #include "./hashtables/array_kht.hpp"
 #include "./hashtables/multi_kht.hpp"
 
@@ -21,6 +23,7 @@
 #include "print_stats.h"
 #include "tests/PrefetchTest.hpp"
 #include "types.hpp"
+#include "utils/tsc.hpp"
 
 #if defined(WITH_PAPI_LIB) || defined(ENABLE_HIGH_LEVEL_PAPI)
 #include <papi.h>
@@ -65,6 +68,14 @@ const Configuration def = {
     .ht_fill = 75,
     .ht_size = HT_TESTS_HT_SIZE,
     .insert_factor = 1,
+    .ht_grow_threshold = 0.0,
+    .ht_snapshot_out = std::string(""),
+    .ht_snapshot_in = std::string(""),
+    .ht_profile = std::string(""),
+    .scan_threads = 0,
+    .hasher = std::string(""),
+    .key_type = std::string("int"),
+    .ht_stats = false,
     .n_prod = 1,
     .n_cons = 1,
     .num_nops = 0,
@@ -74,6 +85,10 @@ const Configuration def = {
     .drop_caches = true,
     .hwprefetchers = false,
     .no_prefetch = false,
+    .prefetch_depth = FLUSH_THRESHOLD,
+    .adaptive_prefetch = false,
+    .reprobe_lines = 1,
+    .coro_lookups = 0,
     .run_both = false,
     .batch_len = HT_TESTS_BATCH_LENGTH,
     .materialize = false,
@@ -82,8 +97,17 @@ const Configuration def = {
     .relation_r_size = 128000000,
     .relation_s_size = 128000000,
     .delimitor = "|",
+    .groupby_strategy = "shared",
+    .groupby_aggrs = "count,sum,min,max",
+    .groupby_relation = "",
+    .groupby_rows = 128000000,
+    .groupby_groups = 1000000,
     .rw_queues = false,
-    .pollute_ratio = 0
+    .pollute_ratio = 0,
+    .delegate_finds = false,
+    .rebalance_parts = 0,
+    .combine_slots = 0,
+    .steal_chunk = 1 << 14
 };  // TODO enum
 
 // for synchronization of threads
@@ -108,6 +132,14 @@ void sync_complete(void) {
     PLOGI.printf("Stopping counters");
     bw_counters->stop();
     bw_counters->compute_mem_bw();
+    const std::string phase =
+        cur_phase == ExecPhase::finds ? "finds" : "insertions";
+    run_counters[phase + ".mem_read_mibs"] = bw_counters->read_mibs;
+    run_counters[phase + ".mem_write_mibs"] = bw_counters->write_mibs;
+    // the CAS counts the bandwidth is computed from, a cacheline each
+    run_counters[phase + ".mem_read_bytes"] = bw_counters->read_bw * 64.0;
+    run_counters[phase + ".mem_write_bytes"] = bw_counters->write_bw * 64.0;
+    run_counters[phase + ".mem_seconds"] = bw_counters->seconds;
     stop_sync = false;
   } else {
     PLOGI.printf("Starting counters");
@@ -136,35 +168,62 @@ void sync_complete(void) {
   PLOGI.printf("Sync phase done!");
 }
 
+#if (KEY_LEN == 8)
+/// The tables of the keys passed by reference (--key-type)
+template <typename KV, typename H>
+BaseHashTable *init_wide_key_ht(const uint64_t sz, uint8_t id) {
+  if (config.ht_type == PARTITIONED_HT) {
+    return new PartitionedHashStore<KV, ItemQueue, H>(sz, id);
+  }
+  return new CASHashTable<KV, ItemQueue, H>(sz);
+}
+#endif
+
 BaseHashTable *init_ht(const uint64_t sz, uint8_t id) {
   BaseHashTable *kmer_ht = NULL;
 
-  // Create hash table
-  switch (config.ht_type) {
-    case MULTI_HT:
-      /* For the CAS Hash table, size is the same as
-          size of one partitioned ht * number of threads */
-      kmer_ht =
-          new MultiHashTable<KVType, ItemQueue>(sz);  // * config.num_threads);
-      break;
-    case PARTITIONED_HT:
-      kmer_ht = new PartitionedHashStore<KVType, ItemQueue>(sz, id);
-      break;
-    case CASHTPP:
-      /* For the CAS Hash table, size is the same as
-          size of one partitioned ht * number of threads */
-      kmer_ht =
-          new CASHashTable<KVType, ItemQueue>(sz);  // * config.num_threads);
-      break;
-    case ARRAY_HT:
-      kmer_ht =
-          new ArrayHashTable<Value, ItemQueue>(sz);
-      break;
-    default:
-      PLOG_FATAL.printf("HT type not implemented");
-      exit(-1);
-      break;
-  }
+  // Create hash table, with the hasher picked on the command line
+  Hashers::dispatch(config.hasher, [&]<typename H>(H) {
+#if (KEY_LEN == 8)
+    if (config.key_type == "key16") {
+      kmer_ht = init_wide_key_ht<Item16, H>(sz, id);
+      return;
+    } else if (config.key_type == "indirect") {
+      kmer_ht = init_wide_key_ht<IndirectItem, H>(sz, id);
+      return;
+    }
+#endif
+    switch (config.ht_type) {
+      case MULTI_HT:
+        /* For the CAS Hash table, size is the same as
+            size of one partitioned ht * number of threads */
+        kmer_ht = new MultiHashTable<KVType, ItemQueue, H>(
+            sz);  // * config.num_threads);
+        break;
+      case PARTITIONED_HT:
+        kmer_ht = new PartitionedHashStore<KVType, ItemQueue, H>(sz, id);
+        break;
+      case CASHTPP:
+        /* For the CAS Hash table, size is the same as
+            size of one partitioned ht * number of threads */
+        kmer_ht = new CASHashTable<KVType, ItemQueue, H>(
+            sz);  // * config.num_threads);
+        break;
+      case ARRAY_HT:
+        kmer_ht = new ArrayHashTable<Value, ItemQueue, H>(sz);
+        break;
+      case CUCKOO_HT:
+        kmer_ht = new CuckooHashTable<KVType, ItemQueue, H>(sz);
+        break;
+      case SWISS_HT:
+        kmer_ht = new SwissHashTable<KVType, ItemQueue, H>(sz);
+        break;
+      default:
+        PLOG_FATAL.printf("HT type not implemented");
+        exit(-1);
+        break;
+    }
+  });
   return kmer_ht;
 }
 
@@ -176,9 +235,11 @@ void free_ht(BaseHashTable *kmer_ht) {
 void Application::shard_thread(int tid, std::barrier<std::function<void()>>* barrier) {
   Shard *sh = &this->shards[tid];
   BaseHashTable *kmer_ht = NULL;
+  on_shard_thread = true;
 
   sh->stats =
       (thread_stats *)std::aligned_alloc(CACHE_LINE_SIZE, sizeof(thread_stats));
+  memset(sh->stats, 0, sizeof(thread_stats));
 
   switch (config.mode) {
     case FASTQ_WITH_INSERT:
@@ -193,9 +254,12 @@ void Application::shard_thread(int tid, std::barrier<std::function<void()>>* bar
     case ZIPFIAN:
     case HASHJOIN:
     case BQ_TESTS_NO_BQ:
+    case HT_PROFILE:
       kmer_ht = init_ht(config.ht_size, sh->shard_idx);
       break;
     case FASTQ_NO_INSERT:
+    case GROUP_BY:
+      // builds a table per aggregate
       break;
     case CACHE_MISS:
       kmer_ht = init_ht(HT_TESTS_HT_SIZE, sh->shard_idx);
@@ -239,14 +303,21 @@ void Application::shard_thread(int tid, std::barrier<std::function<void()>>* bar
     case FASTQ_WITH_INSERT:
       this->test.kmer.count_kmer(sh, config, kmer_ht, barrier);
       break;
+    case GROUP_BY:
+      this->test.gb.run(sh, config, barrier);
+      break;
     default:
       break;
   }
 
+  if (!kmer_ht) {
+    goto done;
+  }
+
   // Write to file
   if (!config.ht_file.empty()) {
-    // for CAS hashtable, not every thread has to write to file
-    if ( (config.ht_type == CASHTPP ||config.ht_type == MULTI_HT) && (sh->shard_idx > 0)) {
+    // a shared hashtable is written once, by the first thread
+    if (kmer_ht->is_shared() && (sh->shard_idx > 0)) {
       goto done;
     }
     std::string outfile = config.ht_file + std::to_string(sh->shard_idx);
@@ -255,6 +326,27 @@ void Application::shard_thread(int tid, std::barrier<std::function<void()>>* bar
     kmer_ht->print_to_file(outfile);
   }
 
+  if (!config.ht_snapshot_out.empty()) {
+    // a shared hashtable is written once, by the first thread
+    if (kmer_ht->is_shared() && (sh->shard_idx > 0)) {
+      goto done;
+    }
+    std::string outfile = snapshot_path(config.ht_snapshot_out, sh->shard_idx);
+    PLOG_INFO.printf("Shard %u: Writing snapshot: %s", sh->shard_idx,
+                     outfile.c_str());
+    kmer_ht->save_snapshot(outfile);
+  }
+
+  if (!config.ht_profile.empty()) {
+    if (kmer_ht->is_shared() && (sh->shard_idx > 0)) {
+      goto done;
+    }
+    std::string outfile = config.ht_profile + std::to_string(sh->shard_idx);
+    PLOG_INFO.printf("Shard %u: Writing profile: %s", sh->shard_idx,
+                     outfile.c_str());
+    kmer_ht->save_profile(outfile);
+  }
+
   // free_ht(kmer_ht);
 
 done:
@@ -274,7 +366,8 @@ int Application::spawn_shard_threads() {
 
   if ((config.mode != SYNTH) && (config.mode != ZIPFIAN) &&
       (config.mode != PREFETCH) && (config.mode != CACHE_MISS) &&
-      (config.mode != RW_RATIO) && (config.mode != HASHJOIN)) {
+      (config.mode != RW_RATIO) && (config.mode != HASHJOIN) &&
+      (config.mode != HT_PROFILE) && (config.mode != GROUP_BY)) {
     config.in_file_sz = get_file_size(config.in_file.c_str());
     PLOG_INFO.printf("File size: %" PRIu64 " bytes", config.in_file_sz);
     seg_sz = config.in_file_sz / config.num_threads;
@@ -285,13 +378,20 @@ int Application::spawn_shard_threads() {
 
   // split the num inserts equally among threads for a
   // non-partitioned hashtable
-  if (config.ht_type == CASHTPP || config.ht_type == MULTI_HT) {
+  if (config.ht_type == CASHTPP || config.ht_type == MULTI_HT ||
+      config.ht_type == CUCKOO_HT || config.ht_type == SWISS_HT) {
     auto orig_num_inserts = HT_TESTS_NUM_INSERTS;
     HT_TESTS_NUM_INSERTS /= (double)config.num_threads;
     PLOGI.printf("Total inserts %" PRIu64 " | num_threads %u | scaled inserts per thread %" PRIu64 "",
           orig_num_inserts, config.num_threads, HT_TESTS_NUM_INSERTS);
   }
 
+  // A stolen key would go to the partition of the thief
+  if (config.ht_type == PARTITIONED_HT && config.steal_chunk) {
+    PLOGI.printf("Partitioned hashtable: splitting the work statically");
+    config.steal_chunk = 0;
+  }
+
   if (config.insert_factor > 1) {
     PLOGI.printf("Insert factor %" PRIu64 ", Effective num insertions %" PRIu64 "", config.insert_factor,
         HT_TESTS_NUM_INSERTS * config.insert_factor);
@@ -357,7 +457,8 @@ int Application::spawn_shard_threads() {
       th.join();
     }
   }
-  if ((config.mode != CACHE_MISS) && (config.mode != HASHJOIN)) {
+  if ((config.mode != CACHE_MISS) && (config.mode != HASHJOIN) &&
+      (config.mode != HT_PROFILE)) {
     print_stats(this->shards, config);
   }
 
@@ -397,7 +498,9 @@ int Application::process(int argc, char *argv[]) {
         "10: Cache Miss test\n"
         "11: Zipfian non-bqueue test\n"
         "12: RW-ratio test\n"
-        "13: Hashjoin")(
+        "13: Hashjoin\n"
+        "14: Profile the hashtable mapped from --snapshot-in\n"
+        "15: Group by")(
         "base",
         po::value<uint64_t>(&config.kmer_create_data_base)
             ->default_value(def.kmer_create_data_base),
@@ -428,15 +531,18 @@ int Application::process(int argc, char *argv[]) {
         "numa-split",
         po::value<uint32_t>(&config.numa_split)->default_value(def.numa_split),
         "Split spawning threads between numa nodes")(
-        "stats",
+        "stats-file",
         po::value<std::string>(&config.stats_file)
             ->default_value(def.stats_file),
-        "Stats file name.")(
+        "Append a record of the run's configuration and results to this file: "
+        "a CSV row if it ends in .csv, a line of JSON otherwise")(
         "ht-type",
         po::value<uint32_t>(&config.ht_type)->default_value(def.ht_type),
         "1: Partitioned HT\n"
         "3: Casht++\n"
-        "4: Arrayht\n")(
+        "4: Arrayht\n"
+        "6: Cuckoo HT\n"
+        "7: Swiss HT\n")(
         "out-file",
         po::value<std::string>(&config.ht_file)->default_value(def.ht_file),
         "Hashtable output file name.")(
@@ -462,6 +568,45 @@ int Application::process(int argc, char *argv[]) {
         "ht-size",
         po::value<uint64_t>(&config.ht_size)->default_value(def.ht_size),
         "adjust hashtable fill ratio [0-100] ")(
+        "ht-grow-threshold",
+        po::value<double>(&config.ht_grow_threshold)
+            ->default_value(def.ht_grow_threshold),
+        "Grow the CAS hashtable, or each partition of the partitioned one, "
+        "once its fill crosses this fraction (0: fixed size)")(
+        "snapshot-out",
+        po::value<std::string>(&config.ht_snapshot_out)
+            ->default_value(def.ht_snapshot_out),
+        "Write a binary snapshot of the hashtable to this file name at the "
+        "end of the run")(
+        "snapshot-in",
+        po::value<std::string>(&config.ht_snapshot_in)
+            ->default_value(def.ht_snapshot_in),
+        "Map the hashtable from the binary snapshot with this file name "
+        "instead of starting empty")(
+        "ht-profile",
+        po::value<std::string>(&config.ht_profile)
+            ->default_value(def.ht_profile),
+        "Write the probe distance, run length and cacheline occupancy "
+        "histograms of the hashtable to this file name at the end of the run")(
+        "scan-threads",
+        po::value<uint32_t>(&config.scan_threads)
+            ->default_value(def.scan_threads),
+        "Threads of the hashtable scans that run once, not from every shard "
+        "(0: all cpus)")(
+        "hasher",
+        po::value<std::string>(&config.hasher)->default_value(def.hasher),
+        "Hash function of the hashtable, one of: crc, city, citycrc, xxhash, "
+        "xxhash3, wyhash, fnv, mulxor, direct_index (default: the build's "
+        "HASHER)")(
+        "key-type",
+        po::value<std::string>(&config.key_type)->default_value(def.key_type),
+        "Keys of the synthetic test (mode 6): int, key16 (16-byte keys) or "
+        "indirect (variable length keys stored out of line). key16 and "
+        "indirect overwrite values and need the CAS or partitioned hashtable")(
+        "ht-stats",
+        po::value<bool>(&config.ht_stats)->default_value(def.ht_stats),
+        "Count reprobes and probe lengths of the hashtable operations and "
+        "report them with the stats")(
         "skew", po::value<double>(&config.skew)->default_value(def.skew),
         "Zipfian skewness")(
         "seed", po::value<int64_t>(&config.seed)->default_value(def.seed),
@@ -469,6 +614,27 @@ int Application::process(int argc, char *argv[]) {
         "hw-pref", po::value<bool>(&config.hwprefetchers)->default_value(def.hwprefetchers))(
         "no-prefetch",
         po::value<bool>(&config.no_prefetch)->default_value(def.no_prefetch))(
+        "prefetch-depth",
+        po::value<uint32_t>(&config.prefetch_depth)
+            ->default_value(def.prefetch_depth),
+        "Requests queued ahead of the one processed by the hashtables, i.e. "
+        "the software prefetch distance (4 to 64)")(
+        "adaptive-prefetch",
+        po::value<bool>(&config.adaptive_prefetch)
+            ->default_value(def.adaptive_prefetch),
+        "Tune the prefetch depth of every thread at runtime from the measured "
+        "cycles per request, starting at --prefetch-depth")(
+        "reprobe-lines",
+        po::value<uint32_t>(&config.reprobe_lines)
+            ->default_value(def.reprobe_lines),
+        "Cachelines the CAS hashtable prefetches at once for a lookup that "
+        "keeps reprobing, doubling per line crossed up to this many (1: one "
+        "line at a time)")(
+        "coro-lookups",
+        po::value<uint32_t>(&config.coro_lookups)
+            ->default_value(def.coro_lookups),
+        "Interleave the lookups of a batch on this many coroutines instead of "
+        "the find queue (CAS and partitioned hashtables, 0: off)")(
         "run-both",
         po::value<bool>(&config.run_both)->default_value(def.run_both))(
         "batch-len",
@@ -487,11 +653,48 @@ int Application::process(int argc, char *argv[]) {
         ("relation_s_size",
         po::value(&config.relation_s_size)->default_value(def.relation_s_size), "Number of elements in relation S. Only used when the relations are generated.")
         ("delimitor",
-        po::value(&config.delimitor)->default_value(def.delimitor), "CSV delimitor for relation files.")(
+        po::value(&config.delimitor)->default_value(def.delimitor), "CSV delimitor for relation files.")
+        ("groupby-strategy",
+        po::value(&config.groupby_strategy)->default_value(def.groupby_strategy),
+        "How the threads aggregate: shared (CAS tables), partitioned (hash "
+        "partition the rows between threads) or local (per thread tables "
+        "merged at the end)")
+        ("groupby-aggrs",
+        po::value(&config.groupby_aggrs)->default_value(def.groupby_aggrs),
+        "Comma separated aggregates computed per key: count, sum, min, max")
+        ("groupby-relation",
+        po::value(&config.groupby_relation)->default_value(def.groupby_relation),
+        "CSV relation of key, value rows to group (generated when empty)")
+        ("groupby-rows",
+        po::value(&config.groupby_rows)->default_value(def.groupby_rows),
+        "Number of rows in the generated relation")
+        ("groupby-groups",
+        po::value(&config.groupby_groups)->default_value(def.groupby_groups),
+        "Number of distinct keys in the generated relation")(
           "rw-queues",
           po::value<bool>(&config.rw_queues)->default_value(def.rw_queues),
           "Enable R/W tests for queues tests"
-        )("pollute-ratio", po::value(&config.pollute_ratio)->default_value(def.pollute_ratio), "Ratio of pollution events to ops (>1)");
+        )("pollute-ratio", po::value(&config.pollute_ratio)->default_value(def.pollute_ratio), "Ratio of pollution events to ops (>1)")(
+          "delegate-finds",
+          po::value<bool>(&config.delegate_finds)
+              ->default_value(def.delegate_finds),
+          "Queue tests: send the finds to the consumer owning the partition "
+          "instead of reading it directly (needs the prefetch engine)")(
+          "rebalance-parts",
+          po::value(&config.rebalance_parts)
+              ->default_value(def.rebalance_parts),
+          "Queue tests: split the keys into N partitions per consumer, moved "
+          "from busy to idle consumers (0: one fixed partition per consumer)")(
+          "combine-slots",
+          po::value(&config.combine_slots)->default_value(def.combine_slots),
+          "Queue tests: merge repeated inserts of a key in a buffer of N slots "
+          "per producer before enqueuing them (0: off, needs the prefetch "
+          "engine)")(
+          "steal-chunk",
+          po::value(&config.steal_chunk)->default_value(def.steal_chunk),
+          "Synth, zipfian, k-mer and hashjoin runs: keys/rows per chunk of "
+          "work the threads steal from each other when they run out (0: "
+          "static split)");
 
     papi_init();
 
@@ -524,6 +727,8 @@ int Application::process(int argc, char *argv[]) {
       PLOG_INFO.printf("Mode : SYNTH");
     } else if (config.mode == PREFETCH) {
       PLOG_INFO.printf("Mode : PREFETCH");
+    } else if (config.mode == HT_PROFILE) {
+      PLOG_INFO.printf("Mode : HT_PROFILE");
     } else if (config.mode == DRY_RUN) {
       PLOG_INFO.printf("Mode : Dry run ...");
       PLOG_INFO.printf(
@@ -560,6 +765,26 @@ int Application::process(int argc, char *argv[]) {
         //config.ht_size = static_cast<double>(max_join_size) * 100 / config.ht_fill;
       }
       PLOGI.printf("Setting ht size to %llu for hashjoin test", config.ht_size);
+    } else if (config.mode == GROUP_BY) {
+      PLOG_INFO.printf("Mode : GROUP_BY");
+      std::vector<unsigned> aggrs;
+      if (!GroupByTest::valid_strategy(config.groupby_strategy) ||
+          !GroupByTest::parse_aggrs(config.groupby_aggrs, &aggrs)) {
+        PLOG_ERROR.printf("--groupby-strategy is one of shared, partitioned "
+                          "or local and --groupby-aggrs a list of count, sum, "
+                          "min and max");
+        exit(-1);
+      }
+      if (config.groupby_relation.empty() && !config.groupby_groups) {
+        PLOG_ERROR.printf("--groupby-groups must be at least 1");
+        exit(-1);
+      }
+      // The tables are sized from the number of groups, the type follows the
+      // strategy
+      if (!config.ht_type) {
+        config.ht_type =
+            config.groupby_strategy == "shared" ? CASHTPP : PARTITIONED_HT;
+      }
     }
 
     switch (config.ht_type) {
@@ -576,6 +801,12 @@ int Application::process(int argc, char *argv[]) {
       case ARRAY_HT:
         PLOG_INFO.printf("Hashtable type : Array HT");
         break;
+      case CUCKOO_HT:
+        PLOG_INFO.printf("Hashtable type : Cuckoo HT");
+        break;
+      case SWISS_HT:
+        PLOG_INFO.printf("Hashtable type : Swiss HT");
+        break;
       default:
         PLOGE.printf("Unknown HT type %u! Specify using --ht-type",
                      config.ht_type);
@@ -590,6 +821,91 @@ int Application::process(int argc, char *argv[]) {
       PLOG_ERROR.printf("ht_fill should be in range [1, 99)");
     }
 
+    if (config.ht_grow_threshold < 0 || config.ht_grow_threshold >= 1) {
+      PLOG_ERROR.printf("ht_grow_threshold should be in range [0, 1)");
+      exit(-1);
+    }
+
+    if (config.ht_size > MAX_HT_CAPACITY) {
+      PLOG_ERROR.printf("ht_size should be at most %lu slots per table",
+                        MAX_HT_CAPACITY);
+      exit(-1);
+    }
+
+    if (config.hasher.empty()) {
+      config.hasher = Hasher::name;
+    } else if (!Hashers::dispatch(config.hasher, [](auto) {})) {
+      PLOG_ERROR.printf("Unknown hasher %s! Pick one of: %s",
+                        config.hasher.c_str(), Hashers::names().c_str());
+      exit(-1);
+    }
+    PLOG_INFO.printf("Hasher : %s", config.hasher.c_str());
+
+    if (config.key_type != "int") {
+#if (KEY_LEN == 8)
+      const bool known =
+          config.key_type == "key16" || config.key_type == "indirect";
+#else
+      const bool known = false;
+#endif
+      if (!known || config.mode != SYNTH ||
+          (config.ht_type != CASHTPP && config.ht_type != PARTITIONED_HT)) {
+        PLOG_ERROR.printf("--key-type %s: key16 and indirect keys (with "
+                          "8-byte key_type) are supported by the synthetic "
+                          "test on the CAS and partitioned hashtables",
+                          config.key_type.c_str());
+        exit(-1);
+      }
+      if (config.key_type == "indirect" && (!config.ht_snapshot_out.empty() ||
+                                            !config.ht_snapshot_in.empty())) {
+        PLOG_ERROR.printf("Snapshots cannot hold indirect keys");
+        exit(-1);
+      }
+    }
+
+    if (config.ht_type == SWISS_HT &&
+        (!config.ht_snapshot_out.empty() || !config.ht_snapshot_in.empty() ||
+         !config.ht_profile.empty())) {
+      PLOG_ERROR.printf("--snapshot-out, --snapshot-in and --ht-profile are "
+                        "unsupported for the swiss hashtable");
+      exit(-1);
+    }
+
+    if ((!config.ht_snapshot_out.empty() || !config.ht_snapshot_in.empty()) &&
+        config.ht_type != CASHTPP && config.ht_type != PARTITIONED_HT &&
+        config.ht_type != CUCKOO_HT) {
+      PLOG_ERROR.printf("Snapshots are only supported by the CAS, cuckoo and "
+                        "partitioned hashtables");
+      exit(-1);
+    }
+
+    if (!config.ht_profile.empty() && config.ht_type != CASHTPP &&
+        config.ht_type != PARTITIONED_HT) {
+      PLOG_ERROR.printf("Profiles are only supported by the linear probing "
+                        "(CAS and partitioned) hashtables");
+      exit(-1);
+    }
+
+    if (config.mode == HT_PROFILE &&
+        (config.ht_snapshot_in.empty() || config.ht_profile.empty())) {
+      PLOG_ERROR.printf("Mode 14 profiles --snapshot-in into --ht-profile");
+      exit(-1);
+    }
+
+    if (config.reprobe_lines < 1 || config.reprobe_lines > 16) {
+      PLOG_ERROR.printf("--reprobe-lines takes 1 to 16 cachelines");
+      exit(-1);
+    }
+
+    if (config.coro_lookups &&
+        ((config.ht_type != CASHTPP && config.ht_type != PARTITIONED_HT) ||
+         config.coro_lookups > MAX_CORO_LOOKUPS)) {
+      PLOG_ERROR.printf("Coroutine lookups are supported by the CAS and "
+                        "partitioned hashtables, with at most %u coroutines",
+                        MAX_CORO_LOOKUPS);
+      exit(-1);
+    }
+
   } catch (std::exception &e) {
     std::cout << e.what() << "\n";
     exit(-1);
@@ -613,6 +929,9 @@ int Application::process(int argc, char *argv[]) {
 
   config.dump_configuration();
 
+  // Calibrate before any thread starts timing
+  tsc_hz();
+
   if ((config.mode == BQ_TESTS_YES_BQ) || (config.mode == FASTQ_WITH_INSERT)) {
     bq_load = BQUEUE_LOAD::HtInsert;
   }
@@ -658,7 +977,9 @@ int Application::process(int argc, char *argv[]) {
     // for hashjoin, ht-type determines how we spawn threads
     if (config.ht_type == PARTITIONED_HT) {
       this->test.qt.run_test(&config, this->n, true, this->npq);
-    } else if ((config.ht_type == CASHTPP) || (config.ht_type == ARRAY_HT) || (config.ht_type == MULTI_HT)) {
+    } else if ((config.ht_type == CASHTPP) || (config.ht_type == ARRAY_HT) ||
+               (config.ht_type == MULTI_HT) || (config.ht_type == CUCKOO_HT) ||
+               (config.ht_type == SWISS_HT)) {
       this->spawn_shard_threads();
     }
   } else if (config.mode == BQ_TESTS_YES_BQ) {
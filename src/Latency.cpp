@@ -2,5 +2,7 @@
 
 namespace kmercounter {
 std::vector<LatencyCollector<pool_size>> collectors;
+std::vector<LatencyCollector<pool_size>> resize_collectors;
 std::mutex collector_lock;
+std::map<std::string, LatencyHistogram> latency_histograms;
 }  // namespace kmercounter
@@ -0,0 +1,319 @@
+/// GROUP BY key with count/sum/min/max aggregates (mode 15).
+/// Every aggregate function is a table of Upsert_KV with its combiner, so a
+/// row is one upsert per aggregate. The strategies differ in where the
+/// upserts of the threads meet:
+///  shared      - all threads upsert into the same CAS tables; no extra pass,
+///                but the threads contend on the hot groups
+///  partitioned - rows are first scattered to the thread owning the hash
+///                partition of their key, which aggregates them without any
+///                sharing; costs a pass over the rows
+///  local       - threads aggregate into private tables, then merge their
+///                partial aggregates into shared CAS tables; the merge pass
+///                is over groups, so it pays off at low cardinality
+
+#include <plog/Log.h>
+
+#include <algorithm>
+#include <array>
+#include <barrier>
+#include <cinttypes>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "fastrange.h"
+#include "hasher.hpp"
+#include "hashtables/base_kht.hpp"
+#include "hashtables/batch_runner/batch_runner.hpp"
+#include "hashtables/cas_kht.hpp"
+#include "hashtables/ht_scan.hpp"
+#include "hashtables/kvtypes.hpp"
+#include "hashtables/simple_kht.hpp"
+#include "input_reader/csv.hpp"
+#include "stats_record.hpp"
+#include "sync.h"
+#include "tests/GroupByTest.hpp"
+#include "utils/tsc.hpp"
+
+namespace kmercounter {
+namespace {
+
+enum Aggregate { COUNT, SUM, MIN, MAX };
+
+/// Rows of the generated relation and the thread a key is partitioned to are
+/// derived from this, not from the table hash, so that partitioning does not
+/// skew the slots the keys take within a partition.
+inline uint64_t mix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+template <typename F>
+void with_combiner(unsigned aggr, F &&f) {
+  switch (aggr) {
+    case COUNT:
+      f(combiner::count{});
+      break;
+    case SUM:
+      f(combiner::sum{});
+      break;
+    case MIN:
+      f(combiner::min{});
+      break;
+    case MAX:
+      f(combiner::max{});
+      break;
+  }
+}
+
+/// Table size for `groups` keys at the configured fill
+uint64_t table_size(uint64_t groups, const Configuration &config) {
+  return std::max<uint64_t>(groups * 100 / config.ht_fill, 1024);
+}
+
+}  // namespace
+
+bool GroupByTest::parse_aggrs(std::string_view aggrs,
+                              std::vector<unsigned> *out) {
+  out->clear();
+  while (!aggrs.empty()) {
+    const auto comma = std::min(aggrs.find(','), aggrs.size());
+    const auto name = aggrs.substr(0, comma);
+    const auto it = std::find(std::begin(AGGR_NAMES), std::end(AGGR_NAMES), name);
+    if (it == std::end(AGGR_NAMES)) {
+      return false;
+    }
+    out->push_back(it - std::begin(AGGR_NAMES));
+    aggrs.remove_prefix(std::min(comma + 1, aggrs.size()));
+  }
+  return !out->empty();
+}
+
+bool GroupByTest::valid_strategy(std::string_view strategy) {
+  return std::find(std::begin(STRATEGIES), std::end(STRATEGIES), strategy) !=
+         std::end(STRATEGIES);
+}
+
+void GroupByTest::run(Shard *sh, const Configuration &config,
+                      std::barrier<VoidFn> *barrier) {
+  const unsigned tid = sh->shard_idx;
+  const unsigned num_threads = config.num_threads;
+  const bool shared = config.groupby_strategy == "shared";
+  const bool partitioned = config.groupby_strategy == "partitioned";
+  std::vector<unsigned> aggrs;
+  parse_aggrs(config.groupby_aggrs, &aggrs);
+
+  if (tid == 0) {
+    this->partitions.assign(partitioned ? num_threads * num_threads : 0, {});
+  }
+
+  // Load this thread's part of the relation. Key 0 marks the empty slots of
+  // the tables, so those rows cannot be grouped.
+  std::vector<KeyValuePair> rows;
+  uint64_t value_sum = 0, dropped = 0;
+  auto add_row = [&](const KeyValuePair &kv) {
+    if (!kv.key) {
+      dropped++;
+      return;
+    }
+    rows.push_back(kv);
+    value_sum += kv.value;
+  };
+  if (config.groupby_relation.empty()) {
+    const uint64_t begin = config.groupby_rows * tid / num_threads;
+    const uint64_t end = config.groupby_rows * (tid + 1) / num_threads;
+    rows.reserve(end - begin);
+    for (uint64_t i = begin; i < end; i++) {
+      const uint64_t r = mix64(config.seed + i);
+      add_row(KeyValuePair(1 + (r >> 32) % config.groupby_groups,
+                           1 + (r & 0xffffffff) % 1000));
+    }
+  } else {
+    input_reader::KeyValueCsvReader reader(config.groupby_relation, tid,
+                                           num_threads, config.delimitor);
+    for (KeyValuePair kv; reader.next(&kv);) {
+      add_row(kv);
+    }
+  }
+  this->total_rows += rows.size();
+  this->total_sum += value_sum;
+  this->dropped_rows += dropped;
+  barrier->arrive_and_wait();
+
+  // A CSV relation may have as many groups as rows
+  const uint64_t groups = config.groupby_relation.empty()
+                              ? config.groupby_groups
+                              : this->total_rows.load();
+  const uint64_t my_groups = std::min<uint64_t>(groups, rows.size());
+  const uint64_t part_groups = groups / num_threads * 5 / 4 + 1024;
+
+  // Per aggregate, the table rows are upserted into and, with the local
+  // strategy, the shared one the partial aggregates are merged into
+  std::vector<std::unique_ptr<BaseHashTable>> tables, merged;
+  Hashers::dispatch(config.hasher, [&]<typename H>(H) {
+    for (const auto aggr : aggrs) {
+      with_combiner(aggr, [&]<typename C>(C) {
+        if (shared) {
+          tables.emplace_back(new CASHashTable<Upsert_KV<C>, ItemQueue, H>(
+              table_size(groups, config)));
+        } else {
+          tables.emplace_back(
+              new PartitionedHashStore<Upsert_KV<C>, ItemQueue, H>(
+                  table_size(partitioned ? part_groups : my_groups, config),
+                  tid));
+        }
+        if (!shared && !partitioned) {
+          merged.emplace_back(
+              new CASHashTable<Upsert_KV<combiner::merged<C>>, ItemQueue, H>(
+                  table_size(groups, config)));
+        }
+      });
+    }
+  });
+
+  std::vector<HTBatchRunner<>> runners;
+  runners.reserve(aggrs.size());
+  for (auto &ht : tables) {
+    runners.emplace_back(ht.get());
+  }
+  auto upsert = [&runners](const KeyValuePair &kv) {
+    for (auto &runner : runners) {
+      runner.insert(kv.key, kv.value);
+    }
+  };
+  auto flush = [&runners] {
+    for (auto &runner : runners) {
+      runner.flush_insert();
+    }
+  };
+
+  barrier->arrive_and_wait();
+  const uint64_t start = RDTSC_START();
+  uint64_t upserts = 0;
+
+  if (partitioned) {
+    auto *out = &this->partitions[tid * num_threads];
+    for (const auto &kv : rows) {
+      out[fastrange32(mix64(kv.key) >> 32, num_threads)].push_back(kv);
+    }
+  } else {
+    for (const auto &kv : rows) {
+      upsert(kv);
+    }
+    flush();
+    upserts += rows.size() * aggrs.size();
+  }
+  const uint64_t phase1_end = RDTSCP();
+
+  if (!shared) {
+    barrier->arrive_and_wait();
+  }
+
+  if (partitioned) {
+    for (auto src = 0u; src < num_threads; src++) {
+      for (const auto &kv : this->partitions[src * num_threads + tid]) {
+        upsert(kv);
+      }
+      upserts += this->partitions[src * num_threads + tid].size() *
+                 aggrs.size();
+    }
+    flush();
+  } else if (!shared) {
+    for (size_t a = 0; a < aggrs.size(); a++) {
+      HTBatchRunner<> runner(merged[a].get());
+      tables[a]->scan(1, [&](unsigned, const KeyValuePair &kv) {
+        runner.insert(kv.key, kv.value);
+        upserts++;
+      });
+      runner.flush_insert();
+    }
+  }
+
+  const uint64_t end = RDTSCP();
+  barrier->arrive_and_wait();
+  const uint64_t query_end = RDTSCP();
+
+  sh->stats->insertions.op_count = upserts;
+  sh->stats->insertions.duration = end - start;
+  sh->stats->any = sh->stats->insertions;
+
+  // Total the groups of the result: partitions are scanned by their owner,
+  // the shared tables once by thread 0
+  const auto &result = (shared || partitioned) ? tables : merged;
+  if (partitioned || tid == 0) {
+    const unsigned n = partitioned ? 1 : max_scan_threads();
+    struct alignas(64) Totals {
+      uint64_t groups;
+      uint64_t checksum;
+    };
+    for (size_t a = 0; a < aggrs.size(); a++) {
+      std::vector<Totals> totals(n, Totals{0, 0});
+      result[a]->scan(n, [&](unsigned scan_tid, const KeyValuePair &kv) {
+        totals[scan_tid].groups++;
+        totals[scan_tid].checksum += kv.value;
+      });
+      uint64_t found = 0;
+      for (const auto &t : totals) {
+        found += t.groups;
+        this->checksums[a] += t.checksum;
+      }
+      this->groups[a] += found;
+      if (a == 0) {
+        sh->stats->ht_fill = found;
+      }
+    }
+    sh->stats->ht_capacity = result[0]->get_capacity();
+  }
+  barrier->arrive_and_wait();
+
+  if (tid == 0) {
+    const uint64_t rows_in = this->total_rows;
+    PLOG_INFO.printf("GROUP BY (%s) over %" PRIu64 " rows: %" PRIu64
+                     " groups in %.3f ms (phase 1 %.3f ms)",
+                     config.groupby_strategy.c_str(), rows_in,
+                     this->groups[0].load(),
+                     cycles_to_ns(query_end - start) / 1e6,
+                     cycles_to_ns(phase1_end - start) / 1e6);
+    if (this->dropped_rows) {
+      PLOG_WARNING.printf("Dropped %" PRIu64 " rows with key 0",
+                          this->dropped_rows.load());
+    }
+
+    run_counters["groupby.rows"] = rows_in;
+    run_counters["groupby.groups"] = this->groups[0];
+    run_counters["groupby.query_ns"] = cycles_to_ns(query_end - start);
+    for (size_t a = 0; a < aggrs.size(); a++) {
+      const std::string name = AGGR_NAMES[aggrs[a]];
+      const uint64_t checksum = this->checksums[a];
+      PLOG_INFO.printf("  %s: total %" PRIu64, name.c_str(), checksum);
+      run_counters["groupby." + name + "_total"] = checksum;
+
+      if (this->groups[a] != this->groups[0]) {
+        PLOG_ERROR.printf("%s has %" PRIu64 " groups, expected %" PRIu64,
+                          name.c_str(), this->groups[a].load(),
+                          this->groups[0].load());
+      }
+      const bool lost = (aggrs[a] == COUNT && checksum != rows_in) ||
+                        (aggrs[a] == SUM && checksum != this->total_sum);
+      if (lost) {
+        PLOG_ERROR.printf("%s does not add up over the groups",
+                          name.c_str());
+      }
+    }
+  }
+  // The shared tables must outlive the scan above
+  barrier->arrive_and_wait();
+
+  if (tid == 0) {
+    this->total_rows = this->total_sum = this->dropped_rows = 0;
+    for (size_t a = 0; a < aggrs.size(); a++) {
+      this->groups[a] = this->checksums[a] = 0;
+    }
+    this->partitions.clear();
+  }
+}
+
+}  // namespace kmercounter
@@ -35,12 +35,33 @@ using JoinArrayElement = std::array<uint64_t, 3>;
 
 using MaterializeVector = std::vector<JoinArrayElement>;
 
+/// Call `f` on the rows of the relation the pool hands the thread, or on
+/// those of the reader when the relation was not split into parts.
+template <typename F>
+void for_each_row(uint32_t tid, HashjoinTest::Relation* rel,
+                  input_reader::SizedInputReader<KeyValuePair>* reader,
+                  F&& f) {
+  if (!rel) {
+    for (KeyValuePair kv; reader->next(&kv);) {
+      f(kv);
+    }
+    return;
+  }
+  for (WorkPool::Chunk chunk; rel->pool->next(tid, &chunk);) {
+    const KeyValuePair* part = rel->parts[chunk.home];
+    for (auto i = chunk.begin; i < chunk.end; i++) {
+      f(part[i]);
+    }
+  }
+}
+
 /// Perform hashjoin on relation `t1` and `t2`.
 /// `t1` is the primary key relation and `t2` is the foreign key relation.
+/// Their rows come from `rel_r` and `rel_s` instead when those are given.
 void hashjoin(Shard* sh, input_reader::SizedInputReader<KeyValuePair>* t1,
               input_reader::SizedInputReader<KeyValuePair>* t2,
-              std::tuple<KeyValuePair*, uint32_t> relation_r,
-              std::tuple<KeyValuePair*, uint32_t> relation_s,
+              HashjoinTest::Relation* rel_r,
+              HashjoinTest::Relation* rel_s,
               BaseHashTable* ht,
               MaterializeVector* mvec,
               bool materialize, std::barrier<std::function<void()>>* barrier) {
@@ -55,19 +76,15 @@ void hashjoin(Shard* sh, input_reader::SizedInputReader<KeyValuePair>* t1,
   }
 
   collector_type *const collector{};
-  auto [rel_r, rel_r_size] = relation_r;
-  auto [rel_s, rel_s_size] = relation_s;
 
-#ifdef ITERATOR
-  for (KeyValuePair kv; t1->next(&kv);) {
-#else
-  for (auto i = 0; i < rel_r_size; i++) {
-    KeyValuePair kv = rel_r[i];
-#endif
+  for_each_row(sh->shard_idx, rel_r, t1, [&](const KeyValuePair& kv) {
     PLOGV.printf("inserting k: %lu, v: %lu", kv.key, kv.value);
     batch_runner.insert(kv);
-  }
+  });
   batch_runner.flush_insert();
+  if (rel_r) {
+    rel_r->pool->done(sh->shard_idx, RDTSCP() - t1_start);
+  }
 
   if (0)
   {
@@ -81,6 +98,9 @@ void hashjoin(Shard* sh, input_reader::SizedInputReader<KeyValuePair>* t1,
 
   if (sh->shard_idx == 0) {
     end_build_ts = std::chrono::steady_clock::now();
+    if (rel_r) {
+      rel_r->pool->report("hashjoin.build");
+    }
   }
 
   // Helper function for checking the result of the batch finds.
@@ -98,18 +118,15 @@ void hashjoin(Shard* sh, input_reader::SizedInputReader<KeyValuePair>* t1,
 
   // Probe.
   const auto t2_start = RDTSC_START();
-#ifdef ITERATOR
-  for (KeyValuePair kv; t2->next(&kv);) {
-#else
-  for (auto i = 0; i < rel_s_size; i++) {
-    KeyValuePair kv = rel_s[i];
-#endif
-    value_type val = kv.value;
+  for_each_row(sh->shard_idx, rel_s, t2, [&](const KeyValuePair& kv) {
     KeyValuePair *f_kv = (KeyValuePair*) batch_runner.find(kv);
     if (f_kv)
       PLOGV.printf("finding key %llu value1 %llu | value2 %llu", kv.key, kv.value, f_kv->value);
-  }
+  });
   batch_runner.flush_find();
+  if (rel_s) {
+    rel_s->pool->done(sh->shard_idx, RDTSCP() - t2_start);
+  }
 
   // Make sure insertions is finished before probing.
   barrier->arrive_and_wait();
@@ -121,6 +138,9 @@ void hashjoin(Shard* sh, input_reader::SizedInputReader<KeyValuePair>* t1,
     PLOG_INFO.printf("Build phase took %llu us, probe phase took %llu us",
         chrono::duration_cast<chrono::microseconds>(end_build_ts - start_build_ts).count(),
         chrono::duration_cast<chrono::microseconds>(end_probe_ts - end_build_ts).count());
+    if (rel_s) {
+      rel_s->pool->report("hashjoin.probe");
+    }
   }
 
   if (0)
@@ -162,9 +182,6 @@ void HashjoinTest::join_relations_generated(Shard* sh,
   auto s = _rdtsc();
   auto sum = 0;
 
-  std::tuple<KeyValuePair*, uint32_t> relation_r;
-  std::tuple<KeyValuePair*, uint32_t> relation_s;
-
   KeyValuePair *rel_r;
   posix_memalign((void **)&rel_r, 64, t1.size() * sizeof(KeyValuePair));
 
@@ -187,15 +204,23 @@ void HashjoinTest::join_relations_generated(Shard* sh,
     i++;
   }
 
-  relation_r = std::make_tuple(rel_r, t1.size());
-  relation_s = std::make_tuple(rel_s, t2.size());
+  // Publish our parts for the others to steal rows from
+  const uint32_t tid = sh->shard_idx;
+  std::call_once(this->init_once, [&] {
+    for (auto *rel : {&this->rel_r, &this->rel_s}) {
+      rel->parts.assign(config.num_threads, nullptr);
+      rel->sizes.assign(config.num_threads, 0);
+    }
+  });
+  this->rel_r.parts[tid] = rel_r;
+  this->rel_r.sizes[tid] = t1.size();
+  this->rel_s.parts[tid] = rel_s;
+  this->rel_s.sizes[tid] = t2.size();
+  HashjoinTest::Relation *relation_r = &this->rel_r;
+  HashjoinTest::Relation *relation_s = &this->rel_s;
 #else
-
-  std::tuple<KeyValuePair*, uint32_t> relation_r;
-  std::tuple<KeyValuePair*, uint32_t> relation_s;
-
-  relation_r = std::make_tuple(nullptr, t1.size());
-  relation_s = std::make_tuple(nullptr, t2.size());
+  HashjoinTest::Relation *relation_r = nullptr;
+  HashjoinTest::Relation *relation_s = nullptr;
 #endif
 
   std::uint64_t start {}, end {};
@@ -208,6 +233,14 @@ void HashjoinTest::join_relations_generated(Shard* sh,
   // Wait for all readers finish initializing.
   barrier->arrive_and_wait();
 
+#ifndef ITERATOR
+  std::call_once(this->pool_once, [&] {
+    for (auto *rel : {&this->rel_r, &this->rel_s}) {
+      rel->pool = std::make_unique<WorkPool>(rel->sizes, config.steal_chunk);
+    }
+  });
+#endif
+
   if (sh->shard_idx == 0) {
     start = _rdtsc();
     start_ts = std::chrono::steady_clock::now();
@@ -247,10 +280,7 @@ void HashjoinTest::join_relations_from_files(Shard* sh,
   barrier->arrive_and_wait();
 
   // Run hashjoin
-  hashjoin(sh, &t1, &t2,
-      std::make_tuple(nullptr, t1.size()),
-      std::make_tuple(nullptr, t2.size()),
-      ht, NULL, false, barrier);
+  hashjoin(sh, &t1, &t2, nullptr, nullptr, ht, NULL, false, barrier);
 }
 
 }  // namespace kmercounter
@@ -38,9 +38,21 @@ extern ExecPhase cur_phase;
 extern std::vector<key_type, huge_page_allocator<key_type>> *zipf_values;
 extern std::vector<cacheline> toxic_waste_dump;
 
+/// Where the keys of the thread's share of a zipfian pass start in
+/// zipf_values, or the first key itself without them (XORWOW)
+inline uint64_t zipf_key_start(uint64_t per_thread, uint32_t home) {
+  const uint64_t key_start = std::max(per_thread * home, (uint64_t)1);
+#ifdef XORWOW
+  return key_start;
+#else
+  return key_start == 1 ? 0 : key_start;
+#endif
+}
+
 OpTimings do_zipfian_inserts(
     BaseHashTable *hashtable, double skew, int64_t seed, unsigned int count,
-    unsigned int id, std::barrier<std::function<void()>> *sync_barrier) {
+    unsigned int id, WorkPool *pool,
+    std::barrier<std::function<void()>> *sync_barrier) {
 #ifdef LATENCY_COLLECTION
   const auto collector = &collectors.at(id);
   collector->claim();
@@ -63,23 +75,23 @@ OpTimings do_zipfian_inserts(
   InsertFindArgument *items =
       (InsertFindArgument *) aligned_alloc(64, sizeof(InsertFindArgument) * config.batch_len);
 
-  uint64_t key_start =
-      std::max(static_cast<uint64_t>(HT_TESTS_NUM_INSERTS) * id, (uint64_t)1);
-
-  PLOGV.printf("id: %u | key_start %" PRIu64 "", id, key_start);
+  PLOGV.printf("id: %u | key_start %" PRIu64 "", id,
+               zipf_key_start(HT_TESTS_NUM_INSERTS, id));
 
   const auto start = RDTSC_START();
   key_type key{};
   std::size_t next_pollution{};
-
-  for (auto j = 0u; j < config.insert_factor; j++) {
-    key_start =
-        std::max(static_cast<uint64_t>(HT_TESTS_NUM_INSERTS) * id, (uint64_t)1);
-    auto zipf_idx = key_start == 1 ? 0 : key_start;
-
-    for (unsigned int n{}; n < HT_TESTS_NUM_INSERTS; ++n) {
+  std::uint64_t num_keys{};
+
+  for (WorkPool::Chunk chunk; pool->next(id, &chunk);) {
+    num_keys += chunk.end - chunk.begin;
+    for (auto i = chunk.begin; i < chunk.end; i++) {
+      // key n of pass i / HT_TESTS_NUM_INSERTS over the keys of chunk.home
+      const uint32_t n = i % HT_TESTS_NUM_INSERTS;
+      const uint64_t zipf_idx =
+          zipf_key_start(HT_TESTS_NUM_INSERTS, chunk.home) + n;
 #ifdef XORWOW
-      auto value = key_start++;
+      auto value = zipf_idx;
 #else
       if (!(zipf_idx & 7) && zipf_idx + 16 < zipf_values->size()) {
         prefetch_object<false>(&zipf_values->at(zipf_idx + 16), 64);
@@ -91,7 +103,6 @@ OpTimings do_zipfian_inserts(
       items[key].id = n;
 
       // printf("zipf_values[%d] = %" PRIu64 "\n", zipf_idx, value);
-      zipf_idx++;
       if (config.no_prefetch) {
         hashtable->insert_noprefetch(&items[key], collector);
 
@@ -113,14 +124,19 @@ OpTimings do_zipfian_inserts(
     }
   }
   if (!config.no_prefetch) {
+    if (key) {
+      InsertFindArguments keypairs(items, key);
+      hashtable->insert_batch(keypairs, collector);
+    }
     hashtable->flush_insert_queue(collector);
   }
 
   const auto end = RDTSCP();
   duration += end - start;
+  pool->done(id, duration);
 
-  PLOG_DEBUG << "Inserts done; Reprobes: " << hashtable->num_reprobes
-             << ", Soft Reprobes: " << hashtable->num_soft_reprobes;
+  PLOG_DEBUG << "Inserts done; Reprobes: " << hashtable->stats.num_reprobes
+             << ", Soft Reprobes: " << hashtable->stats.num_soft_reprobes;
 
 #ifdef WITH_VTUNE_LIB
   __itt_event_end(event);
@@ -130,15 +146,18 @@ OpTimings do_zipfian_inserts(
 
 #ifdef LATENCY_COLLECTION
   collector->dump("async_insert", id);
+  if (id < resize_collectors.size()) {
+    resize_collectors.at(id).dump("resize_stall", id);
+  }
 #endif
 
-  return {duration, HT_TESTS_NUM_INSERTS * config.insert_factor};
+  return {duration, num_keys};
 }
 
 
 
 OpTimings do_zipfian_gets(BaseHashTable *hashtable, unsigned int num_threads,
-                          unsigned int id, auto sync_barrier) {
+                          unsigned int id, WorkPool *pool, auto sync_barrier) {
   std::uint64_t duration{};
   std::uint64_t found = 0, not_found = 0;
 
@@ -171,12 +190,14 @@ OpTimings do_zipfian_gets(BaseHashTable *hashtable, unsigned int num_threads,
   const auto start = RDTSC_START();
   std::uint64_t key{};
   std::size_t next_pollution{};
-  for (auto j = 0u; j < config.insert_factor; j++) {
-    uint64_t key_start = std::max(static_cast<uint64_t>(num_finds) * id, (uint64_t)1);
-    auto zipf_idx = key_start == 1 ? 0 : key_start;
-    for (unsigned int n{}; n < num_finds; ++n) {
+  std::uint64_t num_keys{};
+  for (WorkPool::Chunk chunk; pool->next(id, &chunk);) {
+    num_keys += chunk.end - chunk.begin;
+    for (auto i = chunk.begin; i < chunk.end; i++) {
+      const uint32_t n = i % num_finds;
+      const uint64_t zipf_idx = zipf_key_start(num_finds, chunk.home) + n;
 #ifdef XORWOW
-      auto value = key_start++;
+      auto value = zipf_idx;
 #else
       if (!(zipf_idx & 7) && zipf_idx + 16 < zipf_values->size()) {
         prefetch_object<false>(&zipf_values->at(zipf_idx + 16), 64);
@@ -205,14 +226,14 @@ OpTimings do_zipfian_gets(BaseHashTable *hashtable, unsigned int num_threads,
             prefetch_object<true>(&toxic_waste_dump[next_pollution++ & (1024 * 1024 - 1)], 64);
         }
       }
-
-      zipf_idx++;
     }
   }
   if (!config.no_prefetch) {
-    if (vp.first > 0) {
-      vp.first = 0;
+    if (key) {
+      hashtable->find_batch(InsertFindArguments(items, key), vp, collector);
+      found += vp.first;
     }
+    vp.first = 0;
 
     hashtable->flush_find_queue(vp, collector);
     found += vp.first;
@@ -220,6 +241,7 @@ OpTimings do_zipfian_gets(BaseHashTable *hashtable, unsigned int num_threads,
 
   const auto end = RDTSCP();
   duration += end - start;
+  pool->done(id, duration);
     
 #ifdef WITH_VTUNE_LIB
   __itt_event_end(vtune_event_find);
@@ -237,7 +259,7 @@ OpTimings do_zipfian_gets(BaseHashTable *hashtable, unsigned int num_threads,
   collector->dump("find", id);
 #endif
 
-  return {duration, num_finds * config.insert_factor};
+  return {duration, num_keys};
 }
 
 void ZipfianTest::run(Shard *shard, BaseHashTable *hashtable, double skew,
@@ -253,6 +275,9 @@ void ZipfianTest::run(Shard *shard, BaseHashTable *hashtable, double skew,
     std::lock_guard lock{collector_lock};
     if (step == 0) {
       collectors.resize(config.num_threads);
+      if (config.ht_grow_threshold > 0) {
+        resize_collectors.resize(config.num_threads);
+      }
       step = 1;
     }
   }
@@ -265,9 +290,17 @@ void ZipfianTest::run(Shard *shard, BaseHashTable *hashtable, double skew,
       "%f",
       shard->shard_idx, config.ht_size, HT_TESTS_NUM_INSERTS, skew);
 
+  // Every thread starts out with its own keys, for every pass
+  std::call_once(this->insert_once, [this] {
+    this->insert_pool = std::make_unique<WorkPool>(
+        config.num_threads, HT_TESTS_NUM_INSERTS * config.insert_factor,
+        config.steal_chunk);
+  });
+
   for (uint32_t i = 1; i < HT_TESTS_MAX_STRIDE; i++) {
-    insert_timings = do_zipfian_inserts(hashtable, skew, zipf_seed, count,
-                                        shard->shard_idx, sync_barrier);
+    insert_timings =
+        do_zipfian_inserts(hashtable, skew, zipf_seed, count, shard->shard_idx,
+                           this->insert_pool.get(), sync_barrier);
 
 #ifdef CALC_STATS
     PLOG_INFO.printf(
@@ -276,11 +309,14 @@ void ZipfianTest::run(Shard *shard, BaseHashTable *hashtable, double skew,
         shard->shard_idx, config.batch_len, insert_timings.duration / insert_timings.op_count);
 
     PLOG_INFO.printf("Reprobes %" PRIu64 " soft_reprobes %" PRIu64 "",
-                     hashtable->num_reprobes, hashtable->num_soft_reprobes);
+                     hashtable->stats.num_reprobes, hashtable->stats.num_soft_reprobes);
 #endif
   }
 
   shard->stats->insertions = insert_timings;
+  if (shard->shard_idx == 0) {
+    this->insert_pool->report("zipfian.inserts");
+  }
 
 #ifdef LATENCY_COLLECTION
   {
@@ -306,8 +342,16 @@ void ZipfianTest::run(Shard *shard, BaseHashTable *hashtable, double skew,
 
   cur_phase = ExecPhase::finds;
 
-  const auto num_finds =
-      do_zipfian_gets(hashtable, count, shard->shard_idx, sync_barrier);
+  std::call_once(this->find_once, [this] {
+    this->find_pool = std::make_unique<WorkPool>(
+        config.num_threads, HT_TESTS_NUM_INSERTS * config.insert_factor,
+        config.steal_chunk);
+  });
+  const auto num_finds = do_zipfian_gets(
+      hashtable, count, shard->shard_idx, this->find_pool.get(), sync_barrier);
+  if (shard->shard_idx == 0) {
+    this->find_pool->report("zipfian.finds");
+  }
 
   shard->stats->finds.duration = num_finds.duration;
   shard->stats->finds.op_count = num_finds.op_count;
@@ -328,6 +372,7 @@ void ZipfianTest::run(Shard *shard, BaseHashTable *hashtable, double skew,
     std::lock_guard lock{collector_lock};
     if (step == 2) {
       collectors.clear();
+      resize_collectors.clear();
       step = 3;
     }
   }
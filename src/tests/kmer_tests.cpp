@@ -21,8 +21,20 @@ void KmerTest::count_kmer(Shard* sh,
                               const Configuration& config,
                               BaseHashTable* ht,
                               std::barrier<VoidFn>* barrier){
-  // Be care of the `K` here; it's a compile time constant.
-  auto reader = input_reader::MakeFastqKMerPreloadReader(config.K, config.in_file, sh->shard_idx, config.num_threads);
+  // The file is cut into parts_per_thread parts per thread, in file order,
+  // the parts of a thread being where a static split would have cut
+  const uint32_t tid = sh->shard_idx;
+  const uint32_t parts_per_thread = config.steal_chunk ? PARTS_PER_THREAD : 1;
+  std::call_once(this->init_once, [&] {
+    this->parts.resize(config.num_threads * parts_per_thread);
+    this->pool = std::make_unique<WorkPool>(
+        config.num_threads, parts_per_thread, config.steal_chunk ? 1 : 0);
+  });
+  for (auto p = tid * parts_per_thread; p < (tid + 1) * parts_per_thread; p++) {
+    // Be care of the `K` here; it's a compile time constant.
+    this->parts[p] = input_reader::MakeFastqKMerPreloadReader(
+        config.K, config.in_file, p, this->parts.size());
+  }
   HTBatchRunner batch_runner(ht);
 
   // Wait for all readers finish initializing.
@@ -41,13 +53,24 @@ void KmerTest::count_kmer(Shard* sh,
   }
 
   // Inser Kmers into hashtable
-  for (uint64_t kmer; reader->next(&kmer);) {
-    batch_runner.insert(kmer, 0 /* we use the aggr tables so no value */);
-    num_kmers++;
+  for (WorkPool::Chunk chunk; this->pool->next(tid, &chunk);) {
+    for (auto i = chunk.begin; i < chunk.end; i++) {
+      auto &reader = this->parts[chunk.home * parts_per_thread + i];
+      for (uint64_t kmer; reader->next(&kmer);) {
+        batch_runner.insert(kmer, 0 /* we use the aggr tables so no value */);
+        num_kmers++;
+      }
+    }
   }
   batch_runner.flush_insert();
+  this->pool->done(tid, _rdtsc() - start);
   barrier->arrive_and_wait();
 
+  // Nobody reads our parts anymore
+  for (auto p = tid * parts_per_thread; p < (tid + 1) * parts_per_thread; p++) {
+    this->parts[p].reset();
+  }
+
   sh->stats->insertions.duration = _rdtsc() - start;
   sh->stats->insertions.op_count = num_kmers;
 
@@ -58,6 +81,7 @@ void KmerTest::count_kmer(Shard* sh,
     PLOG_INFO.printf("Kmer insertion took %llu us (%llu cycles)",
         chrono::duration_cast<chrono::microseconds>(end_ts - start_ts).count(),
         end_cycles - start_cycles);
+    this->pool->report("kmer.inserts");
   }
   PLOGV.printf("[%d] Num kmers %llu", sh->shard_idx, num_kmers);
 
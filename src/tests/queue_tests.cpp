@@ -1,11 +1,13 @@
 #include <algorithm>
 #include <cassert>
 #include <cinttypes>
+#include <optional>
 #include <tuple>
 
 #include "fastrange.h"
 #include "hasher.hpp"
 #include "hashtables/ht_helper.hpp"
+#include "hashtables/ht_snapshot.hpp"
 #include "hashtables/simple_kht.hpp"
 #include "helper.hpp"
 #include "input_reader/csv.hpp"
@@ -14,6 +16,7 @@
 #include "misc_lib.h"
 #include "print_stats.h"
 #include "queues/bqueue_aligned.hpp"
+#include "queues/hot_key_combiner.hpp"
 #include "queues/lynxq.hpp"
 #include "queues/section_queues.hpp"
 #include "sync.h"
@@ -55,6 +58,12 @@ struct bq_kmer {
 
 // thread-local since we have multiple consumers
 static __thread int data_idx = 0;
+
+// With --rebalance-parts, every so many messages the producers look for
+// partitions that moved, and the main producer at the backlog of the queues.
+// With --combine-slots, the producers look at the clock as often.
+static constexpr uint64_t MARK_INTERVAL = 64;
+static constexpr uint64_t CONTROL_INTERVAL = 1 << 14;
 auto get_ht_size = [](int ncons) {
   uint64_t ht_size = config.ht_size / ncons;
   if (ht_size & 0x3) {
@@ -141,6 +150,34 @@ static auto mbind_buffer_local(void *buf, ssize_t sz) {
   return ret;
 }
 
+template <typename T>
+std::vector<std::pair<uint32_t, BaseHashTable *>> QueueTest<T>::held_tables(
+    uint32_t tid, uint32_t n_prod, BaseHashTable *ht) const {
+  if (!this->balancer || tid < n_prod) {
+    return {{tid, ht}};
+  }
+  std::vector<std::pair<uint32_t, BaseHashTable *>> tables;
+  for (auto p = 0u; p < this->n_parts; p++) {
+    if (this->balancer->holds(p, tid - n_prod)) {
+      tables.emplace_back(n_prod + p, this->part_tables[p]);
+    }
+  }
+  return tables;
+}
+
+template <typename T>
+void QueueTest<T>::get_held_ht_stats(Shard *sh, uint32_t tid, uint32_t n_prod,
+                                     BaseHashTable *ht) const {
+  const auto tables = this->held_tables(tid, n_prod, ht);
+  get_ht_stats(sh, tables[0].second);
+  for (auto i = 1u; i < tables.size(); i++) {
+    const BaseHashTable *t = tables[i].second;
+    sh->stats->ht_fill += t->get_fill();
+    sh->stats->ht_capacity += t->get_capacity();
+    sh->stats->num_reprobes += t->stats.num_reprobes;
+    sh->stats->num_soft_reprobes += t->stats.num_soft_reprobes;
+  }
+}
 
 std::barrier<std::function<void()>> *prod_barrier;
 uint64_t g_rw_start, g_rw_end;
@@ -179,6 +216,70 @@ void QueueTest<T>::producer_thread(
 #endif
   }
 
+  // Messages are staged a cacheline per consumer, and enqueued a line at a
+  // time
+  struct alignas(64) staged_line {
+    data_t msgs[T::KV_PER_LINE];
+  };
+  std::vector<staged_line> lines(n_cons);
+  std::vector<uint32_t> line_fill(n_cons, 0);
+  auto stage = [&](uint32_t cons, const data_t &msg) {
+    auto &fill = line_fill[cons];
+    lines[cons].msgs[fill] = msg;
+    if (++fill == T::KV_PER_LINE) {
+      this->queues->enqueue_bulk(pqueues[cons], this_prod_id, cons,
+                                 lines[cons].msgs, fill);
+      fill = 0;
+    }
+  };
+
+  // Repeated messages are merged before they are staged (--combine-slots),
+  // and go to whoever owns their partition when they leave the buffer
+  std::optional<HotKeyCombiner<data_t>> combiner;
+  if (this->combining) {
+    combiner.emplace(config.combine_slots);
+  }
+  auto send_combined = [&](const HotKeyCombiner<data_t>::Slot &slot) {
+    const auto cons = this->owner_of(slot.part);
+    if (slot.weight > 1) {
+      stage(cons, data_t(HotKeyCombiner<data_t>::WEIGHT_KEY, slot.weight));
+    }
+    stage(cons, slot.msg);
+  };
+
+  // A partition changed hands: mark the end of what we sent its old owner
+  uint64_t seen_epoch = 0;
+  auto mark_moves = [&] {
+    const auto epoch = this->balancer->epoch();
+    if (epoch == seen_epoch) return;
+    seen_epoch = epoch;
+
+    const auto from = this->balancer->current().from;
+    this->queues->enqueue_bulk(pqueues[from], this_prod_id, from,
+                               lines[from].msgs, line_fill[from]);
+    line_fill[from] = 0;
+    this->queues->enqueue(pqueues[from], this_prod_id, from,
+                          data_t(PartitionBalancer::MARK_KEY, epoch));
+    this->queues->fill_section(pqueues[from], this_prod_id, from,
+                               data_t(PartitionBalancer::FILL_KEY, 0));
+  };
+
+  // The controller runs on the main producer
+  std::vector<uint64_t> backlog(n_cons);
+  auto control = [&] {
+    std::fill(backlog.begin(), backlog.end(), 0);
+    for (auto p = 0u; p < n_prod; p++) {
+      for (auto c = 0u; c < n_cons; c++) {
+        backlog[c] += this->queues->backlog(p, c);
+      }
+    }
+    if (this->balancer->tick(backlog)) {
+      const auto &move = this->balancer->current();
+      PLOGV.printf("Moving partition %u from consumer %u to %u", move.part,
+                   move.from, move.to);
+    }
+  };
+
   struct xorwow_state _xw_state, init_state;
   auto key_start_orig = key_start;
 
@@ -256,7 +357,7 @@ void QueueTest<T>::producer_thread(
     k = zipf_values->at(zipf_idx);
     ++zipf_idx;
     uint64_t hash_val = hasher(&k, sizeof(k));
-    cons_id = hash_to_cpu(hash_val, n_cons);
+    cons_id = this->owner_of(hash_to_cpu(hash_val, this->n_parts));
     auto pq = pqueues[cons_id];
     this->queues->enqueue(pq, this_prod_id, cons_id, {k, k});
     transaction_id++;
@@ -334,7 +435,8 @@ void QueueTest<T>::producer_thread(
       // XXX: if we are testing without insertions, make sure to pick CRC as
       // the hashing mechanism to have reduced overhead
       uint64_t hash_val = hasher(&k, sizeof(k));
-      cons_id = hash_to_cpu(hash_val, n_cons);
+      const auto part = hash_to_cpu(hash_val, this->n_parts);
+      cons_id = this->owner_of(part);
 
       if (!cfg->rw_queues || flips[transaction_id & 1023]) {  // TODO
 #if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
@@ -344,13 +446,16 @@ void QueueTest<T>::producer_thread(
 #endif
         // if (++cons_id >= n_cons) cons_id = 0;
 
-        auto pq = pqueues[cons_id];
         // PLOGV.printf("Queuing key = %" PRIu64 ", value = %" PRIu64, kv.key,
         // kv.value);
 #ifdef LATENCY_COLLECTION
         const auto timer = collector.sync_start();
 #endif
-        this->queues->enqueue(pq, this_prod_id, cons_id, (data_t)kv);
+        if (combiner) {
+          combiner->add((data_t)kv, hash_val, part, send_combined);
+        } else {
+          stage(cons_id, (data_t)kv);
+        }
 #ifdef LATENCY_COLLECTION
         collector.sync_end(timer);
 #endif
@@ -361,7 +466,7 @@ void QueueTest<T>::producer_thread(
         auto &item = items[next_item];
         items[next_item].key = k;
         items[next_item].id = item_id++;
-        items[next_item].part_id = cons_id + n_prod;
+        items[next_item].part_id = part + n_prod;
         if (next_item == 0) ktable->prefetch_queue(QueueType::find_queue);
 
         ++next_item;
@@ -378,13 +483,31 @@ void QueueTest<T>::producer_thread(
         prefetch_object<true>(
             &toxic_waste_dump[next_pollution++ & (1024 * 1024 - 1)], 64);
 
+      if (this->balancer && !(transaction_id & (MARK_INTERVAL - 1))) {
+        mark_moves();
+        if (main_thread && !(transaction_id & (CONTROL_INTERVAL - 1))) {
+          control();
+        }
+      }
+      if (combiner && !(transaction_id & (MARK_INTERVAL - 1))) {
+        combiner->tick(RDTSC_START(), send_combined);
+      }
+
       transaction_id++;
     }
   }
 
+  if (combiner) {
+    combiner->flush(send_combined);
+    this->combined_keys += combiner->num_keys();
+    this->combined_messages += combiner->num_messages();
+  }
+
   // enqueue halt messages and the consumer automatically knows
   // when to stop
   for (cons_id = 0; cons_id < n_cons; cons_id++) {
+    this->queues->enqueue_bulk(pqueues[cons_id], this_prod_id, cons_id,
+                               lines[cons_id].msgs, line_fill[cons_id]);
     this->queues->push_done(this_prod_id, cons_id);
 
     PLOG_DEBUG.printf("Prod %d Sending END message to cons %d (transaction %u)",
@@ -467,12 +590,21 @@ void QueueTest<T>::consumer_thread(
   }
   vtune::set_threadname("consumer_thread" + std::to_string(tid));
 
-  auto ht_size = get_ht_size(n_cons);
+  auto ht_size = get_ht_size(this->n_parts);
 
   if (bq_load == BQUEUE_LOAD::HtInsert) {
     PLOGV.printf("[cons:%u] init_ht id:%d size:%u", this_cons_id, sh->shard_idx,
                  ht_size);
-    kmer_ht = init_ht(ht_size, sh->shard_idx);
+    if (this->balancer) {
+      // The tables of the partitions we start with, the first of which has
+      // our id
+      for (auto p = this_cons_id; p < this->n_parts; p += n_cons) {
+        this->part_tables[p] = init_ht(ht_size, n_prod + p);
+      }
+      kmer_ht = this->part_tables[this_cons_id];
+    } else {
+      kmer_ht = init_ht(ht_size, sh->shard_idx);
+    }
     (*this->ht_vec)[tid] = kmer_ht;
   }
 
@@ -499,15 +631,166 @@ void QueueTest<T>::consumer_thread(
   for (auto i = 0u; i < n_prod; i++) {
     active_qmask |= (1ull << i);
   }
+  const uint64_t all_producers = active_qmask;
+
+  // Times the next message of every producer is inserted (--combine-slots)
+  std::vector<uint32_t> weights(n_prod, 1);
+
+  auto submit_batch = [&](auto num_elements) {
+    InsertFindArguments kp(items, num_elements);
+
+    kmer_ht->insert_batch(kp, collector);
+    inserted += kp.size();
+
+    data_idx = 0;
+  };
+
+  // With --rebalance-parts, a batch per partition, as a batch goes to the
+  // table of one partition, and the messages of the partitions moving to us
+  // that we do not hold yet
+  std::vector<InsertFindArgument *> part_items;
+  std::vector<uint32_t> part_fill;
+  std::vector<char> held;
+  std::vector<std::vector<data_t>> kept;
+  std::vector<uint32_t> incoming;
+  uint64_t mark_epoch = 0, marked = 0, released_epoch = 0;
+  Hasher hasher;
+  if (this->balancer) {
+    part_items.resize(this->n_parts);
+    part_fill.assign(this->n_parts, 0);
+    held.assign(this->n_parts, 0);
+    kept.resize(this->n_parts);
+    for (auto p = 0u; p < this->n_parts; p++) {
+      part_items[p] = (InsertFindArgument *)aligned_alloc(
+          64, sizeof(InsertFindArgument) * config.batch_len);
+      held[p] = this->balancer->holds(p, this_cons_id);
+    }
+  }
+
+  auto submit_part = [&](uint32_t part) {
+    if (!part_fill[part]) return;
+    InsertFindArguments kp(part_items[part], part_fill[part]);
+    this->part_tables[part]->insert_batch(kp, collector);
+    this->balancer->count(part, kp.size());
+    inserted += kp.size();
+    part_fill[part] = 0;
+  };
+
+  auto insert_part = [&](uint32_t part, const data_t &msg) {
+    auto &item = part_items[part][part_fill[part]];
+    item.key = msg.key;
+    item.id = msg.key;
+#if !defined(BQUEUE_KMER_TEST)
+    item.value = msg.value;
+#endif
+    if (++part_fill[part] == config.batch_len) {
+      submit_part(part);
+    }
+  };
+
+  auto route = [&](const data_t &msg, uint32_t weight) {
+#if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
+    const uint64_t hash_val = msg.key >> 32;
+#else
+    const uint64_t key = msg.key;
+    const uint64_t hash_val = hasher(&key, sizeof(key));
+#endif
+    const auto part = hash_to_cpu(hash_val, this->n_parts);
+    if (held[part]) {
+      for (auto w = 0u; w < weight; w++) {
+        insert_part(part, msg);
+      }
+      return;
+    }
+    if (kept[part].empty()) {
+      incoming.push_back(part);
+    }
+    kept[part].insert(kept[part].end(), weight, msg);
+  };
+
+  auto on_mark = [&](uint64_t epoch) {
+    if (epoch != mark_epoch) {
+      mark_epoch = epoch;
+      marked = 0;
+    }
+    marked |= 1ull << prod_id;
+  };
+
+  // Take over the tables handed to us, and hand over the one moving away
+  // once every producer marked the end of its messages to us, or is done.
+  // Returns whether no table is on its way to or from us.
+  auto rebalance = [&] {
+    for (auto it = incoming.begin(); it != incoming.end();) {
+      const auto part = *it;
+      if (!this->balancer->holds(part, this_cons_id)) {
+        ++it;
+        continue;
+      }
+      held[part] = true;
+      for (const auto &msg : kept[part]) {
+        insert_part(part, msg);
+      }
+      kept[part] = {};
+      it = incoming.erase(it);
+    }
+
+    const auto &move = this->balancer->current();
+    if (move.from != this_cons_id || move.epoch == released_epoch) {
+      return incoming.empty();
+    }
+    if (move.epoch != mark_epoch) {
+      mark_epoch = move.epoch;
+      marked = 0;
+    }
+    if (!held[move.part] ||
+        ((marked | ~active_qmask) & all_producers) != all_producers) {
+      return false;
+    }
+    submit_part(move.part);
+    this->part_tables[move.part]->flush_insert_queue(collector);
+    held[move.part] = false;
+    released_epoch = move.epoch;
+    this->balancer->release(move);
+    return incoming.empty();
+  };
+
+  auto flush_batches = [&] {
+    if (this->balancer) {
+      for (auto p = 0u; p < this->n_parts; p++) {
+        submit_part(p);
+      }
+    } else if (data_idx > 0) {
+      submit_batch(data_idx);
+    }
+  };
 
   while (finished_producers < n_prod) {
-    auto submit_batch = [&](auto num_elements) {
-      InsertFindArguments kp(items, num_elements);
+    if (this->balancer) {
+      rebalance();
+    }
 
-      kmer_ht->insert_batch(kp, collector);
-      inserted += kp.size();
+    // The producer sent its last message, its queue needs no more polling
+    auto producer_done = [&] {
+      fipc_test_FAI(finished_producers);
+      // printf("Got MAGIC bit. stopping consumer\n");
+      this->queues->pop_done(prod_id, this_cons_id);
+      active_qmask &= ~(1ull << prod_id);
+      /* PLOGV.printf(
+          "Consumer %u, received HALT from prod_id %u. "
+          "finished_producers :%u",
+          this_cons_id, prod_id, finished_producers);
+          */
+      if (config.ht_stats) {
+        PLOG_DEBUG.printf("Consumer experienced %" PRIu64
+                          " reprobes, %" PRIu64 " soft",
+                          kmer_ht->stats.num_reprobes,
+                          kmer_ht->stats.num_soft_reprobes);
+      }
 
-      data_idx = 0;
+      PLOG_DEBUG.printf("Consumer received %" PRIu64, count);
+      if (!config.no_prefetch) {
+        flush_batches();
+      }
     };
 
     auto get_next_prod = [&](auto inc) {
@@ -530,6 +813,57 @@ void QueueTest<T>::consumer_thread(
       goto pick_next_msg;
     }
 
+    if (bq_load == BQUEUE_LOAD::HtInsert && !config.no_prefetch) {
+      // Take the messages a section at a time, straight from the queue
+      for (auto n = 0u; n < config.batch_len;) {
+        auto msgs = this->queues->dequeue_bulk(cq, prod_id, this_cons_id,
+                                               config.batch_len - n);
+        if (msgs.empty()) {
+          flush_batches();
+          goto pick_next_msg;
+        }
+        n += msgs.size();
+
+        for (const auto &msg : msgs) {
+          ++count;
+          if (msg == T::BQ_MAGIC_KV) [[unlikely]] {
+            producer_done();
+            goto pick_next_msg;
+          }
+          if (this->combining &&
+              msg.key == HotKeyCombiner<data_t>::WEIGHT_KEY) [[unlikely]] {
+            weights[prod_id] = msg.value;
+            continue;
+          }
+          const uint32_t weight = weights[prod_id];
+          weights[prod_id] = 1;
+          if (this->balancer) {
+            if (msg.key == PartitionBalancer::MARK_KEY) [[unlikely]] {
+              on_mark(msg.value);
+              continue;
+            }
+            if (msg.key == PartitionBalancer::FILL_KEY) [[unlikely]] {
+              continue;
+            }
+            route(msg, weight);
+          } else {
+            for (auto w = 0u; w < weight; w++) {
+              items[data_idx].key = msg.key;
+              items[data_idx].id = msg.key;
+#if !defined(BQUEUE_KMER_TEST)
+              items[data_idx].value = msg.value;
+#endif
+              if (++data_idx == config.batch_len) {
+                submit_batch(config.batch_len);
+              }
+            }
+          }
+          transaction_id++;
+        }
+      }
+      goto pick_next_msg;
+    }
+
     for (auto i = 0u; i < 1 * config.batch_len; i++) {
       // dequeue one message
       auto ret =
@@ -556,27 +890,7 @@ void QueueTest<T>::consumer_thread(
       // STOP condition. On receiving this magic message, the consumers stop
       // dequeuing from the queues
       if ((data_t)kv == T::BQ_MAGIC_KV) [[unlikely]] {
-        fipc_test_FAI(finished_producers);
-        // printf("Got MAGIC bit. stopping consumer\n");
-        this->queues->pop_done(prod_id, this_cons_id);
-        active_qmask &= ~(1ull << prod_id);
-        /* PLOGV.printf(
-            "Consumer %u, received HALT from prod_id %u. "
-            "finished_producers :%u",
-            this_cons_id, prod_id, finished_producers);
-            */
-#ifdef CALC_STATS
-        PLOG_DEBUG.printf("Consumer experienced %" PRIu64 " reprobes, %" PRIu64
-                          " soft",
-                          kmer_ht->num_reprobes, kmer_ht->num_soft_reprobes);
-#endif
-
-        PLOG_DEBUG.printf("Consumer received %" PRIu64, count);
-        if (!config.no_prefetch) {
-          if (data_idx > 0) {
-            submit_batch(data_idx);
-          }
-        }
+        producer_done();
         goto pick_next_msg;
       }
 
@@ -620,6 +934,20 @@ void QueueTest<T>::consumer_thread(
     }
   }
 
+  if (this->balancer) {
+    // Tables may still be on their way to or from us
+    while (!rebalance()) {
+      asm volatile("pause");
+    }
+    for (auto p = 0u; p < this->n_parts; p++) {
+      if (held[p]) {
+        submit_part(p);
+        this->part_tables[p]->flush_insert_queue(collector);
+      }
+      free(part_items[p]);
+    }
+  }
+
   auto t_end = RDTSCP();
 
   if (tid == n_prod) vtune::event_end(event);
@@ -628,7 +956,7 @@ void QueueTest<T>::consumer_thread(
   sh->stats->insertions.op_count = transaction_id;
 
   if (bq_load == BQUEUE_LOAD::HtInsert) {
-    get_ht_stats(sh, kmer_ht);
+    this->get_held_ht_stats(sh, tid, n_prod, kmer_ht);
   }
 
   for (auto i = 0u; i < n_prod; ++i) {
@@ -649,12 +977,28 @@ void QueueTest<T>::consumer_thread(
       this_cons_id, transaction_id, (t_end - t_start) / transaction_id, n_prod,
       finished_producers);
 
-  // Write to file
-  if (!this->cfg->ht_file.empty()) {
-    std::string outfile = this->cfg->ht_file + std::to_string(sh->shard_idx);
-    PLOG_INFO.printf("Shard %u: Printing to file: %s", sh->shard_idx,
-                     outfile.c_str());
-    kmer_ht->print_to_file(outfile);
+  // Write to file, a file per table, named after its id
+  for (auto [id, ht] : this->held_tables(tid, n_prod, kmer_ht)) {
+    if (!this->cfg->ht_file.empty()) {
+      std::string outfile = this->cfg->ht_file + std::to_string(id);
+      PLOG_INFO.printf("Shard %u: Printing to file: %s", sh->shard_idx,
+                       outfile.c_str());
+      ht->print_to_file(outfile);
+    }
+
+    if (!this->cfg->ht_snapshot_out.empty()) {
+      std::string outfile = snapshot_path(this->cfg->ht_snapshot_out, id);
+      PLOG_INFO.printf("Shard %u: Writing snapshot: %s", sh->shard_idx,
+                       outfile.c_str());
+      ht->save_snapshot(outfile);
+    }
+
+    if (!this->cfg->ht_profile.empty()) {
+      std::string outfile = this->cfg->ht_profile + std::to_string(id);
+      PLOG_INFO.printf("Shard %u: Writing profile: %s", sh->shard_idx,
+                       outfile.c_str());
+      ht->save_profile(outfile);
+    }
   }
 
 #ifdef LATENCY_COLLECTION
@@ -665,6 +1009,10 @@ void QueueTest<T>::consumer_thread(
 template <typename T>
 void QueueTest<T>::find_thread(int tid, int n_prod, int n_cons, bool is_join,
                                std::barrier<std::function<void()>> *barrier) {
+  if (this->find_requests) {
+    return this->delegated_find_thread(tid, n_prod, n_cons, barrier);
+  }
+
   Shard *sh = &this->shards[tid];
   uint64_t found = 0, not_found = 0;
   uint64_t count = std::max(HT_TESTS_NUM_INSERTS * tid, (uint64_t)1);
@@ -703,9 +1051,15 @@ void QueueTest<T>::find_thread(int tid, int n_prod, int n_cons, bool is_join,
     this->ht_vec->at(tid) = ktable;
   } else {
     PLOGD.printf("Dist to nodes tid %u", tid);
-    auto *part_ht = reinterpret_cast<PartitionedHashStore<KVType, ItemQueue>*>(ktable);
-    void *ht_mem = part_ht->hashtable[part_ht->id];
-    distribute_mem_to_nodes(ht_mem, part_ht->get_ht_size());
+    for (auto [id, ht] : this->held_tables(tid, n_prod, ktable)) {
+      Hashers::dispatch(config.hasher, [&]<typename H>(H) {
+        auto *part_ht =
+            reinterpret_cast<PartitionedHashStore<KVType, ItemQueue, H> *>(
+                ht);
+        void *ht_mem = part_ht->hashtable[part_ht->id];
+        distribute_mem_to_nodes(ht_mem, part_ht->get_ht_size());
+      });
+    }
   }
 
   FindResult *results = new FindResult[config.batch_len];
@@ -774,7 +1128,7 @@ void QueueTest<T>::find_thread(int tid, int n_prod, int n_cons, bool is_join,
       }
       uint64_t hash_val = hasher(&k, sizeof(k));
 
-      partition = hash_to_cpu(hash_val, n_cons);
+      partition = hash_to_cpu(hash_val, this->n_parts);
       // PLOGI.printf("partition %d", partition);
 
 #if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
@@ -858,7 +1212,7 @@ void QueueTest<T>::find_thread(int tid, int n_prod, int n_cons, bool is_join,
         found > 0 ? (t_end - t_start) / found : 0);
   }
 
-  get_ht_stats(sh, ktable);
+  this->get_held_ht_stats(sh, tid, n_prod, ktable);
 
 #ifdef LATENCY_COLLECTION
   collector->dump("find", tid);
@@ -866,6 +1220,260 @@ void QueueTest<T>::find_thread(int tid, int n_prod, int n_cons, bool is_join,
 #endif
 }
 
+/// Finds delegated to the owners of the partitions: every thread sends the
+/// keys it looks up to the consumer owning their partition, which looks them
+/// up in the table of the partition and sends back the results, so no thread
+/// reads the partition of another. A request is the key, with the partition
+/// and id of the find as value. Requests are published every batch_len keys
+/// and answered a batch at a time. As misses have no result, an owner follows the
+/// results of a batch with a {BQ_MAGIC_64BIT, n} record retiring its n
+/// requests.
+template <typename T>
+void QueueTest<T>::delegated_find_thread(
+    int tid, int n_prod, int n_cons,
+    std::barrier<std::function<void()>> *barrier) {
+  Shard *sh = &this->shards[tid];
+  const uint32_t n_threads = n_prod + n_cons;
+  const bool is_owner = tid >= n_prod;
+  const uint32_t this_cons_id = is_owner ? tid - n_prod : 0;
+  BaseHashTable *ktable = is_owner ? this->ht_vec->at(tid) : nullptr;
+  uint64_t found = 0, sent = 0, served = 0;
+  uint64_t count = std::max(HT_TESTS_NUM_INSERTS * tid, (uint64_t)1);
+  Hasher hasher;
+
+#ifdef LATENCY_COLLECTION
+  const auto collector = &collectors.at(tid);
+  collector->claim();
+#else
+  collector_type *const collector{};
+#endif
+
+  vtune::set_threadname("find_thread" + std::to_string(tid));
+
+  // Requests in flight to an owner are bounded, so that neither they nor
+  // their results and retire records can fill the queues of a pair. A full
+  // queue could have two threads spin on each other's queues.
+  const uint64_t window =
+      this->find_requests->queue_size / sizeof(data_t) / 4;
+
+  std::vector<typename T::prod_queue_t *> req_pqueues(n_cons);
+  std::vector<typename T::cons_queue_t *> reply_cqueues(n_cons);
+  for (auto c = 0; c < n_cons; c++) {
+    req_pqueues[c] = &this->find_requests->all_pqueues[tid][c];
+    reply_cqueues[c] = &this->find_replies->all_cqueues[tid][c];
+  }
+  std::vector<uint64_t> outstanding(n_cons, 0);
+  std::vector<bool> unpublished(n_cons, false);
+
+  // Owner side: the requests of every thread, and the queues to answer on
+  std::vector<typename T::cons_queue_t *> req_cqueues;
+  std::vector<typename T::prod_queue_t *> reply_pqueues;
+  std::vector<bool> active;
+  uint32_t requesters_done = 0;
+  InsertFindArgument *items = nullptr;
+  FindResult *results = nullptr;
+  if (is_owner) {
+    for (auto r = 0u; r < n_threads; r++) {
+      req_cqueues.push_back(
+          &this->find_requests->all_cqueues[this_cons_id][r]);
+      reply_pqueues.push_back(
+          &this->find_replies->all_pqueues[this_cons_id][r]);
+    }
+    active.assign(n_threads, true);
+    items = (InsertFindArgument *)aligned_alloc(
+        64, sizeof(InsertFindArgument) * config.batch_len);
+    results = new FindResult[config.batch_len];
+  }
+  ValuePairs vp = std::make_pair(0, results);
+
+  // Answer what the requesters have published, up to a window per requester
+  auto serve = [&] {
+    for (auto r = 0u; r < n_threads; r++) {
+      if (!active[r]) continue;
+      auto pq = reply_pqueues[r];
+      auto send_results = [&] {
+        for (auto i = 0u; i < vp.first; i++) {
+          this->find_replies->enqueue(
+              pq, this_cons_id, r,
+              data_t(vp.second[i].id, vp.second[i].value));
+        }
+        vp.first = 0;
+      };
+
+      uint64_t batch = 0;
+      uint32_t n = 0;
+      auto submit = [&] {
+        ktable->find_batch(InsertFindArguments(items, n), vp, collector);
+        send_results();
+        batch += n;
+        n = 0;
+      };
+      for (data_t kv; batch + n < window;) {
+        if (this->find_requests->try_dequeue(req_cqueues[r], r, this_cons_id,
+                                             &kv) == RETRY) {
+          break;
+        }
+        if (kv == T::BQ_MAGIC_KV) [[unlikely]] {
+          active[r] = false;
+          requesters_done++;
+          break;
+        }
+        items[n].key = kv.key;
+        items[n].id = kv.value;
+        items[n].part_id = n_prod + (kv.value >> 32);
+        if (++n == config.batch_len) submit();
+      }
+      if (n) submit();
+      if (!batch) continue;
+
+      uint32_t flushed;
+      do {
+        ktable->flush_find_queue(vp, collector);
+        flushed = vp.first;
+        send_results();
+      } while (flushed == config.batch_len);
+      this->find_replies->enqueue(pq, this_cons_id, r,
+                                  data_t(T::BQ_MAGIC_64BIT, batch));
+      this->find_replies->publish(pq, this_cons_id, r);
+      served += batch;
+    }
+  };
+
+  auto drain = [&] {
+    for (auto c = 0; c < n_cons; c++) {
+      for (data_t kv; this->find_replies->try_dequeue(reply_cqueues[c], c, tid,
+                                                      &kv) == SUCCESS;) {
+        if (kv.key == T::BQ_MAGIC_64BIT) {
+          outstanding[c] -= kv.value;
+        } else {
+          found++;
+        }
+      }
+    }
+  };
+
+  auto progress = [&] {
+    for (auto c = 0; c < n_cons; c++) {
+      if (unpublished[c]) {
+        this->find_requests->publish(req_pqueues[c], tid, c);
+        unpublished[c] = false;
+      }
+    }
+    if (is_owner) serve();
+    drain();
+  };
+
+  struct xorwow_state _xw_state, init_state;
+  xorwow_init(&_xw_state);
+  init_state = _xw_state;
+
+  auto num_messages = HT_TESTS_NUM_INSERTS / n_threads;
+
+  PLOGV.printf("Delegating finder %u starting | num_messages %lu", tid,
+               num_messages);
+
+  barrier->arrive_and_wait();
+
+  static const auto event = vtune::event_start("find_batch");
+
+  std::size_t next_pollution{};
+  auto t_start = RDTSC_START();
+
+  for (auto m = 0u; m < config.insert_factor; m++) {
+    uint64_t key_start =
+        std::max(static_cast<uint64_t>(num_messages) * tid, (uint64_t)1);
+    auto zipf_idx = key_start == 1 ? 0 : key_start;
+#if defined(XORWOW)
+    _xw_state = init_state;
+#endif
+    uint32_t j = 0;
+    for (auto i = 0u; i < num_messages; i++) {
+      uint64_t k;
+#if defined(XORWOW)
+      k = xorwow(&_xw_state);
+#elif defined(BQ_TESTS_INSERT_ZIPFIAN)
+      if (!(zipf_idx & 7) && zipf_idx + 16 < zipf_values->size())
+        prefetch_object<false>(&zipf_values->at(zipf_idx + 16), 64);
+
+      k = zipf_values->at(zipf_idx);
+      zipf_idx++;
+#else
+      k = key_start++;
+#endif
+      uint64_t hash_val = hasher(&k, sizeof(k));
+      const auto part = hash_to_cpu(hash_val, this->n_parts);
+      const auto owner = this->owner_of(part);
+
+#if defined(BQ_KEY_UPPER_BITS_HAS_HASH)
+      k |= (hash_val << 32);
+#endif
+
+      while (outstanding[owner] >= window) progress();
+
+      this->find_requests->enqueue(req_pqueues[owner], tid, owner,
+                                   data_t(k, (uint64_t)part << 32 |
+                                                 (uint32_t)count++));
+      outstanding[owner]++;
+      unpublished[owner] = true;
+      sent++;
+
+      if (++j == config.batch_len) {
+        j = 0;
+        progress();
+
+        for (auto p = 0u;
+             p < config.pollute_ratio * HT_TESTS_FIND_BATCH_LENGTH; ++p)
+          prefetch_object<true>(
+              &toxic_waste_dump[next_pollution++ & (1024 * 1024 - 1)], 64);
+      }
+    }
+  }
+
+  // Tell the owners we are done, then keep answering until every requester
+  // is done and wait for the last results
+  for (auto c = 0; c < n_cons; c++) {
+    this->find_requests->enqueue(req_pqueues[c], tid, c, T::BQ_MAGIC_KV);
+    unpublished[c] = true;
+  }
+  auto pending = [&] {
+    return std::any_of(outstanding.begin(), outstanding.end(),
+                       [](uint64_t n) { return n > 0; }) ||
+           (is_owner && requesters_done < n_threads);
+  };
+  while (pending()) progress();
+
+  auto t_end = RDTSCP();
+
+  barrier->arrive_and_wait();
+
+#ifdef CALC_STATS
+  PLOG_INFO.printf("Finder %u (found %" PRIu64 ", not_found %" PRIu64
+                   ", served %" PRIu64 ")",
+                   tid, found, sent - found, served);
+#endif
+
+  vtune::event_end(event);
+
+  sh->stats->finds.duration = (t_end - t_start);
+  sh->stats->finds.op_count = found;
+
+  PLOGV.printf(
+      "thread %u | num_finds %lu (not_found %lu) | served %lu | cycles per "
+      "get: %lu",
+      sh->shard_idx, found, sent - found, served,
+      found > 0 ? (t_end - t_start) / found : 0);
+
+  if (is_owner) {
+    this->get_held_ht_stats(sh, tid, n_prod, ktable);
+    free(items);
+    delete[] results;
+  }
+
+#ifdef LATENCY_COLLECTION
+  collector->dump("find", tid);
+#endif
+}
+
 template <typename T>
 void QueueTest<T>::init_queues(uint32_t nprod, uint32_t ncons) {
   PLOG_DEBUG.printf("Initializing queues");
@@ -923,6 +1531,14 @@ void QueueTest<T>::run_test(Configuration *cfg, Numa *n, bool is_join,
       "Kmer insertion took %llu us",
       chrono::duration_cast<chrono::microseconds>(end_ts - start_ts).count());
   print_stats(this->shards, *cfg);
+
+  // All the threads are joined, nothing is queued anymore
+  delete this->queues;
+  delete this->find_requests;
+  delete this->find_replies;
+  this->queues = nullptr;
+  this->find_requests = nullptr;
+  this->find_replies = nullptr;
 }
 
 template <typename T>
@@ -947,6 +1563,18 @@ void QueueTest<T>::run_find_test(Configuration *cfg, Numa *n, bool is_join,
 
   std::barrier barrier(cfg->n_prod + cfg->n_cons, on_completion);
 
+  // The owners answer the finds of all the threads through the queues, see
+  // delegated_find_thread
+  if (cfg->delegate_finds && !cfg->no_prefetch && !is_join) {
+    auto cpus = this->npq->get_assigned_cpu_list_producers();
+    const auto cons_cpus = this->npq->get_assigned_cpu_list_consumers();
+    cpus.insert(cpus.end(), cons_cpus.begin(), cons_cpus.end());
+    this->find_requests = new T(cfg->n_prod + cfg->n_cons, cfg->n_cons,
+                                this->QUEUE_SIZE, cpus);
+    this->find_replies = new T(cfg->n_cons, cfg->n_prod + cfg->n_cons,
+                               this->QUEUE_SIZE, cons_cpus);
+  }
+
   // Spawn threads that will perform find operation
   for (uint32_t assigned_cpu : this->npq->get_assigned_cpu_list_producers()) {
     // skip the first CPU, we'll launch it later
@@ -1050,6 +1678,31 @@ void QueueTest<T>::insert_with_queues(Configuration *cfg, Numa *n, bool is_join,
   // Init queues
   this->init_queues(cfg->n_prod, cfg->n_cons);
 
+  // Partitions that move between the consumers take the prefetch engine,
+  // and a table id each after those of the threads
+  this->n_parts = cfg->n_cons;
+  if (cfg->rebalance_parts > 1 && bq_load == BQUEUE_LOAD::HtInsert &&
+      !cfg->no_prefetch) {
+    this->n_parts = cfg->n_cons * cfg->rebalance_parts;
+    if (cfg->n_prod + this->n_parts > MAX_PARTITIONS) {
+      PLOG_ERROR.printf(
+          "producers (%u) + partitions (%u) exceeded the number of "
+          "partitioned tables (%zu)",
+          cfg->n_prod, this->n_parts, MAX_PARTITIONS);
+      exit(-1);
+    }
+    // A consumer lags behind when it has half of its queues to work through
+    const uint64_t min_backlog =
+        cfg->n_prod * (this->queues->queue_size / sizeof(data_t)) / 2;
+    this->balancer =
+        new PartitionBalancer(this->n_parts, cfg->n_cons, min_backlog);
+    this->part_tables.assign(this->n_parts, nullptr);
+  }
+
+  // Weighted messages are only understood by the bulk consumer path
+  this->combining = cfg->combine_slots && bq_load == BQUEUE_LOAD::HtInsert &&
+                    !cfg->no_prefetch;
+
   std::function<void()> on_completion = []() noexcept {
     // For debugging
     PLOG_INFO << "Sync completed. Starting prod/cons threads!";
@@ -1124,6 +1777,30 @@ void QueueTest<T>::insert_with_queues(Configuration *cfg, Numa *n, bool is_join,
   this->prod_threads.clear();
   this->cons_threads.clear();
 
+  if (this->balancer) {
+    std::vector<uint32_t> parts(cfg->n_cons, 0);
+    for (auto p = 0u; p < this->n_parts; p++) {
+      parts[this->balancer->owner(p)]++;
+    }
+    std::ostringstream os;
+    for (auto c = 0u; c < cfg->n_cons; c++) {
+      os << " " << parts[c];
+    }
+    PLOG_INFO.printf("Moved %" PRIu64 " partitions, partitions per consumer:%s",
+                     this->balancer->num_moves(), os.str().c_str());
+    run_counters["rebalance.moves"] = this->balancer->num_moves();
+  }
+
+  if (this->combining) {
+    const uint64_t keys = this->combined_keys, msgs = this->combined_messages;
+    PLOG_INFO.printf("Combined %" PRIu64 " keys into %" PRIu64
+                     " messages (%.1fx)",
+                     keys, msgs, msgs ? (double)keys / msgs : 0.0);
+    run_counters["combine.keys"] = keys;
+    run_counters["combine.messages"] = msgs;
+    this->combined_keys = this->combined_messages = 0;
+  }
+
   // TODO free everything
   // TODO: Move this stats to find after testing find
   // print_stats(this->shards, *cfg);
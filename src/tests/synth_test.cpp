@@ -1,6 +1,7 @@
 #include <plog/Log.h>
 
 #include <algorithm>
+#include <charconv>
 #include <cstdint>
 
 #include "tests/SynthTest.hpp"
@@ -53,15 +54,63 @@ extern Configuration config;
 extern uint64_t HT_TESTS_HT_SIZE;
 extern uint64_t HT_TESTS_NUM_INSERTS;
 
-__thread struct xorwow_state _xw_state, init_state;
+/// First key of the thread's share of a synthetic insert or find pass
+inline uint64_t synth_key_start(uint32_t home) {
+  return std::max(static_cast<uint64_t>(1), HT_TESTS_NUM_INSERTS * home);
+}
+
+enum class SynthKeys { Int, Key16, Indirect };
+
+inline SynthKeys synth_keys() {
+  if (config.key_type == "key16") return SynthKeys::Key16;
+  if (config.key_type == "indirect") return SynthKeys::Indirect;
+  return SynthKeys::Int;
+}
+
+#if (KEY_LEN == 8)
+/// The key the tables take for the synthetic key `value`: the value itself,
+/// or a wider key made from it, copied into `arena` and passed by reference.
+inline uint64_t synth_key(SynthKeys keys, uint64_t value, KeyArena &arena) {
+  if (keys == SynthKeys::Key16) {
+    const Key16 k{value, value * 0x9E3779B97F4A7C15ULL};
+    return reinterpret_cast<uint64_t>(arena.intern(k));
+  } else if (keys == SynthKeys::Indirect) {
+    char digits[32] = "synth-key-";
+    const auto end = std::to_chars(digits + 10, std::end(digits), value).ptr;
+    return reinterpret_cast<uint64_t>(arena.intern(digits, end - digits));
+  }
+  return value;
+}
+#endif
+
+void SynthTest::init_xorwow() {
+  std::call_once(this->xorwow_once, [this] {
+    this->xw_seeds.resize(config.num_threads);
+    for (auto &seed : this->xw_seeds) {
+      xorwow_init(&seed);
+    }
+  });
+}
 
 OpTimings SynthTest::synth_run(BaseHashTable *ktable, uint8_t start) {
   auto k = 0;
   auto inserted = 0lu;
   std::uint64_t duration{};
-
-  xorwow_init(&_xw_state);
-  init_state = _xw_state;
+  std::uint64_t num_keys{};
+
+  this->init_xorwow();
+  xorwow_seek xw;
+
+  // Every thread starts out with its own keys, for every pass
+  std::call_once(this->insert_once, [this] {
+    this->insert_pool = std::make_unique<WorkPool>(
+        config.num_threads, HT_TESTS_NUM_INSERTS * config.insert_factor,
+        config.steal_chunk);
+#if (KEY_LEN == 8)
+    this->insert_keys.resize(config.num_threads);
+#endif
+  });
+  const SynthKeys keys = synth_keys();
 
   __attribute__((aligned(64))) InsertFindArgument items[HT_TESTS_FIND_BATCH_LENGTH] = {0};
 #ifdef WITH_VTUNE_LIB
@@ -74,29 +123,32 @@ OpTimings SynthTest::synth_run(BaseHashTable *ktable, uint8_t start) {
 
   papi_start_region("synthetic_insertions");
   const auto t_start = RDTSC_START();
-  for (auto j = 0u; j < config.insert_factor; j++) {
-    uint64_t count =
-        std::max(static_cast<uint64_t>(1), HT_TESTS_NUM_INSERTS * start);
-    _xw_state = init_state;
-    for (auto i = 0u; i < HT_TESTS_NUM_INSERTS; i++) {
+  for (WorkPool::Chunk chunk; this->insert_pool->next(start, &chunk);) {
+    num_keys += chunk.end - chunk.begin;
+    for (auto i = chunk.begin; i < chunk.end; i++) {
+      // key n of pass i / HT_TESTS_NUM_INSERTS over the keys of chunk.home
+      const uint64_t n = i % HT_TESTS_NUM_INSERTS;
       std::uint64_t value{};
 #if defined(SAME_KMER)
       value = 32;
 #elif defined(XORWOW)
 #warning "Xorwow rand kmer insert"
-      value = xorwow(&_xw_state);
+      value = xw.at(this->xw_seeds[chunk.home], n);
 #else
-      value = count;
+      value = synth_key_start(chunk.home) + n;
 #endif
-      items[k].key = items[k].value = value;
+#if (KEY_LEN == 8)
+      items[k].key = synth_key(keys, value, this->insert_keys[start]);
+#else
+      items[k].key = value;
+#endif
+      items[k].value = value;
 
       if (config.no_prefetch) {
         ktable->insert_noprefetch((void *)&items[k]);
         k = (k + 1) & (HT_TESTS_BATCH_LENGTH - 1);
-        count++;
         inserted++;
       } else {
-        count++;
         if (++k == HT_TESTS_BATCH_LENGTH) {
           InsertFindArguments kp(items);
           ktable->insert_batch(kp);
@@ -105,20 +157,29 @@ OpTimings SynthTest::synth_run(BaseHashTable *ktable, uint8_t start) {
           inserted += kp.size();
         }
       }
-#if defined(SAME_KMER)
-      count++;
-#endif
     }
-    //PLOG_INFO.printf("inserted %" PRIu64 " items", inserted);
-    // flush the last batch explicitly
-    // printf("%s calling flush queue\n", __func__);
-    if (!config.no_prefetch) {
-      ktable->flush_insert_queue();
+  }
+  //PLOG_INFO.printf("inserted %" PRIu64 " items", inserted);
+  // flush the last batch explicitly
+  // printf("%s calling flush queue\n", __func__);
+  if (!config.no_prefetch) {
+    if (k) {
+      InsertFindArguments kp(items, k);
+      ktable->insert_batch(kp);
+      inserted += kp.size();
     }
+    ktable->flush_insert_queue();
   }
 
   const auto t_end = RDTSCP();
   papi_end_region("synthetic_insertions");
+#if (KEY_LEN == 8)
+  // 16-byte keys are copied into the table
+  if (keys == SynthKeys::Key16) {
+    this->insert_keys[start].clear();
+  }
+#endif
+  this->insert_pool->done(start, t_end - t_start);
 
 #ifdef WITH_VTUNE_LIB
   __itt_event_end(event);
@@ -127,14 +188,15 @@ OpTimings SynthTest::synth_run(BaseHashTable *ktable, uint8_t start) {
   duration += t_end - t_start;
   // printf("%s: %p\n", __func__, ktable->find(&kmers[k]));
 
-  return {duration, HT_TESTS_NUM_INSERTS * config.insert_factor};
+  return {duration, num_keys};
 }
 
 OpTimings SynthTest::synth_run_get(BaseHashTable *ktable, uint8_t tid) {
   auto k = 0;
   uint64_t found = 0;
 
-  _xw_state = init_state;
+  this->init_xorwow();
+  xorwow_seek xw;
 
   __attribute__((aligned(64))) InsertFindArgument items[HT_TESTS_FIND_BATCH_LENGTH] = {0};
 
@@ -143,6 +205,16 @@ OpTimings SynthTest::synth_run_get(BaseHashTable *ktable, uint8_t tid) {
 
   std::uint64_t duration{};
 
+  std::call_once(this->find_once, [this] {
+    this->find_pool = std::make_unique<WorkPool>(
+        config.num_threads, HT_TESTS_NUM_INSERTS * config.insert_factor,
+        config.steal_chunk);
+#if (KEY_LEN == 8)
+    this->find_keys.resize(config.num_threads);
+#endif
+  });
+  const SynthKeys keys = synth_keys();
+
 #ifdef WITH_VTUNE_LIB
   std::string evt_name(ht_type_strings[config.ht_type]);
   evt_name += "_finds";
@@ -153,24 +225,25 @@ OpTimings SynthTest::synth_run_get(BaseHashTable *ktable, uint8_t tid) {
 
   const auto t_start = RDTSC_START();
 
-  for (auto j = 0u; j < config.insert_factor; j++) {
-    uint64_t count =
-        std::max(HT_TESTS_NUM_INSERTS * tid, static_cast<uint64_t>(1));
-    _xw_state = init_state;
-    for (auto i = 0u; i < HT_TESTS_NUM_INSERTS; i++) {
+  for (WorkPool::Chunk chunk; this->find_pool->next(tid, &chunk);) {
+    for (auto i = chunk.begin; i < chunk.end; i++) {
+      const uint64_t n = i % HT_TESTS_NUM_INSERTS;
       std::uint64_t value{};
 #if defined(SAME_KMER)
       value = 32;
 #elif defined(XORWOW)
 #warning "Xorwow rand kmer insert"
-      value = xorwow(&_xw_state);
+      value = xw.at(this->xw_seeds[chunk.home], n);
 #else
-      value = count;
-      count++;
+      value = synth_key_start(chunk.home) + n;
 #endif
+#if (KEY_LEN == 8)
+      items[k].key = synth_key(keys, value, this->find_keys[tid]);
+#else
       items[k].key = value;
+#endif
       items[k].id = value;
-      items[k].part_id = tid;
+      items[k].part_id = chunk.home;
 
       if (config.no_prefetch) {
         void *kv = ktable->find_noprefetch(&items[k]);
@@ -191,9 +264,12 @@ OpTimings SynthTest::synth_run_get(BaseHashTable *ktable, uint8_t tid) {
   }
 
   if (!config.no_prefetch) {
-    if (vp.first > 0) {
-      vp.first = 0;
+    if (k) {
+      InsertFindArguments kp(items, k);
+      ktable->find_batch(kp, vp);
+      found += vp.first;
     }
+    vp.first = 0;
 
     ktable->flush_find_queue(vp);
 
@@ -201,6 +277,10 @@ OpTimings SynthTest::synth_run_get(BaseHashTable *ktable, uint8_t tid) {
   }
 
   const auto t_end = RDTSCP();
+  this->find_pool->done(tid, t_end - t_start);
+#if (KEY_LEN == 8)
+  this->find_keys[tid].clear();
+#endif
 
 #ifdef WITH_VTUNE_LIB
   __itt_event_end(event);
@@ -216,6 +296,7 @@ uint64_t seed2 = 123456789;
 inline uint64_t PREFETCH_STRIDE = 64;
 
 static uint64_t insert_done;
+static uint64_t find_done;
 
 void SynthTest::synth_run_exec(Shard *sh, BaseHashTable *kmer_ht) {
   OpTimings insert_times{};
@@ -230,10 +311,10 @@ void SynthTest::synth_run_exec(Shard *sh, BaseHashTable *kmer_ht) {
         "insertion:%" PRIu64 "",
         sh->shard_idx, i, insert_times.duration / insert_times.op_count);
 
-#ifdef CALC_STATS
-    printf(" Reprobes %" PRIu64 " soft_reprobes %" PRIu64 "\n", kmer_ht->num_reprobes,
-           kmer_ht->num_soft_reprobes);
-#endif
+    if (config.ht_stats) {
+      printf(" Reprobes %" PRIu64 " soft_reprobes %" PRIu64 "\n",
+             kmer_ht->stats.num_reprobes, kmer_ht->stats.num_soft_reprobes);
+    }
   }
   sh->stats->insertions = insert_times;
 
@@ -242,10 +323,21 @@ void SynthTest::synth_run_exec(Shard *sh, BaseHashTable *kmer_ht) {
   while (insert_done < config.num_threads) {
     fipc_test_pause();
   }
+  if (sh->shard_idx == 0) {
+    this->insert_pool->report("synth.inserts");
+  }
 
   const auto find_times = synth_run_get(kmer_ht, sh->shard_idx);
   sh->stats->finds = find_times;
 
+  fipc_test_FAI(find_done);
+  if (sh->shard_idx == 0) {
+    while (find_done < config.num_threads) {
+      fipc_test_pause();
+    }
+    this->find_pool->report("synth.finds");
+  }
+
   if (find_times.op_count > 0) {
     PLOG_INFO.printf(
         "thread %u | num_finds %" PRIu64 " | rdtsc_diff %" PRIu64 " | cycles per get: %" PRIu64 "",
@@ -52,7 +52,7 @@ void SynthTest::synth_run_exec(Shard *sh, BaseHashTable *kmer_ht) {
         "Quick stats: thread:" << sh->shard_idx <<  ", cycles per "
         "insertion:" << duration / op_count
 #ifdef CALC_STATS
-    << ", reprobes: " << kmer_ht->num_reprobes << "soft_reprobes: " << kmer_ht->num_soft_reprobes
+    << ", reprobes: " << kmer_ht->stats.num_reprobes << "soft_reprobes: " << kmer_ht->stats.num_soft_reprobes
 #endif
   ;
   
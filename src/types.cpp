@@ -1,6 +1,9 @@
 #include "types.hpp"
 
 #include <iostream>
+#include <map>
+
+#include "stats_record.hpp"
 
 #include "eth_hashjoin/src/types64.hpp"
 
@@ -28,6 +31,7 @@ Key::Key() : key(0) {}
 
 // Global config. This is a temporary dirty hack.
 Configuration config;
+std::map<std::string, double> run_counters;
 // Extern stuff
 const char* ht_type_strings[] = {
     "",
@@ -36,6 +40,8 @@ const char* ht_type_strings[] = {
     "CASHT++",
     "ARRAY_HT",
     "MULTI_HT",
+    "CUCKOO_HT",
+    "SWISS_HT",
 };
 const char* run_mode_strings[] = {
     "",
@@ -50,6 +56,9 @@ const char* run_mode_strings[] = {
     "BQ_TESTS_NO_BQ",
     "CACHE_MISS",
     "ZIPFIAN",
+    "RW_RATIO",
     "HASHJOIN",
+    "HT_PROFILE",
+    "GROUP_BY",
 };
 }  // namespace kmercounter
\ No newline at end of file
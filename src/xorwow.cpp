@@ -28,4 +28,27 @@ uint32_t xorwow(xorwow_state *state) {
 
   state->counter += 362437;
   return t + state->counter;
-}
\ No newline at end of file
+}
+
+uint32_t xorwow_seek::at(const xorwow_state &seed, uint64_t n) {
+  if (this->seed != &seed || n < this->next ||
+      n / BLOCK != this->next / BLOCK || !(this->next % BLOCK)) {
+    /* splitmix64 of the block index, to tell the blocks of a seed apart */
+    uint64_t z = n / BLOCK + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    this->seed = &seed;
+    this->state = seed;
+    this->state.a ^= static_cast<uint32_t>(z);
+    this->state.b ^= static_cast<uint32_t>(z >> 32);
+    this->state.d |= 1;
+    this->next = n - n % BLOCK;
+  }
+  for (; this->next < n; this->next++) {
+    xorwow(&this->state);
+  }
+  this->next++;
+  return xorwow(&this->state);
+}
@@ -5,7 +5,10 @@
 #include <iostream>
 #include <memory>
 #include <string_view>
+#include <thread>
+#include <vector>
 
+#include "hashtables/batch_runner/batch_runner.hpp"
 #include "hashtables/cas_kht.hpp"
 #include "hashtables/simple_kht.hpp"
 #include "test_lib.hpp"
@@ -204,5 +207,119 @@ TEST_P(AggregationTest, OFF_BY_ONE_TEST) {
 INSTANTIATE_TEST_CASE_P(TestAllCombinations, AggregationTest,
                         ::testing::ValuesIn(HTS));
 
+/// Threads upserting the same keys into the shared table through a combiner
+/// end up with the combination of all their values.
+TEST(CombinerTest, CONCURRENT_UPSERT_TEST) {
+  static constexpr uint64_t num_keys = 1 << 12;
+  static constexpr unsigned num_threads = 4;
+  static constexpr uint64_t rounds = 8;
+  static constexpr uint64_t n = num_threads * rounds;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  // Thread t inserts value(k, t * rounds + r + 1) for key k in round r
+  auto run = []<typename Combiner>(auto value, auto expected) {
+    std::vector<std::unique_ptr<BaseHashTable>> hts;
+    for (auto t = 0u; t < num_threads; t++) {
+      hts.emplace_back(
+          new CASHashTable<Upsert_KV<Combiner>, ItemQueue>{2 * num_keys});
+    }
+
+    std::vector<std::thread> threads;
+    for (auto t = 0u; t < num_threads; t++) {
+      threads.emplace_back([&, t] {
+        HTBatchRunner<> runner(hts[t].get());
+        for (uint64_t r = 0; r < rounds; r++) {
+          for (uint64_t k = 1; k <= num_keys; k++) {
+            runner.insert(k, value(k, t * rounds + r + 1));
+          }
+        }
+        runner.flush_insert();
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    EXPECT_EQ(hts[0]->get_fill(), num_keys);
+    std::atomic<uint64_t> scanned = 0;
+    hts[0]->scan(1, [&](unsigned, const KeyValuePair& kv) {
+      EXPECT_EQ(kv.value, expected(kv.key)) << "key " << kv.key;
+      scanned++;
+    });
+    EXPECT_EQ(scanned, num_keys);
+  };
+
+  run.operator()<combiner::sum>([](uint64_t k, uint64_t i) { return k * i; },
+                                [](uint64_t k) { return k * n * (n + 1) / 2; });
+  run.operator()<combiner::max>([](uint64_t k, uint64_t i) { return k * i; },
+                                [](uint64_t k) { return k * n; });
+  run.operator()<combiner::min>([](uint64_t k, uint64_t i) { return k * i; },
+                                [](uint64_t k) { return k; });
+  run.operator()<combiner::count>([](uint64_t k, uint64_t i) { return k * i; },
+                                  [](uint64_t k) { return n; });
+  run.operator()<combiner::latest>(
+      [](uint64_t k, uint64_t i) { return combiner::latest::make(i, k); },
+      [](uint64_t k) { return combiner::latest::make(n, k); });
+}
+
+/// The single writer upsert of the cmov path claims an empty slot, folds
+/// into the slot of its key and leaves the other slots alone.
+TEST(CombinerTest, INSERT_OR_UPDATE_TEST) {
+  Upsert_KV<combiner::sum> slot{};
+  ItemQueue q{};
+  q.key = 7;
+  q.value = 5;
+  EXPECT_EQ(slot.insert_or_update_v2(&q), 0xFF);
+  EXPECT_EQ(slot.get_key(), 7);
+  EXPECT_EQ(slot.get_value(), 5);
+
+  EXPECT_EQ(slot.insert_or_update_v2(&q), 0xFF);
+  EXPECT_EQ(slot.get_value(), 10);
+
+  q.key = 8;
+  EXPECT_EQ(slot.insert_or_update_v2(&q), 0);
+  EXPECT_EQ(slot.get_key(), 7);
+  EXPECT_EQ(slot.get_value(), 10);
+}
+
+/// Upserts into a partition go through the combiner whatever the branch
+/// style of the build, reprobes and the empty key included.
+TEST(CombinerTest, PARTITIONED_UPSERT_TEST) {
+  static constexpr uint64_t num_keys = 1 << 10;
+  static constexpr uint64_t rounds = 4;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  // Nearly full, for long probe chains
+  PartitionedHashStore<Upsert_KV<combiner::sum>, ItemQueue> ht{
+      num_keys + num_keys / 8, 0};
+  HTBatchRunner<> runner(&ht);
+  for (uint64_t r = 1; r <= rounds; r++) {
+    for (uint64_t k = 0; k < num_keys; k++) {
+      runner.insert(k, k * r);
+    }
+  }
+  runner.flush_insert();
+
+  // The empty key is kept out of the slots
+  EXPECT_EQ(ht.get_fill(), num_keys - 1);
+
+  uint64_t found = 0;
+  // Key k is looked up with the id k + 1
+  runner.set_callback([&](const FindResult& res) {
+    EXPECT_EQ(res.value, (res.id - 1) * rounds * (rounds + 1) / 2)
+        << "key " << res.id - 1;
+    found++;
+  });
+  for (uint64_t k = 0; k < num_keys; k++) {
+    runner.find({k, k + 1});
+    // A flush returns at most a batch
+    if (k % HT_TESTS_BATCH_LENGTH == HT_TESTS_BATCH_LENGTH - 1) {
+      runner.flush_find();
+    }
+  }
+  runner.flush_find();
+  EXPECT_EQ(found, num_keys);
+}
+
 }  // namespace
 }  // namespace kmercounter
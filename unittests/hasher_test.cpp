@@ -0,0 +1,46 @@
+#include "hasher.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "types.hpp"
+
+namespace kmercounter {
+namespace {
+
+/// The batch kernels hash like the hashers do one key at a time.
+template <typename H>
+void ExpectBatchMatchesScalar() {
+  H hasher;
+  // Not a multiple of the batch size, so the tail is hashed one by one
+  std::vector<InsertFindArgument> args(3 * HASH_BATCH_SIZE + 5);
+  for (size_t i = 0; i < args.size(); i++) {
+    args[i].key = i * 0x9E3779B97F4A7C15ULL + 1;
+  }
+
+  std::vector<uint64_t> hashes(args.size());
+  hash_keys(hasher, &args[0].key, sizeof(InsertFindArgument), args.size(),
+            sizeof(key_type), hashes.data());
+  for (size_t i = 0; i < args.size(); i++) {
+    EXPECT_EQ(hashes[i], hasher(&args[i].key, sizeof(key_type))) << i;
+  }
+}
+
+TEST(Hasher, Crc) { ExpectBatchMatchesScalar<CrcHasher>(); }
+
+TEST(Hasher, MulXorBatch) { ExpectBatchMatchesScalar<MulXorHasher>(); }
+
+TEST(Hasher, ScalarOnly) { ExpectBatchMatchesScalar<XxHasher>(); }
+
+TEST(Hasher, Dispatch) {
+  std::string picked;
+  EXPECT_TRUE(Hashers::dispatch("mulxor", [&]<typename H>(H) {
+    picked = H::name;
+  }));
+  EXPECT_EQ(picked, "mulxor");
+  EXPECT_FALSE(Hashers::dispatch("nohash", [](auto) {}));
+}
+
+}  // namespace
+}  // namespace kmercounter
@@ -5,19 +5,34 @@
 #include <gtest/gtest.h>
 #include <plog/Log.h>
 
+#include <array>
+#include <atomic>
+#include <barrier>
 #include <cassert>
+#include <fstream>
 #include <initializer_list>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <numeric>
 #include <span>
+#include <sstream>
+#include <string>
 #include <string_view>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "hashtable.h"
 #include "hashtables/batch_runner/batch_runner.hpp"
 #include "hashtables/cas_kht.hpp"
+#include "hashtables/cuckoo_kht.hpp"
+#include "hashtables/multi_kht.hpp"
 #include "hashtables/simple_kht.hpp"
+#include "hashtables/swiss_kht.hpp"
 #include "test_lib.hpp"
+#include "utils/work_pool.hpp"
+#include "xorwow.hpp"
 
 namespace kmercounter {
 
@@ -45,7 +60,9 @@ class FindResultChecker {
     // Ensure keys are unique.
     assert(init.size() == set_->size());
   }
-  ~FindResultChecker() { assert(set_->empty()); }
+  ~FindResultChecker() {
+    EXPECT_TRUE(set_->empty()) << set_->size() << " results not found";
+  }
 
   void add(const kmercounter::FindResult& result) {
     auto copy = result;
@@ -76,23 +93,23 @@ class HashtableTest : public ::testing::TestWithParam<const char*> {
  protected:
   void SetUp() override {
     const auto ht_name = GetParam();
-    const auto hashtable_size = absl::GetFlag(FLAGS_hashtable_size);
+    ASSERT_TRUE(ht_name == PARTITIONED_HT || ht_name == CAS_HT)
+        << "Invalid hashtable type: " << ht_name;
 
     config.no_prefetch = 0;
-    // Get hashtable.
-    ht_ = std::unique_ptr<kmercounter::BaseHashTable>(
-        [ht_name, hashtable_size]() -> kmercounter::BaseHashTable* {
-          if (ht_name == PARTITIONED_HT)
-            return new kmercounter::PartitionedHashStore<
-                kmercounter::Item, kmercounter::ItemQueue>{hashtable_size, 0};
-          else if (ht_name == CAS_HT)
-            return new kmercounter::CASHashTable<kmercounter::Item,
-                                                 kmercounter::ItemQueue>{
-                hashtable_size};
-          else
-            return nullptr;
-        }());
-    ASSERT_NE(ht_, nullptr) << "Invalid hashtable type: " << ht_name;
+    make_table(absl::GetFlag(FLAGS_hashtable_size));
+  }
+
+  /// Replace the table with one of `size` slots of the tested type, and the
+  /// batch runner with one on it. The old table goes first, since the
+  /// instances of a table type share their storage.
+  template <typename H = Hasher>
+  void make_table(uint64_t size) {
+    ht_.reset();
+    if (GetParam() == PARTITIONED_HT)
+      ht_.reset(new PartitionedHashStore<Item, ItemQueue, H>{size, 0});
+    else
+      ht_.reset(new CASHashTable<Item, ItemQueue, H>{size});
     batch_runner_ = HTBatchRunner<>(ht_.get());
   }
 
@@ -214,6 +231,944 @@ TEST_P(HashtableTest, BATCH_QUERY_TEST) {
   batch_runner_.flush_find();
 }
 
+TEST_P(HashtableTest, BATCH_ERASE_TEST) {
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  // Scatter the keys so that some of them share probe chains.
+  auto key_of = [](uint64_t i) { return i * 0x9E3779B97F4A7C15ULL; };
+
+  // Insert test data.
+  uint64_t test_size = absl::GetFlag(FLAGS_test_size);
+  for (uint64_t i = 1; i <= test_size; i++) {
+    batch_runner_.insert(key_of(i), i);
+  }
+  batch_runner_.flush_insert();
+
+  // Erase every other key.
+  std::array<InsertFindArgument, HT_TESTS_BATCH_LENGTH> args{};
+  for (uint64_t i = 1; i <= test_size; i += 2 * HT_TESTS_BATCH_LENGTH) {
+    for (uint64_t j = 0; j < HT_TESTS_BATCH_LENGTH; j++) {
+      args[j].key = key_of(i + 2 * j + 1);
+      args[j].part_id = 0;
+    }
+    ht_->erase_batch(InsertFindArguments(args));
+  }
+  ht_->flush_erase_queue();
+  EXPECT_EQ(ht_->get_fill(), test_size / 2);
+
+  // Look the keys up one batch at a time so that every result fits in a
+  // single flush.
+  for (uint64_t i = 1; i <= test_size; i += HT_TESTS_BATCH_LENGTH) {
+    FindResultChecker checker;
+    batch_runner_.set_callback(checker.checker());
+    for (uint64_t j = i; j < i + HT_TESTS_BATCH_LENGTH; j++) {
+      if (j & 1) {
+        checker.add(j, j);
+      }
+      batch_runner_.find({key_of(j), j});
+    }
+    batch_runner_.flush_find();
+  }
+}
+
+/// Inserts take the tombstones left by erases back instead of the empty slots
+/// at the end of their chains.
+TEST_P(HashtableTest, TOMBSTONE_REUSE_TEST) {
+  if (GetParam() == PARTITIONED_HT) {
+    GTEST_SKIP() << "The partitioned hashtable erases without tombstones";
+  }
+  static constexpr uint64_t size = 1 << 12;
+  static constexpr uint64_t test_size = size / 2;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  make_table(size);
+  auto* cas = static_cast<CASHashTable<Item, ItemQueue>*>(ht_.get());
+
+  auto key_of = [](uint64_t i) { return i * 0x9E3779B97F4A7C15ULL; };
+  auto tombstones = [cas] {
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < cas->get_capacity(); i++) {
+      n += cas->hashtable[i].is_tombstone();
+    }
+    return n;
+  };
+
+  for (uint64_t i = 1; i <= test_size; i++) {
+    batch_runner_.insert(key_of(i), i);
+  }
+  batch_runner_.flush_insert();
+
+  std::array<InsertFindArgument, HT_TESTS_BATCH_LENGTH> args{};
+  for (uint64_t i = 1; i <= test_size; i += HT_TESTS_BATCH_LENGTH) {
+    for (uint64_t j = 0; j < HT_TESTS_BATCH_LENGTH; j++) {
+      args[j].key = key_of(i + j);
+    }
+    ht_->erase_batch(InsertFindArguments(args));
+  }
+  ht_->flush_erase_queue();
+  EXPECT_EQ(ht_->get_fill(), 0u);
+  EXPECT_EQ(tombstones(), test_size);
+
+  // Every chain still holds the tombstone its key left
+  for (uint64_t i = 1; i <= test_size; i++) {
+    batch_runner_.insert(key_of(i), 2 * i);
+  }
+  batch_runner_.flush_insert();
+  EXPECT_EQ(tombstones(), 0);
+  EXPECT_EQ(ht_->get_fill(), test_size);
+
+  for (uint64_t i = 1; i <= test_size; i += HT_TESTS_BATCH_LENGTH) {
+    FindResultChecker checker;
+    batch_runner_.set_callback(checker.checker());
+    for (uint64_t j = i; j < i + HT_TESTS_BATCH_LENGTH; j++) {
+      checker.add(j, 2 * j);
+      batch_runner_.find({key_of(j), j});
+    }
+    batch_runner_.flush_find();
+  }
+}
+
+/// The key that marks tombstones is stored like any other.
+TEST_P(HashtableTest, TOMBSTONE_KEY_TEST) {
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  for (uint64_t i = 1; i <= HT_TESTS_BATCH_LENGTH; i++) {
+    batch_runner_.insert(i, i);
+  }
+  batch_runner_.flush_insert();
+  std::array<InsertFindArgument, HT_TESTS_BATCH_LENGTH> args{};
+  for (uint64_t i = 0; i < HT_TESTS_BATCH_LENGTH; i++) {
+    args[i].key = i + 1;
+  }
+  ht_->erase_batch(InsertFindArguments(args));
+  ht_->flush_erase_queue();
+
+  {
+    // Not there yet, although the table holds tombstones now
+    FindResultChecker checker;
+    batch_runner_.set_callback(checker.checker());
+    batch_runner_.find({TOMBSTONE_KEY, 1});
+    batch_runner_.flush_find();
+  }
+
+  batch_runner_.insert(TOMBSTONE_KEY, 42);
+  batch_runner_.flush_insert();
+  {
+    FindResultChecker checker{FindResult(1, 42)};
+    batch_runner_.set_callback(checker.checker());
+    batch_runner_.find({TOMBSTONE_KEY, 1});
+    batch_runner_.flush_find();
+  }
+
+  InsertFindArgument arg{TOMBSTONE_KEY, 0, 0, 0};
+  ht_->erase_batch(InsertFindArguments(&arg, 1));
+  ht_->flush_erase_queue();
+  {
+    FindResultChecker checker;
+    batch_runner_.set_callback(checker.checker());
+    batch_runner_.find({TOMBSTONE_KEY, 1});
+    batch_runner_.flush_find();
+  }
+}
+
+/// Both hashtables grow while they are filled way past their initial size.
+TEST_P(HashtableTest, ONLINE_GROW_TEST) {
+  constexpr uint64_t initial_size = 1024;
+  constexpr uint64_t test_size = 16 * initial_size;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+  config.ht_grow_threshold = 0.5;
+
+  // Swap in a small table; partitions are static, so the fixture's table has
+  // to release partition 0 first.
+  make_table(initial_size);
+
+  for (uint64_t i = 1; i <= test_size; i++) {
+    batch_runner_.insert(i, 3 * i);
+  }
+  batch_runner_.flush_insert();
+
+  EXPECT_GT(ht_->get_capacity(), test_size);
+  EXPECT_EQ(ht_->get_fill(), test_size);
+
+  for (uint64_t i = 1; i <= test_size; i += HT_TESTS_BATCH_LENGTH) {
+    FindResultChecker checker;
+    batch_runner_.set_callback(checker.checker());
+    for (uint64_t j = i; j < i + HT_TESTS_BATCH_LENGTH; j++) {
+      checker.add(j, 3 * j);
+      batch_runner_.find({j, j});
+    }
+    batch_runner_.flush_find();
+  }
+
+  config.ht_grow_threshold = 0;
+}
+
+/// A table mapped from a snapshot has the contents of the one that wrote it.
+TEST_P(HashtableTest, SNAPSHOT_TEST) {
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  uint64_t test_size = absl::GetFlag(FLAGS_test_size);
+  for (uint64_t i = 1; i <= test_size; i++) {
+    batch_runner_.insert(i, 5 * i);
+  }
+  batch_runner_.flush_insert();
+
+  const auto base = ::testing::TempDir() + "ht_snapshot";
+  const auto path = snapshot_path(base, 0);
+  ASSERT_TRUE(ht_->save_snapshot(path));
+  const auto capacity = ht_->get_capacity();
+
+  // Swap in a table mapped from the snapshot; its size comes from the
+  // snapshot.
+  config.ht_snapshot_in = base;
+  make_table(1);
+  config.ht_snapshot_in.clear();
+  unlink(path.c_str());
+
+  EXPECT_EQ(ht_->get_capacity(), capacity);
+  EXPECT_EQ(ht_->get_fill(), test_size);
+
+  for (uint64_t i = 1; i <= test_size; i += HT_TESTS_BATCH_LENGTH) {
+    FindResultChecker checker;
+    batch_runner_.set_callback(checker.checker());
+    for (uint64_t j = i; j < i + HT_TESTS_BATCH_LENGTH; j++) {
+      checker.add(j, 5 * j);
+      batch_runner_.find({j, j});
+    }
+    batch_runner_.flush_find();
+  }
+}
+
+/// Every entry shows up once in each histogram of the profile, in total and
+/// summed over the nodes.
+TEST_P(HashtableTest, PROFILE_TEST) {
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  uint64_t test_size = absl::GetFlag(FLAGS_test_size);
+  for (uint64_t i = 1; i <= test_size; i++) {
+    batch_runner_.insert(i * 0x9E3779B97F4A7C15ULL, i);
+  }
+  batch_runner_.flush_insert();
+
+  const auto path = ::testing::TempDir() + "ht_profile";
+  ASSERT_TRUE(ht_->save_profile(path));
+
+  // Entries counted by each histogram, for "all" and for the nodes
+  std::map<std::string, uint64_t> total, per_node;
+  uint64_t at_home = 0;
+  std::ifstream f(path);
+  std::string line;
+  while (std::getline(f, line)) {
+    if (line[0] == '#') continue;
+    std::istringstream is(line);
+    std::string hist, node;
+    uint64_t value, count;
+    is >> hist >> node >> value >> count;
+    // Distances count entries, runs and cachelines count their entries
+    const uint64_t entries = hist == "probe_distance" ? count : value * count;
+    (node == "all" ? total : per_node)[hist] += entries;
+    if (hist == "probe_distance" && node == "all" && value == 0) {
+      at_home = count;
+    }
+  }
+  unlink(path.c_str());
+
+  // The table is lightly loaded, most entries sit in their home slot
+  EXPECT_GT(at_home, test_size / 2);
+  for (const auto& hist : {"probe_distance", "run_length", "line_occupancy"}) {
+    EXPECT_EQ(total[hist], test_size) << hist;
+    EXPECT_EQ(per_node[hist], test_size) << hist;
+  }
+}
+
+/// A parallel scan visits every entry exactly once.
+TEST_P(HashtableTest, PARALLEL_SCAN_TEST) {
+  // Large enough for the table to be cut into several chunks
+  constexpr uint64_t size = 1ull << 20;
+  constexpr unsigned num_threads = 4;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  make_table(size);
+
+  // Spread the keys over the whole table.
+  uint64_t test_size = absl::GetFlag(FLAGS_test_size);
+  uint64_t key_sum = 0;
+  for (uint64_t i = 1; i <= test_size; i++) {
+    const uint64_t key = i * 0x9E3779B97F4A7C15ULL;
+    batch_runner_.insert(key, i);
+    key_sum += key;
+  }
+  batch_runner_.flush_insert();
+
+  std::array<std::atomic<uint64_t>, num_threads> counts{};
+  std::atomic<uint64_t> scanned_key_sum = 0, value_sum = 0;
+  ht_->scan(num_threads, [&](unsigned tid, const KeyValuePair& kv) {
+    ASSERT_LT(tid, num_threads);
+    counts[tid]++;
+    scanned_key_sum += kv.key;
+    value_sum += kv.value;
+  });
+
+  uint64_t count = 0;
+  for (const auto& c : counts) {
+    count += c;
+  }
+  EXPECT_EQ(count, test_size);
+  EXPECT_EQ(scanned_key_sum, key_sum);
+  EXPECT_EQ(value_sum, test_size * (test_size + 1) / 2);
+  EXPECT_EQ(ht_->get_fill(), test_size);
+  EXPECT_EQ(ht_->get_max_count(), test_size);
+}
+
+/// The hashtable counters are only exported while --ht-stats is set.
+TEST_P(HashtableTest, HT_STATS_TEST) {
+  static constexpr uint64_t size = 1 << 14;
+  static constexpr uint64_t test_size = size * 7 / 8;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  make_table(size);
+
+  auto key_of = [](uint64_t i) { return i * 0x9E3779B97F4A7C15ULL; };
+  auto total = [](const auto& counts) {
+    return std::accumulate(std::begin(counts), std::end(counts), 0ULL);
+  };
+
+  config.ht_stats = false;
+  for (uint64_t i = 1; i <= test_size / 2; i++) {
+    batch_runner_.insert(key_of(i), i);
+  }
+  batch_runner_.flush_insert();
+  EXPECT_EQ(ht_->stats.num_reprobes, 0);
+  EXPECT_EQ(total(ht_->stats.probe_lengths), 0);
+
+  config.ht_stats = true;
+  for (uint64_t i = test_size / 2 + 1; i <= test_size; i++) {
+    batch_runner_.insert(key_of(i), i);
+  }
+  batch_runner_.flush_insert();
+  EXPECT_GT(ht_->stats.num_reprobes, 0);
+
+  for (uint64_t i = 1; i <= test_size; i++) {
+    InsertFindArgument arg{key_of(i), 0, static_cast<uint32_t>(i), 0};
+    ASSERT_NE(ht_->find_noprefetch(&arg), nullptr);
+  }
+  EXPECT_EQ(total(ht_->stats.probe_lengths), test_size);
+  EXPECT_GT(ht_->stats.max_distance_from_bucket, 0);
+
+  // Queued and coroutine lookups land in the histogram as well
+  for (const uint32_t coros : {0u, 8u}) {
+    config.coro_lookups = coros;
+    HTStats before = ht_->stats;
+    for (uint64_t i = 1; i <= test_size; i += HT_TESTS_BATCH_LENGTH) {
+      FindResultChecker checker;
+      batch_runner_.set_callback(checker.checker());
+      for (uint64_t j = i; j < i + HT_TESTS_BATCH_LENGTH; j++) {
+        checker.add(j, j);
+        batch_runner_.find({key_of(j), j});
+      }
+      batch_runner_.flush_find();
+    }
+    EXPECT_EQ(total(ht_->stats.probe_lengths) - total(before.probe_lengths),
+              test_size);
+    // The half filled without stats left chains to probe past the home slot
+    EXPECT_GT(total(ht_->stats.probe_lengths) - ht_->stats.probe_lengths[0],
+              total(before.probe_lengths) - before.probe_lengths[0]);
+  }
+  config.coro_lookups = 0;
+  config.ht_stats = false;
+}
+
+/// The queues stay correct while the prefetch depth moves under them.
+TEST_P(HashtableTest, ADAPTIVE_PREFETCH_TEST) {
+  static constexpr uint64_t test_size = 4 * PrefetchDepth::EPOCH_OPS;
+  static constexpr uint32_t initial_depth = 8;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+  config.prefetch_depth = initial_depth;
+  config.adaptive_prefetch = true;
+
+  make_table(2 * test_size);
+  config.prefetch_depth = 0;
+  config.adaptive_prefetch = false;
+
+  for (uint64_t i = 1; i <= test_size; i++) {
+    batch_runner_.insert(i, i * 3);
+  }
+  batch_runner_.flush_insert();
+  EXPECT_EQ(ht_->get_fill(), test_size);
+
+  for (uint64_t i = 1; i <= test_size; i += HT_TESTS_BATCH_LENGTH) {
+    FindResultChecker checker;
+    batch_runner_.set_callback(checker.checker());
+    for (uint64_t j = i; j < i + HT_TESTS_BATCH_LENGTH; j++) {
+      checker.add(j, j * 3);
+      batch_runner_.find({j, j});
+    }
+    batch_runner_.flush_find();
+  }
+
+  std::array<InsertFindArgument, HT_TESTS_BATCH_LENGTH> args{};
+  for (uint64_t i = 1; i <= test_size; i += args.size()) {
+    for (uint64_t j = 0; j < args.size(); j++) {
+      args[j].key = i + j;
+    }
+    ht_->erase_batch(InsertFindArguments(args.data(), args.size()));
+  }
+  ht_->flush_erase_queue();
+  EXPECT_EQ(ht_->get_fill(), 0u);
+
+  for (const PrefetchDepth* depth :
+       {&ht_->insert_depth, &ht_->find_depth, &ht_->erase_depth}) {
+    EXPECT_GE(depth->get(), PrefetchDepth::MIN_PREFETCH_DEPTH);
+    EXPECT_LE(depth->get(), MAX_PREFETCH_DEPTH);
+    EXPECT_EQ((depth->get() - initial_depth) % PrefetchDepth::DEPTH_STEP, 0);
+    EXPECT_GE(depth->mean(), PrefetchDepth::MIN_PREFETCH_DEPTH);
+    EXPECT_LE(depth->mean(), MAX_PREFETCH_DEPTH);
+  }
+}
+
+/// Coroutine lookups find the same entries as the find queue, also on the
+/// long probe chains of a nearly full table.
+TEST_P(HashtableTest, CORO_LOOKUP_TEST) {
+  static constexpr uint64_t size = 1 << 14;
+  static constexpr uint64_t test_size = size * 15 / 16;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  make_table(size);
+
+  auto key_of = [](uint64_t i) { return i * 0x9E3779B97F4A7C15ULL; };
+  for (uint64_t i = 1; i <= test_size; i++) {
+    batch_runner_.insert(key_of(i), i);
+  }
+  batch_runner_.flush_insert();
+
+  for (const uint32_t coros : {1u, 8u, MAX_CORO_LOOKUPS}) {
+    config.coro_lookups = coros;
+    // Every other batch looks up keys that are not there
+    for (uint64_t i = 1; i <= 2 * test_size; i += HT_TESTS_BATCH_LENGTH) {
+      FindResultChecker checker;
+      batch_runner_.set_callback(checker.checker());
+      for (uint64_t j = i; j < i + HT_TESTS_BATCH_LENGTH; j++) {
+        if (j <= test_size) checker.add(j, j);
+        batch_runner_.find({key_of(j), j});
+      }
+      batch_runner_.flush_find();
+    }
+  }
+  config.coro_lookups = 0;
+}
+
+/// Lookups probing through lines prefetched ahead of them still find their
+/// keys, without going back through the queue for those lines.
+TEST_P(HashtableTest, REPROBE_LINES_TEST) {
+  if (GetParam() == PARTITIONED_HT) {
+    GTEST_SKIP() << "Only the CAS hashtable prefetches lines ahead";
+  }
+  static constexpr uint64_t size = 1 << 14;
+  static constexpr uint64_t test_size = size * 15 / 16;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  make_table(size);
+
+  auto key_of = [](uint64_t i) { return i * 0x9E3779B97F4A7C15ULL; };
+  for (uint64_t i = 1; i <= test_size; i++) {
+    batch_runner_.insert(key_of(i), i);
+  }
+  batch_runner_.flush_insert();
+
+  config.reprobe_lines = 4;
+  config.ht_stats = true;
+  for (uint64_t i = 1; i <= test_size; i += HT_TESTS_BATCH_LENGTH) {
+    FindResultChecker checker;
+    batch_runner_.set_callback(checker.checker());
+    for (uint64_t j = i; j < std::min(i + HT_TESTS_BATCH_LENGTH, test_size + 1);
+         j++) {
+      checker.add(j, j);
+      batch_runner_.find({key_of(j), j});
+    }
+    batch_runner_.flush_find();
+  }
+  EXPECT_GT(ht_->stats.num_requeues_avoided, 0);
+  config.reprobe_lines = 1;
+  config.ht_stats = false;
+}
+
+/// The xorwow keys of a thread come out the same when another thread steals
+/// them (--steal-chunk), so the lookups find every key inserted.
+TEST_P(HashtableTest, XORWOW_STEAL_TEST) {
+  static constexpr uint64_t test_size = xorwow_seek::BLOCK + 100;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  std::vector<xorwow_state> seeds(2);
+  for (auto& seed : seeds) {
+    xorwow_init(&seed);
+  }
+  auto drain = [&](WorkPool& pool, std::initializer_list<unsigned> threads,
+                   auto&& op) {
+    for (unsigned t : threads) {
+      xorwow_seek xw;
+      for (WorkPool::Chunk chunk; pool.next(t, &chunk);) {
+        for (auto n = chunk.begin; n < chunk.end; n++) {
+          op(xw.at(seeds[chunk.home], n), n);
+        }
+      }
+    }
+  };
+
+  // Thread 0 has no keys, so it starts off with the back half of thread 1's
+  WorkPool inserts({0, test_size}, 64);
+  drain(inserts, {0, 1, 0}, [&](uint64_t key, uint64_t n) {
+    batch_runner_.insert(key, n);
+  });
+  batch_runner_.flush_insert();
+
+  // Thread 1 looks up all of its keys itself
+  uint64_t found = 0;
+  batch_runner_.set_callback([&](const FindResult&) { found++; });
+  WorkPool finds({0, test_size}, 100);
+  drain(finds, {1}, [&](uint64_t key, uint64_t n) {
+    batch_runner_.find({key, n});
+    // A flush returns up to a batch of results
+    if (n % HT_TESTS_BATCH_LENGTH == HT_TESTS_BATCH_LENGTH - 1) {
+      batch_runner_.flush_find();
+    }
+  });
+  batch_runner_.flush_find();
+  EXPECT_EQ(found, test_size);
+}
+
+/// Keys wider than key_type are passed by reference, inline or out of line.
+TEST_P(HashtableTest, WIDE_KEY_TEST) {
+  static constexpr uint64_t test_size = 1 << 14;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  auto run = [this]<typename KV>(const std::vector<uint64_t>& keys,
+                                 const std::vector<uint64_t>& lookups) {
+    std::unique_ptr<BaseHashTable> ht;
+    if (GetParam() == PARTITIONED_HT)
+      ht.reset(new PartitionedHashStore<KV, ItemQueue>{2 * test_size, 0});
+    else
+      ht.reset(new CASHashTable<KV, ItemQueue>{2 * test_size});
+    HTBatchRunner<> runner(ht.get());
+
+    for (uint64_t i = 0; i < test_size; i++) {
+      runner.insert(keys[i], i);
+    }
+    // Overwrite half of the values
+    for (uint64_t i = 0; i < test_size; i += 2) {
+      runner.insert(keys[i], 7 * i);
+    }
+    runner.flush_insert();
+    EXPECT_EQ(ht->get_fill(), test_size);
+
+    // Look up through copies of the keys, including one that is absent
+    for (uint64_t i = 0; i < test_size; i += HT_TESTS_BATCH_LENGTH) {
+      FindResultChecker checker;
+      runner.set_callback(checker.checker());
+      for (uint64_t j = i; j < i + HT_TESTS_BATCH_LENGTH; j++) {
+        checker.add(j, j % 2 ? j : 7 * j);
+        runner.find({lookups[j], j});
+      }
+      runner.find({lookups[test_size], test_size});
+      runner.flush_find();
+    }
+  };
+
+  // 16-byte keys that share their low half
+  std::vector<Key16> keys16, lookups16;
+  for (uint64_t i = 0; i <= test_size; i++) {
+    keys16.push_back({42, i * 0x9E3779B97F4A7C15ULL + 1});
+  }
+  lookups16 = keys16;
+  std::vector<uint64_t> keys, lookups;
+  for (uint64_t i = 0; i <= test_size; i++) {
+    keys.push_back(reinterpret_cast<uint64_t>(&keys16[i]));
+    lookups.push_back(reinterpret_cast<uint64_t>(&lookups16[i]));
+  }
+  run.operator()<Item16>(keys, lookups);
+
+  // Variable length keys with long common prefixes
+  KeyArena arena;
+  std::vector<std::string> strings;
+  std::vector<VarKey> var_lookups;
+  for (uint64_t i = 0; i <= test_size; i++) {
+    strings.push_back(std::string(i % 61, 'k') + std::to_string(i));
+  }
+  keys.clear();
+  lookups.clear();
+  for (const auto& str : strings) {
+    keys.push_back(
+        reinterpret_cast<uint64_t>(arena.intern(str.data(), str.size())));
+    var_lookups.push_back({str.data(), str.size()});
+  }
+  for (const auto& key : var_lookups) {
+    lookups.push_back(reinterpret_cast<uint64_t>(&key));
+  }
+  run.operator()<IndirectItem>(keys, lookups);
+}
+
+/// The branchless inserts claim an empty slot, overwrite the value of their
+/// own key and leave other keys alone.
+template <typename KV>
+void insert_or_update(uint64_t key, uint64_t other) {
+  KV slot{};
+  ItemQueue q{};
+  q.key = key;
+  q.value = 1;
+  EXPECT_EQ(slot.insert_or_update_v2(&q), 0xFF);
+  EXPECT_TRUE(slot.compare_key(&q));
+
+  q.value = 2;
+  EXPECT_EQ(slot.insert_or_update_v2(&q), 0xFF);
+  EXPECT_EQ(slot.get_value(), 2);
+
+  q.key = other;
+  q.value = 3;
+  EXPECT_EQ(slot.insert_or_update_v2(&q), 0);
+  EXPECT_FALSE(slot.compare_key(&q));
+  EXPECT_EQ(slot.get_value(), 2);
+}
+
+TEST(KVTest, INSERT_OR_UPDATE_TEST) {
+  insert_or_update<Item>(5, 6);
+
+  const Key16 key16{1, 2}, other16{1, 3};
+  insert_or_update<Item16>(reinterpret_cast<uint64_t>(&key16),
+                           reinterpret_cast<uint64_t>(&other16));
+
+  KeyArena arena;
+  insert_or_update<IndirectItem>(
+      reinterpret_cast<uint64_t>(arena.intern("key", 3)),
+      reinterpret_cast<uint64_t>(arena.intern("other", 5)));
+}
+
+/// Every hasher can be picked at runtime.
+TEST_P(HashtableTest, HASHER_TEST) {
+  constexpr uint64_t test_size = 1 << 12;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  for (const auto name : {"crc", "city", "citycrc", "xxhash", "xxhash3",
+                          "wyhash", "fnv", "mulxor", "direct_index"}) {
+    SCOPED_TRACE(name);
+    ASSERT_TRUE(Hashers::dispatch(name, [this]<typename H>(H) {
+      this->make_table<H>(2 * test_size);
+    }));
+
+    for (uint64_t i = 1; i <= test_size; i++) {
+      batch_runner_.insert(i, 2 * i);
+    }
+    batch_runner_.flush_insert();
+    EXPECT_EQ(ht_->get_fill(), test_size);
+
+    for (uint64_t i = 1; i <= test_size; i += HT_TESTS_BATCH_LENGTH) {
+      FindResultChecker checker;
+      batch_runner_.set_callback(checker.checker());
+      for (uint64_t j = i; j < i + HT_TESTS_BATCH_LENGTH; j++) {
+        checker.add(j, 2 * j);
+        batch_runner_.find({j, j});
+      }
+      batch_runner_.flush_find();
+    }
+  }
+}
+
+/// Fill a shared table from several threads, erase every other key, then
+/// look up all of them along with as many absent keys.
+template <typename HT>
+void fill_erase_find(uint64_t size, uint64_t test_size) {
+  constexpr unsigned num_threads = 4;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  auto key_of = [](uint64_t i) { return i * 0x9E3779B97F4A7C15ULL; };
+
+  std::vector<std::unique_ptr<BaseHashTable>> hts;
+  for (unsigned t = 0; t < num_threads; t++) {
+    hts.emplace_back(new HT{size});
+  }
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t] {
+      HTBatchRunner<> runner(hts[t].get());
+      for (uint64_t i = 1 + t; i <= test_size; i += num_threads) {
+        runner.insert(key_of(i), i);
+      }
+      runner.flush_insert();
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto& ht = hts[0];
+  EXPECT_EQ(ht->get_capacity(), size);
+  EXPECT_EQ(ht->get_fill(), test_size);
+
+  // Erase every other key.
+  std::array<InsertFindArgument, HT_TESTS_BATCH_LENGTH> args{};
+  for (uint64_t i = 1; i <= test_size; i += 2 * HT_TESTS_BATCH_LENGTH) {
+    uint64_t n = 0;
+    for (uint64_t j = i + 1; j <= test_size && n < args.size(); j += 2) {
+      args[n++].key = key_of(j);
+    }
+    ht->erase_batch(InsertFindArguments(args.data(), n));
+  }
+  ht->flush_erase_queue();
+  EXPECT_EQ(ht->get_fill(), (test_size + 1) / 2);
+
+  HTBatchRunner<> runner(ht.get());
+  for (uint64_t i = 1; i <= 2 * test_size; i += HT_TESTS_BATCH_LENGTH) {
+    FindResultChecker checker;
+    runner.set_callback(checker.checker());
+    for (uint64_t j = i; j < i + HT_TESTS_BATCH_LENGTH; j++) {
+      if (j <= test_size && (j & 1)) {
+        checker.add(j, j);
+      }
+      runner.find({key_of(j), j});
+    }
+    runner.flush_find();
+  }
+}
+
+/// Insert the same keys from several threads at the same time. Every key
+/// must end up in a single slot, which counts the inserts of all of them.
+/// The table is small and refilled for every round, so that the threads
+/// keep racing for the same groups.
+template <typename HT>
+void same_key_inserts(uint64_t size, uint64_t test_size, unsigned rounds) {
+  constexpr unsigned num_threads = 4;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  auto key_of = [](uint64_t i) { return i * 0x9E3779B97F4A7C15ULL; };
+
+  for (unsigned r = 0; r < rounds; r++) {
+    std::vector<std::unique_ptr<BaseHashTable>> hts;
+    for (unsigned t = 0; t < num_threads; t++) {
+      hts.emplace_back(new HT{size});
+    }
+
+    std::barrier start(num_threads);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; t++) {
+      threads.emplace_back([&, t] {
+        HTBatchRunner<> runner(hts[t].get());
+        start.arrive_and_wait();
+        for (uint64_t i = 1; i <= test_size; i++) {
+          runner.insert(key_of(i), i);
+        }
+        runner.flush_insert();
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    auto& ht = hts[0];
+    ASSERT_EQ(ht->get_fill(), test_size) << "round " << r;
+
+    HTBatchRunner<> runner(ht.get());
+    for (uint64_t i = 1; i <= test_size; i += HT_TESTS_BATCH_LENGTH) {
+      FindResultChecker checker;
+      runner.set_callback(checker.checker());
+      for (uint64_t j = i;
+           j < std::min(i + HT_TESTS_BATCH_LENGTH, test_size + 1); j++) {
+        checker.add(j, num_threads);
+        runner.find({key_of(j), j});
+      }
+      runner.flush_find();
+    }
+  }
+}
+
+/// Insert and erase the same keys from several threads at the same time, on
+/// a table small enough for their tombstones to be taken by other keys. An
+/// insert that loses its slot to an erase must not write into the tombstone,
+/// so every key that is left holds what was inserted for it: its own id, or
+/// for the aggregating KV a count of at most all of its inserts.
+template <typename KV>
+void insert_erase_race(uint64_t size, uint64_t test_size, unsigned rounds) {
+  constexpr unsigned num_threads = 4;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+
+  auto key_of = [](uint64_t i) { return i * 0x9E3779B97F4A7C15ULL; };
+
+  std::vector<std::unique_ptr<BaseHashTable>> hts;
+  for (unsigned t = 0; t < num_threads; t++) {
+    hts.emplace_back(new CASHashTable<KV, ItemQueue>{size});
+  }
+
+  std::barrier start(num_threads);
+  std::vector<std::thread> threads;
+  // The last thread erases what the others insert
+  for (unsigned t = 0; t < num_threads - 1; t++) {
+    threads.emplace_back([&, t] {
+      HTBatchRunner<> runner(hts[t].get());
+      start.arrive_and_wait();
+      for (unsigned r = 0; r < rounds; r++) {
+        for (uint64_t i = 1; i <= test_size; i++) {
+          runner.insert(key_of(i), i);
+        }
+        runner.flush_insert();
+      }
+    });
+  }
+  threads.emplace_back([&] {
+    auto& ht = hts[num_threads - 1];
+    std::array<InsertFindArgument, HT_TESTS_BATCH_LENGTH> args{};
+    start.arrive_and_wait();
+    for (unsigned r = 0; r < rounds; r++) {
+      for (uint64_t i = 1; i <= test_size; i += args.size()) {
+        uint64_t n = 0;
+        for (uint64_t j = i; j <= test_size && n < args.size(); j++) {
+          args[n++].key = key_of(j);
+        }
+        ht->erase_batch(InsertFindArguments(args.data(), n));
+      }
+      ht->flush_erase_queue();
+    }
+  });
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const uint64_t max_count = (num_threads - 1) * rounds;
+  HTBatchRunner<> runner(hts[0].get(), [&](const FindResult& result) {
+    if constexpr (std::is_same_v<KV, Aggr_KV>) {
+      EXPECT_GE(result.value, 1u) << "key " << result.id;
+      EXPECT_LE(result.value, max_count) << "key " << result.id;
+    } else {
+      EXPECT_EQ(result.value, result.id);
+    }
+  });
+  for (uint64_t i = 1; i <= test_size; i++) {
+    runner.find({key_of(i), i});
+    // A flush returns up to a batch of results
+    if (i % HT_TESTS_BATCH_LENGTH == 0) {
+      runner.flush_find();
+    }
+  }
+}
+
+TEST(CASHashtableTest, INSERT_ERASE_RACE_TEST) {
+  insert_erase_race<Item>(1 << 8, 1 << 6, 1 << 10);
+  insert_erase_race<Aggr_KV>(1 << 8, 1 << 6, 1 << 10);
+}
+
+/// The cuckoo hashtable holds every key at 95% load.
+TEST(CuckooHashtableTest, HIGH_LOAD_TEST) {
+  constexpr uint64_t size = 1 << 16;
+  fill_erase_find<CuckooHashTable<Item, ItemQueue>>(size, size * 95 / 100);
+}
+
+/// Inserts into a full table fail and are counted, whether or not
+/// --ht-stats is set.
+template <typename HT>
+void full_table_inserts(uint64_t size) {
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+  auto key_of = [](uint64_t i) { return i * 0x9E3779B97F4A7C15ULL; };
+
+  HT ht{size};
+  HTBatchRunner<> runner(&ht);
+  for (uint64_t i = 1; i <= 2 * size; i++) {
+    runner.insert(key_of(i), i);
+  }
+  runner.flush_insert();
+  EXPECT_EQ(ht.get_fill() + ht.stats.num_failed_inserts, 2 * size);
+
+  InsertFindArgument arg{};
+  arg.key = key_of(2 * size + 1);
+  arg.value = 1;
+  EXPECT_FALSE(ht.insert(&arg));
+  EXPECT_EQ(ht.get_fill() + ht.stats.num_failed_inserts, 2 * size + 1);
+}
+
+TEST(CuckooHashtableTest, FULL_TABLE_TEST) {
+  full_table_inserts<CuckooHashTable<Item, ItemQueue>>(1 << 10);
+}
+
+/// Another instance keeps looking up keys of partition 0 while it grows, so
+/// the tables it replaces must outlive those lookups, and the lookups queued
+/// before a grow must still find the keys the partition held.
+TEST(PartitionedHashtableTest, GROW_WHILE_READ_TEST) {
+  constexpr uint64_t initial_size = 1024;
+  constexpr uint64_t test_size = 64 * initial_size;
+  constexpr uint64_t preloaded = initial_size / 4;
+  config.batch_len = HT_TESTS_BATCH_LENGTH;
+  config.ht_grow_threshold = 0.5;
+
+  PartitionedHashStore<Item, ItemQueue> writer{initial_size, 0};
+  PartitionedHashStore<Item, ItemQueue> reader{initial_size, 1};
+  {
+    HTBatchRunner<> runner(&writer);
+    for (uint64_t i = 1; i <= preloaded; i++) {
+      runner.insert(i, i);
+    }
+  }
+
+  std::atomic<bool> done{false};
+  uint64_t rounds = 0;
+  std::thread lookups([&] {
+    HTBatchRunner<> runner(&reader);
+    while (!done.load()) {
+      FindResultChecker checker;
+      runner.set_callback(checker.checker());
+      for (uint64_t i = 1; i <= preloaded; i++) {
+        checker.add(i, i);
+        runner.find({i, i});
+        // A flush returns up to a batch of results
+        if (i % HT_TESTS_BATCH_LENGTH == 0) {
+          runner.flush_find();
+        }
+      }
+      runner.flush_find();
+      rounds++;
+    }
+  });
+
+  {
+    HTBatchRunner<> runner(&writer);
+    for (uint64_t i = preloaded + 1; i <= test_size; i++) {
+      runner.insert(i, i);
+    }
+  }
+  done.store(true);
+  lookups.join();
+
+  EXPECT_GT(rounds, 0u);
+  EXPECT_GT(writer.get_capacity(), test_size);
+  EXPECT_EQ(writer.get_fill(), test_size);
+
+  {
+    FindResultChecker checker;
+    HTBatchRunner<> runner(&reader, checker.checker());
+    for (uint64_t i = 1; i <= test_size; i++) {
+      checker.add(i, i);
+      runner.find({i, i});
+    }
+  }
+
+  config.ht_grow_threshold = 0;
+}
+
+/// Half of the keys spill from their level 0 line into level 1.
+TEST(MultiHashtableTest, FILL_ERASE_TEST) {
+  constexpr uint64_t size = 1 << 16;
+  fill_erase_find<MultiHashTable<Item, ItemQueue>>(size, size * 3 / 8);
+}
+
+TEST(SwissHashtableTest, FILL_ERASE_TEST) {
+  constexpr uint64_t size = 1 << 16;
+  fill_erase_find<SwissHashTable<Item, ItemQueue>>(size, size * 7 / 8);
+}
+
+TEST(SwissHashtableTest, SAME_KEY_INSERT_TEST) {
+  constexpr uint64_t size = 1 << 10;
+  same_key_inserts<SwissHashTable<Aggr_KV, ItemQueue>>(size, size / 2, 256);
+}
+
+TEST(SwissHashtableTest, FULL_TABLE_TEST) {
+  full_table_inserts<SwissHashTable<Item, ItemQueue>>(1 << 10);
+}
+
 INSTANTIATE_TEST_CASE_P(TestAllHashtables, HashtableTest,
                         ::testing::ValuesIn(HTS));
 
@@ -0,0 +1,85 @@
+#include "queues/hot_key_combiner.hpp"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <vector>
+
+#include "types.hpp"
+
+namespace kmercounter {
+namespace {
+
+using Combiner = HotKeyCombiner<KeyValuePair>;
+
+struct Sent {
+  std::map<uint64_t, uint64_t> counts;
+  uint64_t sends = 0;
+
+  void operator()(const Combiner::Slot &slot) {
+    counts[slot.msg.key] += slot.weight;
+    sends++;
+  }
+};
+
+TEST(HotKeyCombiner, MergesRepeatedMessages) {
+  Combiner combiner(4);
+  Sent sent;
+  for (auto i = 0; i < 100; i++) {
+    combiner.add(KeyValuePair(7, 7), 7, 0, sent);
+  }
+  EXPECT_EQ(sent.sends, 0);
+  combiner.flush(sent);
+  EXPECT_EQ(sent.sends, 1);
+  EXPECT_EQ(sent.counts[7], 100);
+  EXPECT_EQ(combiner.num_keys(), 100);
+  // The weight goes in a message of its own
+  EXPECT_EQ(combiner.num_messages(), 2);
+}
+
+TEST(HotKeyCombiner, CountsStayExact) {
+  Combiner combiner(8);
+  Sent sent;
+  std::map<uint64_t, uint64_t> expected;
+  for (uint64_t i = 0; i < 3 * Combiner::MAX_WEIGHT; i++) {
+    // A hot key between a run of cold ones that collide with it
+    const uint64_t key = i % 3 ? 1 : 1 + 8 * (i % 50);
+    combiner.add(KeyValuePair(key, key), key, 0, sent);
+    expected[key]++;
+  }
+  combiner.flush(sent);
+  EXPECT_EQ(sent.counts, expected);
+}
+
+TEST(HotKeyCombiner, SendsFullSlots) {
+  Combiner combiner(1);
+  Sent sent;
+  for (auto i = 0u; i < Combiner::MAX_WEIGHT; i++) {
+    combiner.add(KeyValuePair(3, 3), 3, 0, sent);
+  }
+  EXPECT_EQ(sent.sends, 1);
+  EXPECT_EQ(sent.counts[3], Combiner::MAX_WEIGHT);
+}
+
+TEST(HotKeyCombiner, KeepsDifferentValuesApart) {
+  Combiner combiner(1);
+  Sent sent;
+  combiner.add(KeyValuePair(3, 1), 3, 0, sent);
+  combiner.add(KeyValuePair(3, 2), 3, 0, sent);
+  EXPECT_EQ(sent.sends, 1);
+  EXPECT_EQ(sent.counts[3], 1);
+}
+
+TEST(HotKeyCombiner, FlushesOnTime) {
+  Combiner combiner(4);
+  Sent sent;
+  combiner.add(KeyValuePair(3, 3), 3, 0, sent);
+  combiner.tick(1, sent);
+  combiner.tick(Combiner::FLUSH_CYCLES, sent);
+  EXPECT_EQ(sent.sends, 0);
+  combiner.tick(1 + Combiner::FLUSH_CYCLES, sent);
+  EXPECT_EQ(sent.sends, 1);
+}
+
+}  // namespace
+}  // namespace kmercounter
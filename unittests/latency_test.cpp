@@ -0,0 +1,56 @@
+#include "Latency.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+namespace kmercounter {
+namespace {
+
+/// Every value falls into a bucket that covers it, and buckets are no wider
+/// than 1 / SUB_BUCKETS of their values.
+TEST(LatencyHistogram, Buckets) {
+  for (std::uint64_t v :
+       {0ull, 1ull, 31ull, 32ull, 33ull, 1000ull, 123456789ull, ~0ull}) {
+    const auto i = LatencyHistogram::index_of(v);
+    ASSERT_LT(i, LatencyHistogram::NUM_BUCKETS);
+    EXPECT_LE(LatencyHistogram::lowest_of(i), v);
+    EXPECT_GE(LatencyHistogram::highest_of(i), v);
+    EXPECT_LE(LatencyHistogram::highest_of(i) - LatencyHistogram::lowest_of(i),
+              v / LatencyHistogram::SUB_BUCKETS);
+  }
+}
+
+TEST(LatencyHistogram, Percentiles) {
+  LatencyHistogram h;
+  for (std::uint64_t v = 1; v <= 10000; v++) h.record(v);
+
+  EXPECT_EQ(h.count(), 10000);
+  EXPECT_EQ(h.max(), 10000);
+  EXPECT_DOUBLE_EQ(h.mean(), 5000.5);
+  // Within the precision of the buckets
+  EXPECT_NEAR(h.percentile(50), 5000, 5000 / LatencyHistogram::SUB_BUCKETS);
+  EXPECT_NEAR(h.percentile(99), 9900, 9900 / LatencyHistogram::SUB_BUCKETS);
+  EXPECT_EQ(h.percentile(100), 10000);
+}
+
+/// Merging the histograms of two threads is the same as recording all of
+/// the samples in one.
+TEST(LatencyHistogram, Merge) {
+  LatencyHistogram a, b, all;
+  for (std::uint64_t v = 0; v < 1000; v++) {
+    (v % 3 ? a : b).record(v * v);
+    all.record(v * v);
+  }
+  a.merge(b);
+
+  EXPECT_EQ(a.count(), all.count());
+  EXPECT_EQ(a.max(), all.max());
+  EXPECT_DOUBLE_EQ(a.mean(), all.mean());
+  for (double p : {50.0, 99.0, 99.9, 99.99}) {
+    EXPECT_EQ(a.percentile(p), all.percentile(p)) << p;
+  }
+}
+
+}  // namespace
+}  // namespace kmercounter
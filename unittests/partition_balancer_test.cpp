@@ -0,0 +1,68 @@
+#include "queues/partition_balancer.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace kmercounter {
+namespace {
+
+constexpr uint64_t MIN_BACKLOG = 100;
+
+TEST(PartitionBalancer, StartsRoundRobin) {
+  PartitionBalancer balancer(6, 3, MIN_BACKLOG);
+  for (auto p = 0u; p < 6; p++) {
+    EXPECT_EQ(balancer.owner(p), p % 3);
+    EXPECT_TRUE(balancer.holds(p, p % 3));
+  }
+  EXPECT_EQ(balancer.epoch(), 0);
+  EXPECT_EQ(balancer.num_moves(), 0);
+}
+
+TEST(PartitionBalancer, KeepsPutWhileConsumersKeepUp) {
+  PartitionBalancer balancer(4, 2, MIN_BACKLOG);
+  balancer.count(0, 1000);
+  EXPECT_FALSE(balancer.tick({MIN_BACKLOG - 1, 0}));
+  balancer.count(0, 1000);
+  EXPECT_FALSE(balancer.tick({MIN_BACKLOG, MIN_BACKLOG}));
+  EXPECT_EQ(balancer.num_moves(), 0);
+}
+
+TEST(PartitionBalancer, MovesFromBusyToIdle) {
+  PartitionBalancer balancer(4, 2, MIN_BACKLOG);
+  // Consumer 0 holds partitions 0 and 2
+  balancer.count(0, 100);
+  balancer.count(2, 900);
+  balancer.count(1, 100);
+  ASSERT_TRUE(balancer.tick({10 * MIN_BACKLOG, 0}));
+
+  const auto &move = balancer.current();
+  EXPECT_EQ(move.epoch, 1);
+  EXPECT_EQ(move.from, 0);
+  EXPECT_EQ(move.to, 1);
+  // Moving 2 would turn the imbalance around, moving 0 evens it out better
+  EXPECT_EQ(move.part, 0);
+  EXPECT_EQ(balancer.owner(0), 1);
+  // The table stays with the old owner until it hands it over
+  EXPECT_TRUE(balancer.holds(0, 0));
+  EXPECT_FALSE(balancer.holds(0, 1));
+
+  // No other move until then
+  balancer.count(2, 900);
+  EXPECT_FALSE(balancer.tick({10 * MIN_BACKLOG, 0}));
+
+  balancer.release(move);
+  EXPECT_TRUE(balancer.holds(0, 1));
+  balancer.count(2, 900);
+  EXPECT_FALSE(balancer.tick({10 * MIN_BACKLOG, 0}));
+  EXPECT_EQ(balancer.num_moves(), 1);
+}
+
+TEST(PartitionBalancer, KeepsTheLastPartition) {
+  PartitionBalancer balancer(2, 2, MIN_BACKLOG);
+  balancer.count(0, 1000);
+  EXPECT_FALSE(balancer.tick({10 * MIN_BACKLOG, 0}));
+}
+
+}  // namespace
+}  // namespace kmercounter
@@ -0,0 +1,79 @@
+#include "stats_record.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace kmercounter {
+namespace {
+StatsRecord make_record() {
+  StatsRecord rec;
+  rec.add("run.host", "a\"b");
+  rec.add("config.ht_size", 1024U);
+  rec.add("config.ht_stats", true);
+  rec.add("threads.0.inserts.ops", 10UL);
+  rec.add("threads.0.finds.ops", 20UL);
+  rec.add("threads.1.inserts.ops", 30UL);
+  rec.add("totals.set_mops", 1.5);
+  return rec;
+}
+
+TEST(StatsRecord, JsonNestsAlongDots) {
+  std::ostringstream os;
+  make_record().write_json(os);
+  EXPECT_EQ(os.str(),
+            "{\"run\":{\"host\":\"a\\\"b\"},"
+            "\"config\":{\"ht_size\":1024,\"ht_stats\":true},"
+            "\"threads\":{\"0\":{\"inserts\":{\"ops\":10},"
+            "\"finds\":{\"ops\":20}},\"1\":{\"inserts\":{\"ops\":30}}},"
+            "\"totals\":{\"set_mops\":1.5}}\n");
+}
+
+TEST(StatsRecord, CsvHeaderMatchesRow) {
+  std::ostringstream header, row;
+  const auto rec = make_record();
+  rec.write_csv_header(header);
+  rec.write_csv_row(row);
+  EXPECT_EQ(header.str(),
+            "run.host,config.ht_size,config.ht_stats,threads.0.inserts.ops,"
+            "threads.0.finds.ops,threads.1.inserts.ops,totals.set_mops\n");
+  EXPECT_EQ(row.str(), "\"a\\\"b\",1024,true,10,20,30,1.5\n");
+}
+
+TEST(StatsRecord, CsvWithOtherColumnsIsNotAppendedTo) {
+  const std::string path = testing::TempDir() + "stats_record_test.csv";
+  const std::string rotated = testing::TempDir() + "stats_record_test.1.csv";
+  std::remove(path.c_str());
+  std::remove(rotated.c_str());
+
+  const auto rec = make_record();
+  StatsRecord other;
+  other.add("run.host", "b");
+  other.add("threads.0.inserts.ops", 1UL);
+
+  EXPECT_EQ(rec.append_to(path), path);
+  EXPECT_EQ(other.append_to(path), rotated);
+  EXPECT_EQ(rec.append_to(path), path);
+  EXPECT_EQ(other.append_to(path), rotated);
+
+  auto lines = [](const std::string &file) {
+    std::ifstream in(file);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line);) lines.push_back(line);
+    return lines;
+  };
+  const auto main_lines = lines(path);
+  ASSERT_EQ(main_lines.size(), 3);
+  EXPECT_EQ(main_lines[0], rec.csv_header());
+  const auto rotated_lines = lines(rotated);
+  ASSERT_EQ(rotated_lines.size(), 3);
+  EXPECT_EQ(rotated_lines[0], "run.host,threads.0.inserts.ops");
+  EXPECT_EQ(rotated_lines[2], "\"b\",1");
+
+  std::remove(path.c_str());
+  std::remove(rotated.c_str());
+}
+}  // namespace
+}  // namespace kmercounter
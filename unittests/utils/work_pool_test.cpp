@@ -0,0 +1,89 @@
+#include "utils/work_pool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace kmercounter {
+namespace {
+
+TEST(WorkPoolTest, StaticSplitKeepsItsItems) {
+  WorkPool pool(4, 100, 0);
+  WorkPool::Chunk chunk;
+  ASSERT_TRUE(pool.next(2, &chunk));
+  EXPECT_EQ(chunk.home, 2);
+  EXPECT_EQ(chunk.begin, 0);
+  EXPECT_EQ(chunk.end, 100);
+  // The other threads did not start, still nothing to steal
+  EXPECT_FALSE(pool.next(2, &chunk));
+}
+
+TEST(WorkPoolTest, TakesOwnChunksInOrder) {
+  WorkPool pool({10, 25}, 10);
+  WorkPool::Chunk chunk;
+  for (uint64_t begin = 0; begin < 25; begin += 10) {
+    ASSERT_TRUE(pool.next(1, &chunk));
+    EXPECT_EQ(chunk.home, 1);
+    EXPECT_EQ(chunk.begin, begin);
+    EXPECT_EQ(chunk.end, std::min<uint64_t>(begin + 10, 25));
+  }
+}
+
+TEST(WorkPoolTest, StealsHalfFromTheBack) {
+  WorkPool pool({0, 80}, 10);
+  WorkPool::Chunk chunk;
+  ASSERT_TRUE(pool.next(0, &chunk));
+  EXPECT_EQ(chunk.home, 1);
+  EXPECT_EQ(chunk.begin, 40);
+  // Thread 1 keeps the front half
+  for (uint64_t begin = 0; begin < 40; begin += 10) {
+    ASSERT_TRUE(pool.next(1, &chunk));
+    EXPECT_EQ(chunk.begin, begin);
+  }
+  // Then steals back the back half of the three thread 0 has left
+  ASSERT_TRUE(pool.next(1, &chunk));
+  EXPECT_EQ(chunk.home, 1);
+  EXPECT_EQ(chunk.begin, 60);
+}
+
+TEST(WorkPoolTest, EveryItemOnce) {
+  constexpr unsigned num_threads = 8;
+  std::vector<uint64_t> sizes;
+  for (auto t = 0u; t < num_threads; t++) {
+    sizes.push_back(1000 + 337 * t);
+  }
+  WorkPool pool(sizes, 7);
+  std::vector<std::vector<std::atomic<int>>> seen(num_threads);
+  for (auto t = 0u; t < num_threads; t++) {
+    seen[t] = std::vector<std::atomic<int>>(sizes[t]);
+  }
+
+  std::vector<std::thread> threads;
+  for (auto t = 0u; t < num_threads; t++) {
+    threads.emplace_back([&, t] {
+      for (WorkPool::Chunk chunk; pool.next(t, &chunk);) {
+        for (auto i = chunk.begin; i < chunk.end; i++) {
+          seen[chunk.home][i]++;
+        }
+        // A slow thread gets its items stolen
+        if (t == 0) {
+          std::this_thread::sleep_for(std::chrono::microseconds(10));
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (auto t = 0u; t < num_threads; t++) {
+    for (const auto &count : seen[t]) {
+      ASSERT_EQ(count, 1);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace kmercounter